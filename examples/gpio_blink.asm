@@ -1,59 +1,64 @@
 ; GPIO Blink Program
 ; Blinks GPIO pin 0 using timer interrupts
 ; Timer interrupt handler toggles GPIO pin
+;
+; Device registers: GPIO port 0x8003, timer latch 0x8004-0x8005, timer
+; control 0x8006, timer count 0x8007-0x8008, timer IRQ acknowledge
+; 0x8009. An interrupt pushes PC, then the flags, and enters the handler
+; at the vector in 0xFFFE-0xFFFF; the handler returns with PLP, RTS.
 
 .org 0x0200
 
-start:
-    ; Initialize GPIO port (all outputs)
-    LDI #0xFF
-    STA [gpio_port]
-    
-    ; Initialize timer
-    LDI #0x00
-    STA [timer_latch]     ; Timer latch low
-    LDI #0x10
-    STA [timer_latch+1]   ; Timer latch high (0x1000)
-    
-    ; Enable timer interrupt
-    LDI #0x06
-    STA [timer_ctrl]      ; Start timer, enable IRQ
-    
-    ; Enable interrupts
-    CLI
-    
-    ; Main loop - just wait for interrupts
-main_loop:
-    NOP
-    JMP main_loop
-
-; Timer interrupt handler
-.org 0x0300
+    JMP start
 
+; Timer interrupt handler, at 0x0203 right after the JMP
 timer_irq:
     ; Save registers
     PHA
-    PHP
-    
+
     ; Toggle GPIO pin 0
-    LDA [gpio_port]
+    LDA [0x8003]
     XOR #0x01
-    STA [gpio_port]
-    
+    STA [0x8003]
+
     ; Clear timer interrupt
     LDI #0x01
-    STA [timer_irq]
-    
+    STA [0x8009]
+
     ; Restore registers
-    PLP
     PLA
-    
-    ; Return from interrupt
-    RTI
 
-; Variables
-gpio_port:   .word 0x8003
-timer_latch: .word 0x8004
-timer_ctrl:  .word 0x8005
-timer_irq:   .word 0x8007
+    ; Return from interrupt: flags, then PC
+    PLP
+    RTS
+
+start:
+    ; Point the IRQ vector at the handler
+    LDI #0x03
+    STA [0xFFFE]
+    LDI #0x02
+    STA [0xFFFF]
+
+    ; Initialize GPIO port (pin 0 low)
+    LDI #0x00
+    STA [0x8003]
+
+    ; Initialize timer: count down from 0x1000, reloading from the latch
+    LDI #0x00
+    STA [0x8004]          ; Timer latch low
+    STA [0x8007]          ; Timer count low
+    LDI #0x10
+    STA [0x8005]          ; Timer latch high (0x1000)
+    STA [0x8008]          ; Timer count high
+
+    ; Enable timer interrupt
+    LDI #0x07
+    STA [0x8006]          ; Continuous, enable IRQ, start timer
+
+    ; Enable interrupts
+    CLI
 
+    ; Main loop - just wait for interrupts
+main_loop:
+    NOP
+    JMP main_loop
@@ -0,0 +1,58 @@
+// Example device plugin: a xorshift random number generator.
+//
+// Build as a shared object and load it with cpu-sim --plugin:
+//   cc -shared -fPIC -Isrc -o rng_plugin.so examples/rng_plugin.c
+//
+// Registers:
+//   0x8080  RNG_DATA   read: next random byte
+//   0x8081  RNG_SEED   write: reseed (0 restores the power-on seed)
+//
+// The generator state lives in the device set's plugin state, so it is
+// copied with snapshots and included in state hashes like any register.
+
+#include "devices.h"
+#include <string.h>
+
+#define RNG_DATA_ADDR 0x8080
+#define RNG_SEED_ADDR 0x8081
+#define RNG_POWER_ON_SEED 0x2545F491u
+
+typedef struct {
+    uint32_t x;
+} rng_state_t;
+
+static void rng_init(device_set_t* set, void* state) {
+    (void)set;
+    rng_state_t* rng = state;
+    rng->x = RNG_POWER_ON_SEED;
+}
+
+static uint8_t rng_read(device_set_t* set, void* state, uint16_t address) {
+    (void)set;
+    (void)address;
+    rng_state_t* rng = state;
+    rng->x ^= rng->x << 13;
+    rng->x ^= rng->x >> 17;
+    rng->x ^= rng->x << 5;
+    return rng->x & 0xFF;
+}
+
+static void rng_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)set;
+    (void)address;
+    rng_state_t* rng = state;
+    rng->x = value ? RNG_POWER_ON_SEED ^ ((uint32_t)value * 0x01010101u) : RNG_POWER_ON_SEED;
+}
+
+static size_t rng_snapshot(const device_set_t* set, const void* state, uint64_t now, uint8_t* buffer) {
+    (void)set;
+    (void)now;
+    memcpy(buffer, state, sizeof(rng_state_t));
+    return sizeof(rng_state_t);
+}
+
+const device_ops_t cpu_device_plugin = {
+    DEVICE_PLUGIN_ABI, "rng",
+    {{RNG_DATA_ADDR, 1, DEVICE_ACCESS_READ}, {RNG_SEED_ADDR, 1, DEVICE_ACCESS_WRITE}},
+    sizeof(rng_state_t), rng_init, NULL, rng_read, rng_write, NULL, NULL, rng_snapshot
+};
@@ -1,12 +1,23 @@
 #include "CPUBridge.h"
 #include <QTimer>
 #include <cstdio>
+#include <cstdlib>
 
-CPUBridge::CPUBridge(QObject* parent) : QObject(parent), cpu(nullptr) {
+CPUBridge::CPUBridge(QObject* parent)
+    : QObject(parent), cpu(nullptr), wave(nullptr), display(nullptr), view(nullptr),
+      frame(FB_WIDTH, FB_HEIGHT, QImage::Format_RGB32) {
+    frame.fill(Qt::black);
 }
 
 CPUBridge::~CPUBridge() {
-    if (cpu) cpu_destroy(cpu);
+    if (cpu) {
+        device_set_attach_wave(cpu->devices, nullptr);
+        device_set_attach_display(cpu->devices, nullptr);
+        cpu_destroy(cpu);
+    }
+    wave_queue_destroy(wave);
+    fb_display_destroy(display);
+    free(view);
 }
 
 bool CPUBridge::initialize() {
@@ -15,9 +26,32 @@ bool CPUBridge::initialize() {
 
     // Initialize memory system if needed
     memory_init(cpu->memory);
+
+    // GPIO changes arrive as events instead of polling the port; the
+    // queue drops rather than stalling the CPU if the GUI falls behind
+    wave = wave_queue_create(false);
+    if (wave) device_set_attach_wave(cpu->devices, wave);
+
+    // Presented framebuffer frames; only changed rows are repainted
+    display = fb_display_create();
+    view = static_cast<fb_view_t*>(calloc(1, sizeof(fb_view_t)));
+    if (display && view) device_set_attach_display(cpu->devices, display);
     return true;
 }
 
+void CPUBridge::fetchFrame() {
+    if (!display || !view) return;
+
+    uint64_t rows = fb_display_fetch(display, view);
+    if (!rows) return;
+    for (int y = 0; y < FB_HEIGHT; ++y) {
+        if (!(rows & (1ULL << y))) continue;
+        QRgb* line = reinterpret_cast<QRgb*>(frame.scanLine(y));
+        for (int x = 0; x < FB_WIDTH; ++x) line[x] = 0xFF000000u | fb_view_pixel(view, x, y);
+    }
+    emit framebufferChanged(frame);
+}
+
 void CPUBridge::reset() {
     if (cpu) cpu_reset(cpu);
     emit registersChanged();
@@ -27,8 +61,12 @@ void CPUBridge::step() {
     if (cpu) {
         cpu_step(cpu);
         emit registersChanged();
-        uint8_t gpio = isa_read_memory(cpu, GPIO_PORT_ADDR);
-        emit gpioChanged(gpio);
+
+        wave_event_t event;
+        while (wave && wave_queue_pop(wave, &event)) {
+            if (event.signal == WAVE_SIGNAL_GPIO) emit gpioChanged(event.new_value);
+        }
+        fetchFrame();
     }
 }
 
@@ -5,8 +5,11 @@ extern "C" {
 #include "cpu.h"
 #include "memory.h"
 #include "devices.h"
+#include "wave.h"
+#include "framebuffer.h"
 }
 
+#include <QImage>
 #include <QObject>
 
 class CPUBridge : public QObject {
@@ -35,7 +38,14 @@ signals:
     void registersChanged();
     void memoryChanged(uint16_t addr, uint8_t value);
     void gpioChanged(uint8_t value);
+    void framebufferChanged(const QImage& frame);
 
 private:
     cpu_state_t* cpu;
+    wave_queue_t* wave;
+    fb_display_t* display;
+    fb_view_t* view;
+    QImage frame;
+
+    void fetchFrame();
 };
@@ -7,6 +7,7 @@
 #include <QVBoxLayout>
 #include <QGroupBox>
 #include <QGridLayout>
+#include <QPixmap>
 
 MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), bridge(new CPUBridge(this)) {
     // Central widget
@@ -66,8 +67,16 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), bridge(new CPUBri
     }
     left->addWidget(ledsBox);
 
-    // Right: memory and code (placeholder)
+    // Right: framebuffer, memory and code (placeholder)
     QVBoxLayout* right = new QVBoxLayout();
+    QGroupBox* displayBox = new QGroupBox("Framebuffer");
+    QVBoxLayout* displayLayout = new QVBoxLayout();
+    displayBox->setLayout(displayLayout);
+    displayLabel = new QLabel();
+    displayLabel->setFixedSize(FB_WIDTH * 4, FB_HEIGHT * 4);
+    displayLabel->setStyleSheet("background: black;");
+    displayLayout->addWidget(displayLabel);
+    right->addWidget(displayBox);
     QGroupBox* memBox = new QGroupBox("Memory (partial view)");
     QVBoxLayout* memLayout = new QVBoxLayout();
     memBox->setLayout(memLayout);
@@ -96,6 +105,10 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent), bridge(new CPUBri
         }
     });
 
+    connect(bridge, &CPUBridge::framebufferChanged, this, [this](const QImage& frame){
+        displayLabel->setPixmap(QPixmap::fromImage(frame.scaled(displayLabel->size())));
+    });
+
     pollTimer = new QTimer(this);
     pollTimer->setInterval(100);
     connect(pollTimer, &QTimer::timeout, this, &MainWindow::updateRegisters);
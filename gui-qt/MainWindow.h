@@ -33,6 +33,7 @@ private:
     QLabel* zeroLabel;
     QLabel* intLabel;
     std::vector<QLabel*> ledLabels;
+    QLabel* displayLabel;
     QPushButton* stepButton;
     QPushButton* runButton;
     QPushButton* stopButton;
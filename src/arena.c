@@ -0,0 +1,112 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+void arena_init(arena_t* arena) {
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+void arena_destroy(arena_t* arena) {
+    while (arena->first) {
+        arena_block_t* next = arena->first->next;
+        free(arena->first);
+        arena->first = next;
+    }
+    arena->current = NULL;
+}
+
+void arena_reset(arena_t* arena) {
+    for (arena_block_t* block = arena->first; block; block = block->next) {
+        block->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+// Make the current block one with room for size bytes: the next block
+// if it was kept by a reset and is large enough, or a new one
+static arena_block_t* arena_next_block(arena_t* arena, size_t size) {
+    arena_block_t* current = arena->current;
+    arena_block_t* next = current ? current->next : arena->first;
+    if (next && next->size >= size) {
+        arena->current = next;
+        return next;
+    }
+
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    arena_block_t* block = malloc(sizeof(arena_block_t) + ARENA_ALIGN + block_size);
+    if (!block) {
+        return NULL;
+    }
+    uintptr_t data = (uintptr_t)(block + 1);
+    block->data = (unsigned char*)ARENA_ROUND(data);
+    block->used = 0;
+    block->size = block_size;
+    block->next = next;
+    if (current) {
+        current->next = block;
+    } else {
+        arena->first = block;
+    }
+    arena->current = block;
+    return block;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    size_t rounded = size ? ARENA_ROUND(size) : ARENA_ALIGN;
+    arena_block_t* block = arena->current;
+    if (!block || block->size - block->used < rounded) {
+        block = arena_next_block(arena, rounded);
+        if (!block) {
+            return NULL;
+        }
+    }
+
+    void* memory = block->data + block->used;
+    block->used += rounded;
+    return memory;
+}
+
+void* arena_calloc(arena_t* arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void* memory = arena_alloc(arena, count * size);
+    if (memory) {
+        memset(memory, 0, count * size);
+    }
+    return memory;
+}
+
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size) {
+    if (!memory) {
+        return arena_alloc(arena, new_size);
+    }
+
+    // The last allocation of the current block grows in place
+    arena_block_t* block = arena->current;
+    size_t old_rounded = old_size ? ARENA_ROUND(old_size) : ARENA_ALIGN;
+    size_t new_rounded = new_size ? ARENA_ROUND(new_size) : ARENA_ALIGN;
+    if (block && (unsigned char*)memory + old_rounded == block->data + block->used &&
+        block->size - (block->used - old_rounded) >= new_rounded) {
+        block->used = block->used - old_rounded + new_rounded;
+        return memory;
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+    if (grown) {
+        memcpy(grown, memory, old_size < new_size ? old_size : new_size);
+    }
+    return grown;
+}
+
+char* arena_strndup(arena_t* arena, const char* text, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    if (copy) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bump allocator.
+// Memory comes from a list of blocks and is only given back all at once:
+// arena_reset rewinds to the first block and keeps every block for the
+// next round, so a warm arena serves the same workload again without
+// calling malloc; arena_destroy frees the blocks. An allocation larger
+// than the block size gets a block of its own.
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block* next;
+    size_t used;
+    size_t size;
+    unsigned char* data;        // ARENA_ALIGN-aligned, after the header
+} arena_block_t;
+
+typedef struct {
+    arena_block_t* first;
+    arena_block_t* current;     // Allocations come from here
+} arena_t;
+
+void arena_init(arena_t* arena);
+void arena_destroy(arena_t* arena);
+void arena_reset(arena_t* arena);
+
+// Aligned, uninitialised memory; NULL when out of memory
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_calloc(arena_t* arena, size_t count, size_t size);
+
+// Resize an allocation: in place when it is the last one in its block
+// and there is room, otherwise a copy (the old memory is not reused)
+void* arena_grow(arena_t* arena, void* memory, size_t old_size, size_t new_size);
+
+// NUL-terminated copy of length bytes
+char* arena_strndup(arena_t* arena, const char* text, size_t length);
+
+#endif // ARENA_H
@@ -1,4 +1,5 @@
 #include "assembler.h"
+#include "machine.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,10 @@ typedef struct {
     char* input_file;
     char* output_file;
     char* listing_file;
+    char* machine_file;
+    bool relocatable;
+    bool relax;
+    bool cycle_report;
     bool verbose;
     bool help_requested;
 } cli_options_t;
@@ -44,6 +49,20 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "Failed to create assembler instance\n");
         return 1;
     }
+    assembler->relocatable = options.relocatable;
+    assembler->relax = options.relax;
+    assembler->listing = options.listing_file || options.cycle_report;
+    
+    // Cycle costs from a machine description instead of the built-in table
+    machine_config_t machine;
+    if (options.machine_file) {
+        machine_config_default(&machine);
+        if (!machine_config_load(&machine, options.machine_file)) {
+            assembler_destroy(assembler);
+            return 1;
+        }
+        assembler->cycle_table = machine.cycles;
+    }
     
     // Assemble file
     if (!assembler_assemble_file(assembler, options.input_file)) {
@@ -57,8 +76,18 @@ int main(int argc, char* argv[]) {
         print_assembler_info(assembler);
     }
     
+    // Save an object file for cpu-link
+    if (options.relocatable && options.output_file) {
+        if (!assembler_save_object(assembler, options.output_file)) {
+            fprintf(stderr, "Failed to save object file\n");
+            assembler_destroy(assembler);
+            return 1;
+        }
+        printf("Object file saved to %s\n", options.output_file);
+    }
+    
     // Save binary output
-    if (options.output_file) {
+    if (!options.relocatable && options.output_file) {
         if (!assembler_save_binary(assembler, options.output_file)) {
             fprintf(stderr, "Failed to save binary output\n");
             assembler_destroy(assembler);
@@ -77,8 +106,13 @@ int main(int argc, char* argv[]) {
         printf("Listing file saved to %s\n", options.listing_file);
     }
     
+    // Costliest blocks and loops
+    if (options.cycle_report) {
+        assembler_print_cycle_report(assembler, stdout, 10);
+    }
+    
     printf("Assembly completed successfully\n");
-    printf("Output size: %d bytes\n", assembler->output_size);
+    printf("Output size: %u bytes\n", assembler->output_size);
     
     // Cleanup
     assembler_destroy(assembler);
@@ -87,25 +121,38 @@ int main(int argc, char* argv[]) {
 
 void print_usage(const char* program_name) {
     printf("Usage: %s [OPTIONS] INPUT_FILE\n", program_name);
+    printf("\nINPUT_FILE may be - to read the source from standard input.\n");
     printf("\nOptions:\n");
     printf("  -o, --output FILE      Output binary file\n");
     printf("  -l, --listing FILE     Output listing file\n");
+    printf("  -c, --object           Output a relocatable object file for cpu-link\n");
+    printf("  -R, --no-relax         Keep every branch and JMP as written\n");
+    printf("  -C, --cycle-report     Print the costliest blocks and loops in cycles\n");
+    printf("  -M, --machine FILE     Take cycle costs from a machine description\n");
     printf("  -v, --verbose          Verbose output\n");
     printf("  -h, --help             Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s program.asm -o program.bin\n", program_name);
     printf("  %s program.asm -o program.bin -l program.lst\n", program_name);
     printf("  %s program.asm -v\n", program_name);
+    printf("  %s program.asm -C -M board.ini\n", program_name);
+    printf("  %s -c main.asm -o main.o && cpu-link main.o lib.o -o program.bin\n", program_name);
+    printf("  generate_source | %s - -o program.bin\n", program_name);
 }
 
 void print_help(void) {
     print_usage("asm");
     printf("\nAssembler Features:\n");
     printf("  - Labels and symbols\n");
-    printf("  - Directives (.org, .byte, .word, .string)\n");
-    printf("  - Multiple number formats (decimal, hex, binary)\n");
+    printf("  - Directives (.org, .byte, .word, .string, .section, .global, .incbin)\n");
+    printf("  - Multiple number formats (decimal, $hex, 0xhex, %%binary, 'c')\n");
     printf("  - Comments (;)\n");
-    printf("  - Include files (.include)\n");
+    printf("  - Branch relaxation: an out-of-range branch becomes the inverse branch over\n");
+    printf("    a JMP, and a JMP reached only by a branch falling through becomes a branch\n");
+    printf("  - Include files (.include), cached and lexed once per process\n");
+    printf("  - Macros (.macro NAME PARAM, ... / .endm); @name labels are local to an expansion\n");
+    printf("  - Listing with each line's address, bytes and cycles, cycles per labelled\n");
+    printf("    block and per loop (closed by a backward branch or JMP)\n");
     printf("\nSupported Instructions:\n");
     printf("  LDI, LDA, STA, MOV\n");
     printf("  ADD, SUB, CMP, INC, DEC\n");
@@ -125,6 +172,10 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
     static struct option long_options[] = {
         {"output", required_argument, 0, 'o'},
         {"listing", required_argument, 0, 'l'},
+        {"object", no_argument, 0, 'c'},
+        {"no-relax", no_argument, 0, 'R'},
+        {"cycle-report", no_argument, 0, 'C'},
+        {"machine", required_argument, 0, 'M'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
@@ -137,10 +188,14 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
     options->input_file = NULL;
     options->output_file = NULL;
     options->listing_file = NULL;
+    options->machine_file = NULL;
+    options->relocatable = false;
+    options->relax = true;
+    options->cycle_report = false;
     options->verbose = false;
     options->help_requested = false;
     
-    while ((c = getopt_long(argc, argv, "o:l:vh", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "o:l:cRCM:vh", long_options, &option_index)) != -1) {
         switch (c) {
             case 'o':
                 options->output_file = optarg;
@@ -148,6 +203,18 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
             case 'l':
                 options->listing_file = optarg;
                 break;
+            case 'c':
+                options->relocatable = true;
+                break;
+            case 'R':
+                options->relax = false;
+                break;
+            case 'C':
+                options->cycle_report = true;
+                break;
+            case 'M':
+                options->machine_file = optarg;
+                break;
             case 'v':
                 options->verbose = true;
                 break;
@@ -172,7 +239,7 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
 void print_assembler_info(assembler_t* assembler) {
     printf("Assembler Information:\n");
     printf("  Input file: %s\n", assembler->filename);
-    printf("  Output size: %d bytes\n", assembler->output_size);
+    printf("  Output size: %u bytes\n", assembler->output_size);
     printf("  Origin address: 0x%04X\n", assembler->origin_address);
     printf("  Labels defined: %d\n", assembler->label_count);
     printf("  Symbols defined: %d\n", assembler->symbol_count);
@@ -1,10 +1,32 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "assembler.h"
+#include "object.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdarg.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
+
+static name_slot_t* assembler_index_find(const name_index_t* index, const char* name, size_t length);
+static bool assembler_define_label(assembler_t* assembler, const char* name, size_t length, uint16_t address);
+static const char* assembler_intern(assembler_t* assembler, const char* name, size_t length);
+static name_slot_t* assembler_add_name(assembler_t* assembler, name_index_t* index, const char* name,
+                                       size_t length);
+static token_t assembler_lex(assembler_t* assembler, bool report);
+static bool assembler_expand_macro(assembler_t* assembler, const macro_t* macro);
+static char* assembler_resolve_path(assembler_t* assembler, const char* name, size_t length);
+static bool assembler_define_macro(assembler_t* assembler);
+static bool assembler_relax(assembler_t* assembler);
+
 // Create assembler instance
 assembler_t* assembler_create(void) {
     assembler_t* assembler = malloc(sizeof(assembler_t));
@@ -14,501 +36,1846 @@ assembler_t* assembler_create(void) {
     
     // Initialize state
     memset(assembler, 0, sizeof(assembler_t));
-    assembler->output = malloc(65536); // 64KB output buffer
-    if (!assembler->output) {
-        free(assembler);
+    arena_init(&assembler->arena);
+    assembler->relax = true;
+    if (!assembler_reset(assembler)) {
+        assembler_destroy(assembler);
         return NULL;
     }
     
-    assembler->output_size = 0;
-    assembler->current_address = 0;
-    assembler->origin_address = 0;
-    assembler->label_count = 0;
-    assembler->symbol_count = 0;
-    assembler->include_count = 0;
-    assembler->error_occurred = false;
-    
     return assembler;
 }
 
-// Destroy assembler instance
+// Destroy assembler instance; everything it allocated goes with the arena
 void assembler_destroy(assembler_t* assembler) {
     if (assembler) {
-        if (assembler->output) {
-            free(assembler->output);
+        arena_destroy(&assembler->arena);
+        free(assembler);
+    }
+}
+
+// Forget the last assembly: labels, symbols, fixups, sections and output.
+// The arena keeps its blocks, so assembling many small sources in turn
+// allocates nothing once it has grown to fit the largest.
+bool assembler_reset(assembler_t* assembler) {
+    arena_t arena = assembler->arena;
+    bool relocatable = assembler->relocatable;
+    bool relax = assembler->relax;
+    bool listing = assembler->listing;
+    const uint8_t* cycle_table = assembler->cycle_table;
+    memset(assembler, 0, sizeof(assembler_t));
+    assembler->arena = arena;
+    assembler->relocatable = relocatable;
+    assembler->relax = relax;
+    assembler->listing = listing;
+    assembler->cycle_table = cycle_table;
+    
+    arena_reset(&assembler->arena);
+    assembler->output = arena_alloc(&assembler->arena, ASSEMBLER_OUTPUT_SIZE);
+    return assembler->output != NULL;
+}
+
+// Start a section of relocatable output at address 0. An empty section
+// is renamed instead, so a .section at the top of a file leaves no empty
+// text section behind.
+static bool assembler_begin_section(assembler_t* assembler, const char* name, size_t length) {
+    section_t* section = NULL;
+    if (assembler->section_count > 0) {
+        section = &assembler->sections[assembler->section_count - 1];
+        if (section->start != assembler->output_size) {
+            section = NULL;
         }
-        if (assembler->file) {
-            fclose(assembler->file);
+    }
+    
+    if (!section) {
+        if (assembler->section_count == assembler->section_capacity) {
+            int capacity = assembler->section_capacity ? assembler->section_capacity * 2 : 16;
+            section_t* sections = arena_grow(&assembler->arena, assembler->sections,
+                                             (size_t)assembler->section_capacity * sizeof(section_t),
+                                             (size_t)capacity * sizeof(section_t));
+            if (!sections) {
+                assembler_error(assembler, "Out of memory");
+                return false;
+            }
+            assembler->sections = sections;
+            assembler->section_capacity = capacity;
         }
-        free(assembler);
+        section = &assembler->sections[assembler->section_count++];
+        section->start = assembler->output_size;
     }
+    
+    section->name = assembler_intern(assembler, name, length);
+    if (!section->name) {
+        assembler_error(assembler, "Out of memory");
+        return false;
+    }
+    section->address = 0;
+    section->fixed = false;
+    assembler->current_address = 0;
+    assembler->fallthrough = -1;
+    return true;
 }
 
-// Assemble file
-bool assembler_assemble_file(assembler_t* assembler, const char* filename) {
-    assembler->filename = (char*)filename;
-    assembler->file = fopen(filename, "r");
-    if (!assembler->file) {
-        assembler_error(assembler, "Cannot open file: %s", filename);
+// Assemble a source held in one buffer; fixups point into it, so it must
+// stay valid until they are patched at the end
+static bool assembler_assemble_buffer(assembler_t* assembler, const char* source, size_t size) {
+    assembler->source = source;
+    assembler->source_end = source + size;
+    assembler->cursor = source;
+    assembler->line_start = source;
+    assembler->line_number = 1;
+    assembler->tokens = NULL;
+    assembler->input_depth = 0;
+    assembler->current_token.type = TOKEN_EOF;
+    
+    // Output starts in the text section
+    if (assembler->section_count == 0 && !assembler_begin_section(assembler, "text", 4)) {
         return false;
     }
     
-    assembler->line_number = 0;
-    assembler->column_number = 0;
+    // One pass: code is emitted as it is read, and references to labels
+    // further on are patched at the end
+    assembler_next_token(assembler);
+    while (assembler_parse_line(assembler)) {
+    }
+    
+    // Size branches, then resolve labels; relocatable output leaves them
+    // to the linker
+    if (!assembler->error_occurred && !assembler->relocatable && assembler_relax(assembler)) {
+        assembler_resolve_labels(assembler);
+    }
     
-    // First pass: collect labels
-    while (!feof(assembler->file)) {
-        if (!assembler_parse_line(assembler)) {
+    // An error can stop assembly inside an include or a macro
+    assembler->source = assembler->source_end = assembler->cursor = NULL;
+    assembler->tokens = NULL;
+    assembler->input_depth = 0;
+    memset(&assembler->pending_input, 0, sizeof(input_t));
+    return !assembler->error_occurred;
+}
+
+// Read a stream to its end into one buffer
+static char* assembler_read_stream(FILE* file, size_t* size) {
+    size_t capacity = 65536;
+    char* buffer = malloc(capacity);
+    *size = 0;
+    while (buffer) {
+        *size += fread(buffer + *size, 1, capacity - *size, file);
+        if (*size < capacity) {
             break;
         }
+        capacity *= 2;
+        char* grown = realloc(buffer, capacity);
+        if (!grown) {
+            free(buffer);
+        }
+        buffer = grown;
     }
+    return buffer;
+}
+
+// Load a whole source file: mapped when it is a regular file, read
+// otherwise (pipes, standard input)
+static char* assembler_load_source(const char* filename, size_t* size, bool* mapped) {
+    bool standard_input = strcmp(filename, "-") == 0;
+    *mapped = false;
     
-    // Reset file for second pass
-    fseek(assembler->file, 0, SEEK_SET);
-    assembler->line_number = 0;
-    assembler->column_number = 0;
-    assembler->current_address = assembler->origin_address;
+#if defined(__unix__) || defined(__APPLE__)
+    if (!standard_input) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return NULL;
+        }
+        struct stat st;
+        void* map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (map != MAP_FAILED) {
+            *size = (size_t)st.st_size;
+            *mapped = true;
+            return map;
+        }
+    }
+#endif
+    
+    FILE* file = standard_input ? stdin : fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+    char* buffer = assembler_read_stream(file, size);
+    if (file != stdin) {
+        fclose(file);
+    }
+    return buffer;
+}
+
+// Release a source from assembler_load_source
+static void assembler_unload_source(char* source, size_t size, bool mapped) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (mapped) {
+        munmap(source, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(source);
+}
+
+// Included file kept loaded with its tokens. An alias is the same
+// content under another path or modification time and shares the tokens.
+typedef struct include_entry {
+    struct include_entry* next;
+    char* path;
+    long long mtime;
+    size_t size;
+    uint64_t hash;
+    char* source;               // Copy of the file; NULL for an alias
+    const char* text;           // What the tokens point into
+    token_t* tokens;
+    size_t token_count;
+} include_entry_t;
+
+static include_entry_t* include_cache;
+static include_cache_stats_t include_stats;
+
+#if defined(__unix__) || defined(__APPLE__)
+static pthread_mutex_t include_lock = PTHREAD_MUTEX_INITIALIZER;
+#define INCLUDE_LOCK() pthread_mutex_lock(&include_lock)
+#define INCLUDE_UNLOCK() pthread_mutex_unlock(&include_lock)
+#else
+#define INCLUDE_LOCK() ((void)0)
+#define INCLUDE_UNLOCK() ((void)0)
+#endif
+
+// Hash file contents (64-bit FNV-1a)
+static uint64_t assembler_hash_source(const char* source, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t)source[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Lex a whole source into a token array, without reporting errors: a
+// malformed token is kept as TOKEN_UNKNOWN and reported when replayed
+static token_t* assembler_lex_source(const char* source, size_t size, size_t* count) {
+    assembler_t* scratch = calloc(1, sizeof(assembler_t));
+    size_t capacity = 1024;
+    token_t* tokens = malloc(capacity * sizeof(token_t));
+    if (!scratch || !tokens) {
+        free(scratch);
+        free(tokens);
+        return NULL;
+    }
+    scratch->source = scratch->cursor = scratch->line_start = source;
+    scratch->source_end = source + size;
+    scratch->line_number = 1;
+    scratch->current_token.type = TOKEN_EOF;
     
-    // Second pass: generate code
-    while (!feof(assembler->file)) {
-        if (!assembler_parse_line(assembler)) {
+    *count = 0;
+    for (;;) {
+        token_t token = assembler_lex(scratch, false);
+        if (token.type == TOKEN_EOF) {
             break;
         }
+        if (*count == capacity) {
+            capacity *= 2;
+            token_t* grown = realloc(tokens, capacity * sizeof(token_t));
+            if (!grown) {
+                free(tokens);
+                tokens = NULL;
+                break;
+            }
+            tokens = grown;
+        }
+        tokens[(*count)++] = token;
     }
+    free(scratch);
+    return tokens;
+}
+
+// Find an include file in the cache, loading and lexing it on a miss
+static const include_entry_t* assembler_include_lookup(const char* path) {
+    long long mtime = -1;
+    size_t size = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat st;
+    if (stat(path, &st) == 0) {
+#if defined(__APPLE__)
+        mtime = (long long)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        size = (size_t)st.st_size;
+    }
+#endif
     
-    // Resolve labels
-    if (!assembler_resolve_labels(assembler)) {
-        return false;
+    INCLUDE_LOCK();
+    include_stats.lookups++;
+    include_entry_t* entry = include_cache;
+    while (entry && !(mtime >= 0 && entry->mtime == mtime && entry->size == size && strcmp(entry->path, path) == 0)) {
+        entry = entry->next;
+    }
+    if (entry) {
+        include_stats.hits++;
+        INCLUDE_UNLOCK();
+        return entry;
     }
     
-    fclose(assembler->file);
-    assembler->file = NULL;
+    // Changed, only touched, new, or a copy of a file seen under another
+    // name: the content hash tells
+    bool mapped;
+    char* source = assembler_load_source(path, &size, &mapped);
+    if (!source) {
+        INCLUDE_UNLOCK();
+        return NULL;
+    }
+    uint64_t hash = assembler_hash_source(source, size);
+    include_entry_t* same = NULL;
+    for (entry = include_cache; entry; entry = entry->next) {
+        if (entry->hash != hash || entry->size != size) {
+            continue;
+        }
+        if (strcmp(entry->path, path) == 0) {
+            break;
+        }
+        if (!same && entry->source && memcmp(entry->source, source, size) == 0) {
+            same = entry;
+        }
+    }
+    if (entry) {
+        include_stats.hits++;
+        entry->mtime = mtime;
+        assembler_unload_source(source, size, mapped);
+        INCLUDE_UNLOCK();
+        return entry;
+    }
     
-    return !assembler->error_occurred;
+    entry = calloc(1, sizeof(include_entry_t));
+    char* copy = entry ? malloc(strlen(path) + 1) : NULL;
+    if (!copy) {
+        assembler_unload_source(source, size, mapped);
+        free(entry);
+        INCLUDE_UNLOCK();
+        return NULL;
+    }
+    strcpy(copy, path);
+    entry->path = copy;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->hash = hash;
+    
+    if (same) {
+        include_stats.hits++;
+        assembler_unload_source(source, size, mapped);
+        entry->text = same->text;
+        entry->tokens = same->tokens;
+        entry->token_count = same->token_count;
+    } else {
+        // Cached tokens outlive this assembly, so they must not point into
+        // a mapping that changes when the file is edited in place
+        if (mapped) {
+            char* copy = malloc(size ? size : 1);
+            if (copy) {
+                memcpy(copy, source, size);
+            }
+            assembler_unload_source(source, size, true);
+            source = copy;
+        }
+        entry->source = source;
+        entry->text = source;
+        entry->tokens = source ? assembler_lex_source(source, size, &entry->token_count) : NULL;
+        if (!entry->tokens) {
+            free(source);
+            free(entry->path);
+            free(entry);
+            INCLUDE_UNLOCK();
+            return NULL;
+        }
+        include_stats.files++;
+    }
+    entry->next = include_cache;
+    include_cache = entry;
+    INCLUDE_UNLOCK();
+    return entry;
 }
 
-// Parse a single line
-bool assembler_parse_line(assembler_t* assembler) {
-    char line[MAX_LINE_LENGTH];
-    if (!fgets(line, sizeof(line), assembler->file)) {
-        return false;
+// Include cache counters
+include_cache_stats_t assembler_include_cache_stats(void) {
+    INCLUDE_LOCK();
+    include_cache_stats_t stats = include_stats;
+    INCLUDE_UNLOCK();
+    return stats;
+}
+
+// Drop every cached include
+void assembler_clear_include_cache(void) {
+    INCLUDE_LOCK();
+    while (include_cache) {
+        include_entry_t* next = include_cache->next;
+        if (include_cache->source) {
+            free(include_cache->source);
+            free(include_cache->tokens);
+        }
+        free(include_cache->path);
+        free(include_cache);
+        include_cache = next;
     }
+    memset(&include_stats, 0, sizeof(include_stats));
+    INCLUDE_UNLOCK();
+}
+
+// Assemble file
+bool assembler_assemble_file(assembler_t* assembler, const char* filename) {
+    assembler->filename = (char*)filename;
     
-    assembler->line_number++;
-    assembler->current_line = line;
-    assembler->column_number = 0;
+    size_t size;
+    bool mapped;
+    char* source = assembler_load_source(filename, &size, &mapped);
+    if (!source) {
+        assembler_error(assembler, "Cannot open file: %s", filename);
+        return false;
+    }
     
-    // Skip whitespace
-    assembler_skip_whitespace(assembler);
+    bool assembled = assembler_assemble_buffer(assembler, source, size);
+    assembler_unload_source(source, size, mapped);
+    return assembled;
+}
+
+// Assemble source text held by the caller
+bool assembler_assemble_string(assembler_t* assembler, const char* source) {
+    if (!assembler->filename) {
+        assembler->filename = "<string>";
+    }
+    return assembler_assemble_buffer(assembler, source, strlen(source));
+}
+
+// Skip blanks and a comment, stopping at the end of the line
+void assembler_skip_whitespace(assembler_t* assembler) {
+    const char* p = assembler->cursor;
+    const char* end = assembler->source_end;
     
-    // Skip empty lines
-    if (assembler->current_line[assembler->column_number] == '\n' || 
-        assembler->current_line[assembler->column_number] == '\0') {
-        return true;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
     }
+    if (p < end && *p == ';') {
+        while (p < end && *p != '\n') {
+            p++;
+        }
+    }
+    assembler->cursor = p;
+}
+
+// Value of a digit in a base, or -1
+static int assembler_digit_value(char c, int base) {
+    int value = isdigit((unsigned char)c) ? c - '0' :
+                isxdigit((unsigned char)c) ? tolower((unsigned char)c) - 'a' + 10 : -1;
+    return value < base ? value : -1;
+}
+
+// Lex a number: decimal, $hex, 0xhex, %binary or a 'c' character
+static bool assembler_lex_number(assembler_t* assembler, token_t* token) {
+    const char* p = assembler->cursor;
+    const char* end = assembler->source_end;
     
-    // Skip comments
-    if (assembler->current_line[assembler->column_number] == ';') {
+    if (*p == '\'') {
+        p++;
+        if (p < end && *p == '\\' && p + 1 < end) {
+            p++;
+            token->value = *p == 'n' ? '\n' : *p == 't' ? '\t' : *p == 'r' ? '\r' : *p == '0' ? 0 : (uint8_t)*p;
+        } else if (p < end) {
+            token->value = (uint8_t)*p;
+        }
+        p++;
+        if (p >= end || *p != '\'') {
+            return false;
+        }
+        assembler->cursor = p + 1;
         return true;
     }
     
-    // Parse label
-    if (assembler_parse_label(assembler)) {
-        return true;
+    int base = 10;
+    if (*p == '$') {
+        base = 16;
+        p++;
+    } else if (*p == '%') {
+        base = 2;
+        p++;
+    } else if (*p == '0' && p + 1 < end && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
     }
     
-    // Parse directive
-    if (assembler->current_line[assembler->column_number] == '.') {
-        return assembler_parse_directive(assembler);
+    const char* digits = p;
+    uint32_t value = 0;
+    while (p < end && assembler_is_identifier_char(*p)) {
+        int digit = assembler_digit_value(*p, base);
+        if (digit < 0) {
+            return false;
+        }
+        value = value * base + digit;
+        if (value > 0xFFFF) {
+            return false;
+        }
+        p++;
+    }
+    if (p == digits) {
+        return false;
+    }
+    token->value = (uint16_t)value;
+    assembler->cursor = p;
+    return true;
+}
+
+// Save and restore the input being read
+static void assembler_save_input(const assembler_t* assembler, input_t* input) {
+    input->filename = assembler->filename;
+    input->source = assembler->source;
+    input->source_end = assembler->source_end;
+    input->cursor = assembler->cursor;
+    input->line_start = assembler->line_start;
+    input->line_number = assembler->line_number;
+    input->tokens = assembler->tokens;
+    input->token_count = assembler->token_count;
+    input->token_index = assembler->token_index;
+}
+
+static void assembler_load_input(assembler_t* assembler, const input_t* input) {
+    assembler->filename = input->filename;
+    assembler->source = input->source;
+    assembler->source_end = input->source_end;
+    assembler->cursor = input->cursor;
+    assembler->line_start = input->line_start;
+    assembler->line_number = input->line_number;
+    assembler->tokens = input->tokens;
+    assembler->token_count = input->token_count;
+    assembler->token_index = input->token_index;
+}
+
+// Switch to the pending include or macro expansion
+static bool assembler_enter_input(assembler_t* assembler) {
+    if (assembler->input_depth == MAX_INCLUDES) {
+        memset(&assembler->pending_input, 0, sizeof(input_t));
+        assembler_error(assembler, "Includes and macros nested too deeply");
+        return false;
+    }
+    assembler_save_input(assembler, &assembler->inputs[assembler->input_depth++]);
+    assembler_load_input(assembler, &assembler->pending_input);
+    memset(&assembler->pending_input, 0, sizeof(input_t));
+    assembler->current_token.type = TOKEN_EOF;
+    return true;
+}
+
+// The end of an include or a macro expansion ends its line and, unless
+// peeking, resumes the input it was entered from
+static token_t assembler_leave_input(assembler_t* assembler, token_t token, bool report) {
+    token.type = TOKEN_NEWLINE;
+    token.length = 0;
+    if (report) {
+        assembler_load_input(assembler, &assembler->inputs[--assembler->input_depth]);
+    }
+    assembler->current_token = token;
+    return token;
+}
+
+// Next token of a cached include; malformed tokens are reported here as
+// the lexer would have
+static token_t assembler_replay(assembler_t* assembler, bool report) {
+    if (assembler->token_index == assembler->token_count) {
+        token_t end = {0};
+        end.type = TOKEN_EOF;
+        end.line = assembler->line_number;
+        if (assembler->token_count > 0) {
+            const token_t* last = &assembler->tokens[assembler->token_count - 1];
+            end.text = last->text + last->length + (last->type == TOKEN_STRING);
+        }
+        return assembler->input_depth > 0 ? assembler_leave_input(assembler, end, report) : end;
     }
     
-    // Parse instruction
-    return assembler_parse_instruction(assembler);
+    token_t token = assembler->tokens[assembler->token_index++];
+    assembler->line_number = token.line;
+    if (report && token.type == TOKEN_UNKNOWN) {
+        if (token.text[0] == '"') {
+            assembler_error(assembler, "Unterminated string");
+        } else if (assembler_is_number_char(token.text[0]) || token.text[0] == '\'') {
+            assembler_error(assembler, "Invalid number");
+        }
+    }
+    assembler->current_token = token;
+    return token;
 }
 
-// Parse label
-bool assembler_parse_label(assembler_t* assembler) {
-    char label_name[MAX_LABEL_LENGTH];
-    int i = 0;
+// Lex the next token into current_token, reporting malformed ones if asked
+static token_t assembler_lex(assembler_t* assembler, bool report) {
+    if (assembler->tokens) {
+        return assembler_replay(assembler, report);
+    }
     
-    // Check if this is a label
-    while (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-        if (i >= MAX_LABEL_LENGTH - 1) {
-            assembler_error(assembler, "Label name too long");
-            return false;
+    // Leaving a line
+    if (assembler->current_token.type == TOKEN_NEWLINE) {
+        assembler->line_number++;
+        assembler->line_start = assembler->cursor;
+    }
+    
+    assembler_skip_whitespace(assembler);
+    
+    const char* p = assembler->cursor;
+    const char* end = assembler->source_end;
+    token_t token = {0};
+    token.text = p;
+    token.line = assembler->line_number;
+    token.column = (int)(p - assembler->line_start) + 1;
+    
+    if (p >= end) {
+        token.type = TOKEN_EOF;
+    } else if (isalpha((unsigned char)*p) || *p == '_' || *p == '@') {
+        p++;
+        while (p < end && assembler_is_identifier_char(*p)) {
+            p++;
         }
-        label_name[i++] = assembler->current_line[assembler->column_number++];
+        token.type = TOKEN_IDENTIFIER;
+        assembler->cursor = p;
+    } else if (assembler_is_number_char(*p) || *p == '\'') {
+        token.type = TOKEN_NUMBER;
+        if (!assembler_lex_number(assembler, &token)) {
+            if (report) {
+                assembler_error(assembler, "Invalid number");
+            }
+            token.type = TOKEN_UNKNOWN;
+            assembler->cursor = p + 1;
+        }
+    } else if (*p == '"') {
+        const char* close = memchr(p + 1, '"', end - p - 1);
+        const char* newline = memchr(p + 1, '\n', end - p - 1);
+        if (!close || (newline && newline < close)) {
+            if (report) {
+                assembler_error(assembler, "Unterminated string");
+            }
+            token.type = TOKEN_UNKNOWN;
+            assembler->cursor = newline ? newline : end;
+        } else {
+            token.type = TOKEN_STRING;
+            token.text = p + 1;
+            assembler->cursor = close + 1;
+        }
+    } else {
+        switch (*p) {
+            case '\n': token.type = TOKEN_NEWLINE; break;
+            case ',': token.type = TOKEN_COMMA; break;
+            case ':': token.type = TOKEN_COLON; break;
+            case '[': token.type = TOKEN_LBRACKET; break;
+            case ']': token.type = TOKEN_RBRACKET; break;
+            case '(': token.type = TOKEN_LPAREN; break;
+            case ')': token.type = TOKEN_RPAREN; break;
+            case '+': token.type = TOKEN_PLUS; break;
+            case '-': token.type = TOKEN_MINUS; break;
+            case '#': token.type = TOKEN_HASH; break;
+            case '.': token.type = TOKEN_DOT; break;
+            default: token.type = TOKEN_UNKNOWN; break;
+        }
+        assembler->cursor = p + 1;
     }
     
-    if (i == 0) {
-        return false; // Not a label
+    if (token.type != TOKEN_STRING) {
+        token.length = assembler->cursor - token.text;
+    } else {
+        token.length = assembler->cursor - 1 - token.text;
+    }
+    if (token.type == TOKEN_EOF && assembler->input_depth > 0) {
+        return assembler_leave_input(assembler, token, report);
     }
+    assembler->current_token = token;
+    return token;
+}
+
+// Read the next token. Tokens are slices of the source buffer; nothing is
+// copied.
+token_t assembler_next_token(assembler_t* assembler) {
+    return assembler_lex(assembler, true);
+}
+
+// Check whether the token after the current one has the given type,
+// without consuming anything
+bool assembler_peek_token(assembler_t* assembler, token_type_t expected) {
+    const char* cursor = assembler->cursor;
+    size_t token_index = assembler->token_index;
+    int line_number = assembler->line_number;
+    token_t current = assembler->current_token;
     
-    label_name[i] = '\0';
+    assembler->current_token.type = TOKEN_EOF;
+    bool matches = assembler_lex(assembler, false).type == expected;
     
-    // Check for colon
-    assembler_skip_whitespace(assembler);
-    if (assembler->current_line[assembler->column_number] == ':') {
-        assembler->column_number++;
-        assembler_add_label(assembler, label_name, assembler->current_address);
-        return true;
+    assembler->cursor = cursor;
+    assembler->token_index = token_index;
+    assembler->line_number = line_number;
+    assembler->current_token = current;
+    return matches;
+}
+
+// Consume the current token if it has the given type
+bool assembler_expect_token(assembler_t* assembler, token_type_t expected) {
+    static const char* names[] = {
+        "end of input", "identifier", "number", "string", "','", "'['", "']'", "'+'", "'-'",
+        "'#'", "'.'", "end of line", "character", "':'", "'('", "')'"
+    };
+    
+    if (assembler->current_token.type != expected) {
+        // A malformed token has been reported already
+        if (!assembler->error_occurred) {
+            assembler_error(assembler, "Expected %s", names[expected]);
+        }
+        return false;
+    }
+    assembler_next_token(assembler);
+    return true;
+}
+
+// Check whether a token's text is the given word
+bool assembler_token_is(const token_t* token, const char* text) {
+    return strlen(text) == token->length && memcmp(token->text, text, token->length) == 0;
+}
+
+// Start a listing record for the line the current token is on; its
+// index, or -1 when out of memory
+static int assembler_list_line(assembler_t* assembler) {
+    if (assembler->line_count == assembler->line_capacity) {
+        int capacity = assembler->line_capacity ? assembler->line_capacity * 2 : 256;
+        listing_line_t* lines = arena_grow(&assembler->arena, assembler->lines,
+                                           (size_t)assembler->line_capacity * sizeof(listing_line_t),
+                                           (size_t)capacity * sizeof(listing_line_t));
+        if (!lines) {
+            assembler_error(assembler, "Out of memory");
+            return -1;
+        }
+        assembler->lines = lines;
+        assembler->line_capacity = capacity;
     }
     
-    // Not a label, reset position
-    assembler->column_number -= i;
-    return false;
+    const char* start = assembler->current_token.text;
+    while (start > assembler->source && start[-1] != '\n') {
+        start--;
+    }
+    listing_line_t* line = &assembler->lines[assembler->line_count];
+    memset(line, 0, sizeof(listing_line_t));
+    line->text = start;
+    line->filename = assembler->filename;
+    line->line = assembler->current_token.line;
+    line->offset = assembler->output_size;
+    return assembler->line_count++;
 }
 
-// Parse directive
-bool assembler_parse_directive(assembler_t* assembler) {
-    assembler->column_number++; // Skip '.'
+// Parse a single line
+bool assembler_parse_line(assembler_t* assembler) {
+    token_t* token = &assembler->current_token;
+    if (token->type == TOKEN_EOF || assembler->error_occurred) {
+        return false;
+    }
     
-    char directive[32];
-    int i = 0;
-    while (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-        if (i >= 31) {
-            assembler_error(assembler, "Directive name too long");
+    // Keep the line for the listing, copied as the source is unmapped
+    // after assembly; the empty line that ends an include or a macro
+    // expansion is not in any source
+    int listed = -1;
+    if (assembler->listing && token->length > 0) {
+        listed = assembler_list_line(assembler);
+        if (listed < 0) {
             return false;
         }
-        directive[i++] = assembler->current_line[assembler->column_number++];
     }
-    directive[i] = '\0';
     
-    assembler_skip_whitespace(assembler);
+    // Parse label; a directive or instruction may follow it
+    assembler_parse_label(assembler);
+    
+    bool parsed = true;
+    bool code = false;
+    if (token->type == TOKEN_DOT) {
+        parsed = assembler_parse_directive(assembler);
+    } else if (token->type == TOKEN_IDENTIFIER) {
+        name_slot_t* macro = assembler_index_find(&assembler->macro_index, token->text, token->length);
+        code = !macro;
+        parsed = macro ? assembler_expand_macro(assembler, &assembler->macros[macro->entry]) :
+                         assembler_parse_instruction(assembler);
+    }
+    if (!parsed || assembler->error_occurred) {
+        return false;
+    }
     
-    if (strcmp(directive, "org") == 0) {
+    // A statement ends its line; an include or a macro expansion is read
+    // from the next line on
+    if (token->type != TOKEN_NEWLINE && token->type != TOKEN_EOF) {
+        assembler_error(assembler, "Unexpected '%.*s'", (int)token->length, token->text);
+        return false;
+    }
+    if (listed >= 0) {
+        listing_line_t* line = &assembler->lines[listed];
+        line->length = token->text - line->text;
+        line->text = arena_strndup(&assembler->arena, line->text, line->length);
+        if (!line->text) {
+            assembler_error(assembler, "Out of memory");
+            return false;
+        }
+        line->section = assembler->section_count - 1;
+        line->code = code;
+    }
+    if (assembler->pending_input.filename && !assembler_enter_input(assembler)) {
+        return false;
+    }
+    assembler_next_token(assembler);
+    return true;
+}
+
+// Parse label
+bool assembler_parse_label(assembler_t* assembler) {
+    token_t name = assembler->current_token;
+    if (name.type != TOKEN_IDENTIFIER || !assembler_peek_token(assembler, TOKEN_COLON)) {
+        return false;
+    }
+    
+    assembler_next_token(assembler);    // ':'
+    assembler_next_token(assembler);
+    return assembler_define_label(assembler, name.text, name.length, assembler->current_address);
+}
+
+// Parse directive
+bool assembler_parse_directive(assembler_t* assembler) {
+    assembler_next_token(assembler);    // '.'
+    token_t directive = assembler->current_token;
+    if (!assembler_expect_token(assembler, TOKEN_IDENTIFIER)) {
+        return false;
+    }
+    
+    if (assembler_token_is(&directive, "org")) {
+        assembler->unresolved = false;
         uint16_t address = assembler_parse_expression(assembler);
+        if (assembler->unresolved) {
+            assembler_error(assembler, ".org address must be defined before it is used");
+            return false;
+        }
+        
+        // .org fixes the section it starts; in absolute output it always
+        // starts one, which branch relaxation moves code within
+        if (!assembler->relocatable && !assembler_begin_section(assembler, "text", 4)) {
+            return false;
+        }
+        section_t* section = &assembler->sections[assembler->section_count - 1];
+        if (section->start != assembler->output_size) {
+            assembler_error(assembler, ".org must start a section in relocatable output");
+            return false;
+        }
+        section->address = address;
+        section->fixed = true;
         assembler->current_address = address;
         assembler->origin_address = address;
         return true;
-    } else if (strcmp(directive, "byte") == 0) {
-        uint16_t value = assembler_parse_expression(assembler);
-        assembler_emit_byte(assembler, value & 0xFF);
-        return true;
-    } else if (strcmp(directive, "word") == 0) {
-        uint16_t value = assembler_parse_expression(assembler);
-        assembler_emit_word(assembler, value);
+    } else if (assembler_token_is(&directive, "section")) {
+        // Sections only mean something to the linker
+        token_t name = assembler->current_token;
+        if (!assembler_expect_token(assembler, TOKEN_IDENTIFIER)) {
+            return false;
+        }
+        return !assembler->relocatable || assembler_begin_section(assembler, name.text, name.length);
+    } else if (assembler_token_is(&directive, "global")) {
+        // Labels other modules may use, separated by commas
+        do {
+            if (assembler->current_token.type == TOKEN_COMMA) {
+                assembler_next_token(assembler);
+            }
+            token_t name = assembler->current_token;
+            if (!assembler_expect_token(assembler, TOKEN_IDENTIFIER)) {
+                return false;
+            }
+            if (assembler->relocatable &&
+                !assembler_add_name(assembler, &assembler->global_index, name.text, name.length)) {
+                return false;
+            }
+        } while (assembler->current_token.type == TOKEN_COMMA);
         return true;
-    } else if (strcmp(directive, "string") == 0) {
-        assembler_skip_whitespace(assembler);
-        if (assembler->current_line[assembler->column_number] == '"') {
-            assembler->column_number++;
-            while (assembler->current_line[assembler->column_number] != '"' && 
-                   assembler->current_line[assembler->column_number] != '\n') {
-                assembler_emit_byte(assembler, assembler->current_line[assembler->column_number++]);
+    } else if (assembler_token_is(&directive, "byte") || assembler_token_is(&directive, "word")) {
+        // One or more values, separated by commas
+        uint8_t width = directive.text[0] == 'b' ? 1 : 2;
+        do {
+            if (assembler->current_token.type == TOKEN_COMMA) {
+                assembler_next_token(assembler);
             }
-            if (assembler->current_line[assembler->column_number] == '"') {
-                assembler->column_number++;
+            if (!assembler_emit_operand(assembler, width, false)) {
+                return false;
             }
+        } while (assembler->current_token.type == TOKEN_COMMA);
+        return true;
+    } else if (assembler_token_is(&directive, "string")) {
+        token_t text = assembler->current_token;
+        if (!assembler_expect_token(assembler, TOKEN_STRING)) {
+            return false;
+        }
+        for (size_t i = 0; i < text.length; i++) {
+            assembler_emit_byte(assembler, text.text[i]);
         }
         return true;
-    } else if (strcmp(directive, "include") == 0) {
-        assembler_skip_whitespace(assembler);
-        if (assembler->current_line[assembler->column_number] == '"') {
-            assembler->column_number++;
-            char filename[256];
-            int i = 0;
-            while (assembler->current_line[assembler->column_number] != '"' && 
-                   assembler->current_line[assembler->column_number] != '\n' && i < 255) {
-                filename[i++] = assembler->current_line[assembler->column_number++];
-            }
-            filename[i] = '\0';
-            if (assembler->current_line[assembler->column_number] == '"') {
-                assembler->column_number++;
+    } else if (assembler_token_is(&directive, "include") || assembler_token_is(&directive, "incbin")) {
+        token_t name = assembler->current_token;
+        if (!assembler_expect_token(assembler, TOKEN_STRING)) {
+            return false;
+        }
+        char* path = assembler_resolve_path(assembler, name.text, name.length);
+        if (!path) {
+            return false;
+        }
+        
+        // Binary data is copied straight from the mapped file
+        if (directive.text[3] == 'b') {
+            size_t size;
+            bool mapped;
+            char* data = assembler_load_source(path, &size, &mapped);
+            if (!data) {
+                assembler_error(assembler, "Cannot open file: %s", path);
+                return false;
             }
-            
-            // TODO: Handle include files
-            assembler_warning(assembler, "Include files not yet implemented");
+            for (size_t i = 0; i < size && !assembler->error_occurred; i++) {
+                assembler_emit_byte(assembler, (uint8_t)data[i]);
+            }
+            assembler_unload_source(data, size, mapped);
+            return !assembler->error_occurred;
+        }
+        
+        // Source is replayed from the include cache's tokens
+        const include_entry_t* entry = assembler_include_lookup(path);
+        if (!entry) {
+            assembler_error(assembler, "Cannot open include file: %s", path);
+            return false;
         }
+        input_t* input = &assembler->pending_input;
+        memset(input, 0, sizeof(input_t));
+        input->filename = path;
+        input->source = entry->text;
+        input->source_end = entry->text + entry->size;
+        input->line_number = 1;
+        input->tokens = entry->tokens;
+        input->token_count = entry->token_count;
         return true;
+    } else if (assembler_token_is(&directive, "macro")) {
+        return assembler_define_macro(assembler);
+    } else if (assembler_token_is(&directive, "endm")) {
+        assembler_error(assembler, ".endm without .macro");
+        return false;
     } else {
-        assembler_error(assembler, "Unknown directive: .%s", directive);
+        assembler_error(assembler, "Unknown directive: .%.*s", (int)directive.length, directive.text);
         return false;
     }
 }
 
-// Parse instruction
-bool assembler_parse_instruction(assembler_t* assembler) {
-    char instruction[32];
-    int i = 0;
+// Path of a file named by a directive, relative to the directory of the
+// file naming it
+static char* assembler_resolve_path(assembler_t* assembler, const char* name, size_t length) {
+    const char* base = assembler->filename;
+    const char* slash = base ? strrchr(base, '/') : NULL;
+    size_t directory = slash && name[0] != '/' ? (size_t)(slash - base + 1) : 0;
+    
+    char* path = arena_alloc(&assembler->arena, directory + length + 1);
+    if (!path) {
+        assembler_error(assembler, "Out of memory");
+        return NULL;
+    }
+    memcpy(path, base, directory);
+    memcpy(path + directory, name, length);
+    path[directory + length] = '\0';
+    return path;
+}
+
+// Parse a macro definition: its name and parameters, then every line up to
+// .endm, which is kept as text and assembled at each use
+static bool assembler_define_macro(assembler_t* assembler) {
+    token_t* token = &assembler->current_token;
+    token_t name = *token;
+    if (!assembler_expect_token(assembler, TOKEN_IDENTIFIER)) {
+        return false;
+    }
+    if (assembler_lookup_mnemonic(name.text, name.length)) {
+        assembler_error(assembler, "Macro name is an instruction: %.*s", (int)name.length, name.text);
+        return false;
+    }
+    if (assembler_index_find(&assembler->macro_index, name.text, name.length)) {
+        assembler_error(assembler, "Duplicate macro: %.*s", (int)name.length, name.text);
+        return false;
+    }
+    
+    macro_t macro;
+    memset(&macro, 0, sizeof(macro));
+    while (token->type == TOKEN_IDENTIFIER) {
+        if (macro.param_count == MAX_MACRO_PARAMS) {
+            assembler_error(assembler, "Too many macro parameters");
+            return false;
+        }
+        macro.params[macro.param_count] = token->text;
+        macro.param_lengths[macro.param_count++] = token->length;
+        assembler_next_token(assembler);
+        if (token->type != TOKEN_COMMA) {
+            break;
+        }
+        assembler_next_token(assembler);
+    }
+    if (token->type != TOKEN_NEWLINE) {
+        return assembler_expect_token(assembler, TOKEN_NEWLINE);
+    }
+    
+    // The body must end in the same input it started in
+    int depth = assembler->input_depth;
+    assembler_next_token(assembler);
+    
+    // The body starts with its first line's indentation, so every expanded
+    // line lists the way it was written
+    macro.body = token->text;
+    while (macro.body[-1] == ' ' || macro.body[-1] == '\t') {
+        macro.body--;
+    }
+    macro.line = token->line;
+    macro.filename = assembler->filename;
+    bool line_start = true;
+    for (;;) {
+        if (token->type == TOKEN_EOF || assembler->input_depth != depth) {
+            assembler_error(assembler, "Missing .endm for macro %.*s", (int)name.length, name.text);
+            return false;
+        }
+        if (assembler->error_occurred) {
+            return false;
+        }
+        if (line_start && token->type == TOKEN_DOT) {
+            const char* dot = token->text;
+            assembler_next_token(assembler);
+            if (assembler_token_is(token, "endm")) {
+                macro.length = dot - macro.body;
+                break;
+            }
+            if (assembler_token_is(token, "macro")) {
+                assembler_error(assembler, "Macros cannot be defined inside a macro");
+                return false;
+            }
+        }
+        line_start = token->type == TOKEN_NEWLINE;
+        assembler_next_token(assembler);
+    }
+    assembler_next_token(assembler);
     
-    // Get instruction name
-    while (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-        if (i >= 31) {
-            assembler_error(assembler, "Instruction name too long");
+    if (assembler->macro_count == assembler->macro_capacity) {
+        int capacity = assembler->macro_capacity ? assembler->macro_capacity * 2 : 16;
+        macro_t* macros = arena_grow(&assembler->arena, assembler->macros,
+                                     (size_t)assembler->macro_capacity * sizeof(macro_t),
+                                     (size_t)capacity * sizeof(macro_t));
+        if (!macros) {
+            assembler_error(assembler, "Out of memory");
             return false;
         }
-        instruction[i++] = assembler->current_line[assembler->column_number++];
+        assembler->macros = macros;
+        assembler->macro_capacity = capacity;
+    }
+    name_slot_t* slot = assembler_add_name(assembler, &assembler->macro_index, name.text, name.length);
+    if (!slot) {
+        return false;
     }
-    instruction[i] = '\0';
+    macro.name = slot->name;
+    assembler->macros[slot->entry] = macro;
+    assembler->macro_count = assembler->macro_index.count;
+    return true;
+}
+
+// Copy a macro body with its parameters replaced by the arguments and
+// every @name made @N_name, N numbering the expansion. Returns the size;
+// out may be NULL to measure.
+static size_t assembler_substitute(assembler_t* assembler, const macro_t* macro, const char** args,
+                                   const size_t* lengths, int expansion, char* out) {
+    input_t saved;
+    token_t current = assembler->current_token;
+    assembler_save_input(assembler, &saved);
+    
+    input_t body;
+    memset(&body, 0, sizeof(body));
+    body.source = body.cursor = body.line_start = macro->body;
+    body.source_end = macro->body + macro->length;
+    assembler_load_input(assembler, &body);
+    assembler->current_token.type = TOKEN_EOF;
+    
+    char local[24];
+    size_t size = 0;
+    const char* copied = macro->body;
+    for (;;) {
+        token_t token = assembler_lex(assembler, false);
+        if (token.text >= body.source_end) {
+            break;
+        }
+        if (token.type != TOKEN_IDENTIFIER) {
+            continue;
+        }
+        
+        const char* text = NULL;
+        size_t length = 0;
+        for (int i = 0; i < macro->param_count && !text; i++) {
+            if (macro->param_lengths[i] == token.length && memcmp(macro->params[i], token.text, token.length) == 0) {
+                text = args[i];
+                length = lengths[i];
+            }
+        }
+        size_t prefix = 0;
+        if (!text && token.text[0] == '@') {
+            prefix = (size_t)snprintf(local, sizeof(local), "@%d_", expansion);
+            text = token.text + 1;
+            length = token.length - 1;
+        }
+        if (!text) {
+            continue;
+        }
+        
+        size_t gap = token.text - copied;
+        if (out) {
+            memcpy(out + size, copied, gap);
+            memcpy(out + size + gap, local, prefix);
+            memcpy(out + size + gap + prefix, text, length);
+        }
+        size += gap + prefix + length;
+        copied = token.text + token.length;
+    }
+    if (out) {
+        memcpy(out + size, copied, body.source_end - copied);
+    }
+    size += body.source_end - copied;
+    
+    assembler_load_input(assembler, &saved);
+    assembler->current_token = current;
+    return size;
+}
+
+// Expand a macro: read its arguments, then queue the substituted body to
+// be assembled from the next line on
+static bool assembler_expand_macro(assembler_t* assembler, const macro_t* macro) {
+    token_t* token = &assembler->current_token;
+    assembler_next_token(assembler);
     
-    if (i == 0) {
-        assembler_error(assembler, "Expected instruction");
+    // Arguments are the source text between commas
+    const char* args[MAX_MACRO_PARAMS];
+    size_t lengths[MAX_MACRO_PARAMS];
+    int count = 0;
+    int parens = 0;
+    const char* start = NULL;
+    const char* end = NULL;
+    while (token->type != TOKEN_NEWLINE && token->type != TOKEN_EOF && !assembler->error_occurred) {
+        if (token->type == TOKEN_COMMA && parens == 0) {
+            if (!start || count == MAX_MACRO_PARAMS) {
+                assembler_error(assembler, start ? "Too many macro arguments" : "Empty macro argument");
+                return false;
+            }
+            args[count] = start;
+            lengths[count++] = end - start;
+            start = NULL;
+            assembler_next_token(assembler);
+            continue;
+        }
+        parens += token->type == TOKEN_LPAREN ? 1 : token->type == TOKEN_RPAREN ? -1 : 0;
+        bool quoted = token->type == TOKEN_STRING;
+        if (!start) {
+            start = token->text - quoted;
+        }
+        end = token->text + token->length + quoted;
+        assembler_next_token(assembler);
+    }
+    if (assembler->error_occurred) {
+        return false;
+    }
+    if (start) {
+        if (count == MAX_MACRO_PARAMS) {
+            assembler_error(assembler, "Too many macro arguments");
+            return false;
+        }
+        args[count] = start;
+        lengths[count++] = end - start;
+    } else if (count > 0) {
+        assembler_error(assembler, "Empty macro argument");
+        return false;
+    }
+    if (count != macro->param_count) {
+        assembler_error(assembler, "Wrong number of arguments for macro %s: expected %d, got %d", macro->name, macro->param_count, count);
         return false;
     }
     
-    // Get opcode
-    opcode_t opcode = assembler_get_opcode(instruction);
-    if (opcode == 0 && strcmp(instruction, "NOP") != 0) {
-        assembler_error(assembler, "Unknown instruction: %s", instruction);
+    // The expansion lives in the arena, so fixups may point into it
+    int expansion = ++assembler->expansion_count;
+    size_t size = assembler_substitute(assembler, macro, args, lengths, expansion, NULL);
+    char* text = arena_alloc(&assembler->arena, size + 1);
+    if (!text) {
+        assembler_error(assembler, "Out of memory");
         return false;
     }
+    assembler_substitute(assembler, macro, args, lengths, expansion, text);
+    text[size] = '\0';
     
-    assembler_skip_whitespace(assembler);
+    input_t* input = &assembler->pending_input;
+    memset(input, 0, sizeof(input_t));
+    input->filename = (char*)macro->filename;
+    input->source = input->cursor = input->line_start = text;
+    input->source_end = text + size;
+    input->line_number = macro->line;
+    return true;
+}
+
+// Parse instruction
+bool assembler_parse_instruction(assembler_t* assembler) {
+    token_t name = assembler->current_token;
+    const mnemonic_t* mnemonic = assembler_lookup_mnemonic(name.text, name.length);
+    if (!mnemonic) {
+        assembler_error(assembler, "Unknown instruction: %.*s", (int)name.length, name.text);
+        return false;
+    }
+    assembler_next_token(assembler);
     
     // Emit opcode
-    assembler_emit_byte(assembler, opcode);
-    
-    // Parse operands based on instruction
-    if (strcmp(instruction, "LDI") == 0) {
-        uint16_t value = assembler_parse_expression(assembler);
-        assembler_emit_byte(assembler, value & 0xFF);
-    } else if (strcmp(instruction, "LDA") == 0 || strcmp(instruction, "STA") == 0) {
-        // Parse addressing mode
-        if (assembler->current_line[assembler->column_number] == '#') {
-            // Immediate mode
-            assembler->column_number++;
-            uint16_t value = assembler_parse_expression(assembler);
-            assembler_emit_byte(assembler, value & 0xFF);
-        } else if (assembler->current_line[assembler->column_number] == '[') {
-            // Absolute addressing
-            assembler->column_number++;
-            uint16_t address = assembler_parse_expression(assembler);
-            if (assembler->current_line[assembler->column_number] == ']') {
-                assembler->column_number++;
-                assembler_emit_byte(assembler, address & 0xFF);
-                assembler_emit_byte(assembler, (address >> 8) & 0xFF);
-            } else {
-                assembler_error(assembler, "Expected ']'");
+    assembler_emit_byte(assembler, mnemonic->opcode);
+    
+    // Parse operands based on the instruction's addressing mode
+    token_t* token = &assembler->current_token;
+    switch (mnemonic->operand) {
+        case OPERAND_NONE:
+            // The CPU fetches an operand byte for every instruction
+            assembler_emit_byte(assembler, 0);
+            break;
+            
+        case OPERAND_IMMEDIATE:
+            return assembler_emit_operand(assembler, 1, false);
+            
+        case OPERAND_REGISTER: {
+            register_t reg;
+            if (token->type != TOKEN_IDENTIFIER || !assembler_lookup_register(token->text, token->length, &reg)) {
+                assembler_error(assembler, "Unknown register: %.*s", (int)token->length, token->text);
                 return false;
             }
-        } else {
-            assembler_error(assembler, "Invalid addressing mode");
-            return false;
+            assembler_next_token(assembler);
+            assembler_emit_byte(assembler, reg);
+            break;
         }
-    } else if (strcmp(instruction, "MOV") == 0) {
-        // Parse register
-        char reg_name[8];
-        int i = 0;
-        while (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-            if (i >= 7) {
-                assembler_error(assembler, "Register name too long");
+            
+        case OPERAND_ABSOLUTE: {
+            bool emitted;
+            if (token->type == TOKEN_LBRACKET) {
+                assembler_next_token(assembler);
+                emitted = assembler_emit_operand(assembler, 2, false) &&
+                          assembler_expect_token(assembler, TOKEN_RBRACKET);
+            } else if (token->type == TOKEN_HASH) {
+                assembler_error(assembler, "Invalid addressing mode");
                 return false;
+            } else {
+                emitted = assembler_emit_operand(assembler, 2, false);
             }
-            reg_name[i++] = assembler->current_line[assembler->column_number++];
+            
+            // A JMP to a label that only the fall-through of the branch
+            // before reaches runs with that branch's condition false, so
+            // relaxation may replace it with the inverse branch
+            fixup_t* jump = assembler->fixup_count > 0 ? &assembler->fixups[assembler->fixup_count - 1] : NULL;
+            if (emitted && mnemonic->opcode == OP_JMP && jump && (uint32_t)jump->offset + 2 == assembler->output_size &&
+                assembler->fallthrough >= 0 && assembler->fallthrough < assembler->fixup_count - 1) {
+                const fixup_t* branch = &assembler->fixups[assembler->fallthrough];
+                if (branch->relax == RELAX_BRANCH && branch->offset + 2 == jump->offset) {
+                    jump->relax = RELAX_JUMP;
+                    jump->condition = assembler->output[branch->offset - 1];
+                }
+            }
+            return emitted;
         }
-        reg_name[i] = '\0';
+            
+        case OPERAND_RELATIVE:
+            if (!assembler_emit_operand(assembler, 1, true)) {
+                return false;
+            }
+            assembler->fallthrough = assembler->fixup_count - 1;
+            break;
+    }
+    
+    return true;
+}
+
+// Parse expression
+uint16_t assembler_parse_expression(assembler_t* assembler) {
+    return assembler_parse_term(assembler);
+}
+
+// Parse term
+uint16_t assembler_parse_term(assembler_t* assembler) {
+    uint16_t left = assembler_parse_factor(assembler);
+    
+    while (assembler->current_token.type == TOKEN_PLUS || assembler->current_token.type == TOKEN_MINUS) {
+        token_type_t op = assembler->current_token.type;
+        assembler_next_token(assembler);
+        uint16_t right = assembler_parse_factor(assembler);
         
-        register_t reg = assembler_get_register(reg_name);
-        if (reg == 0 && strcmp(reg_name, "A") != 0) {
-            assembler_error(assembler, "Unknown register: %s", reg_name);
+        if (op == TOKEN_PLUS) {
+            left += right;
+        } else {
+            left -= right;
+        }
+    }
+    
+    return left;
+}
+
+// Parse factor
+uint16_t assembler_parse_factor(assembler_t* assembler) {
+    switch (assembler->current_token.type) {
+        case TOKEN_LPAREN: {
+            assembler_next_token(assembler);
+            uint16_t value = assembler_parse_expression(assembler);
+            assembler_expect_token(assembler, TOKEN_RPAREN);
+            return value;
+        }
+        case TOKEN_HASH:
+            assembler_next_token(assembler);
+            return assembler_parse_factor(assembler);
+        case TOKEN_NUMBER:
+            return assembler_parse_number_literal(assembler);
+        case TOKEN_IDENTIFIER:
+            return assembler_parse_identifier(assembler);
+        default:
+            if (!assembler->error_occurred) {
+                assembler_error(assembler, "Expected number or identifier");
+            }
+            return 0;
+    }
+}
+
+// Parse number literal (the lexer has worked out its value)
+uint16_t assembler_parse_number_literal(assembler_t* assembler) {
+    uint16_t value = assembler->current_token.value;
+    assembler_next_token(assembler);
+    return value;
+}
+
+// Parse identifier
+uint16_t assembler_parse_identifier(assembler_t* assembler) {
+    token_t identifier = assembler->current_token;
+    assembler_next_token(assembler);
+    
+    // Check if it's a label; in relocatable output its address is only
+    // known once the linker has placed its section
+    name_slot_t* slot = assembler_index_find(&assembler->label_index, identifier.text, identifier.length);
+    if (slot && !(assembler->relocatable && !assembler->resolving)) {
+        assembler->label_used = true;
+        return assembler->labels[slot->entry].address;
+    }
+    
+    // Check if it's a symbol
+    slot = assembler_index_find(&assembler->symbol_index, identifier.text, identifier.length);
+    if (slot) {
+        return assembler->symbols[slot->entry].value;
+    }
+    
+    // Labels may be used before they are defined until the fixups are patched
+    if (!assembler->resolving) {
+        assembler->unresolved = true;
+        return 0;
+    }
+    
+    assembler_error(assembler, "Undefined label or symbol: %.*s", (int)identifier.length, identifier.text);
+    return 0;
+}
+
+// Hash a name (FNV-1a)
+static uint32_t assembler_hash_name(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding a name, or the empty slot it would go in
+static name_slot_t* assembler_index_slot(const name_index_t* index, const char* name, size_t length, uint32_t hash) {
+    uint32_t mask = index->capacity - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        name_slot_t* slot = &index->slots[i];
+        if (!slot->name || (slot->hash == hash && strncmp(slot->name, name, length) == 0 &&
+                            slot->name[length] == '\0')) {
+            return slot;
+        }
+    }
+}
+
+// Find a name in an index
+static name_slot_t* assembler_index_find(const name_index_t* index, const char* name, size_t length) {
+    if (index->capacity == 0) {
+        return NULL;
+    }
+    name_slot_t* slot = assembler_index_slot(index, name, length, assembler_hash_name(name, length));
+    return slot->name ? slot : NULL;
+}
+
+// Slot for a name, doubling the index first if it would pass half full
+static name_slot_t* assembler_index_claim(assembler_t* assembler, name_index_t* index, const char* name,
+                                          size_t length) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : 64;
+        name_slot_t* slots = arena_calloc(&assembler->arena, capacity, sizeof(name_slot_t));
+        if (!slots) {
+            return NULL;
+        }
+        for (uint32_t i = 0; i < index->capacity; i++) {
+            name_slot_t* old = &index->slots[i];
+            if (old->name) {
+                uint32_t j = old->hash & (capacity - 1);
+                while (slots[j].name) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = *old;
+            }
+        }
+        index->slots = slots;
+        index->capacity = capacity;
+    }
+    
+    uint32_t hash = assembler_hash_name(name, length);
+    name_slot_t* slot = assembler_index_slot(index, name, length, hash);
+    slot->hash = hash;
+    return slot;
+}
+
+// Copy a name into the arena
+static const char* assembler_intern(assembler_t* assembler, const char* name, size_t length) {
+    return arena_strndup(&assembler->arena, name, length);
+}
+
+// Add a name to an index, or find it there; a new name gets the next
+// entry number
+static name_slot_t* assembler_add_name(assembler_t* assembler, name_index_t* index, const char* name,
+                                       size_t length) {
+    name_slot_t* slot = assembler_index_claim(assembler, index, name, length);
+    if (slot && slot->name) {
+        return slot;
+    }
+    
+    const char* copy = slot ? assembler_intern(assembler, name, length) : NULL;
+    if (!copy) {
+        assembler_error(assembler, "Out of memory");
+        return NULL;
+    }
+    slot->name = copy;
+    slot->entry = index->count++;
+    return slot;
+}
+
+// Define a label named by a slice of the source
+static bool assembler_define_label(assembler_t* assembler, const char* name, size_t length, uint16_t address) {
+    if (assembler->label_count == assembler->label_capacity) {
+        int capacity = assembler->label_capacity ? assembler->label_capacity * 2 : 256;
+        label_t* labels = arena_grow(&assembler->arena, assembler->labels,
+                                     (size_t)assembler->label_capacity * sizeof(label_t),
+                                     (size_t)capacity * sizeof(label_t));
+        if (!labels) {
+            assembler_error(assembler, "Out of memory");
             return false;
         }
-        
-        assembler_emit_byte(assembler, reg);
-    } else if (strcmp(instruction, "JMP") == 0 || strcmp(instruction, "JSR") == 0) {
-        uint16_t address = assembler_parse_expression(assembler);
-        assembler_emit_byte(assembler, address & 0xFF);
-        assembler_emit_byte(assembler, (address >> 8) & 0xFF);
-    } else if (strcmp(instruction, "BEQ") == 0 || strcmp(instruction, "BNE") == 0 ||
-               strcmp(instruction, "BCS") == 0 || strcmp(instruction, "BCC") == 0 ||
-               strcmp(instruction, "BMI") == 0 || strcmp(instruction, "BPL") == 0 ||
-               strcmp(instruction, "BVS") == 0 || strcmp(instruction, "BVC") == 0) {
-        uint16_t address = assembler_parse_expression(assembler);
-        int16_t offset = address - (assembler->current_address + 1);
-        if (offset < -128 || offset > 127) {
-            assembler_error(assembler, "Branch offset out of range: %d", offset);
+        assembler->labels = labels;
+        assembler->label_capacity = capacity;
+    }
+    
+    uint32_t count = assembler->label_index.count;
+    name_slot_t* slot = assembler_add_name(assembler, &assembler->label_index, name, length);
+    if (!slot) {
+        return false;
+    }
+    if (assembler->label_index.count == count) {
+        assembler_error(assembler, "Duplicate label: %.*s (first defined on line %d)", (int)length, name,
+                        assembler->labels[slot->entry].line);
+        return false;
+    }
+    
+    label_t* label = &assembler->labels[slot->entry];
+    assembler->label_count = assembler->label_index.count;
+    label->name = slot->name;
+    label->address = address;
+    label->defined = true;
+    label->line = assembler->line_number;
+    label->section = assembler->section_count ? assembler->section_count - 1 : 0;
+    assembler->fallthrough = -1;
+    
+    return true;
+}
+
+// Add label
+bool assembler_add_label(assembler_t* assembler, const char* name, uint16_t address) {
+    return assembler_define_label(assembler, name, strlen(name), address);
+}
+
+// Add symbol
+bool assembler_add_symbol(assembler_t* assembler, const char* name, uint16_t value) {
+    if (assembler->symbol_count == assembler->symbol_capacity) {
+        int capacity = assembler->symbol_capacity ? assembler->symbol_capacity * 2 : 256;
+        symbol_t* symbols = arena_grow(&assembler->arena, assembler->symbols,
+                                       (size_t)assembler->symbol_capacity * sizeof(symbol_t),
+                                       (size_t)capacity * sizeof(symbol_t));
+        if (!symbols) {
+            assembler_error(assembler, "Out of memory");
             return false;
         }
-        assembler_emit_byte(assembler, offset & 0xFF);
+        assembler->symbols = symbols;
+        assembler->symbol_capacity = capacity;
     }
     
+    name_slot_t* slot = assembler_add_name(assembler, &assembler->symbol_index, name, strlen(name));
+    if (!slot) {
+        return false;
+    }
+    
+    symbol_t* symbol = &assembler->symbols[slot->entry];
+    assembler->symbol_count = assembler->symbol_index.count;
+    symbol->name = slot->name;
+    symbol->value = value;
+    symbol->defined = true;
+    
     return true;
 }
 
-// Parse expression
-uint16_t assembler_parse_expression(assembler_t* assembler) {
-    return assembler_parse_term(assembler);
+// Find label
+label_t* assembler_find_label(assembler_t* assembler, const char* name) {
+    name_slot_t* slot = assembler_index_find(&assembler->label_index, name, strlen(name));
+    return slot ? &assembler->labels[slot->entry] : NULL;
 }
 
-// Parse term
-uint16_t assembler_parse_term(assembler_t* assembler) {
-    uint16_t left = assembler_parse_factor(assembler);
-    
-    assembler_skip_whitespace(assembler);
-    
-    while (assembler->current_line[assembler->column_number] == '+' || 
-           assembler->current_line[assembler->column_number] == '-') {
-        char op = assembler->current_line[assembler->column_number++];
-        uint16_t right = assembler_parse_factor(assembler);
-        
-        if (op == '+') {
-            left += right;
-        } else {
-            left -= right;
-        }
-        
-        assembler_skip_whitespace(assembler);
-    }
-    
-    return left;
+// Find symbol
+symbol_t* assembler_find_symbol(assembler_t* assembler, const char* name) {
+    name_slot_t* slot = assembler_index_find(&assembler->symbol_index, name, strlen(name));
+    return slot ? &assembler->symbols[slot->entry] : NULL;
 }
 
-// Parse factor
-uint16_t assembler_parse_factor(assembler_t* assembler) {
-    assembler_skip_whitespace(assembler);
-    
-    if (assembler->current_line[assembler->column_number] == '(') {
-        assembler->column_number++;
-        uint16_t value = assembler_parse_expression(assembler);
-        if (assembler->current_line[assembler->column_number] == ')') {
-            assembler->column_number++;
-        }
-        return value;
-    }
-    
-    if (assembler->current_line[assembler->column_number] == '#') {
-        assembler->column_number++;
-        return assembler_parse_number_literal(assembler);
-    }
-    
-    if (isdigit(assembler->current_line[assembler->column_number]) || 
-        assembler->current_line[assembler->column_number] == '$' ||
-        assembler->current_line[assembler->column_number] == '%') {
-        return assembler_parse_number_literal(assembler);
+// Forget every label, keeping symbols
+void assembler_reset_labels(assembler_t* assembler) {
+    if (assembler->label_index.slots) {
+        memset(assembler->label_index.slots, 0, assembler->label_index.capacity * sizeof(name_slot_t));
     }
+    assembler->label_index.count = 0;
+    assembler->label_count = 0;
+}
+
+// Evaluate an expression held in text. Errors are reported against the
+// current line number.
+bool assembler_evaluate(assembler_t* assembler, const char* text, size_t length, uint16_t* value) {
+    bool failed = assembler->error_occurred;
+    bool resolving = assembler->resolving;
+    assembler->error_occurred = false;
+    assembler->resolving = true;
+    assembler->tokens = NULL;
+    assembler->cursor = text;
+    assembler->line_start = text;
+    assembler->source_end = text + length;
+    assembler->current_token.type = TOKEN_EOF;
+    assembler_next_token(assembler);
     
-    if (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-        return assembler_parse_identifier(assembler);
+    *value = assembler_parse_expression(assembler);
+    token_t* token = &assembler->current_token;
+    if (!assembler->error_occurred && token->type != TOKEN_EOF) {
+        assembler_error(assembler, "Unexpected '%.*s'", (int)token->length, token->text);
     }
     
-    assembler_error(assembler, "Expected number or identifier");
-    return 0;
+    bool evaluated = !assembler->error_occurred;
+    assembler->error_occurred = assembler->error_occurred || failed;
+    assembler->resolving = resolving;
+    return evaluated;
 }
 
-// Parse number literal
-uint16_t assembler_parse_number_literal(assembler_t* assembler) {
-    char number_str[32];
-    int i = 0;
-    
-    if (assembler->current_line[assembler->column_number] == '$') {
-        // Hexadecimal
-        assembler->column_number++;
-        while (isxdigit(assembler->current_line[assembler->column_number])) {
-            if (i >= 31) {
-                assembler_error(assembler, "Number too long");
-                return 0;
-            }
-            number_str[i++] = assembler->current_line[assembler->column_number++];
-        }
-        number_str[i] = '\0';
-        return strtol(number_str, NULL, 16);
-    } else if (assembler->current_line[assembler->column_number] == '%') {
-        // Binary
-        assembler->column_number++;
-        while (assembler->current_line[assembler->column_number] == '0' || 
-               assembler->current_line[assembler->column_number] == '1') {
-            if (i >= 31) {
-                assembler_error(assembler, "Number too long");
-                return 0;
-            }
-            number_str[i++] = assembler->current_line[assembler->column_number++];
-        }
-        number_str[i] = '\0';
-        return strtol(number_str, NULL, 2);
-    } else {
-        // Decimal
-        while (isdigit(assembler->current_line[assembler->column_number])) {
-            if (i >= 31) {
-                assembler_error(assembler, "Number too long");
-                return 0;
-            }
-            number_str[i++] = assembler->current_line[assembler->column_number++];
+// Section holding an output position
+static int assembler_section_at(const assembler_t* assembler, uint32_t position) {
+    int low = 0;
+    int high = assembler->section_count - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (assembler->sections[middle].start <= position) {
+            low = middle;
+        } else {
+            high = middle - 1;
         }
-        number_str[i] = '\0';
-        return strtol(number_str, NULL, 10);
     }
+    return low;
 }
 
-// Parse identifier
-uint16_t assembler_parse_identifier(assembler_t* assembler) {
-    char identifier[MAX_LABEL_LENGTH];
-    int i = 0;
-    
-    while (assembler_is_identifier_char(assembler->current_line[assembler->column_number])) {
-        if (i >= MAX_LABEL_LENGTH - 1) {
-            assembler_error(assembler, "Identifier too long");
-            return 0;
+// Bytes the relaxed sites before an output position add: shifts[k] sums
+// the deltas of the sites before site k, whose operands are at offsets[k]
+static int32_t assembler_relax_shift(const uint32_t* offsets, const int32_t* shifts, int sites, uint32_t position) {
+    int low = 0;
+    int high = sites;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (offsets[middle] < position) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
-        identifier[i++] = assembler->current_line[assembler->column_number++];
-    }
-    identifier[i] = '\0';
-    
-    // Check if it's a label
-    label_t* label = assembler_find_label(assembler, identifier);
-    if (label) {
-        return label->address;
     }
-    
-    // Check if it's a symbol
-    symbol_t* symbol = assembler_find_symbol(assembler, identifier);
-    if (symbol) {
-        return symbol->value;
-    }
-    
-    assembler_error(assembler, "Undefined label or symbol: %s", identifier);
-    return 0;
+    return shifts[low];
 }
 
-// Add label
-bool assembler_add_label(assembler_t* assembler, const char* name, uint16_t address) {
-    if (assembler->label_count >= MAX_LABELS) {
-        assembler_error(assembler, "Too many labels");
+// Rewrite the output with the instruction sizes relaxation chose, moving
+// fixups and sections with the code
+static bool assembler_relax_output(assembler_t* assembler, const uint32_t* offsets, const int32_t* shifts, int sites) {
+    uint32_t size = assembler->output_size + shifts[sites];
+    if (size > ASSEMBLER_OUTPUT_SIZE) {
+        assembler_error(assembler, "Output larger than 64 KiB");
+        return false;
+    }
+    uint8_t* output = arena_alloc(&assembler->arena, ASSEMBLER_OUTPUT_SIZE);
+    if (!output) {
+        assembler_error(assembler, "Out of memory");
         return false;
     }
     
-    label_t* label = &assembler->labels[assembler->label_count++];
-    strncpy(label->name, name, MAX_LABEL_LENGTH - 1);
-    label->name[MAX_LABEL_LENGTH - 1] = '\0';
-    label->address = address;
-    label->defined = true;
-    label->line = assembler->line_number;
+    const uint8_t* input = assembler->output;
+    uint32_t copied = 0;
+    int32_t moved = 0;              // Bytes added before the current fixup
+    int32_t section_moved = 0;      // Bytes added before its section
+    int section = 0;
+    for (int i = 0; i < assembler->fixup_count; i++) {
+        fixup_t* fixup = &assembler->fixups[i];
+        while (section + 1 < assembler->section_count && assembler->sections[section + 1].start <= fixup->offset) {
+            section++;
+            section_moved = moved;
+        }
+        fixup->resolved = false;
+        if (fixup->relax == RELAX_NONE) {
+            fixup->offset += moved;
+            fixup->base += moved - section_moved;
+            continue;
+        }
+        
+        // Copy up to the instruction, then write it in its chosen form
+        uint32_t at = fixup->offset - 1;
+        memcpy(output + copied + moved, input + copied, at - copied);
+        copied = at + 1 + fixup->width;
+        uint8_t* out = output + at + moved;
+        uint16_t address = fixup->base - fixup->width - 1 + (moved - section_moved);
+        if (fixup->relax == RELAX_BRANCH && fixup->delta > 0) {
+            out[0] = input[at] ^ 1;     // Branch pairs differ in the low bit
+            out[1] = 3;
+            out[2] = OP_JMP;
+            out[3] = out[4] = 0;
+            fixup->offset = at + moved + 3;
+            fixup->width = 2;
+            fixup->relative = false;
+            fixup->base = address + 5;
+        } else if (fixup->relax == RELAX_JUMP && fixup->delta < 0) {
+            out[0] = fixup->condition ^ 1;
+            out[1] = 0;
+            fixup->offset = at + moved + 1;
+            fixup->width = 1;
+            fixup->relative = true;
+            fixup->base = address + 2;
+        } else {
+            memcpy(out, input + at, 1 + fixup->width);
+            fixup->offset = at + moved + 1;
+            fixup->base = address + 1 + fixup->width;
+        }
+        moved += fixup->delta;
+    }
+    memcpy(output + copied + moved, input + copied, assembler->output_size - copied);
     
+    for (int i = 0; i < assembler->line_count; i++) {
+        assembler->lines[i].offset += assembler_relax_shift(offsets, shifts, sites, assembler->lines[i].offset);
+    }
+    const section_t* last = &assembler->sections[assembler->section_count - 1];
+    assembler->current_address += moved - assembler_relax_shift(offsets, shifts, sites, last->start);
+    for (int i = 0; i < assembler->section_count; i++) {
+        assembler->sections[i].start += assembler_relax_shift(offsets, shifts, sites, assembler->sections[i].start);
+    }
+    assembler->output = output;
+    assembler->output_size = size;
     return true;
 }
 
-// Find label
-label_t* assembler_find_label(assembler_t* assembler, const char* name) {
-    for (int i = 0; i < assembler->label_count; i++) {
-        if (strcmp(assembler->labels[i].name, name) == 0) {
-            return &assembler->labels[i];
+// Branch relaxation. Every branch, and every JMP only the fall-through of
+// a branch reaches, is a site whose size is chosen here: a branch out of
+// range becomes the inverse branch over a JMP (5 bytes), a JMP in range
+// becomes the inverse of the branch before it (2 bytes). Sites start in
+// the short form and only ever grow, so repeating until nothing changes
+// ends. Code then moves within its section, labels with it, and every
+// fixup is patched again.
+static bool assembler_relax(assembler_t* assembler) {
+    fixup_t* fixups = assembler->fixups;
+    int sites = 0;
+    for (int i = 0; i < assembler->fixup_count; i++) {
+        fixups[i].delta = fixups[i].relax == RELAX_JUMP ? -1 : 0;
+        sites += fixups[i].relax != RELAX_NONE;
+    }
+    if (sites == 0) {
+        return true;
+    }
+    
+    arena_t* arena = &assembler->arena;
+    int* site_fixups = arena_alloc(arena, sites * sizeof(int));
+    uint32_t* offsets = arena_alloc(arena, sites * sizeof(uint32_t));
+    int32_t* shifts = arena_alloc(arena, (sites + 1) * sizeof(int32_t));
+    uint16_t* addresses = arena_alloc(arena, (assembler->label_count + 1) * sizeof(uint16_t));
+    if (!site_fixups || !offsets || !shifts || !addresses) {
+        assembler_error(assembler, "Out of memory");
+        return false;
+    }
+    for (int i = 0, site = 0; i < assembler->fixup_count; i++) {
+        if (fixups[i].relax != RELAX_NONE) {
+            site_fixups[site] = i;
+            offsets[site++] = fixups[i].offset;
         }
     }
-    return NULL;
-}
-
-// Find symbol
-symbol_t* assembler_find_symbol(assembler_t* assembler, const char* name) {
-    for (int i = 0; i < assembler->symbol_count; i++) {
-        if (strcmp(assembler->symbols[i].name, name) == 0) {
-            return &assembler->symbols[i];
+    for (int i = 0; i < assembler->label_count; i++) {
+        addresses[i] = assembler->labels[i].address;
+    }
+    
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        shifts[0] = 0;
+        for (int site = 0; site < sites; site++) {
+            shifts[site + 1] = shifts[site] + fixups[site_fixups[site]].delta;
+        }
+        
+        // Labels move by what the sites before them in their section add
+        for (int i = 0; i < assembler->label_count; i++) {
+            label_t* label = &assembler->labels[i];
+            const section_t* section = &assembler->sections[label->section];
+            uint32_t position = section->start + (uint16_t)(addresses[i] - section->address);
+            label->address = addresses[i] + assembler_relax_shift(offsets, shifts, sites, position) -
+                             assembler_relax_shift(offsets, shifts, sites, section->start);
+        }
+        
+        // Lengthen the short sites whose target is out of reach
+        for (int site = 0; site < sites; site++) {
+            fixup_t* fixup = &fixups[site_fixups[site]];
+            if ((fixup->relax == RELAX_BRANCH && fixup->delta > 0) || (fixup->relax == RELAX_JUMP && fixup->delta == 0)) {
+                continue;
+            }
+            uint16_t target;
+            assembler->line_number = fixup->line;
+            if (!assembler_evaluate(assembler, fixup->expression, fixup->length, &target)) {
+                return false;
+            }
+            const section_t* section = &assembler->sections[assembler_section_at(assembler, fixup->offset - 1)];
+            uint16_t next = fixup->base - fixup->width + 1 + shifts[site] -
+                            assembler_relax_shift(offsets, shifts, sites, section->start);
+            int offset = (int16_t)(target - next);
+            if (offset < -128 || offset > 127) {
+                fixup->delta = fixup->relax == RELAX_BRANCH ? 3 : 0;
+                changed = true;
+            }
         }
     }
-    return NULL;
+    
+    // Nothing to rewrite while every site is as emitted
+    bool moved = false;
+    for (int site = 0; site < sites && !moved; site++) {
+        moved = fixups[site_fixups[site]].delta != 0;
+    }
+    return !moved || assembler_relax_output(assembler, offsets, shifts, sites);
 }
 
-// Resolve labels
+// Patch every forward reference now that all labels are known
 bool assembler_resolve_labels(assembler_t* assembler) {
-    // TODO: Implement label resolution
-    return true;
+    for (int i = 0; i < assembler->fixup_count; i++) {
+        fixup_t* fixup = &assembler->fixups[i];
+        if (fixup->resolved) {
+            continue;
+        }
+        assembler->line_number = fixup->line;
+        uint16_t value;
+        if (!assembler_evaluate(assembler, fixup->expression, fixup->length, &value)) {
+            continue;
+        }
+        if (fixup->relative) {
+            int offset = (int16_t)(value - fixup->base);
+            if (offset < -128 || offset > 127) {
+                assembler_error(assembler, "Branch offset out of range: %d", offset);
+                continue;
+            }
+            value = (uint16_t)offset;
+        }
+        
+        assembler->output[fixup->offset] = value & 0xFF;
+        if (fixup->width == 2) {
+            assembler->output[fixup->offset + 1] = (value >> 8) & 0xFF;
+        }
+    }
+    
+    return !assembler->error_occurred;
 }
 
 // Emit byte
 void assembler_emit_byte(assembler_t* assembler, uint8_t value) {
-    if (assembler->output_size < 65536) {
+    if (assembler->output_size < ASSEMBLER_OUTPUT_SIZE) {
         assembler->output[assembler->output_size++] = value;
         assembler->current_address++;
+    } else if (!assembler->error_occurred) {
+        assembler_error(assembler, "Output larger than 64 KiB");
+    }
+}
+
+// Emit an operand expression of one or two bytes. A branch offset counts
+// from the address after it. An expression naming a label that is not
+// defined yet is emitted as zero and recorded as a fixup, which keeps a
+// slice of the source to evaluate again. With branch relaxation, branches
+// and operands naming any label are recorded too, as code may move; a
+// branch out of range is left for assembler_relax to lengthen.
+bool assembler_emit_operand(assembler_t* assembler, uint8_t width, bool relative) {
+    const char* start = assembler->current_token.text;
+    assembler->unresolved = false;
+    assembler->label_used = false;
+    uint16_t value = assembler_parse_expression(assembler);
+    uint16_t base = assembler->current_address + width;
+    if (assembler->error_occurred) {
+        return false;
+    }
+    
+    bool relaxing = assembler->relax && !assembler->relocatable;
+    bool resolved = !assembler->unresolved;
+    if (resolved && relative) {
+        int offset = (int16_t)(value - base);
+        resolved = offset >= -128 && offset <= 127;
+        if (!resolved && !relaxing) {
+            assembler_error(assembler, "Branch offset out of range: %d", offset);
+            return false;
+        }
+        value = (uint16_t)offset;
+    }
+    
+    if (!resolved || (relaxing && (relative || assembler->label_used))) {
+        if (assembler->fixup_count == assembler->fixup_capacity) {
+            int capacity = assembler->fixup_capacity ? assembler->fixup_capacity * 2 : 256;
+            fixup_t* fixups = arena_grow(&assembler->arena, assembler->fixups,
+                                         (size_t)assembler->fixup_capacity * sizeof(fixup_t),
+                                         (size_t)capacity * sizeof(fixup_t));
+            if (!fixups) {
+                assembler_error(assembler, "Out of memory");
+                return false;
+            }
+            assembler->fixups = fixups;
+            assembler->fixup_capacity = capacity;
+        }
+        
+        // Relocatable output outlives the source, so it keeps a copy
+        fixup_t* fixup = &assembler->fixups[assembler->fixup_count];
+        fixup->length = assembler->current_token.text - start;
+        fixup->expression = assembler->relocatable ? assembler_intern(assembler, start, fixup->length) : start;
+        if (!fixup->expression) {
+            assembler_error(assembler, "Out of memory");
+            return false;
+        }
+        assembler->fixup_count++;
+        fixup->offset = assembler->output_size;
+        fixup->base = base;
+        fixup->width = width;
+        fixup->relative = relative;
+        fixup->resolved = resolved;
+        fixup->relax = relaxing && relative ? RELAX_BRANCH : RELAX_NONE;
+        fixup->condition = 0;
+        fixup->delta = 0;
+        fixup->line = assembler->line_number;
+    }
+    if (!resolved) {
+        value = 0;
     }
+    
+    assembler_emit_byte(assembler, value & 0xFF);
+    if (width == 2) {
+        assembler_emit_byte(assembler, (value >> 8) & 0xFF);
+    }
+    return true;
 }
 
 // Emit word
@@ -524,14 +1891,6 @@ void assembler_emit_string(assembler_t* assembler, const char* str) {
     }
 }
 
-// Skip whitespace
-void assembler_skip_whitespace(assembler_t* assembler) {
-    while (assembler->current_line[assembler->column_number] == ' ' || 
-           assembler->current_line[assembler->column_number] == '\t') {
-        assembler->column_number++;
-    }
-}
-
 // Check if character is identifier character
 bool assembler_is_identifier_char(char c) {
     return isalnum(c) || c == '_';
@@ -553,54 +1912,151 @@ uint16_t assembler_parse_number(const char* str) {
     }
 }
 
+// Instruction and register names are looked up with a perfect hash: the
+// name's characters packed into a word (so at most four), multiplied by a
+// constant chosen so that no two names share a slot, top bits as the
+// index. A lookup is one multiply and one compare, with no string
+// comparisons; the tables are laid out at compile time.
+#define NAME_KEY(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+#define NAME_HASH_MULTIPLIER 0xA3BEBA43u
+#define NAME_SLOT(key, bits) ((uint32_t)((uint32_t)(key) * NAME_HASH_MULTIPLIER) >> (32 - (bits)))
+#define MNEMONIC_BITS 7
+#define REGISTER_BITS 3
+
+#define MNEMONIC(a, b, c, d, opcode, operand) \
+    [NAME_SLOT(NAME_KEY(a, b, c, d), MNEMONIC_BITS)] = {NAME_KEY(a, b, c, d), opcode, operand}
+#define REGISTER(a, b, c, d, reg) \
+    [NAME_SLOT(NAME_KEY(a, b, c, d), REGISTER_BITS)] = {NAME_KEY(a, b, c, d), reg}
+
+// Operand syntax follows the first addressing mode of each opcode in the
+// ISA's instruction table, which is the one the CPU decodes
+static const mnemonic_t mnemonic_table[1 << MNEMONIC_BITS] = {
+    // Load/Store
+    MNEMONIC('L', 'D', 'I', 0, OP_LDI, OPERAND_IMMEDIATE),
+    MNEMONIC('L', 'D', 'A', 0, OP_LDA, OPERAND_ABSOLUTE),
+    MNEMONIC('S', 'T', 'A', 0, OP_STA, OPERAND_ABSOLUTE),
+    MNEMONIC('M', 'O', 'V', 0, OP_MOV, OPERAND_REGISTER),
+    
+    // Arithmetic
+    MNEMONIC('A', 'D', 'D', 0, OP_ADD, OPERAND_IMMEDIATE),
+    MNEMONIC('S', 'U', 'B', 0, OP_SUB, OPERAND_IMMEDIATE),
+    MNEMONIC('A', 'D', 'C', 0, OP_ADC, OPERAND_IMMEDIATE),
+    MNEMONIC('S', 'B', 'C', 0, OP_SBC, OPERAND_IMMEDIATE),
+    MNEMONIC('C', 'M', 'P', 0, OP_CMP, OPERAND_IMMEDIATE),
+    MNEMONIC('I', 'N', 'C', 0, OP_INC, OPERAND_REGISTER),
+    MNEMONIC('D', 'E', 'C', 0, OP_DEC, OPERAND_REGISTER),
+    
+    // Logical
+    MNEMONIC('A', 'N', 'D', 0, OP_AND, OPERAND_IMMEDIATE),
+    MNEMONIC('O', 'R', 0, 0, OP_OR, OPERAND_IMMEDIATE),
+    MNEMONIC('X', 'O', 'R', 0, OP_XOR, OPERAND_IMMEDIATE),
+    
+    // Shift/Rotate
+    MNEMONIC('S', 'H', 'L', 0, OP_SHL, OPERAND_REGISTER),
+    MNEMONIC('S', 'H', 'R', 0, OP_SHR, OPERAND_REGISTER),
+    MNEMONIC('R', 'O', 'L', 0, OP_ROL, OPERAND_REGISTER),
+    MNEMONIC('R', 'O', 'R', 0, OP_ROR, OPERAND_REGISTER),
+    
+    // Jump/Call
+    MNEMONIC('J', 'M', 'P', 0, OP_JMP, OPERAND_ABSOLUTE),
+    MNEMONIC('J', 'S', 'R', 0, OP_JSR, OPERAND_ABSOLUTE),
+    MNEMONIC('R', 'T', 'S', 0, OP_RTS, OPERAND_NONE),
+    
+    // Branch
+    MNEMONIC('B', 'E', 'Q', 0, OP_BEQ, OPERAND_RELATIVE),
+    MNEMONIC('B', 'N', 'E', 0, OP_BNE, OPERAND_RELATIVE),
+    MNEMONIC('B', 'C', 'S', 0, OP_BCS, OPERAND_RELATIVE),
+    MNEMONIC('B', 'C', 'C', 0, OP_BCC, OPERAND_RELATIVE),
+    MNEMONIC('B', 'M', 'I', 0, OP_BMI, OPERAND_RELATIVE),
+    MNEMONIC('B', 'P', 'L', 0, OP_BPL, OPERAND_RELATIVE),
+    MNEMONIC('B', 'V', 'S', 0, OP_BVS, OPERAND_RELATIVE),
+    MNEMONIC('B', 'V', 'C', 0, OP_BVC, OPERAND_RELATIVE),
+    
+    // Stack
+    MNEMONIC('P', 'H', 'A', 0, OP_PHA, OPERAND_NONE),
+    MNEMONIC('P', 'L', 'A', 0, OP_PLA, OPERAND_NONE),
+    MNEMONIC('P', 'H', 'P', 0, OP_PHP, OPERAND_NONE),
+    MNEMONIC('P', 'L', 'P', 0, OP_PLP, OPERAND_NONE),
+    MNEMONIC('P', 'U', 'S', 'H', OP_PUSH, OPERAND_REGISTER),
+    MNEMONIC('P', 'O', 'P', 0, OP_POP, OPERAND_REGISTER),
+    
+    // System
+    MNEMONIC('S', 'E', 'I', 0, OP_SEI, OPERAND_NONE),
+    MNEMONIC('C', 'L', 'I', 0, OP_CLI, OPERAND_NONE),
+    MNEMONIC('N', 'O', 'P', 0, OP_NOP, OPERAND_NONE),
+    MNEMONIC('H', 'L', 'T', 0, OP_HLT, OPERAND_NONE),
+    
+    // Atomic read-modify-write
+    MNEMONIC('T', 'A', 'S', 0, OP_TAS, OPERAND_ABSOLUTE),
+    MNEMONIC('C', 'A', 'S', 0, OP_CAS, OPERAND_ABSOLUTE)
+};
+
+static const struct {
+    uint32_t key;
+    register_t reg;
+} register_table[1 << REGISTER_BITS] = {
+    REGISTER('A', 0, 0, 0, REG_A),
+    REGISTER('B', 0, 0, 0, REG_B),
+    REGISTER('C', 0, 0, 0, REG_C),
+    REGISTER('D', 0, 0, 0, REG_D),
+    REGISTER('X', 0, 0, 0, REG_X),
+    REGISTER('Y', 0, 0, 0, REG_Y),
+    REGISTER('S', 'P', 0, 0, REG_SP),
+    REGISTER('P', 'C', 0, 0, REG_PC)
+};
+
+// Pack a name into a lookup key; 0 if it is empty or too long
+static uint32_t assembler_name_key(const char* name, size_t length) {
+    if (length == 0 || length > 4) {
+        return 0;
+    }
+    
+    uint32_t key = 0;
+    for (size_t i = 0; i < length; i++) {
+        key |= (uint32_t)(uint8_t)name[i] << (8 * i);
+    }
+    return key;
+}
+
+// Look up an instruction name
+const mnemonic_t* assembler_lookup_mnemonic(const char* name, size_t length) {
+    uint32_t key = assembler_name_key(name, length);
+    const mnemonic_t* entry = &mnemonic_table[NAME_SLOT(key, MNEMONIC_BITS)];
+    return key != 0 && entry->key == key ? entry : NULL;
+}
+
+// Look up a register name
+bool assembler_lookup_register(const char* name, size_t length, register_t* reg) {
+    uint32_t key = assembler_name_key(name, length);
+    uint32_t slot = NAME_SLOT(key, REGISTER_BITS);
+    if (key == 0 || register_table[slot].key != key) {
+        return false;
+    }
+    *reg = register_table[slot].reg;
+    return true;
+}
+
 // Check if string is register name
 bool assembler_is_register_name(const char* name) {
-    return strcmp(name, "A") == 0 || strcmp(name, "B") == 0 || 
-           strcmp(name, "C") == 0 || strcmp(name, "D") == 0 ||
-           strcmp(name, "X") == 0 || strcmp(name, "Y") == 0 ||
-           strcmp(name, "SP") == 0 || strcmp(name, "PC") == 0;
+    register_t reg;
+    return assembler_lookup_register(name, strlen(name), &reg);
 }
 
 // Get register number
 register_t assembler_get_register(const char* name) {
-    if (strcmp(name, "A") == 0) return REG_A;
-    if (strcmp(name, "B") == 0) return REG_B;
-    if (strcmp(name, "C") == 0) return REG_C;
-    if (strcmp(name, "D") == 0) return REG_D;
-    if (strcmp(name, "X") == 0) return REG_X;
-    if (strcmp(name, "Y") == 0) return REG_Y;
-    if (strcmp(name, "SP") == 0) return REG_SP;
-    if (strcmp(name, "PC") == 0) return REG_PC;
-    return 0;
+    register_t reg;
+    return assembler_lookup_register(name, strlen(name), &reg) ? reg : 0;
 }
 
 // Check if string is instruction name
 bool assembler_is_instruction_name(const char* name) {
-    return strcmp(name, "LDI") == 0 || strcmp(name, "LDA") == 0 || 
-           strcmp(name, "STA") == 0 || strcmp(name, "MOV") == 0 ||
-           strcmp(name, "ADD") == 0 || strcmp(name, "SUB") == 0 ||
-           strcmp(name, "JMP") == 0 || strcmp(name, "JSR") == 0 ||
-           strcmp(name, "RTS") == 0 || strcmp(name, "BEQ") == 0 ||
-           strcmp(name, "BNE") == 0 || strcmp(name, "NOP") == 0 ||
-           strcmp(name, "HLT") == 0;
+    return assembler_lookup_mnemonic(name, strlen(name)) != NULL;
 }
 
 // Get opcode
 opcode_t assembler_get_opcode(const char* name) {
-    if (strcmp(name, "LDI") == 0) return OP_LDI;
-    if (strcmp(name, "LDA") == 0) return OP_LDA;
-    if (strcmp(name, "STA") == 0) return OP_STA;
-    if (strcmp(name, "MOV") == 0) return OP_MOV;
-    if (strcmp(name, "ADD") == 0) return OP_ADD;
-    if (strcmp(name, "SUB") == 0) return OP_SUB;
-    if (strcmp(name, "JMP") == 0) return OP_JMP;
-    if (strcmp(name, "JSR") == 0) return OP_JSR;
-    if (strcmp(name, "RTS") == 0) return OP_RTS;
-    if (strcmp(name, "BEQ") == 0) return OP_BEQ;
-    if (strcmp(name, "BNE") == 0) return OP_BNE;
-    if (strcmp(name, "NOP") == 0) return OP_NOP;
-    if (strcmp(name, "HLT") == 0) return OP_HLT;
-    return 0;
+    const mnemonic_t* mnemonic = assembler_lookup_mnemonic(name, strlen(name));
+    return mnemonic ? mnemonic->opcode : 0;
 }
 
 // Get addressing mode
@@ -650,17 +2106,356 @@ bool assembler_save_binary(assembler_t* assembler, const char* filename) {
     return written == assembler->output_size;
 }
 
-// Save listing
+// Address of an output position in a section
+static uint16_t assembler_address_at(const assembler_t* assembler, int section, uint32_t position) {
+    const section_t* s = &assembler->sections[section];
+    return (uint16_t)(s->address + (position - s->start));
+}
+
+// Output position after a listed line's bytes
+static uint32_t assembler_line_end(const assembler_t* assembler, int index) {
+    return index + 1 < assembler->line_count ? assembler->lines[index + 1].offset : assembler->output_size;
+}
+
+// Cycles the instructions of a listed line cost
+static uint32_t assembler_line_cycles(const assembler_t* assembler, int index, const uint8_t* cycles) {
+    uint32_t total = 0;
+    uint32_t end = assembler_line_end(assembler, index);
+    for (uint32_t p = assembler->lines[index].offset; p < end; p += isa_get_length(assembler->output[p])) {
+        total += cycles[assembler->output[p]];
+    }
+    return total;
+}
+
+// Instruction of the listed code, for cycle estimates
+typedef struct {
+    uint32_t offset;
+    uint16_t address;
+    int section;
+} listed_instruction_t;
+
+// Sum the cycles of the instructions from first on, in its section and
+// below an address
+static uint32_t assembler_sum_cycles(const assembler_t* assembler, const listed_instruction_t* instructions, int count,
+                                     int first, uint16_t end, const uint8_t* cycles) {
+    uint32_t total = 0;
+    int section = instructions[first].section;
+    for (int i = first; i < count && instructions[i].section == section && instructions[i].address < end; i++) {
+        total += cycles[assembler->output[instructions[i].offset]];
+    }
+    return total;
+}
+
+// Label at an address in a section, NULL if none
+static const char* assembler_label_at(const assembler_t* assembler, int section, uint16_t address) {
+    for (int i = 0; i < assembler->label_count; i++) {
+        if (assembler->labels[i].section == section && assembler->labels[i].address == address) {
+            return assembler->labels[i].name;
+        }
+    }
+    return NULL;
+}
+
+// Cycle estimates
+cycle_block_t* assembler_cycle_blocks(assembler_t* assembler, int* count) {
+    const uint8_t* cycles = assembler->cycle_table ? assembler->cycle_table : isa_default_cycles();
+    *count = 0;
+    
+    // Decode the listed code
+    int capacity = 0;
+    for (int i = 0; i < assembler->line_count; i++) {
+        if (assembler->lines[i].code) {
+            capacity += (int)(assembler_line_end(assembler, i) - assembler->lines[i].offset) / 2;
+        }
+    }
+    listed_instruction_t* instructions = arena_alloc(&assembler->arena, (capacity + 1) * sizeof(listed_instruction_t));
+    cycle_block_t* blocks = arena_alloc(&assembler->arena, (assembler->label_count + capacity + 1) * sizeof(cycle_block_t));
+    if (!instructions || !blocks) {
+        return NULL;
+    }
+    int instruction_count = 0;
+    for (int i = 0; i < assembler->line_count; i++) {
+        const listing_line_t* line = &assembler->lines[i];
+        uint32_t end = assembler_line_end(assembler, i);
+        for (uint32_t p = line->offset; line->code && p < end; p += isa_get_length(assembler->output[p])) {
+            listed_instruction_t* instruction = &instructions[instruction_count++];
+            instruction->offset = p;
+            instruction->section = assembler_section_at(assembler, p);
+            instruction->address = assembler_address_at(assembler, instruction->section, p);
+        }
+    }
+    
+    // A block from each label to the next label in its section; labels at
+    // one address share a block
+    for (int i = 0; i < assembler->label_count; i++) {
+        const label_t* label = &assembler->labels[i];
+        if (i > 0 && label->section == assembler->labels[i - 1].section &&
+            label->address == assembler->labels[i - 1].address) {
+            continue;
+        }
+        uint16_t end = 0xFFFF;
+        for (int j = i + 1; j < assembler->label_count; j++) {
+            if (assembler->labels[j].section == label->section && assembler->labels[j].address > label->address) {
+                end = assembler->labels[j].address;
+                break;
+            }
+        }
+        int first = 0;
+        while (first < instruction_count && !(instructions[first].section == label->section &&
+                                               instructions[first].address >= label->address)) {
+            first++;
+        }
+        if (first == instruction_count || instructions[first].address >= end) {
+            continue;
+        }
+        
+        cycle_block_t* block = &blocks[(*count)++];
+        memset(block, 0, sizeof(cycle_block_t));
+        block->name = label->name;
+        block->start = label->address;
+        block->cycles = assembler_sum_cycles(assembler, instructions, instruction_count, first, end, cycles);
+        int last = first;
+        while (last + 1 < instruction_count && instructions[last + 1].section == label->section &&
+               instructions[last + 1].address < end) {
+            last++;
+        }
+        block->end = instructions[last].address + isa_get_length(assembler->output[instructions[last].offset]);
+    }
+    
+    // A loop from the target of each backward branch or JMP to it
+    for (int i = 0; i < instruction_count; i++) {
+        const uint8_t* code = &assembler->output[instructions[i].offset];
+        uint16_t address = instructions[i].address;
+        uint16_t target;
+        if (code[0] >= OP_BEQ && code[0] <= OP_BVC) {
+            target = (uint16_t)(address + 2 + (int8_t)code[1]);
+        } else if (code[0] == OP_JMP) {
+            target = code[1] | (code[2] << 8);
+        } else {
+            continue;
+        }
+        int first = i;
+        while (first > 0 && instructions[first - 1].section == instructions[i].section &&
+               instructions[first - 1].address >= target) {
+            first--;
+        }
+        if (target > address || instructions[first].address != target) {
+            continue;
+        }
+        
+        cycle_block_t* block = &blocks[(*count)++];
+        memset(block, 0, sizeof(cycle_block_t));
+        block->name = assembler_label_at(assembler, instructions[i].section, target);
+        block->start = target;
+        block->end = address + isa_get_length(code[0]);
+        block->cycles = assembler_sum_cycles(assembler, instructions, instruction_count, first, block->end, cycles);
+        block->loop = true;
+        
+        // Counted down in A: LDI #n before the loop, DEC A; BNE at its end
+        // (relaxed: DEC A; BEQ +3; JMP)
+        int dec = code[0] == OP_BNE ? i - 1 : i - 2;
+        const uint8_t* skip = i > 0 ? &assembler->output[instructions[i - 1].offset] : NULL;
+        bool counted = dec >= first && (code[0] == OP_BNE || (code[0] == OP_JMP && skip[0] == OP_BEQ && skip[1] == 3));
+        const uint8_t* decrement = counted ? &assembler->output[instructions[dec].offset] : NULL;
+        const uint8_t* load = first > 0 ? &assembler->output[instructions[first - 1].offset] : NULL;
+        if (decrement && decrement[0] == OP_DEC && decrement[1] == REG_A && load && load[0] == OP_LDI &&
+            instructions[first - 1].section == instructions[i].section) {
+            block->iterations = load[1] ? load[1] : 256;
+        }
+    }
+    return blocks;
+}
+
+// Write one listing row per physical line of a listed line; the first
+// carries the address, the bytes (five a row) and the cycles
+static void assembler_write_listing_line(const assembler_t* assembler, FILE* file, int index, const uint8_t* cycles) {
+    const listing_line_t* line = &assembler->lines[index];
+    uint32_t position = line->offset;
+    uint32_t end = assembler_line_end(assembler, index);
+    const char* text = line->text;
+    const char* text_end = line->text + line->length;
+    int number = line->line;
+    
+    do {
+        const char* newline = memchr(text, '\n', text_end - text);
+        const char* eol = newline ? newline : text_end;
+        char bytes[16] = "";
+        for (int i = 0; i < 5 && position < end; i++, position++) {
+            snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", assembler->output[position]);
+        }
+        
+        fprintf(file, "%5d  ", number);
+        if (text == line->text && (line->code || line->offset < end)) {
+            fprintf(file, "%04X  ", assembler_address_at(assembler, line->section, line->offset));
+        } else {
+            fprintf(file, "      ");
+        }
+        fprintf(file, "%-15s", bytes);
+        if (text == line->text && line->code) {
+            fprintf(file, "%6u ", assembler_line_cycles(assembler, index, cycles));
+        } else {
+            fprintf(file, "       ");
+        }
+        fprintf(file, "%.*s\n", (int)(eol - text), text);
+        
+        text = newline ? newline + 1 : text_end;
+        number++;
+    } while (text < text_end);
+    
+    // Data past the first five bytes
+    while (position < end) {
+        uint16_t address = assembler_address_at(assembler, line->section, position);
+        char bytes[16] = "";
+        for (int i = 0; i < 5 && position < end; i++, position++) {
+            snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", assembler->output[position]);
+        }
+        fprintf(file, "       %04X  %s\n", address, bytes);
+    }
+}
+
+// Save listing: every source line with its address, bytes and cycles,
+// then the cycle estimates
 bool assembler_save_listing(assembler_t* assembler, const char* filename) {
     FILE* file = fopen(filename, "w");
     if (!file) {
         return false;
     }
     
-    // TODO: Generate listing file
     fprintf(file, "Assembler listing\n");
-    fprintf(file, "================\n\n");
+    fprintf(file, "================\n");
+    const uint8_t* cycles = assembler->cycle_table ? assembler->cycle_table : isa_default_cycles();
+    const char* current = NULL;
+    for (int i = 0; i < assembler->line_count; i++) {
+        const char* name = assembler->lines[i].filename ? assembler->lines[i].filename : "<string>";
+        if (!current || strcmp(current, name) != 0) {
+            fprintf(file, "\n%s:\n", name);
+            fprintf(file, " Line  Addr  Bytes          Cycles Source\n");
+            current = name;
+        }
+        assembler_write_listing_line(assembler, file, i, cycles);
+    }
+    
+    int count;
+    cycle_block_t* blocks = assembler_cycle_blocks(assembler, &count);
+    for (int loops = 0; loops < 2 && blocks; loops++) {
+        bool header = false;
+        for (int i = 0; i < count; i++) {
+            const cycle_block_t* block = &blocks[i];
+            if (block->loop != loops) {
+                continue;
+            }
+            if (!header) {
+                fprintf(file, loops ? "\nLoops (cycles per iteration)\n" : "\nBlocks (cycles once through)\n");
+                header = true;
+            }
+            fprintf(file, "  %04X-%04X  %-24s %6u", block->start, (uint16_t)(block->end - 1),
+                    block->name ? block->name : "", block->cycles);
+            if (block->iterations) {
+                fprintf(file, " x %u = %u", block->iterations, block->cycles * block->iterations);
+            }
+            fprintf(file, "\n");
+        }
+    }
     
+    bool written = !ferror(file);
     fclose(file);
-    return true;
+    return written;
+}
+
+// Weight of a block in the cycle report: a counted loop costs every
+// iteration
+static uint32_t assembler_block_weight(const cycle_block_t* block) {
+    return block->iterations ? block->cycles * block->iterations : block->cycles;
+}
+
+// Print the costliest blocks and loops
+void assembler_print_cycle_report(assembler_t* assembler, FILE* out, int count) {
+    int block_count;
+    cycle_block_t* blocks = assembler_cycle_blocks(assembler, &block_count);
+    if (!blocks) {
+        fprintf(out, "Out of memory\n");
+        return;
+    }
+    
+    // Selection of the costliest: the report is short
+    fprintf(out, "Costliest blocks (cycles):\n");
+    for (int shown = 0; shown < count && shown < block_count; shown++) {
+        int best = shown;
+        for (int i = shown + 1; i < block_count; i++) {
+            if (assembler_block_weight(&blocks[i]) > assembler_block_weight(&blocks[best])) {
+                best = i;
+            }
+        }
+        cycle_block_t block = blocks[best];
+        blocks[best] = blocks[shown];
+        blocks[shown] = block;
+        
+        fprintf(out, "  %8u  %04X-%04X  %s %s", assembler_block_weight(&block), block.start,
+                (uint16_t)(block.end - 1), block.loop ? "loop " : "block", block.name ? block.name : "");
+        if (block.iterations) {
+            fprintf(out, " (%u x %u)", block.iterations, block.cycles);
+        } else if (block.loop) {
+            fprintf(out, " (per iteration)");
+        }
+        fprintf(out, "\n");
+    }
+}
+
+// Save relocatable output as an object file (see object.h)
+bool assembler_save_object(assembler_t* assembler, const char* filename) {
+    // Every .global name must be a label of this module
+    for (uint32_t i = 0; i < assembler->global_index.capacity; i++) {
+        const char* name = assembler->global_index.slots[i].name;
+        if (name && !assembler_find_label(assembler, name)) {
+            assembler_error(assembler, "Undefined global label: %s", name);
+            return false;
+        }
+    }
+    
+    object_t* object = object_create(assembler->filename ? assembler->filename : "<string>");
+    bool saved = object != NULL;
+    
+    for (int i = 0; saved && i < assembler->section_count; i++) {
+        const section_t* section = &assembler->sections[i];
+        uint32_t end = i + 1 < assembler->section_count ? assembler->sections[i + 1].start : assembler->output_size;
+        object_section_t* part = object_add_section(object, section->name, assembler->output + section->start,
+                                                    end - section->start);
+        saved = part != NULL;
+        if (saved) {
+            part->fixed = section->fixed;
+            part->address = section->address;
+        }
+    }
+    
+    // Offsets count from the start of their section
+    for (int i = 0; saved && i < assembler->label_count; i++) {
+        const label_t* label = &assembler->labels[i];
+        const section_t* section = &assembler->sections[label->section];
+        bool global = assembler_index_find(&assembler->global_index, label->name, strlen(label->name)) != NULL;
+        saved = object_add_symbol(object, label->name, label->section, label->address - section->address,
+                                  global) != NULL;
+    }
+    
+    // Fixups are in output order, so the section only ever moves on
+    int current = 0;
+    for (int i = 0; saved && i < assembler->fixup_count; i++) {
+        const fixup_t* fixup = &assembler->fixups[i];
+        while (current + 1 < assembler->section_count && fixup->offset >= assembler->sections[current + 1].start) {
+            current++;
+        }
+        const section_t* section = &assembler->sections[current];
+        object_relocation_t* relocation = object_add_relocation(object, current, fixup->expression, fixup->length);
+        saved = relocation != NULL;
+        if (saved) {
+            relocation->offset = fixup->offset - section->start;
+            relocation->base = fixup->base - section->address;
+            relocation->width = fixup->width;
+            relocation->relative = fixup->relative;
+            relocation->line = fixup->line;
+        }
+    }
+    
+    saved = saved && object_save(object, filename);
+    object_destroy(object);
+    return saved;
 }
@@ -2,15 +2,15 @@
 #define ASSEMBLER_H
 
 #include "isa.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 // Assembler configuration
-#define MAX_LABELS 1000
-#define MAX_LABEL_LENGTH 64
-#define MAX_LINE_LENGTH 256
-#define MAX_INCLUDES 10
+#define MAX_INCLUDES 32              // Nesting of includes and macro expansions
+#define MAX_MACRO_PARAMS 16
+#define ASSEMBLER_OUTPUT_SIZE 65536
 
 // Token types
 typedef enum {
@@ -26,53 +26,234 @@ typedef enum {
     TOKEN_HASH,
     TOKEN_DOT,
     TOKEN_NEWLINE,
-    TOKEN_UNKNOWN
+    TOKEN_UNKNOWN,
+    TOKEN_COLON,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN
 } token_type_t;
 
 // Token structure
 typedef struct {
     token_type_t type;
-    char* text;
-    uint16_t value;
+    const char* text;           // Slice of the source, not NUL-terminated
+    size_t length;              // (a string's text is inside its quotes)
+    uint16_t value;             // TOKEN_NUMBER
     int line;
     int column;
 } token_t;
 
 // Label structure
 typedef struct {
-    char name[MAX_LABEL_LENGTH];
+    const char* name;           // In the assembler's arena
     uint16_t address;
     bool defined;
     int line;
+    int section;                // Relocatable output: section it is in
 } label_t;
 
 // Symbol structure
 typedef struct {
-    char name[MAX_LABEL_LENGTH];
+    const char* name;           // In the assembler's arena
     uint16_t value;
     bool defined;
 } symbol_t;
 
+// Instruction whose size branch relaxation chooses (see assembler_relax)
+typedef enum {
+    RELAX_NONE = 0,
+    RELAX_BRANCH,               // Bxx; out of range: B!xx over a JMP
+    RELAX_JUMP                  // JMP only reached by a branch falling
+                                // through; in range: that branch inverted
+} relax_kind_t;
+
+// Reference to a label defined further on, patched once every label is
+// known (see assembler_resolve_labels). With relaxation, every branch and
+// every operand naming a label is one, as code may still move.
+typedef struct {
+    uint16_t offset;            // Output position of the operand
+    uint16_t base;              // Relative: address the offset counts from
+    uint8_t width;              // 1 or 2 bytes
+    bool relative;              // Branch offset instead of a value
+    bool resolved;              // Emitted already; patched again only if
+                                // relaxation moved code
+    uint8_t relax;              // relax_kind_t
+    uint8_t condition;          // RELAX_JUMP: opcode of the branch before
+    int8_t delta;               // Bytes relaxation adds to the instruction
+    const char* expression;     // Slice of the source (relocatable output:
+    size_t length;              // a copy in the arena)
+    int line;
+} fixup_t;
+
+// Section of relocatable output (see object.h), or in absolute output
+// the code from one .org to the next; it runs from its start to the next
+// section's start in the output
+typedef struct {
+    const char* name;           // In the assembler's arena
+    uint32_t start;             // Output position
+    uint16_t address;           // Address of its first byte: 0 unless fixed
+    bool fixed;                 // Placed by .org
+} section_t;
+
+// Operand syntax of an instruction, from its addressing mode in the ISA
+typedef enum {
+    OPERAND_NONE = 0,       // No operand; a zero byte fills the operand slot
+    OPERAND_IMMEDIATE,      // #value or value, one byte
+    OPERAND_REGISTER,       // Register name, one byte
+    OPERAND_ABSOLUTE,       // [address] or address, two bytes
+    OPERAND_RELATIVE        // Branch target, one signed byte
+} operand_kind_t;
+
+// Instruction name (see assembler_lookup_mnemonic)
+typedef struct {
+    uint32_t key;           // Name packed into a word, 0 = empty slot
+    opcode_t opcode;
+    operand_kind_t operand;
+} mnemonic_t;
+
+// Name index slot
+typedef struct {
+    const char* name;       // NULL = empty
+    uint32_t hash;
+    int entry;              // Label or symbol number
+} name_slot_t;
+
+// Open-addressing hash index from names to labels or symbols
+typedef struct {
+    name_slot_t* slots;
+    uint32_t capacity;      // Power of two, at most half full
+    uint32_t count;
+} name_index_t;
+
+// Macro defined with .macro NAME [PARAM, ...] ... .endm
+typedef struct {
+    const char* name;           // In the assembler's arena
+    const char* body;           // Slice of the defining source, up to .endm
+    size_t length;
+    const char* filename;
+    int line;                   // Of the body's first line
+    int param_count;
+    const char* params[MAX_MACRO_PARAMS];
+    size_t param_lengths[MAX_MACRO_PARAMS];
+} macro_t;
+
+// Input being read: a source buffer lexed in place, or the tokens of a
+// cached include replayed
+typedef struct {
+    char* filename;
+    const char* source;
+    const char* source_end;
+    const char* cursor;
+    const char* line_start;
+    int line_number;
+    const token_t* tokens;
+    size_t token_count;
+    size_t token_index;
+} input_t;
+
+// Source line kept for the listing (see assembler_save_listing)
+typedef struct {
+    const char* text;           // The line up to its newline; a macro
+    size_t length;              // definition runs to its .endm
+    const char* filename;
+    int line;
+    uint32_t offset;            // Output position of its first byte
+    int section;
+    bool code;                  // An instruction, not data
+} listing_line_t;
+
+// Static cycle estimate for a stretch of code (see assembler_cycle_blocks)
+typedef struct {
+    const char* name;           // Label at its start; NULL if none
+    uint16_t start;             // Address of its first instruction
+    uint16_t end;               // Address after its last
+    uint32_t cycles;            // Once through; a loop: one iteration
+    uint32_t iterations;        // Loop counted down by LDI #n ... DEC A,
+                                // BNE: n (0 = 256); 0 if not known
+    bool loop;                  // Closed by a backward branch or JMP
+} cycle_block_t;
+
+// Include cache counters (see assembler_include_cache_stats)
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    int files;
+} include_cache_stats_t;
+
 // Assembler state
 typedef struct {
-    // Input
+    // Input: the whole source in one buffer, a mapped file or the caller's
+    // string, lexed in place. An included file is replayed from the
+    // include cache's tokens instead.
     char* filename;
-    FILE* file;
-    char* current_line;
+    const char* source;
+    const char* source_end;
+    const char* cursor;         // Next character to lex
+    const char* line_start;
     int line_number;
-    int column_number;
+    const token_t* tokens;      // NULL unless replaying
+    size_t token_count;
+    size_t token_index;
+    
+    // Inputs suspended by .include and macro expansion, innermost last,
+    // and the one to enter once the current line ends
+    input_t inputs[MAX_INCLUDES];
+    int input_depth;
+    input_t pending_input;
+    
+    // Everything below lives in the arena: the output, the tables and
+    // their indexes, and interned names. assembler_reset rewinds it.
+    arena_t arena;
     
     // Output
-    uint8_t* output;
-    uint16_t output_size;
+    uint8_t* output;            // ASSEMBLER_OUTPUT_SIZE bytes
+    uint32_t output_size;
     uint16_t current_address;
     uint16_t origin_address;
     
-    // Labels and symbols
-    label_t labels[MAX_LABELS];
-    symbol_t symbols[MAX_LABELS];
+    // Labels and symbols, looked up through hash indexes
+    label_t* labels;
+    symbol_t* symbols;
     int label_count;
     int symbol_count;
+    int label_capacity;
+    int symbol_capacity;
+    name_index_t label_index;
+    name_index_t symbol_index;
+    
+    // Forward references
+    fixup_t* fixups;
+    int fixup_count;
+    int fixup_capacity;
+    bool unresolved;            // The last expression named an undefined label
+    bool label_used;            // The last expression named a label
+    bool resolving;             // Patching fixups: undefined names are errors
+    
+    // Branch relaxation (absolute output; on unless asm --no-relax)
+    bool relax;
+    int fallthrough;            // Fixup of the branch just emitted, -1 once
+                                // a label or .org may enter the code after it
+    
+    // Listing (asm -l, --cycle-report): lines are only kept when asked for
+    bool listing;
+    listing_line_t* lines;
+    int line_count;
+    int line_capacity;
+    const uint8_t* cycle_table; // Costs by opcode; NULL = the ISA's
+    
+    // Relocatable output (asm -c): every label reference becomes a fixup,
+    // left for the linker
+    bool relocatable;
+    section_t* sections;
+    int section_count;
+    int section_capacity;
+    name_index_t global_index;  // Names given to .global
+    
+    // Macros
+    macro_t* macros;
+    int macro_count;
+    int macro_capacity;
+    name_index_t macro_index;
+    int expansion_count;        // Numbers the local labels of each expansion
     
     // Current token
     token_t current_token;
@@ -80,30 +261,48 @@ typedef struct {
     // Error handling
     bool error_occurred;
     char error_message[256];
-    
-    // Include files
-    char* includes[MAX_INCLUDES];
-    int include_count;
 } assembler_t;
 
 // Assembler functions
 assembler_t* assembler_create(void);
 void assembler_destroy(assembler_t* assembler);
-bool assembler_assemble_file(assembler_t* assembler, const char* filename);
-bool assembler_assemble_string(assembler_t* assembler, const char* source);
+bool assembler_reset(assembler_t* assembler);        // Ready for another assembly, reusing memory
+bool assembler_assemble_file(assembler_t* assembler, const char* filename);  // "-" = stdin
+bool assembler_assemble_string(assembler_t* assembler, const char* source);  // Kept by the caller
 bool assembler_save_binary(assembler_t* assembler, const char* filename);
-bool assembler_save_listing(assembler_t* assembler, const char* filename);
+bool assembler_save_listing(assembler_t* assembler, const char* filename);   // Needs listing
+bool assembler_save_object(assembler_t* assembler, const char* filename);    // Relocatable output
+
+// Process-wide cache of lexed include files, keyed by path, modification
+// time and size. A file that was only touched, or a copy under another
+// name, is matched by its content hash and not lexed again. Shared by
+// every assembler in the process; cached tokens are never modified.
+include_cache_stats_t assembler_include_cache_stats(void);
+void assembler_clear_include_cache(void);   // No assembly may be running
+
+// Evaluate an expression held in text, with every name defined; the
+// linker uses this to apply relocations
+bool assembler_evaluate(assembler_t* assembler, const char* text, size_t length, uint16_t* value);
+
+// Cycle estimates from the listed lines, charged as the simulator does:
+// a block runs from each label to the next, and a loop from the target
+// of a backward branch or JMP to it. The blocks come first, then the
+// loops; they live in the arena until the next assembly.
+cycle_block_t* assembler_cycle_blocks(assembler_t* assembler, int* count);
+void assembler_print_cycle_report(assembler_t* assembler, FILE* out, int count);    // Costliest first
 
 // Token functions
 token_t assembler_next_token(assembler_t* assembler);
 void assembler_skip_whitespace(assembler_t* assembler);
 bool assembler_expect_token(assembler_t* assembler, token_type_t expected);
 bool assembler_peek_token(assembler_t* assembler, token_type_t expected);
+bool assembler_token_is(const token_t* token, const char* text);
 
 // Label functions
 bool assembler_add_label(assembler_t* assembler, const char* name, uint16_t address);
 label_t* assembler_find_label(assembler_t* assembler, const char* name);
 bool assembler_resolve_labels(assembler_t* assembler);
+void assembler_reset_labels(assembler_t* assembler);
 
 // Symbol functions
 bool assembler_add_symbol(assembler_t* assembler, const char* name, uint16_t value);
@@ -121,6 +320,7 @@ bool assembler_parse_label(assembler_t* assembler);
 
 // Output functions
 void assembler_emit_byte(assembler_t* assembler, uint8_t value);
+bool assembler_emit_operand(assembler_t* assembler, uint8_t width, bool relative);
 void assembler_emit_word(assembler_t* assembler, uint16_t value);
 void assembler_emit_string(assembler_t* assembler, const char* str);
 
@@ -136,6 +336,11 @@ bool assembler_is_register_name(const char* name);
 register_t assembler_get_register(const char* name);
 bool assembler_is_instruction_name(const char* name);
 opcode_t assembler_get_opcode(const char* name);
+
+// Mnemonic and register lookup by perfect hash; names need not be
+// NUL-terminated
+const mnemonic_t* assembler_lookup_mnemonic(const char* name, size_t length);
+bool assembler_lookup_register(const char* name, size_t length, register_t* reg);
 addressing_mode_t assembler_get_addressing_mode(const char* name);
 
 // Missing function declarations
@@ -0,0 +1,173 @@
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Host atomics for state shared between host threads: guest memory and
+// the IPI register in SMP machines, the framebuffer's dirty rows and the
+// single-producer queues (wave, UART link).
+//
+// GCC and Clang map straight onto their __atomic builtins with the given
+// ordering. MSVC has no C11 atomics in C mode, so loads and stores are
+// volatile accesses fenced against compiler reordering (acquire and
+// release on x86 and x64), and read-modify-write operations use the
+// Interlocked intrinsics, which are full barriers whatever order is asked.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+#include <intrin.h>
+
+#define ATOMICS_RELAXED 0
+#define ATOMICS_ACQUIRE 1
+#define ATOMICS_RELEASE 2
+#define ATOMICS_ACQ_REL 3
+#define ATOMICS_SEQ_CST 4
+
+static inline uint8_t atomics_load_u8(const volatile uint8_t* p, int order) {
+    uint8_t value = *p;
+    (void)order;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void atomics_store_u8(volatile uint8_t* p, uint8_t value, int order) {
+    if (order == ATOMICS_SEQ_CST) {
+        _InterlockedExchange8((volatile char*)p, (char)value);
+        return;
+    }
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+static inline uint8_t atomics_exchange_u8(volatile uint8_t* p, uint8_t value, int order) {
+    (void)order;
+    return (uint8_t)_InterlockedExchange8((volatile char*)p, (char)value);
+}
+
+// True if *p held *expected and now holds value; otherwise *expected
+// receives the current value
+static inline bool atomics_cas_u8(volatile uint8_t* p, uint8_t* expected, uint8_t value, int order) {
+    char old = _InterlockedCompareExchange8((volatile char*)p, (char)value, (char)*expected);
+    (void)order;
+    if ((uint8_t)old == *expected) {
+        return true;
+    }
+    *expected = (uint8_t)old;
+    return false;
+}
+
+static inline uint8_t atomics_fetch_or_u8(volatile uint8_t* p, uint8_t value, int order) {
+    (void)order;
+    return (uint8_t)_InterlockedOr8((volatile char*)p, (char)value);
+}
+
+static inline uint8_t atomics_fetch_and_u8(volatile uint8_t* p, uint8_t value, int order) {
+    (void)order;
+    return (uint8_t)_InterlockedAnd8((volatile char*)p, (char)value);
+}
+
+static inline uint64_t atomics_load_u64(const volatile uint64_t* p, int order) {
+    (void)order;
+#ifdef _WIN64
+    uint64_t value = *p;
+    _ReadWriteBarrier();
+    return value;
+#else
+    // A 32-bit host cannot load 64 bits in one access
+    return (uint64_t)_InterlockedCompareExchange64((volatile __int64*)p, 0, 0);
+#endif
+}
+
+static inline uint64_t atomics_exchange_u64(volatile uint64_t* p, uint64_t value, int order) {
+    (void)order;
+    return (uint64_t)_InterlockedExchange64((volatile __int64*)p, (__int64)value);
+}
+
+static inline uint64_t atomics_fetch_or_u64(volatile uint64_t* p, uint64_t value, int order) {
+    (void)order;
+    return (uint64_t)_InterlockedOr64((volatile __int64*)p, (__int64)value);
+}
+
+static inline int atomics_load_int(const volatile int* p, int order) {
+    int value = *p;
+    (void)order;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void atomics_store_int(volatile int* p, int value, int order) {
+    (void)order;
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+static inline int atomics_fetch_add_int(volatile int* p, int value, int order) {
+    (void)order;
+    return (int)_InterlockedExchangeAdd((volatile long*)p, (long)value);
+}
+
+static inline size_t atomics_load_size(const volatile size_t* p, int order) {
+    size_t value = *p;
+    (void)order;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void atomics_store_size(volatile size_t* p, size_t value, int order) {
+    (void)order;
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+static inline void* atomics_load_pointer(void* const volatile* p, int order) {
+    void* value = *p;
+    (void)order;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void atomics_store_pointer(void* volatile* p, void* value, int order) {
+    (void)order;
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+// Any object pointer type
+#define atomics_load_ptr(p, order) atomics_load_pointer((void* const volatile*)(p), (order))
+#define atomics_store_ptr(p, value, order) atomics_store_pointer((void* volatile*)(p), (value), (order))
+
+#else
+
+#define ATOMICS_RELAXED __ATOMIC_RELAXED
+#define ATOMICS_ACQUIRE __ATOMIC_ACQUIRE
+#define ATOMICS_RELEASE __ATOMIC_RELEASE
+#define ATOMICS_ACQ_REL __ATOMIC_ACQ_REL
+#define ATOMICS_SEQ_CST __ATOMIC_SEQ_CST
+
+#define atomics_load_u8(p, order) __atomic_load_n((p), (order))
+#define atomics_store_u8(p, value, order) __atomic_store_n((p), (value), (order))
+#define atomics_exchange_u8(p, value, order) __atomic_exchange_n((p), (value), (order))
+#define atomics_cas_u8(p, expected, value, order) \
+    __atomic_compare_exchange_n((p), (expected), (value), false, (order), (order))
+#define atomics_fetch_or_u8(p, value, order) __atomic_fetch_or((p), (value), (order))
+#define atomics_fetch_and_u8(p, value, order) __atomic_fetch_and((p), (value), (order))
+
+#define atomics_load_u64(p, order) __atomic_load_n((p), (order))
+#define atomics_exchange_u64(p, value, order) __atomic_exchange_n((p), (value), (order))
+#define atomics_fetch_or_u64(p, value, order) __atomic_fetch_or((p), (value), (order))
+
+#define atomics_load_int(p, order) __atomic_load_n((p), (order))
+#define atomics_store_int(p, value, order) __atomic_store_n((p), (value), (order))
+#define atomics_fetch_add_int(p, value, order) __atomic_fetch_add((p), (value), (order))
+
+#define atomics_load_size(p, order) __atomic_load_n((p), (order))
+#define atomics_store_size(p, value, order) __atomic_store_n((p), (value), (order))
+
+#define atomics_load_ptr(p, order) __atomic_load_n((p), (order))
+#define atomics_store_ptr(p, value, order) __atomic_store_n((p), (value), (order))
+
+#endif
+
+#endif // ATOMICS_H
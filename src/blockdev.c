@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "blockdev.h"
+#include "memory.h"
+#include "devices.h"
+#include "statehash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Sectors reachable with a 16-bit sector number
+#define BLOCK_ADDRESSABLE_SECTORS 65536u
+
+// True when [address, address + length) is plain RAM in the machine's
+// device map (no ROM, open bus or relocated device) that the MMU maps
+// straight through, outside SMP machines (where other cores must see
+// each byte through the atomic memory path)
+static bool block_in_ram(cpu_state_t* cpu, uint16_t address, uint32_t length) {
+    return !cpu->smp && (uint32_t)address + length <= RAM_END + 1 &&
+           device_map_is_memory(cpu->devices->map, address, length) &&
+           mmu_is_identity(&cpu->devices->mmu, address, length);
+}
+
+// Copy host bytes into guest memory. RAM is written directly with the
+// memory hash folded out and back in; anything else goes through the
+// CPU's memory handlers a byte at a time.
+static void block_to_guest(cpu_state_t* cpu, uint16_t address, const uint8_t* data, uint32_t length) {
+    if (!block_in_ram(cpu, address, length)) {
+        for (uint32_t i = 0; i < length; i++) {
+            isa_write_memory(cpu, (uint16_t)(address + i), data[i]);
+        }
+        return;
+    }
+
+    if (cpu->hash_enabled) {
+        for (uint32_t i = 0; i < length; i++) {
+            cpu->memory_hash ^= statehash_memory_key(address + i, cpu->memory[address + i]) ^
+                                statehash_memory_key(address + i, data[i]);
+        }
+    }
+    memcpy(cpu->memory + address, data, length);
+}
+
+// Copy guest memory out to host bytes
+static void block_from_guest(cpu_state_t* cpu, uint16_t address, uint8_t* data, uint32_t length) {
+    if (block_in_ram(cpu, address, length)) {
+        memcpy(data, cpu->memory + address, length);
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        data[i] = isa_read_memory(cpu, (uint16_t)(address + i));
+    }
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct block_image {
+    block_backend_t backend;
+    int fd;
+    uint32_t sectors;
+
+    // mmap backend
+    uint8_t* map;
+    size_t map_size;
+
+    // async backend: one command at a time, split into per-sector jobs
+    pthread_t threads[BLOCK_POOL_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // Jobs available or shutting down
+    bool in_flight;             // A command was submitted (CPU thread only)
+    uint8_t command;
+    uint32_t first_sector;
+    uint32_t jobs;
+    uint32_t next_job;
+    uint32_t finished_jobs;
+    bool failed;
+    bool stop;
+    uint8_t staging[BLOCK_MAX_COUNT * BLOCK_SECTOR_SIZE];
+};
+
+// Pool worker: take the next sector of the current command and do it
+static void* block_worker(void* arg) {
+    block_image_t* image = arg;
+
+    pthread_mutex_lock(&image->lock);
+    for (;;) {
+        while (!image->stop && image->next_job >= image->jobs) {
+            pthread_cond_wait(&image->work, &image->lock);
+        }
+        if (image->stop) {
+            break;
+        }
+        uint32_t job = image->next_job++;
+        uint8_t command = image->command;
+        off_t offset = (off_t)(image->first_sector + job) * BLOCK_SECTOR_SIZE;
+        uint8_t* data = image->staging + (size_t)job * BLOCK_SECTOR_SIZE;
+        pthread_mutex_unlock(&image->lock);
+
+        bool ok;
+        if (command == BLOCK_CMD_READ) {
+            ok = pread(image->fd, data, BLOCK_SECTOR_SIZE, offset) == BLOCK_SECTOR_SIZE;
+        } else if (command == BLOCK_CMD_WRITE) {
+            ok = pwrite(image->fd, data, BLOCK_SECTOR_SIZE, offset) == BLOCK_SECTOR_SIZE;
+        } else {
+            ok = fsync(image->fd) == 0;
+        }
+
+        pthread_mutex_lock(&image->lock);
+        image->failed |= !ok;
+        image->finished_jobs++;
+    }
+    pthread_mutex_unlock(&image->lock);
+    return NULL;
+}
+
+static bool block_start_pool(block_image_t* image) {
+    pthread_mutex_init(&image->lock, NULL);
+    pthread_cond_init(&image->work, NULL);
+
+    for (int i = 0; i < BLOCK_POOL_THREADS; i++) {
+        if (pthread_create(&image->threads[i], NULL, block_worker, image) != 0) {
+            fprintf(stderr, "Cannot start block I/O thread\n");
+            return false;
+        }
+        image->thread_count++;
+    }
+    return true;
+}
+
+static void block_stop_pool(block_image_t* image) {
+    pthread_mutex_lock(&image->lock);
+    image->stop = true;
+    pthread_cond_broadcast(&image->work);
+    pthread_mutex_unlock(&image->lock);
+
+    for (int i = 0; i < image->thread_count; i++) {
+        pthread_join(image->threads[i], NULL);
+    }
+    pthread_cond_destroy(&image->work);
+    pthread_mutex_destroy(&image->lock);
+}
+
+block_image_t* block_image_open(const char* spec) {
+    block_backend_t backend = BLOCK_BACKEND_MMAP;
+    const char* path = spec;
+
+    if (strncmp(spec, "mmap:", 5) == 0) {
+        path = spec + 5;
+    } else if (strncmp(spec, "async:", 6) == 0) {
+        backend = BLOCK_BACKEND_ASYNC;
+        path = spec + 6;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open disk image %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BLOCK_SECTOR_SIZE) {
+        fprintf(stderr, "Disk image %s must hold at least one %d-byte sector\n", path, BLOCK_SECTOR_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    block_image_t* image = calloc(1, sizeof(block_image_t));
+    if (!image) {
+        close(fd);
+        return NULL;
+    }
+    image->backend = backend;
+    image->fd = fd;
+    image->sectors = (uint32_t)(st.st_size / BLOCK_SECTOR_SIZE < BLOCK_ADDRESSABLE_SECTORS ?
+                                st.st_size / BLOCK_SECTOR_SIZE : BLOCK_ADDRESSABLE_SECTORS);
+
+    if (backend == BLOCK_BACKEND_MMAP) {
+        // Only the addressable sectors are mapped
+        image->map_size = (size_t)image->sectors * BLOCK_SECTOR_SIZE;
+        image->map = mmap(NULL, image->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (image->map == MAP_FAILED) {
+            fprintf(stderr, "Cannot map disk image %s: %s\n", path, strerror(errno));
+            close(fd);
+            free(image);
+            return NULL;
+        }
+    } else if (!block_start_pool(image)) {
+        block_image_close(image);
+        return NULL;
+    }
+    return image;
+}
+
+void block_image_close(block_image_t* image) {
+    if (!image) {
+        return;
+    }
+
+    if (image->backend == BLOCK_BACKEND_MMAP) {
+        msync(image->map, image->map_size, MS_SYNC);
+        munmap(image->map, image->map_size);
+    } else {
+        // Workers finish the job in hand before stopping
+        block_stop_pool(image);
+        fsync(image->fd);
+    }
+    close(image->fd);
+    free(image);
+}
+
+// Hand a command's sectors to the pool (a flush is a single job)
+static void block_submit(block_image_t* image, uint8_t command, uint32_t sector, uint32_t count) {
+    pthread_mutex_lock(&image->lock);
+    image->command = command;
+    image->first_sector = sector;
+    image->jobs = command == BLOCK_CMD_FLUSH ? 1 : count;
+    image->next_job = 0;
+    image->finished_jobs = 0;
+    image->failed = false;
+    image->in_flight = true;
+    pthread_cond_broadcast(&image->work);
+    pthread_mutex_unlock(&image->lock);
+}
+
+// True once every job of the submitted command has finished
+static bool block_finished(block_image_t* image, bool* failed) {
+    pthread_mutex_lock(&image->lock);
+    bool finished = image->finished_jobs == image->jobs;
+    *failed = image->failed;
+    pthread_mutex_unlock(&image->lock);
+    return finished;
+}
+
+// mmap backend: the whole command is a copy between mapping and guest
+static bool block_run_mapped(cpu_state_t* cpu, block_device_t* block) {
+    block_image_t* image = block->image;
+    uint8_t* data = image->map + (size_t)block->sector * BLOCK_SECTOR_SIZE;
+    uint32_t length = (uint32_t)block->count * BLOCK_SECTOR_SIZE;
+
+    switch (block->command) {
+        case BLOCK_CMD_READ:
+            block_to_guest(cpu, block->buffer, data, length);
+            return true;
+        case BLOCK_CMD_WRITE:
+            block_from_guest(cpu, block->buffer, data, length);
+            return true;
+        default:
+            return msync(image->map, image->map_size, MS_SYNC) == 0;
+    }
+}
+
+#else
+
+struct block_image {
+    block_backend_t backend;
+    uint32_t sectors;
+    bool in_flight;
+    uint8_t* map;
+    uint8_t staging[1];
+};
+
+block_image_t* block_image_open(const char* spec) {
+    fprintf(stderr, "Disk images are not supported on this platform (%s)\n", spec);
+    return NULL;
+}
+
+void block_image_close(block_image_t* image) {
+    (void)image;
+}
+
+static void block_submit(block_image_t* image, uint8_t command, uint32_t sector, uint32_t count) {
+    (void)image;
+    (void)command;
+    (void)sector;
+    (void)count;
+}
+
+static bool block_finished(block_image_t* image, bool* failed) {
+    (void)image;
+    *failed = true;
+    return true;
+}
+
+static bool block_run_mapped(cpu_state_t* cpu, block_device_t* block) {
+    (void)cpu;
+    (void)block;
+    return false;
+}
+
+#endif
+
+uint32_t block_image_sectors(const block_image_t* image) {
+    return image->sectors;
+}
+
+block_backend_t block_image_backend(const block_image_t* image) {
+    return image->backend;
+}
+
+void blockdev_attach(cpu_state_t* cpu, block_image_t* image) {
+    device_set_attach_block(cpu->devices, image, image ? image->sectors : 0);
+}
+
+// Finish the command and raise the completion interrupt if enabled
+static void blockdev_complete(cpu_state_t* cpu, bool error) {
+    device_set_t* devices = cpu->devices;
+
+    block_complete(&devices->block, error);
+    devices->now = cpu->cycle_count;
+    device_set_update_irq(devices);
+}
+
+bool blockdev_run(cpu_state_t* cpu) {
+    block_device_t* block = &cpu->devices->block;
+    block_image_t* image = block->image;
+    bool transfer = block->command != BLOCK_CMD_FLUSH;
+
+    if (!image) {
+        blockdev_complete(cpu, true);
+        return true;
+    }
+    if (transfer && (block->count > BLOCK_MAX_COUNT ||
+                     (uint32_t)block->sector + block->count > image->sectors)) {
+        blockdev_complete(cpu, true);
+        return true;
+    }
+
+    if (image->backend == BLOCK_BACKEND_MMAP) {
+        blockdev_complete(cpu, !block_run_mapped(cpu, block));
+    } else {
+        uint32_t length = (uint32_t)block->count * BLOCK_SECTOR_SIZE;
+        bool failed;
+
+        if (!image->in_flight) {
+            // Guest data is captured at submission; the guest may reuse the buffer
+            if (block->command == BLOCK_CMD_WRITE) {
+                block_from_guest(cpu, block->buffer, image->staging, length);
+            }
+            block_submit(image, block->command, block->sector, block->count);
+        }
+        if (!block_finished(image, &failed)) {
+            return false;
+        }
+        image->in_flight = false;
+        if (block->command == BLOCK_CMD_READ && !failed) {
+            block_to_guest(cpu, block->buffer, image->staging, length);
+        }
+        blockdev_complete(cpu, failed);
+    }
+
+    if (!block->error && transfer) {
+        if (block->command == BLOCK_CMD_READ) {
+            block->sectors_read += block->count;
+        } else {
+            block->sectors_written += block->count;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Block storage backed by a host disk image.
+// The guest programs the block device registers in the device set and
+// writes a command; the command runs at the CPU's next device poll.
+//
+// The mmap backend maps the image MAP_SHARED, so a read or write is one
+// memcpy between the mapping and guest RAM and completes at that poll.
+// Written sectors reach the file through the page cache; FLUSH msyncs.
+// The async backend keeps the image unmapped and hands the command's
+// sectors to a small thread pool doing pread/pwrite. Host I/O then never
+// runs on the simulation thread: with the mapping, a sector not in the
+// page cache faults in the middle of the instruction that started the
+// command (slow or network storage stalls the whole machine), while the
+// pool overlaps it with guest execution, and the guest sees the latency
+// as a busy STATUS, as with a real disk. It also serves files that cannot
+// be mapped. Its commands stay busy until the pool finishes, so completion
+// timing depends on the host. POSIX only; elsewhere opening fails.
+
+#define BLOCK_POOL_THREADS 4
+
+// Host I/O backends
+typedef enum {
+    BLOCK_BACKEND_MMAP = 0,
+    BLOCK_BACKEND_ASYNC
+} block_backend_t;
+
+// Disk image (opaque outside blockdev.c)
+typedef struct block_image block_image_t;
+
+// Open "PATH", "mmap:PATH" or "async:PATH". The image size is rounded down
+// to whole sectors and must hold at least one.
+block_image_t* block_image_open(const char* spec);
+void block_image_close(block_image_t* image);
+
+uint32_t block_image_sectors(const block_image_t* image);
+block_backend_t block_image_backend(const block_image_t* image);
+
+// Attach an image to the CPU's block device (NULL detaches)
+void blockdev_attach(cpu_state_t* cpu, block_image_t* image);
+
+// Run the pending command as far as possible; true once it completed
+bool blockdev_run(cpu_state_t* cpu);
+
+#endif // BLOCKDEV_H
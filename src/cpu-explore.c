@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "explore.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// Command line options
+typedef struct {
+    char* input_file;
+    uint16_t load_address;
+    bool entry_set;
+    bool verbose;
+    bool help_requested;
+    explore_config_t config;
+} cli_options_t;
+
+// Function prototypes
+void print_usage(const char* program_name);
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
+bool parse_byte_list(const char* text, uint8_t* values, int* count);
+
+int main(int argc, char* argv[]) {
+    cli_options_t options;
+
+    // Parse command line options
+    if (!parse_cli_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    if (options.help_requested) {
+        print_usage("cpu-explore");
+        return 0;
+    }
+
+    if (!options.input_file) {
+        fprintf(stderr, "No input file specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Build the initial memory image, default vectors included
+    uint8_t* image = malloc(MEMORY_SIZE);
+    if (!image) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memory_init(image);
+
+    FILE* file = fopen(options.input_file, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", options.input_file);
+        free(image);
+        return 1;
+    }
+    size_t image_size = fread(&image[options.load_address], 1, MEMORY_SIZE - options.load_address, file);
+    fclose(file);
+
+    explore_config_t* config = &options.config;
+    config->image = image;
+    if (!options.entry_set) {
+        config->entry_address = options.load_address;
+    }
+
+    if (options.verbose) {
+        printf("Loaded %zu bytes at 0x%04X, entry 0x%04X, %d thread(s)\n", image_size,
+               options.load_address, config->entry_address, config->threads);
+    }
+
+    explore_result_t result;
+    bool ok = explore_run(config, &result);
+
+    printf("Explored %llu states, %llu transitions, depth %u%s\n",
+           (unsigned long long)result.states, (unsigned long long)result.transitions,
+           result.depth, result.complete ? " (complete)" : " (incomplete)");
+    printf("Halted paths: %llu, truncated transitions: %llu\n",
+           (unsigned long long)result.halted, (unsigned long long)result.truncated);
+    if (options.verbose || result.spilled_bytes > 0) {
+        printf("Visited set: %zu KiB (%zu KiB spilled to disk)\n",
+               result.visited_bytes / 1024, result.spilled_bytes / 1024);
+    }
+    if (result.frontier_spilled_bytes > 0) {
+        printf("Frontier: up to %zu KiB spilled to disk\n", result.frontier_spilled_bytes / 1024);
+    }
+
+    for (int i = 0; i < result.violation_count; i++) {
+        explore_print_violation(&result, &result.violations[i], stdout);
+    }
+    if (result.violation_count == 0 && result.complete) {
+        printf("No violations reachable\n");
+    }
+
+    int exit_code = !ok ? 1 : (result.violation_count > 0 ? 2 : 0);
+    explore_result_free(&result);
+    free(image);
+    return exit_code;
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [OPTIONS] PROGRAM.bin\n", program_name);
+    printf("\nExplores every state reachable under all UART RX, GPIO and IRQ inputs\n");
+    printf("and reports invalid opcodes, stack overflows and reached assertions.\n");
+    printf("\nOptions:\n");
+    printf("  -a, --addr ADDRESS       Load address (default: 0x0200)\n");
+    printf("  -e, --entry ADDRESS      Entry point (default: load address)\n");
+    printf("  -A, --assert ADDRESS     Address that must never be reached (repeatable)\n");
+    printf("  -S, --stack-limit ADDR   Report SP below ADDR as stack overflow\n");
+    printf("  -R, --rx BYTES           RX bytes to try, comma separated (default: 0x00,0x0D,0x41)\n");
+    printf("  -g, --gpio MASK          Nondeterministic GPIO input pins (default: none)\n");
+    printf("  -i, --irq                Branch on IRQ arrival at every instruction\n");
+    printf("  -j, --threads N          Worker threads (default: online CPUs)\n");
+    printf("  -s, --states N           Maximum distinct states (default: 1000000)\n");
+    printf("  -d, --depth N            Maximum search depth in input points\n");
+    printf("  -m, --memory MB          RAM budget before spilling (default: 1024)\n");
+    printf("  -D, --spill-dir DIR      Directory for spill files (default: $TMPDIR or /tmp)\n");
+    printf("  -v, --verbose            Verbose output\n");
+    printf("  -h, --help               Show this help message\n");
+    printf("\nExit status is 2 when a violation is reachable.\n");
+    printf("\nExamples:\n");
+    printf("  %s firmware.bin --assert 0x0300 --rx 0x41,0x42\n", program_name);
+    printf("  %s firmware.bin --irq --stack-limit 0x7F00 -j 8\n", program_name);
+}
+
+bool parse_byte_list(const char* text, uint8_t* values, int* count) {
+    char buffer[1024];
+    strncpy(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    *count = 0;
+    for (char* token = strtok(buffer, ","); token; token = strtok(NULL, ",")) {
+        if (*count >= 256) {
+            return false;
+        }
+        values[(*count)++] = (uint8_t)strtol(token, NULL, 0);
+    }
+    return true;
+}
+
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
+    static struct option long_options[] = {
+        {"addr", required_argument, 0, 'a'},
+        {"entry", required_argument, 0, 'e'},
+        {"assert", required_argument, 0, 'A'},
+        {"stack-limit", required_argument, 0, 'S'},
+        {"rx", required_argument, 0, 'R'},
+        {"gpio", required_argument, 0, 'g'},
+        {"irq", no_argument, 0, 'i'},
+        {"threads", required_argument, 0, 'j'},
+        {"states", required_argument, 0, 's'},
+        {"depth", required_argument, 0, 'd'},
+        {"memory", required_argument, 0, 'm'},
+        {"spill-dir", required_argument, 0, 'D'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    // Set defaults
+    options->input_file = NULL;
+    options->load_address = 0x0200;
+    options->entry_set = false;
+    options->verbose = false;
+    options->help_requested = false;
+    explore_config_init(&options->config);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options->config.threads = cpus > 0 ? (int)cpus : 1;
+    if (getenv("TMPDIR")) {
+        options->config.spill_dir = getenv("TMPDIR");
+    }
+
+    while ((c = getopt_long(argc, argv, "a:e:A:S:R:g:ij:s:d:m:D:vh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'a':
+                options->load_address = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                options->config.entry_address = strtol(optarg, NULL, 0);
+                options->entry_set = true;
+                break;
+            case 'A':
+                if (options->config.assert_count >= EXPLORE_MAX_ASSERTS) {
+                    fprintf(stderr, "Too many assertion addresses (max %d)\n", EXPLORE_MAX_ASSERTS);
+                    return false;
+                }
+                options->config.asserts[options->config.assert_count++] = strtol(optarg, NULL, 0);
+                break;
+            case 'S':
+                options->config.stack_limit = strtol(optarg, NULL, 0);
+                break;
+            case 'R':
+                if (!parse_byte_list(optarg, options->config.rx_values, &options->config.rx_value_count)) {
+                    fprintf(stderr, "Too many RX values (max 256)\n");
+                    return false;
+                }
+                break;
+            case 'g':
+                options->config.gpio_mask = strtol(optarg, NULL, 0);
+                break;
+            case 'i':
+                options->config.irq = true;
+                break;
+            case 'j':
+                options->config.threads = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                options->config.max_states = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                options->config.max_depth = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                options->config.memory_limit = (size_t)strtoull(optarg, NULL, 0) * 1024 * 1024;
+                break;
+            case 'D':
+                options->config.spill_dir = optarg;
+                break;
+            case 'v':
+                options->verbose = true;
+                break;
+            case 'h':
+                options->help_requested = true;
+                break;
+            case '?':
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Get input file from remaining arguments
+    if (optind < argc) {
+        options->input_file = argv[optind];
+    }
+
+    return true;
+}
@@ -0,0 +1,140 @@
+#include "linker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+// Command line options
+typedef struct {
+    char** object_files;
+    int object_count;
+    char* output_file;
+    char* script_file;
+    char* map_file;
+    bool help_requested;
+} cli_options_t;
+
+// Function prototypes
+void print_usage(const char* program_name);
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
+
+int main(int argc, char* argv[]) {
+    cli_options_t options = {0};
+
+    // Parse command line options
+    if (!parse_cli_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    if (options.help_requested) {
+        print_usage("cpu-link");
+        return 0;
+    }
+
+    if (options.object_count == 0) {
+        fprintf(stderr, "No object files specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    linker_t* linker = linker_create();
+    if (!linker) {
+        fprintf(stderr, "Failed to create linker\n");
+        return 1;
+    }
+
+    bool ok = !options.script_file || linker_load_script(linker, options.script_file);
+    for (int i = 0; ok && i < options.object_count; i++) {
+        ok = linker_add_object(linker, options.object_files[i]);
+    }
+    if (!ok || !linker_link(linker)) {
+        fprintf(stderr, "Link failed\n");
+        linker_destroy(linker);
+        return 1;
+    }
+
+    if (!linker_save_image(linker, options.output_file)) {
+        fprintf(stderr, "Failed to save image %s\n", options.output_file);
+        linker_destroy(linker);
+        return 1;
+    }
+    printf("Image 0x%04X-0x%04X saved to %s (%u bytes)\n", linker->image_start,
+           linker->image_end > linker->image_start ? linker->image_end - 1 : linker->image_start,
+           options.output_file, linker->image_end - linker->image_start);
+
+    if (options.map_file) {
+        if (!linker_save_map(linker, options.map_file)) {
+            fprintf(stderr, "Failed to save map file %s\n", options.map_file);
+            linker_destroy(linker);
+            return 1;
+        }
+        printf("Map saved to %s\n", options.map_file);
+    }
+
+    linker_destroy(linker);
+    return 0;
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [OPTIONS] OBJECT...\n", program_name);
+    printf("\nLinks object files from asm -c into one image, loaded at its lowest address.\n");
+    printf("\nOptions:\n");
+    printf("  -o, --output FILE        Output image (default: a.bin)\n");
+    printf("  -T, --script FILE        Linker script placing the sections\n");
+    printf("  -m, --map FILE           Write a map of sections and global labels\n");
+    printf("  -h, --help               Show this help message\n");
+    printf("\nLinker script:\n");
+    printf("  [image]          origin = ADDRESS\n");
+    printf("  [section NAME]   address = ADDRESS, align = N\n");
+    printf("\nExamples:\n");
+    printf("  %s main.o lib.o -o program.bin\n", program_name);
+    printf("  %s -T rom.ld main.o lib.o -o program.bin -m program.map\n", program_name);
+}
+
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
+    static struct option long_options[] = {
+        {"output", required_argument, 0, 'o'},
+        {"script", required_argument, 0, 'T'},
+        {"map", required_argument, 0, 'm'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    // Set defaults
+    options->object_files = NULL;
+    options->object_count = 0;
+    options->output_file = "a.bin";
+    options->script_file = NULL;
+    options->map_file = NULL;
+    options->help_requested = false;
+
+    while ((c = getopt_long(argc, argv, "o:T:m:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'o':
+                options->output_file = optarg;
+                break;
+            case 'T':
+                options->script_file = optarg;
+                break;
+            case 'm':
+                options->map_file = optarg;
+                break;
+            case 'h':
+                options->help_requested = true;
+                break;
+            case '?':
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Object files are the remaining arguments
+    options->object_files = argv + optind;
+    options->object_count = argc - optind;
+
+    return true;
+}
@@ -0,0 +1,239 @@
+#include "lockstep.h"
+#include "cpu.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+// Registered engines
+static const lockstep_engine_t* engines[] = {
+    &lockstep_isa_engine,
+    &lockstep_simple_engine
+};
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+// Command line options
+typedef struct {
+    char* input_file;
+    char* engine_a;
+    char* engine_b;
+    uint16_t load_address;
+    uint16_t entry_address;
+    bool entry_set;
+    uint64_t check_interval;
+    uint64_t max_instructions;
+    bool list_engines;
+    bool verbose;
+    bool help_requested;
+} cli_options_t;
+
+// Function prototypes
+void print_usage(const char* program_name);
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
+const lockstep_engine_t* find_engine(const char* name);
+
+int main(int argc, char* argv[]) {
+    cli_options_t options = {0};
+
+    // Parse command line options
+    if (!parse_cli_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    if (options.help_requested) {
+        print_usage("cpu-lockstep");
+        return 0;
+    }
+
+    if (options.list_engines) {
+        for (size_t i = 0; i < ENGINE_COUNT; i++) {
+            printf("%s\n", engines[i]->name);
+        }
+        return 0;
+    }
+
+    if (!options.input_file) {
+        fprintf(stderr, "No input file specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const lockstep_engine_t* ops_a = find_engine(options.engine_a);
+    const lockstep_engine_t* ops_b = find_engine(options.engine_b);
+    if (!ops_a || !ops_b) {
+        fprintf(stderr, "Unknown engine: %s (use --list)\n", ops_a ? options.engine_b : options.engine_a);
+        return 1;
+    }
+
+    // Build the shared memory image, default vectors included
+    uint8_t* image = malloc(MEMORY_SIZE);
+    if (!image) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memory_init(image);
+
+    FILE* file = fopen(options.input_file, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", options.input_file);
+        free(image);
+        return 1;
+    }
+    size_t image_size = fread(&image[options.load_address], 1, MEMORY_SIZE - options.load_address, file);
+    fclose(file);
+
+    if (!options.entry_set) {
+        options.entry_address = options.load_address;
+    }
+
+    void* engine_a = ops_a->create();
+    void* engine_b = ops_b->create();
+    if (!engine_a || !engine_b) {
+        fprintf(stderr, "Failed to create engines\n");
+        if (engine_a) ops_a->destroy(engine_a);
+        if (engine_b) ops_b->destroy(engine_b);
+        free(image);
+        return 1;
+    }
+
+    ops_a->start(engine_a, image, options.entry_address);
+    ops_b->start(engine_b, image, options.entry_address);
+    free(image);
+
+    if (options.verbose) {
+        printf("Loaded %zu bytes at 0x%04X, entry 0x%04X\n", image_size,
+               options.load_address, options.entry_address);
+        printf("Comparing %s against %s every %llu instructions\n", ops_a->name, ops_b->name,
+               (unsigned long long)options.check_interval);
+    }
+
+    lockstep_config_t config = {
+        options.check_interval,
+        options.max_instructions,
+        options.verbose
+    };
+    lockstep_result_t result;
+    int exit_code = 0;
+
+    if (!lockstep_run(ops_a, engine_a, ops_b, engine_b, &config, &result)) {
+        exit_code = 1;
+    } else if (result.diverged) {
+        printf("Divergence at instruction %llu (PC=0x%04X)\n",
+               (unsigned long long)result.divergence_index, result.divergence_pc);
+        lockstep_dump(ops_a, engine_a, ops_b, engine_b);
+        exit_code = 2;
+    } else {
+        printf("No divergence after %llu instructions (%llu checks)\n",
+               (unsigned long long)result.instructions, (unsigned long long)result.checks);
+    }
+
+    ops_a->destroy(engine_a);
+    ops_b->destroy(engine_b);
+    return exit_code;
+}
+
+const lockstep_engine_t* find_engine(const char* name) {
+    for (size_t i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(engines[i]->name, name) == 0) {
+            return engines[i];
+        }
+    }
+    return NULL;
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [OPTIONS] PROGRAM.bin\n", program_name);
+    printf("\nRuns a program on two engines in lockstep and reports the first\n");
+    printf("instruction at which their register or memory state diverges.\n");
+    printf("\nOptions:\n");
+    printf("  -a, --addr ADDRESS       Load address (default: 0x0200)\n");
+    printf("  -e, --entry ADDRESS      Entry point (default: load address)\n");
+    printf("  -1, --engine-a NAME      Reference engine (default: isa)\n");
+    printf("  -2, --engine-b NAME      Engine under test (default: simple)\n");
+    printf("  -n, --interval N         Instructions between hash checks (default: 1000)\n");
+    printf("  -c, --count N            Maximum instructions (default: 1000000)\n");
+    printf("  -l, --list               List available engines\n");
+    printf("  -v, --verbose            Print every checkpoint\n");
+    printf("  -h, --help               Show this help message\n");
+    printf("\nExit status is 2 when the engines diverge.\n");
+    printf("\nExamples:\n");
+    printf("  %s program.bin\n", program_name);
+    printf("  %s program.bin -1 isa -2 simple -n 64\n", program_name);
+}
+
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
+    static struct option long_options[] = {
+        {"addr", required_argument, 0, 'a'},
+        {"entry", required_argument, 0, 'e'},
+        {"engine-a", required_argument, 0, '1'},
+        {"engine-b", required_argument, 0, '2'},
+        {"interval", required_argument, 0, 'n'},
+        {"count", required_argument, 0, 'c'},
+        {"list", no_argument, 0, 'l'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    // Set defaults
+    options->input_file = NULL;
+    options->engine_a = "isa";
+    options->engine_b = "simple";
+    options->load_address = 0x0200;
+    options->entry_address = 0;
+    options->entry_set = false;
+    options->check_interval = 1000;
+    options->max_instructions = 1000000;
+    options->list_engines = false;
+    options->verbose = false;
+    options->help_requested = false;
+
+    while ((c = getopt_long(argc, argv, "a:e:1:2:n:c:lvh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'a':
+                options->load_address = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                options->entry_address = strtol(optarg, NULL, 0);
+                options->entry_set = true;
+                break;
+            case '1':
+                options->engine_a = optarg;
+                break;
+            case '2':
+                options->engine_b = optarg;
+                break;
+            case 'n':
+                options->check_interval = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                options->max_instructions = strtoull(optarg, NULL, 0);
+                break;
+            case 'l':
+                options->list_engines = true;
+                break;
+            case 'v':
+                options->verbose = true;
+                break;
+            case 'h':
+                options->help_requested = true;
+                break;
+            case '?':
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Get input file from remaining arguments
+    if (optind < argc) {
+        options->input_file = argv[optind];
+    }
+
+    return true;
+}
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "net.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// Command line options
+typedef struct {
+    char* topology_file;
+    int threads;
+    uint64_t max_cycles;
+    bool print_topology;
+    bool digest;
+    bool quiet;
+    bool help_requested;
+} cli_options_t;
+
+// Function prototypes
+void print_usage(const char* program_name);
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
+
+int main(int argc, char* argv[]) {
+    cli_options_t options = {0};
+
+    // Parse command line options
+    if (!parse_cli_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    if (options.help_requested) {
+        print_usage("cpu-net");
+        return 0;
+    }
+
+    if (!options.topology_file) {
+        fprintf(stderr, "No topology file specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    net_t* net = net_load(options.topology_file);
+    if (!net) {
+        return 1;
+    }
+    if (options.print_topology) {
+        net_print_topology(net);
+        net_destroy(net);
+        return 0;
+    }
+    if (!net_reset(net)) {
+        net_destroy(net);
+        return 1;
+    }
+
+    // One thread per core by default, never more than there are boards
+    int threads = options.threads;
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    if (threads > net->board_count) {
+        threads = net->board_count;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool running = net_run(net, options.max_cycles, threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    uint64_t instructions = 0;
+    for (int i = 0; i < net->board_count; i++) {
+        instructions += net->boards[i].cpu->instruction_count;
+    }
+
+    if (!options.quiet) {
+        net_print_status(net);
+    }
+    printf("%d boards on %d threads: %llu windows, %llu instructions in %.3f s (%.1f MIPS)%s\n",
+           net->board_count, threads, (unsigned long long)net->windows, (unsigned long long)instructions,
+           seconds, seconds > 0 ? (double)instructions / seconds / 1e6 : 0.0,
+           running ? ", cycle limit reached" : "");
+    if (options.digest) {
+        printf("Digest: %016llx\n", (unsigned long long)net_digest(net));
+    }
+
+    net_destroy(net);
+    return 0;
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [OPTIONS] TOPOLOGY.ini\n", program_name);
+    printf("\nRuns the boards of a topology file, their UARTs linked as described,\n");
+    printf("on a pool of host threads. Results do not depend on the thread count.\n");
+    printf("\nOptions:\n");
+    printf("  -j, --threads N          Host threads (default: one per CPU, at most one per board)\n");
+    printf("  -c, --cycles N           Cycles to run each board for (default: 10000000)\n");
+    printf("  -t, --topology           Print the boards' links and exit\n");
+    printf("  -d, --digest             Print a hash of the final state of every board\n");
+    printf("  -q, --quiet              Only print the summary\n");
+    printf("  -h, --help               Show this help message\n");
+    printf("\nExamples:\n");
+    printf("  %s examples/token_ring.ini\n", program_name);
+    printf("  %s examples/token_ring.ini -j 1 --digest\n", program_name);
+}
+
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
+    static struct option long_options[] = {
+        {"threads", required_argument, 0, 'j'},
+        {"cycles", required_argument, 0, 'c'},
+        {"topology", no_argument, 0, 't'},
+        {"digest", no_argument, 0, 'd'},
+        {"quiet", no_argument, 0, 'q'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    // Set defaults
+    options->topology_file = NULL;
+    options->threads = 0;
+    options->max_cycles = 10000000;
+    options->print_topology = false;
+    options->digest = false;
+    options->quiet = false;
+    options->help_requested = false;
+
+    while ((c = getopt_long(argc, argv, "j:c:tdqh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'j':
+                options->threads = atoi(optarg);
+                if (options->threads < 1 || options->threads > NET_MAX_THREADS) {
+                    fprintf(stderr, "Invalid thread count: %s (1-%d)\n", optarg, NET_MAX_THREADS);
+                    return false;
+                }
+                break;
+            case 'c':
+                options->max_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                options->print_topology = true;
+                break;
+            case 'd':
+                options->digest = true;
+                break;
+            case 'q':
+                options->quiet = true;
+                break;
+            case 'h':
+                options->help_requested = true;
+                break;
+            case '?':
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Get topology file from remaining arguments
+    if (optind < argc) {
+        options->topology_file = argv[optind];
+    }
+
+    return true;
+}
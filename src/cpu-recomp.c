@@ -0,0 +1,169 @@
+#include "recomp.h"
+#include "cpu.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+// Command line options
+typedef struct {
+    char* input_file;
+    char* output_file;
+    uint16_t load_address;
+    uint16_t entry_address;
+    bool entry_set;
+    bool verbose;
+    bool help_requested;
+} cli_options_t;
+
+// Function prototypes
+void print_usage(const char* program_name);
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
+
+int main(int argc, char* argv[]) {
+    cli_options_t options = {0};
+
+    // Parse command line options
+    if (!parse_cli_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    if (options.help_requested) {
+        print_usage("cpu-recomp");
+        return 0;
+    }
+
+    if (!options.input_file) {
+        fprintf(stderr, "No input file specified\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Build the same memory image cpu-sim would see, default vectors included
+    uint8_t* memory = malloc(MEMORY_SIZE);
+    if (!memory) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memory_init(memory);
+
+    FILE* file = fopen(options.input_file, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", options.input_file);
+        free(memory);
+        return 1;
+    }
+    size_t image_size = fread(&memory[options.load_address], 1, MEMORY_SIZE - options.load_address, file);
+    fclose(file);
+
+    if (image_size == 0) {
+        fprintf(stderr, "%s is empty\n", options.input_file);
+        free(memory);
+        return 1;
+    }
+
+    if (!options.entry_set) {
+        options.entry_address = options.load_address;
+    }
+
+    FILE* out = stdout;
+    if (options.output_file) {
+        out = fopen(options.output_file, "w");
+        if (!out) {
+            fprintf(stderr, "Cannot create %s\n", options.output_file);
+            free(memory);
+            return 1;
+        }
+    }
+
+    int blocks = recomp_generate(memory, options.load_address, image_size, options.entry_address, out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(memory);
+
+    if (blocks < 0) {
+        fprintf(stderr, "Translation failed\n");
+        return 1;
+    }
+
+    if (options.verbose) {
+        fprintf(stderr, "Translated %d basic blocks from %zu bytes at 0x%04X (entry 0x%04X)\n",
+                blocks, image_size, options.load_address, options.entry_address);
+    }
+
+    return 0;
+}
+
+void print_usage(const char* program_name) {
+    printf("Usage: %s [OPTIONS] PROGRAM.bin\n", program_name);
+    printf("\nTranslates a guest binary into a C translation unit that can be built\n");
+    printf("as a native module and run with cpu-sim --native.\n");
+    printf("\nOptions:\n");
+    printf("  -a, --addr ADDRESS     Load address (default: 0x0200)\n");
+    printf("  -e, --entry ADDRESS    Entry point (default: load address)\n");
+    printf("  -o, --output FILE      Output C file (default: stdout)\n");
+    printf("  -v, --verbose          Verbose output\n");
+    printf("  -h, --help             Show this help message\n");
+    printf("\nExamples:\n");
+    printf("  %s firmware.bin -a 0x0200 -o firmware.c\n", program_name);
+    printf("  cc -O2 -shared -fPIC -Isrc firmware.c -o firmware.so\n");
+    printf("  cpu-sim firmware.bin --native ./firmware.so --run\n");
+}
+
+bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
+    static struct option long_options[] = {
+        {"addr", required_argument, 0, 'a'},
+        {"entry", required_argument, 0, 'e'},
+        {"output", required_argument, 0, 'o'},
+        {"verbose", no_argument, 0, 'v'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    int c;
+
+    // Set defaults
+    options->input_file = NULL;
+    options->output_file = NULL;
+    options->load_address = 0x0200;
+    options->entry_address = 0;
+    options->entry_set = false;
+    options->verbose = false;
+    options->help_requested = false;
+
+    while ((c = getopt_long(argc, argv, "a:e:o:vh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'a':
+                options->load_address = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                options->entry_address = strtol(optarg, NULL, 0);
+                options->entry_set = true;
+                break;
+            case 'o':
+                options->output_file = optarg;
+                break;
+            case 'v':
+                options->verbose = true;
+                break;
+            case 'h':
+                options->help_requested = true;
+                break;
+            case '?':
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    // Get input file from remaining arguments
+    if (optind < argc) {
+        options->input_file = argv[optind];
+    }
+
+    return true;
+}
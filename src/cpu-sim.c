@@ -1,6 +1,15 @@
 #include "cpu.h"
 #include "memory.h"
 #include "devices.h"
+#include "recomp.h"
+#include "livelock.h"
+#include "uart_sink.h"
+#include "uart_source.h"
+#include "wave.h"
+#include "blockdev.h"
+#include "framebuffer.h"
+#include "machine.h"
+#include "smp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,6 +26,24 @@ typedef struct {
     uint16_t watch_addr;
     uint64_t max_cycles;
     char* until_condition;
+    char* native_module;
+    bool livelock_detection;
+    char* uart_output;
+    int64_t uart_latency;
+    char* uart_input;
+    uint32_t baud_rate;
+    bool irq_stats;
+    char* vcd_file;
+    char* wave_log;
+    char* disk_image;
+    char* fb_dump;
+    char* machine_file;
+    int cores;
+    uint32_t quantum;
+    bool round_robin;
+    char* plugins[DEVICE_MAX];
+    int plugin_count;
+    bool list_devices;
     bool help_requested;
 } cli_options_t;
 
@@ -26,7 +53,8 @@ void print_help(void);
 bool parse_cli_options(int argc, char* argv[], cli_options_t* options);
 void print_cpu_status(cpu_state_t* cpu);
 void run_interactive_mode(cpu_state_t* cpu);
-void run_batch_mode(cpu_state_t* cpu, cli_options_t* options);
+void run_batch_mode(cpu_state_t* cpu, cli_options_t* options, recomp_module_t* native, bool external_input);
+void run_smp_mode(smp_machine_t* smp, cli_options_t* options);
 
 int main(int argc, char* argv[]) {
     cli_options_t options = {0};
@@ -41,18 +69,103 @@ int main(int argc, char* argv[]) {
         return 0;
     }
     
+    // Device plugins must be registered before the CPU's devices are created
+    for (int i = 0; i < options.plugin_count; i++) {
+        if (!device_plugin_load(options.plugins[i])) {
+            return 1;
+        }
+    }
+    
+    // Machine description: memory map, device placement, clock, cycle costs
+    machine_config_t machine;
+    machine_config_default(&machine);
+    if (options.machine_file && !machine_config_load(&machine, options.machine_file)) {
+        return 1;
+    }
+    if (options.list_devices) {
+        machine_config_print(&machine);
+        return 0;
+    }
+    if (options.native_module && !machine.default_cycles) {
+        fprintf(stderr, "Native modules are built for the default cycle costs; %s changes them\n",
+                options.machine_file);
+        return 1;
+    }
+    
+    // Cores, quantum and schedule on the command line override the machine's
+    int cores = options.cores ? options.cores : machine.cores;
+    uint32_t quantum = options.quantum ? options.quantum : machine.quantum;
+    smp_schedule_t schedule = options.round_robin ? SMP_SCHEDULE_ROUND_ROBIN : machine.schedule;
+    if (cores > 1 && (!options.run_immediately || options.native_module)) {
+        fprintf(stderr, "Multi-core machines run in batch mode (--run) and are interpreted only\n");
+        return 1;
+    }
+    
     // Create CPU instance
-    cpu_state_t* cpu = cpu_create();
+    cpu_state_t* cpu = options.machine_file ? cpu_create_from_config(&machine) : cpu_create();
     if (!cpu) {
         fprintf(stderr, "Failed to create CPU instance\n");
         return 1;
     }
     
+    // Attach the UART output sink (configured machines start without one)
+    uart_sink_t* sink = NULL;
+    if (!cpu->devices->uart.sink) {
+        uart_set_sink(&cpu->devices->uart, uart_sink_default());
+    }
+    if (options.uart_output) {
+        sink = uart_sink_open(options.uart_output);
+        if (!sink) {
+            cpu_destroy(cpu);
+            return 1;
+        }
+        uart_set_sink(&cpu->devices->uart, sink);
+    }
+    if (options.uart_latency >= 0) {
+        uart_sink_set_latency(cpu->devices->uart.sink, (uint64_t)options.uart_latency);
+    }
+    
     // Set CPU frequency
     if (options.frequency_hz > 0) {
         cpu_set_frequency(cpu, options.frequency_hz);
     }
     
+    // Attach the UART input source, paced at 10 bit times (8N1) per byte
+    uart_source_t* source = NULL;
+    if (options.uart_input) {
+        if (strcmp(options.uart_input, "stdin") == 0 && !options.run_immediately) {
+            fprintf(stderr, "--uart-in stdin needs --run (stdin carries monitor commands)\n");
+            cpu_destroy(cpu);
+            uart_sink_destroy(sink);
+            return 1;
+        }
+        source = uart_source_open(options.uart_input);
+        if (!source) {
+            cpu_destroy(cpu);
+            uart_sink_destroy(sink);
+            return 1;
+        }
+        uint32_t frequency = options.frequency_hz > 0 ? options.frequency_hz : machine.clock_hz;
+        device_set_attach_source(cpu->devices, source, (uint32_t)((uint64_t)frequency * 10 / options.baud_rate));
+        if (uart_source_pty_name(source)) {
+            printf("UART input on %s\n", uart_source_pty_name(source));
+            fflush(stdout);
+        }
+    }
+    
+    // Attach the block device's disk image
+    block_image_t* disk = NULL;
+    if (options.disk_image) {
+        disk = block_image_open(options.disk_image);
+        if (!disk) {
+            cpu_destroy(cpu);
+            uart_source_destroy(source);
+            uart_sink_destroy(sink);
+            return 1;
+        }
+        blockdev_attach(cpu, disk);
+    }
+    
     // Enable trace if requested
     if (options.trace_enabled) {
         cpu_enable_trace(cpu, true);
@@ -73,22 +186,102 @@ int main(int argc, char* argv[]) {
         if (!cpu_load_file(cpu, options.program_file, options.load_address)) {
             fprintf(stderr, "Failed to load program from %s\n", options.program_file);
             cpu_destroy(cpu);
+            block_image_close(disk);
+            uart_source_destroy(source);
+            uart_sink_destroy(sink);
             return 1;
         }
         printf("Loaded program from %s at address 0x%04X\n", 
                options.program_file, options.load_address);
     }
     
-    // Run in appropriate mode
-    if (options.run_immediately) {
-        run_batch_mode(cpu, &options);
+    // Load native module if specified
+    recomp_module_t* native = NULL;
+    if (options.native_module) {
+        native = recomp_load(options.native_module);
+        if (!native) {
+            cpu_destroy(cpu);
+            block_image_close(disk);
+            uart_source_destroy(source);
+            uart_sink_destroy(sink);
+            return 1;
+        }
+        if (!recomp_matches_image(native, cpu->memory)) {
+            fprintf(stderr, "Warning: %s was not built from the loaded image; "
+                    "using the interpreter only\n", options.native_module);
+            recomp_unload(native);
+            native = NULL;
+        }
+    }
+    
+    // Record GPIO, timer output and IRQ line changes
+    wave_recorder_t* recorder = NULL;
+    if (options.vcd_file || options.wave_log) {
+        recorder = wave_recorder_open(options.vcd_file, options.wave_log);
+        if (!recorder) {
+            recomp_unload(native);
+            cpu_destroy(cpu);
+            block_image_close(disk);
+            uart_source_destroy(source);
+            uart_sink_destroy(sink);
+            return 1;
+        }
+        device_set_attach_wave(cpu->devices, wave_recorder_queue(recorder));
+    }
+    
+    // Collect presented frames for the final frame dump
+    fb_display_t* display = NULL;
+    if (options.fb_dump) {
+        display = fb_display_create();
+        device_set_attach_display(cpu->devices, display);
+    }
+    
+    // Run in appropriate mode. Host input and async disk completions make
+    // the run depend on more than the machine state.
+    int status = 0;
+    if (options.run_immediately && cores > 1) {
+        smp_machine_t* smp = smp_create(cpu, cores, quantum, schedule);
+        if (smp) {
+            run_smp_mode(smp, &options);
+            smp_destroy(smp);
+        } else {
+            fprintf(stderr, "Failed to create the cores\n");
+            status = 1;
+        }
+    } else if (options.run_immediately) {
+        bool external = source || (disk && block_image_backend(disk) == BLOCK_BACKEND_ASYNC);
+        run_batch_mode(cpu, &options, native, external);
     } else {
         run_interactive_mode(cpu);
     }
     
     // Cleanup
+    if (display) {
+        // Automatic mode has not published changes made since its last present
+        if (cpu->devices->fb.control & FB_CTRL_AUTO) {
+            framebuffer_present(cpu);
+        }
+        fb_view_t* view = calloc(1, sizeof(fb_view_t));
+        if (view) {
+            fb_display_fetch(display, view);
+            if (fb_view_write_ppm(view, options.fb_dump)) {
+                printf("Frame %u written to %s\n", view->frame, options.fb_dump);
+            }
+            free(view);
+        }
+        device_set_attach_display(cpu->devices, NULL);
+        fb_display_destroy(display);
+    }
+    if (recorder) {
+        device_set_attach_wave(cpu->devices, NULL);
+        wave_recorder_close(recorder, cpu->cycle_count);
+    }
+    recomp_unload(native);
     cpu_destroy(cpu);
-    return 0;
+    block_image_close(disk);
+    uart_source_destroy(source);
+    uart_sink_destroy(sink);
+    return status;
 }
 
 void print_usage(const char* program_name) {
@@ -96,17 +289,50 @@ void print_usage(const char* program_name) {
     printf("\nOptions:\n");
     printf("  -a, --addr ADDRESS     Load program at ADDRESS (default: 0x0200)\n");
     printf("  -r, --run              Run program immediately\n");
-    printf("  -f, --freq HZ           Set CPU frequency in Hz (default: 1000000)\n");
+    printf("  -f, --freq HZ           Set CPU frequency in Hz (default: 1000000 or the\n");
+    printf("                         machine's clock)\n");
     printf("  -t, --trace            Enable instruction tracing\n");
     printf("  -b, --break ADDRESS    Set breakpoint at ADDRESS\n");
     printf("  -w, --watch ADDRESS    Set watchpoint at ADDRESS\n");
     printf("  -c, --cycles COUNT      Maximum cycles to execute\n");
     printf("  -u, --until CONDITION  Run until condition is met\n");
+    printf("  -n, --native MODULE    Run translated blocks from a cpu-recomp module\n");
+    printf("  -L, --no-livelock      Disable livelock detection in batch mode\n");
+    printf("  -o, --uart SPEC        UART output: stdout, stdout:block, file:PATH,\n");
+    printf("                         unix:PATH or null (default: stdout)\n");
+    printf("  -l, --uart-latency N   Flush buffered UART output within N cycles (0 = only\n");
+    printf("                         on newline, full buffer or halt; default: 10000)\n");
+    printf("  -i, --uart-in SPEC     UART input: stdin, file:PATH, pipe:PATH or pty\n");
+    printf("                         (disables livelock detection)\n");
+    printf("  -B, --baud RATE        UART input baud rate in guest time (default: 115200)\n");
+    printf("  -I, --irq-stats        Print interrupt latency per source after a batch run\n");
+    printf("  -V, --vcd FILE         Write GPIO, timer output and IRQ changes as a VCD\n");
+    printf("  -W, --wave-log FILE    Write the same changes as a run-length-compressed log\n");
+    printf("  -d, --disk SPEC        Block device image: PATH or mmap:PATH (memory-mapped),\n");
+    printf("                         async:PATH (thread pool, keeps host I/O off the\n");
+    printf("                         simulation thread; disables livelock detection)\n");
+    printf("  -F, --fb-dump FILE     Write the last presented framebuffer frame as a PPM\n");
+    printf("  -M, --machine FILE     Machine description: memory map, devices, clock and\n");
+    printf("                         cycle costs (see machines/)\n");
+    printf("  -P, --plugin PATH      Load a device plugin (shared object; repeatable)\n");
+    printf("  -C, --cores N          Run N cores sharing memory and devices (2-8; needs\n");
+    printf("                         --run; default: the machine's, or 1)\n");
+    printf("  -Q, --quantum CYCLES   Cycles the cores run between synchronisations\n");
+    printf("                         (default: 1000)\n");
+    printf("  -R, --round-robin      Run the cores in turn on one thread, reproducibly\n");
+    printf("  -D, --devices          List the machine's memory map and devices\n");
     printf("  -h, --help             Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s examples/hello.bin --addr 0x0200 --run\n", program_name);
     printf("  %s --trace --break 0x0300\n", program_name);
     printf("  %s examples/addloop.bin --freq 500000 --cycles 10000\n", program_name);
+    printf("  %s examples/hello.bin --run --uart file:out.txt\n", program_name);
+    printf("  %s echo.bin --run --uart-in pty --baud 9600\n", program_name);
+    printf("  %s blink.bin --run --cycles 1000000 --vcd blink.vcd\n", program_name);
+    printf("  %s logger.bin --run --disk logs.img\n", program_name);
+    printf("  %s dice.bin --run --plugin build/rng_plugin.so\n", program_name);
+    printf("  %s monitor.bin --run --machine machines/rom-board.ini\n", program_name);
+    printf("  %s spinlock.bin --run --cores 4 --round-robin --quantum 1\n", program_name);
 }
 
 void print_help(void) {
@@ -139,6 +365,23 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
         {"watch", required_argument, 0, 'w'},
         {"cycles", required_argument, 0, 'c'},
         {"until", required_argument, 0, 'u'},
+        {"native", required_argument, 0, 'n'},
+        {"no-livelock", no_argument, 0, 'L'},
+        {"uart", required_argument, 0, 'o'},
+        {"uart-latency", required_argument, 0, 'l'},
+        {"uart-in", required_argument, 0, 'i'},
+        {"baud", required_argument, 0, 'B'},
+        {"irq-stats", no_argument, 0, 'I'},
+        {"vcd", required_argument, 0, 'V'},
+        {"wave-log", required_argument, 0, 'W'},
+        {"disk", required_argument, 0, 'd'},
+        {"fb-dump", required_argument, 0, 'F'},
+        {"machine", required_argument, 0, 'M'},
+        {"plugin", required_argument, 0, 'P'},
+        {"cores", required_argument, 0, 'C'},
+        {"quantum", required_argument, 0, 'Q'},
+        {"round-robin", no_argument, 0, 'R'},
+        {"devices", no_argument, 0, 'D'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -155,9 +398,26 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
     options->watch_addr = 0;
     options->max_cycles = 0;
     options->until_condition = NULL;
+    options->native_module = NULL;
+    options->livelock_detection = true;
+    options->uart_output = NULL;
+    options->uart_latency = -1;
+    options->uart_input = NULL;
+    options->baud_rate = 115200;
+    options->irq_stats = false;
+    options->vcd_file = NULL;
+    options->wave_log = NULL;
+    options->disk_image = NULL;
+    options->fb_dump = NULL;
+    options->machine_file = NULL;
+    options->cores = 0;
+    options->quantum = 0;
+    options->round_robin = false;
+    options->plugin_count = 0;
+    options->list_devices = false;
     options->help_requested = false;
     
-    while ((c = getopt_long(argc, argv, "a:rf:tb:w:c:u:h", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "a:rf:tb:w:c:u:n:Lo:l:i:B:IV:W:d:F:M:P:C:Q:RDh", long_options, &option_index)) != -1) {
         switch (c) {
             case 'a':
                 options->load_address = strtol(optarg, NULL, 0);
@@ -183,6 +443,73 @@ bool parse_cli_options(int argc, char* argv[], cli_options_t* options) {
             case 'u':
                 options->until_condition = optarg;
                 break;
+            case 'n':
+                options->native_module = optarg;
+                break;
+            case 'L':
+                options->livelock_detection = false;
+                break;
+            case 'o':
+                options->uart_output = optarg;
+                break;
+            case 'l':
+                options->uart_latency = strtoll(optarg, NULL, 0);
+                break;
+            case 'i':
+                options->uart_input = optarg;
+                break;
+            case 'B':
+                options->baud_rate = strtoul(optarg, NULL, 0);
+                if (options->baud_rate == 0) {
+                    fprintf(stderr, "Invalid baud rate: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'I':
+                options->irq_stats = true;
+                break;
+            case 'V':
+                options->vcd_file = optarg;
+                break;
+            case 'W':
+                options->wave_log = optarg;
+                break;
+            case 'd':
+                options->disk_image = optarg;
+                break;
+            case 'F':
+                options->fb_dump = optarg;
+                break;
+            case 'M':
+                options->machine_file = optarg;
+                break;
+            case 'P':
+                if (options->plugin_count == DEVICE_MAX) {
+                    fprintf(stderr, "Too many plugins\n");
+                    return false;
+                }
+                options->plugins[options->plugin_count++] = optarg;
+                break;
+            case 'C':
+                options->cores = (int)strtol(optarg, NULL, 0);
+                if (options->cores < 1 || options->cores > SMP_MAX_CORES) {
+                    fprintf(stderr, "Invalid core count: %s (1 to %d)\n", optarg, SMP_MAX_CORES);
+                    return false;
+                }
+                break;
+            case 'Q':
+                options->quantum = strtoul(optarg, NULL, 0);
+                if (options->quantum == 0) {
+                    fprintf(stderr, "Invalid quantum: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'R':
+                options->round_robin = true;
+                break;
+            case 'D':
+                options->list_devices = true;
+                break;
             case 'h':
                 options->help_requested = true;
                 break;
@@ -236,7 +563,9 @@ void run_interactive_mode(cpu_state_t* cpu) {
         } else if (strcmp(command, "help") == 0) {
             print_help();
         } else if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
-            if (cpu_step(cpu)) {
+            bool stepped = cpu_step(cpu);
+            device_set_flush(cpu->devices);
+            if (stepped) {
                 print_cpu_status(cpu);
             } else {
                 printf("Execution stopped\n");
@@ -333,7 +662,7 @@ void run_interactive_mode(cpu_state_t* cpu) {
     }
 }
 
-void run_batch_mode(cpu_state_t* cpu, cli_options_t* options) {
+void run_batch_mode(cpu_state_t* cpu, cli_options_t* options, recomp_module_t* native, bool external_input) {
     printf("Running program in batch mode...\n");
     
     // Reset CPU to load address
@@ -345,10 +674,41 @@ void run_batch_mode(cpu_state_t* cpu, cli_options_t* options) {
         max_cycles = 1000000; // Default limit
     }
     
-    cpu_run(cpu, max_cycles);
+    // Interpreted runs stop as soon as the machine state provably repeats.
+    // Host input and async disk I/O are not part of that state, so waiting
+    // for them would look like a livelock; a periodic program being
+    // recorded is meant to run on.
+    livelock_detector_t livelock;
+    bool recording = options->vcd_file || options->wave_log;
+    bool detect = !native && !external_input && !recording && options->livelock_detection &&
+                  livelock_init(&livelock, cpu);
+    
+    if (native) {
+        recomp_run(native, cpu, max_cycles);
+    } else if (detect) {
+        livelock_run(&livelock, cpu, max_cycles);
+    } else {
+        cpu_run(cpu, max_cycles);
+    }
+    
+    if (detect) {
+        if (livelock.detected) {
+            printf("Livelock at PC=0x%04X (state repeats every %llu backward branches)\n",
+                   livelock.pc, (unsigned long long)livelock.cycle_samples);
+        }
+        livelock_cleanup(&livelock);
+    }
     
     // Print final status
     print_cpu_status(cpu);
+    if (native) {
+        printf("Native blocks: %llu, interpreted steps: %llu\n",
+               (unsigned long long)native->native_blocks,
+               (unsigned long long)native->fallback_steps);
+    }
+    if (options->irq_stats) {
+        pic_print_stats(&cpu->devices->pic);
+    }
     
     if (cpu_is_running(cpu)) {
         printf("Program completed successfully\n");
@@ -357,3 +717,26 @@ void run_batch_mode(cpu_state_t* cpu, cli_options_t* options) {
     }
 }
 
+void run_smp_mode(smp_machine_t* smp, cli_options_t* options) {
+    printf("Running program on %d cores in batch mode...\n", smp->core_count);
+    
+    // Every core starts at the load address with its own stack
+    smp_reset_to_address(smp, options->load_address);
+    
+    uint64_t max_cycles = options->max_cycles;
+    if (max_cycles == 0) {
+        max_cycles = 1000000; // Default limit
+    }
+    bool running = smp_run(smp, max_cycles);
+    
+    smp_print_status(smp);
+    if (options->irq_stats) {
+        pic_print_stats(&smp->cores[0]->devices->pic);
+    }
+    
+    if (running) {
+        printf("Program completed successfully\n");
+    } else {
+        printf("Program stopped\n");
+    }
+}
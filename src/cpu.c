@@ -1,6 +1,11 @@
 #include "cpu.h"
 #include "memory.h"
 #include "devices.h"
+#include "statehash.h"
+#include "dma.h"
+#include "blockdev.h"
+#include "framebuffer.h"
+#include "smp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,10 +31,17 @@ cpu_state_t* cpu_create(void) {
         free(cpu);
         return NULL;
     }
+    cpu->memory_size = MEMORY_SIZE;
     
     // Initialize state
+    cpu->hash_enabled = false;
+    cpu->memory_hash = 0;
+    cpu->devices = NULL;
+    cpu->smp = NULL;
+    cpu->core_id = 0;
     cpu_reset(cpu);
     cpu->frequency_hz = CPU_FREQUENCY_HZ;
+    cpu->cycle_table = isa_default_cycles();
     cpu->cycles_per_second = 0;
     cpu->last_tick_time = 0;
     
@@ -37,7 +49,58 @@ cpu_state_t* cpu_create(void) {
     memory_init(cpu->memory);
     
     // Initialize devices
-    devices_init();
+    if (!devices_init()) {
+        free(cpu->memory);
+        free(cpu);
+        return NULL;
+    }
+    cpu->devices = &g_devices;
+    cpu->owns_devices = false;
+    
+    return cpu;
+}
+
+// Create a CPU with its own private device set, for running several
+// machines in one process (model checking, lockstep, multi-board)
+cpu_state_t* cpu_create_isolated(void) {
+    device_set_t* devices = malloc(sizeof(device_set_t));
+    if (!devices) {
+        return NULL;
+    }
+    
+    cpu_state_t* cpu = malloc(sizeof(cpu_state_t));
+    if (!cpu) {
+        free(devices);
+        return NULL;
+    }
+    
+    cpu->memory = malloc(MEMORY_SIZE);
+    if (!cpu->memory) {
+        free(cpu);
+        free(devices);
+        return NULL;
+    }
+    cpu->memory_size = MEMORY_SIZE;
+    
+    cpu->hash_enabled = false;
+    cpu->memory_hash = 0;
+    cpu->devices = NULL;
+    cpu->smp = NULL;
+    cpu->core_id = 0;
+    cpu_reset(cpu);
+    cpu->frequency_hz = CPU_FREQUENCY_HZ;
+    cpu->cycle_table = isa_default_cycles();
+    cpu->cycles_per_second = 0;
+    cpu->last_tick_time = 0;
+    
+    if (!device_set_init(devices)) {
+        free(cpu->memory);
+        free(cpu);
+        free(devices);
+        return NULL;
+    }
+    cpu->devices = devices;
+    cpu->owns_devices = true;
     
     return cpu;
 }
@@ -48,13 +111,23 @@ void cpu_destroy(cpu_state_t* cpu) {
         if (cpu->memory) {
             free(cpu->memory);
         }
-        devices_cleanup();
+        if (cpu->owns_devices) {
+            device_set_flush(cpu->devices);
+            free(cpu->devices);
+        } else {
+            devices_cleanup();
+        }
         free(cpu);
     }
 }
 
 // Reset CPU to initial state
 void cpu_reset(cpu_state_t* cpu) {
+    // Device timing continues across the reset in the new cycle timebase
+    if (cpu->devices) {
+        device_set_rebase(cpu->devices, cpu->cycle_count);
+    }
+    
     // Clear all registers
     memset(cpu->regs, 0, sizeof(cpu->regs));
     
@@ -70,6 +143,7 @@ void cpu_reset(cpu_state_t* cpu) {
     // Clear control flags
     cpu->running = false;
     cpu->irq_pending = false;
+    cpu->irq_raised = false;
     cpu->nmi_pending = false;
     
     // Reset counters
@@ -83,11 +157,15 @@ void cpu_reset(cpu_state_t* cpu) {
     cpu->watch_addr = 0;
     cpu->watch_hit = false;
     
-    // Clear memory
-    memset(cpu->memory, 0, MEMORY_SIZE);
+    // Clear memory and map it straight through again
+    memset(cpu->memory, 0, cpu->memory_size);
+    if (cpu->devices) {
+        mmu_reset(&cpu->devices->mmu);
+    }
     
     // Initialize memory map
     memory_init(cpu->memory);
+    cpu_rehash_memory(cpu);
 }
 
 // Reset CPU to specific address
@@ -96,12 +174,16 @@ void cpu_reset_to_address(cpu_state_t* cpu, uint16_t address) {
     // initializes registers and control flags. Tests load a program into
     // memory and then call this function, so clearing memory here would
     // erase the loaded program.
+    if (cpu->devices) {
+        device_set_rebase(cpu->devices, cpu->cycle_count);
+    }
     memset(cpu->regs, 0, sizeof(cpu->regs));
     isa_set_register16(cpu, REG_SP, 0x7FFF);
     isa_set_register16(cpu, REG_PC, address);
     cpu->flags = 0;
     cpu->running = false;
     cpu->irq_pending = false;
+    cpu->irq_raised = false;
     cpu->nmi_pending = false;
     cpu->cycle_count = 0;
     cpu->instruction_count = 0;
@@ -138,6 +220,9 @@ bool cpu_step(cpu_state_t* cpu) {
     // Execute instruction
     bool result = isa_execute_instruction(cpu);
     
+    // Device events and the device interrupt line
+    cpu_poll_devices(cpu);
+    
     // Print trace if enabled
     if (cpu->trace_enabled) {
         cpu_print_status(cpu);
@@ -146,6 +231,50 @@ bool cpu_step(cpu_state_t* cpu) {
     return result;
 }
 
+// Resample this core's interrupt line from cpu_irq() and its IPI bit and
+// run the devices. In an SMP machine the devices are shared and core 0
+// runs them under the bus lock.
+void cpu_poll_devices(cpu_state_t* cpu) {
+    device_set_t* devices = cpu->devices;
+    if (!devices) {
+        return;
+    }
+    
+    cpu->irq_pending = cpu->irq_raised || ipi_pending(&devices->ipi, cpu->core_id);
+    if (cpu->smp) {
+        if (cpu->core_id == 0) {
+            smp_service_devices(cpu);
+        }
+        return;
+    }
+    cpu_service_devices(cpu, cpu->cycle_count);
+}
+
+// Run a started DMA transfer or block command, present the framebuffer,
+// service devices whose next event is due by cycle now and add the device
+// IRQ line to the interrupt line cpu_poll_devices() resampled
+void cpu_service_devices(cpu_state_t* cpu, uint64_t now) {
+    device_set_t* devices = cpu->devices;
+    
+    if (devices->dma.busy) {
+        dma_run(cpu);
+    }
+    if (devices->block.busy) {
+        blockdev_run(cpu);
+    }
+    if (devices->fb.present_pending || ((devices->fb.control & FB_CTRL_AUTO) &&
+                                        atomics_load_u64(&devices->fb.dirty, ATOMICS_RELAXED) &&
+                                        now >= devices->fb.next_auto)) {
+        framebuffer_present(cpu);
+    }
+    if (now >= devices->next_event) {
+        device_set_service(devices, now);
+    }
+    if (devices->irq) {
+        cpu->irq_pending = true;
+    }
+}
+
 // Run CPU for specified number of cycles
 bool cpu_run(cpu_state_t* cpu, uint64_t max_cycles) {
     cpu->running = true;
@@ -160,6 +289,9 @@ bool cpu_run(cpu_state_t* cpu, uint64_t max_cycles) {
         cpu_throttle(cpu);
     }
     
+    if (cpu->devices) {
+        device_set_flush(cpu->devices);
+    }
     return cpu->running;
 }
 
@@ -168,8 +300,9 @@ void cpu_stop(cpu_state_t* cpu) {
     cpu->running = false;
 }
 
-// Trigger IRQ
+// Trigger IRQ; it stays raised until the CPU takes it
 void cpu_irq(cpu_state_t* cpu) {
+    cpu->irq_raised = true;
     cpu->irq_pending = true;
 }
 
@@ -202,6 +335,25 @@ void cpu_handle_interrupts(cpu_state_t* cpu) {
     if (cpu->irq_pending && !isa_get_flag(cpu, FLAG_INTERRUPT)) {
         cpu->irq_pending = false;
         
+        // A device interrupt is entered at the interrupt controller, which
+        // names the handler in vectored mode; otherwise, and for cpu_irq()
+        // and IPIs, jump to the IRQ vector (0xFFFE). In an SMP machine only
+        // core 0 is wired to the controller.
+        uint16_t irq_vector = isa_read_memory(cpu, 0xFFFE) | (isa_read_memory(cpu, 0xFFFF) << 8);
+        bool device = false;
+        if (cpu->smp) {
+            device = smp_acknowledge_irq(cpu, &irq_vector);
+        } else if (cpu->devices) {
+            device = device_set_acknowledge_irq(cpu->devices, cpu->cycle_count, &irq_vector);
+        }
+        if (!device) {
+            // A device line acknowledged since it was sampled is dropped
+            if (!cpu->irq_raised && !(cpu->devices && ipi_pending(&cpu->devices->ipi, cpu->core_id))) {
+                return;
+            }
+            cpu->irq_raised = false;
+        }
+        
         // Save current state
         isa_push16(cpu, isa_get_register16(cpu, REG_PC));
         isa_push(cpu, cpu->flags);
@@ -209,8 +361,6 @@ void cpu_handle_interrupts(cpu_state_t* cpu) {
         // Set interrupt disable flag
         isa_set_flag(cpu, FLAG_INTERRUPT);
         
-        // Jump to IRQ vector (0xFFFE)
-        uint16_t irq_vector = isa_read_memory(cpu, 0xFFFE) | (isa_read_memory(cpu, 0xFFFF) << 8);
         isa_set_register16(cpu, REG_PC, irq_vector);
     }
 }
@@ -348,6 +498,11 @@ bool cpu_load_program(cpu_state_t* cpu, const uint8_t* program, size_t size, uin
         return false;
     }
     
+    if (cpu->hash_enabled) {
+        for (size_t i = 0; i < size; i++) {
+            statehash_update(&cpu->memory_hash, address + i, cpu->memory[address + i], program[i]);
+        }
+    }
     memcpy(&cpu->memory[address], program, size);
     return true;
 }
@@ -372,10 +527,164 @@ bool cpu_load_file(cpu_state_t* cpu, const char* filename, uint16_t address) {
     // Read file into memory
     size_t bytes_read = fread(&cpu->memory[address], 1, size, file);
     fclose(file);
+    cpu_rehash_memory(cpu);
     
     return bytes_read == size;
 }
 
+// Give the CPU a physical memory of size bytes for the MMU to bank into
+// its 64 KiB space (a power of two up to MMU_MAX_PHYSICAL). The first
+// 64 KiB keep their contents; the rest starts cleared.
+bool cpu_set_memory_size(cpu_state_t* cpu, uint32_t size) {
+    if (size < MEMORY_SIZE || size > MMU_MAX_PHYSICAL || (size & (size - 1)) != 0) {
+        fprintf(stderr, "Physical memory must be a power of two from 64 KiB to 16 MiB\n");
+        return false;
+    }
+    
+    uint8_t* memory = calloc(size, 1);
+    if (!memory) {
+        return false;
+    }
+    memcpy(memory, cpu->memory, MEMORY_SIZE);
+    free(cpu->memory);
+    cpu->memory = memory;
+    cpu->memory_size = size;
+    if (cpu->devices) {
+        mmu_init(&cpu->devices->mmu, size);
+    }
+    cpu_rehash_memory(cpu);
+    return true;
+}
+
+// Enable/disable incremental state hashing
+void cpu_enable_state_hash(cpu_state_t* cpu, bool enable) {
+    cpu->hash_enabled = enable;
+    cpu_rehash_memory(cpu);
+}
+
+// Recompute the memory hash after memory was changed behind the CPU's back
+void cpu_rehash_memory(cpu_state_t* cpu) {
+    if (cpu->hash_enabled) {
+        cpu->memory_hash = statehash_memory(cpu->memory, 0, cpu->memory_size);
+    }
+}
+
+// Hash of registers, control state, devices and memory.
+// O(1) in the memory size when hashing is enabled.
+uint64_t cpu_state_hash(cpu_state_t* cpu) {
+    uint8_t state[13 + DEVICES_STATE_SIZE];
+    memcpy(state, cpu->regs, sizeof(cpu->regs));
+    state[8] = cpu->flags;
+    state[9] = cpu->running;
+    state[10] = cpu->irq_pending;
+    state[11] = cpu->nmi_pending;
+    state[12] = cpu->irq_raised;
+    size_t size = 13 + device_set_pack_state(cpu->devices, cpu->cycle_count, &state[13]);
+    
+    uint64_t memory_hash = cpu->hash_enabled ? cpu->memory_hash
+                                             : statehash_memory(cpu->memory, 0, cpu->memory_size);
+    return statehash_bytes(0, state, size) ^ memory_hash;
+}
+
+// Allocate a snapshot buffer
+cpu_snapshot_t* cpu_snapshot_create(void) {
+    cpu_snapshot_t* snapshot = calloc(1, sizeof(cpu_snapshot_t));
+    if (!snapshot) {
+        return NULL;
+    }
+    
+    snapshot->memory = malloc(MEMORY_SIZE);
+    if (!snapshot->memory) {
+        free(snapshot);
+        return NULL;
+    }
+    snapshot->memory_size = MEMORY_SIZE;
+    
+    return snapshot;
+}
+
+// Free a snapshot buffer
+void cpu_snapshot_destroy(cpu_snapshot_t* snapshot) {
+    if (snapshot) {
+        free(snapshot->memory);
+        free(snapshot);
+    }
+}
+
+// Save the machine state. The buffer grows to the CPU's physical memory
+// on first use with a banked machine; false, with the snapshot unchanged,
+// if it cannot.
+bool cpu_snapshot_save(cpu_state_t* cpu, cpu_snapshot_t* snapshot) {
+    if (snapshot->memory_size != cpu->memory_size) {
+        uint8_t* memory = realloc(snapshot->memory, cpu->memory_size);
+        if (!memory) {
+            fprintf(stderr, "Cannot allocate a %u-byte snapshot\n", cpu->memory_size);
+            return false;
+        }
+        snapshot->memory = memory;
+        snapshot->memory_size = cpu->memory_size;
+    }
+    
+    memcpy(snapshot->regs, cpu->regs, sizeof(cpu->regs));
+    snapshot->flags = cpu->flags;
+    snapshot->running = cpu->running;
+    snapshot->irq_pending = cpu->irq_pending;
+    snapshot->irq_raised = cpu->irq_raised;
+    snapshot->nmi_pending = cpu->nmi_pending;
+    snapshot->cycle_count = cpu->cycle_count;
+    snapshot->instruction_count = cpu->instruction_count;
+    snapshot->memory_hash = cpu->memory_hash;
+    snapshot->devices = *cpu->devices;
+    memcpy(snapshot->memory, cpu->memory, cpu->memory_size);
+    return true;
+}
+
+// Restore a previously saved machine state
+void cpu_snapshot_restore(cpu_state_t* cpu, const cpu_snapshot_t* snapshot) {
+    memcpy(cpu->regs, snapshot->regs, sizeof(cpu->regs));
+    cpu->flags = snapshot->flags;
+    cpu->running = snapshot->running;
+    cpu->irq_pending = snapshot->irq_pending;
+    cpu->irq_raised = snapshot->irq_raised;
+    cpu->nmi_pending = snapshot->nmi_pending;
+    cpu->cycle_count = snapshot->cycle_count;
+    cpu->instruction_count = snapshot->instruction_count;
+    *cpu->devices = snapshot->devices;
+    memcpy(cpu->memory, snapshot->memory, cpu->memory_size);
+    
+    // The saved hash is only valid if hashing was on when it was taken
+    if (cpu->hash_enabled) {
+        cpu->memory_hash = snapshot->memory_hash;
+        if (cpu->memory_hash == 0) {
+            cpu_rehash_memory(cpu);
+        }
+    }
+}
+
+// Exact comparison of the machine state against a snapshot (counters excluded)
+bool cpu_snapshot_matches(cpu_state_t* cpu, const cpu_snapshot_t* snapshot) {
+    uint8_t current[DEVICES_STATE_SIZE];
+    uint8_t saved[DEVICES_STATE_SIZE];
+    
+    if (memcmp(cpu->regs, snapshot->regs, sizeof(cpu->regs)) != 0 ||
+        cpu->flags != snapshot->flags ||
+        cpu->running != snapshot->running ||
+        cpu->irq_pending != snapshot->irq_pending ||
+        cpu->irq_raised != snapshot->irq_raised ||
+        cpu->nmi_pending != snapshot->nmi_pending) {
+        return false;
+    }
+    
+    size_t size = device_set_pack_state(cpu->devices, cpu->cycle_count, current);
+    device_set_pack_state(&snapshot->devices, snapshot->cycle_count, saved);
+    if (memcmp(current, saved, size) != 0) {
+        return false;
+    }
+    
+    return snapshot->memory_size == cpu->memory_size &&
+           memcmp(cpu->memory, snapshot->memory, cpu->memory_size) == 0;
+}
+
 // Utility functions
 uint16_t cpu_get_pc(cpu_state_t* cpu) {
     return isa_get_register16(cpu, REG_PC);
@@ -2,7 +2,9 @@
 #define CPU_H
 
 #include "isa.h"
+#include "devices.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // CPU configuration
@@ -12,8 +14,25 @@
 // CPU state structure is defined in isa.h
 // Additional CPU-specific fields are added in cpu.c
 
+// Saved machine state (registers, control state, devices and memory)
+typedef struct {
+    uint8_t regs[8];
+    uint8_t flags;
+    bool running;
+    bool irq_pending;
+    bool irq_raised;
+    bool nmi_pending;
+    uint64_t cycle_count;
+    uint32_t instruction_count;
+    uint64_t memory_hash;
+    device_set_t devices;
+    uint8_t* memory;
+    uint32_t memory_size;
+} cpu_snapshot_t;
+
 // CPU functions
 cpu_state_t* cpu_create(void);
+cpu_state_t* cpu_create_isolated(void);
 void cpu_destroy(cpu_state_t* cpu);
 void cpu_reset(cpu_state_t* cpu);
 void cpu_reset_to_address(cpu_state_t* cpu, uint16_t address);
@@ -27,6 +46,8 @@ void cpu_stop(cpu_state_t* cpu);
 void cpu_irq(cpu_state_t* cpu);
 void cpu_nmi(cpu_state_t* cpu);
 void cpu_handle_interrupts(cpu_state_t* cpu);
+void cpu_poll_devices(cpu_state_t* cpu);
+void cpu_service_devices(cpu_state_t* cpu, uint64_t now);
 
 // Clock control
 void cpu_set_frequency(cpu_state_t* cpu, uint32_t hz);
@@ -48,6 +69,17 @@ const char* cpu_get_status_string(cpu_state_t* cpu);
 // Memory operations
 bool cpu_load_program(cpu_state_t* cpu, const uint8_t* program, size_t size, uint16_t address);
 bool cpu_load_file(cpu_state_t* cpu, const char* filename, uint16_t address);
+bool cpu_set_memory_size(cpu_state_t* cpu, uint32_t size);
+
+// State hashing and snapshots
+void cpu_enable_state_hash(cpu_state_t* cpu, bool enable);
+void cpu_rehash_memory(cpu_state_t* cpu);
+uint64_t cpu_state_hash(cpu_state_t* cpu);
+cpu_snapshot_t* cpu_snapshot_create(void);
+void cpu_snapshot_destroy(cpu_snapshot_t* snapshot);
+bool cpu_snapshot_save(cpu_state_t* cpu, cpu_snapshot_t* snapshot);
+void cpu_snapshot_restore(cpu_state_t* cpu, const cpu_snapshot_t* snapshot);
+bool cpu_snapshot_matches(cpu_state_t* cpu, const cpu_snapshot_t* snapshot);
 
 // Utility functions
 uint16_t cpu_get_pc(cpu_state_t* cpu);
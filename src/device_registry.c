@@ -0,0 +1,343 @@
+#include "devices.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+// Registered plugins, after the in-tree devices
+static const device_ops_t* registry_plugins[DEVICE_MAX];
+static int registry_plugin_count = 0;
+
+// Compiled maps. A set keeps pointing at the map it was created with, so
+// maps replaced by later registrations are kept until exit.
+static device_map_t** registry_maps = NULL;
+static int registry_map_count = 0;
+static bool registry_stale = true;
+
+// Flat per-address tables, compressed into the map's page tables
+typedef struct {
+    uint8_t slot[0x10000];
+    uint8_t access[0x10000];
+} registry_flat_t;
+
+// Placement of a device in a layout (NULL = at its registered addresses)
+static const device_placement_t* registry_placement(const device_layout_t* layout, const device_ops_t* ops) {
+    for (int i = 0; layout && i < layout->placement_count; i++) {
+        if (strcmp(layout->placements[i].device, ops->name) == 0) {
+            return &layout->placements[i];
+        }
+    }
+    return NULL;
+}
+
+// Claim a device's ranges, moved by offset; false on overlap or outside the
+// MMIO window
+static bool registry_claim(registry_flat_t* flat, const device_map_t* map, const device_ops_t* ops,
+                           uint8_t slot, uint16_t offset) {
+    for (int r = 0; r < DEVICE_MAX_RANGES && ops->ranges[r].size; r++) {
+        const device_range_t* range = &ops->ranges[r];
+        uint32_t base = (uint16_t)(range->base + offset);
+        if (base < MMIO_START || base + range->size > MMIO_END + 1u) {
+            fprintf(stderr, "Device %s: range 0x%04X+%u is outside the MMIO window\n",
+                    ops->name, (unsigned)base, range->size);
+            return false;
+        }
+        for (uint32_t address = base; address < base + range->size; address++) {
+            uint8_t claimed = flat->slot[address];
+            if (claimed == DEVICE_SLOT_ROM) {
+                fprintf(stderr, "Device %s: 0x%04X is in ROM\n", ops->name, address);
+                return false;
+            }
+            if (claimed != 0 && claimed != DEVICE_SLOT_OPEN) {
+                fprintf(stderr, "Device %s: 0x%04X is already claimed by %s\n", ops->name,
+                        address, map->devices[claimed - 1]->name);
+                return false;
+            }
+            flat->slot[address] = slot;
+            flat->access[address] = range->access;
+        }
+    }
+    return true;
+}
+
+// Store each distinct page of the flat tables once; false if there are
+// more than DEVICE_MAP_PAGES
+static bool registry_compress(device_map_t* map, const registry_flat_t* flat) {
+    int pages = 1;      // Slot table 0 is all memory
+
+    for (int page = 0; page < 256; page++) {
+        const uint8_t* slot = flat->slot + page * 256;
+        const uint8_t* access = flat->access + page * 256;
+        int table = 0;
+        while (table < pages && (memcmp(map->slot[table], slot, 256) != 0 ||
+                                 memcmp(map->access[table], access, 256) != 0)) {
+            table++;
+        }
+        if (table == pages) {
+            if (pages == DEVICE_MAP_PAGES) {
+                fprintf(stderr, "Device map needs more than %d distinct pages\n", DEVICE_MAP_PAGES);
+                return false;
+            }
+            memcpy(map->slot[table], slot, 256);
+            memcpy(map->access[table], access, 256);
+            pages++;
+        }
+        map->page_table[page] = (uint8_t)table;
+    }
+    return true;
+}
+
+// Compile the in-tree devices plus the given plugins into a new map
+static device_map_t* registry_build(const device_ops_t* const* plugins, int plugin_count,
+                                    const device_layout_t* layout) {
+    device_map_t* map = calloc(1, sizeof(device_map_t));
+    registry_flat_t* flat = calloc(1, sizeof(registry_flat_t));
+    bool ok = map && flat;
+
+    if (ok) {
+        memcpy(map->irq_line, layout->irq_line, sizeof(map->irq_line));
+        for (int i = 0; i < layout->region_count; i++) {
+            const device_region_t* region = &layout->regions[i];
+            uint8_t access = region->slot == DEVICE_SLOT_ROM ? DEVICE_ACCESS_READ : 0;
+            memset(flat->slot + region->start, region->slot, region->end - region->start + 1u);
+            memset(flat->access + region->start, access, region->end - region->start + 1u);
+        }
+    }
+
+    size_t state_used = 0;
+    for (int i = 0; ok && i < device_builtin_count + plugin_count; i++) {
+        const device_ops_t* ops = i < device_builtin_count ? device_builtin_ops[i]
+                                                           : plugins[i - device_builtin_count];
+        const device_placement_t* placement = registry_placement(layout, ops);
+        uint16_t offset = 0;
+        if (placement && placement->relocate) {
+            offset = (uint16_t)(placement->base - ops->ranges[0].base);
+        }
+
+        map->devices[i] = ops;
+        map->state_offset[i] = (uint16_t)state_used;
+        map->relocation[i] = (uint16_t)-offset;
+        state_used += DEVICE_STATE_SLICE(ops->state_size);
+        if (!(placement && placement->disabled)) {
+            ok = registry_claim(flat, map, ops, (uint8_t)(i + 1), offset);
+        }
+    }
+    map->count = device_builtin_count + plugin_count;
+
+    ok = ok && registry_compress(map, flat);
+    free(flat);
+    if (!ok) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+// Check a device against the current registrations without changing them
+static bool registry_accepts(const device_ops_t* ops) {
+    if (ops->abi_version != DEVICE_PLUGIN_ABI) {
+        fprintf(stderr, "Device %s was built for device ABI %u (expected %d)\n",
+                ops->name ? ops->name : "?", ops->abi_version, DEVICE_PLUGIN_ABI);
+        return false;
+    }
+    if (device_builtin_count + registry_plugin_count == DEVICE_MAX) {
+        fprintf(stderr, "Device %s: registry is full\n", ops->name);
+        return false;
+    }
+
+    size_t state_used = DEVICE_STATE_SLICE(ops->state_size);
+    for (int i = 0; i < registry_plugin_count; i++) {
+        state_used += DEVICE_STATE_SLICE(registry_plugins[i]->state_size);
+    }
+    if (state_used > DEVICE_PLUGIN_STATE_SIZE) {
+        fprintf(stderr, "Device %s: plugin state exceeds %d bytes\n", ops->name, DEVICE_PLUGIN_STATE_SIZE);
+        return false;
+    }
+
+    // Trial build with the default layout catches overlaps and ranges
+    // outside the window
+    const device_ops_t* plugins[DEVICE_MAX];
+    device_layout_t layout;
+    device_layout_default(&layout);
+    memcpy(plugins, registry_plugins, sizeof(registry_plugins[0]) * registry_plugin_count);
+    plugins[registry_plugin_count] = ops;
+    device_map_t* map = registry_build(plugins, registry_plugin_count + 1, &layout);
+    free(map);
+    return map != NULL;
+}
+
+// Add a device. Machines created afterwards dispatch to it.
+bool device_register(const device_ops_t* ops) {
+    if (!registry_accepts(ops)) {
+        return false;
+    }
+    registry_plugins[registry_plugin_count++] = ops;
+    registry_stale = true;
+    return true;
+}
+
+// Remove a registered plugin device (machines already created keep it)
+void device_unregister(const device_ops_t* ops) {
+    for (int i = 0; i < registry_plugin_count; i++) {
+        if (registry_plugins[i] == ops) {
+            memmove(&registry_plugins[i], &registry_plugins[i + 1],
+                    sizeof(registry_plugins[0]) * (registry_plugin_count - i - 1));
+            registry_plugin_count--;
+            registry_stale = true;
+            return;
+        }
+    }
+}
+
+// Load a shared object exporting a device_ops_t named DEVICE_PLUGIN_SYMBOL
+// and register it. The library stays loaded until exit.
+bool device_plugin_load(const char* path) {
+#ifdef _WIN32
+    HMODULE handle = LoadLibraryA(path);
+    if (!handle) {
+        fprintf(stderr, "Failed to load device plugin %s\n", path);
+        return false;
+    }
+    const device_ops_t* ops = (const device_ops_t*)GetProcAddress(handle, DEVICE_PLUGIN_SYMBOL);
+#else
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Failed to load device plugin %s: %s\n", path, dlerror());
+        return false;
+    }
+    const device_ops_t* ops = (const device_ops_t*)dlsym(handle, DEVICE_PLUGIN_SYMBOL);
+#endif
+
+    if (!ops) {
+        fprintf(stderr, "%s does not export %s\n", path, DEVICE_PLUGIN_SYMBOL);
+    } else if (device_register(ops)) {
+        return true;
+    }
+
+#ifdef _WIN32
+    FreeLibrary(handle);
+#else
+    dlclose(handle);
+#endif
+    return false;
+}
+
+// Keep a compiled map for the life of the process
+static bool registry_retain(device_map_t* map) {
+    device_map_t** maps = realloc(registry_maps, sizeof(*maps) * (registry_map_count + 1));
+    if (!maps) {
+        return false;
+    }
+    registry_maps = maps;
+    registry_maps[registry_map_count++] = map;
+    return true;
+}
+
+// Today's fixed layout: every device at its registered addresses, the rest
+// of the device page open, interrupt sources on their own lines
+void device_layout_default(device_layout_t* layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->regions[0].start = MMIO_DEVICE_START;
+    layout->regions[0].end = MMIO_DEVICE_END;
+    layout->regions[0].slot = DEVICE_SLOT_OPEN;
+    layout->region_count = 1;
+    for (int i = 0; i < PIC_SOURCES; i++) {
+        layout->irq_line[i] = (uint8_t)i;
+    }
+}
+
+// Map of the current registrations in the default layout, compiled on
+// first use after a change; NULL if it cannot be allocated
+const device_map_t* device_registry_map(void) {
+    static const device_map_t* current = NULL;
+
+    if (registry_stale || !current) {
+        device_layout_t layout;
+        device_layout_default(&layout);
+        device_map_t* map = registry_build(registry_plugins, registry_plugin_count, &layout);
+        if (!map || !registry_retain(map)) {
+            // Registrations were checked when added; only allocation can fail
+            fprintf(stderr, "Cannot build the device map\n");
+            free(map);
+            return NULL;
+        }
+        current = map;
+        registry_stale = false;
+    }
+    return current;
+}
+
+// Map of the current registrations in a machine layout; NULL if the layout
+// does not fit
+const device_map_t* device_registry_layout(const device_layout_t* layout) {
+    const device_map_t* builtin = device_registry_map();
+    if (!builtin) {
+        return NULL;
+    }
+
+    for (int i = 0; i < layout->placement_count; i++) {
+        bool known = false;
+        for (int d = 0; d < builtin->count; d++) {
+            known = known || strcmp(builtin->devices[d]->name, layout->placements[i].device) == 0;
+        }
+        if (!known) {
+            fprintf(stderr, "Unknown device %s\n", layout->placements[i].device);
+            return NULL;
+        }
+    }
+
+    device_map_t* map = registry_build(registry_plugins, registry_plugin_count, layout);
+    if (map && !registry_retain(map)) {
+        free(map);
+        map = NULL;
+    }
+    return map;
+}
+
+// True when [address, address + length) is plain memory. A page whose
+// slot table is 0 is all memory; a mixed page is checked address by address.
+bool device_map_is_memory(const device_map_t* map, uint16_t address, uint32_t length) {
+    uint32_t end = (uint32_t)address + length;
+    if (end > 0x10000) {
+        return false;
+    }
+    for (uint32_t page_start = address; page_start < end; page_start = (page_start | 0xFF) + 1) {
+        uint8_t table = map->page_table[page_start >> 8];
+        if (table == 0) {
+            continue;
+        }
+        uint32_t page_end = (page_start | 0xFF) + 1 < end ? (page_start | 0xFF) + 1 : end;
+        for (uint32_t i = page_start; i < page_end; i++) {
+            if (map->slot[table][i & 0xFF] != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// List a map's devices at their addresses in that map
+void device_map_print(const device_map_t* map) {
+    for (int i = 0; i < map->count; i++) {
+        const device_ops_t* ops = map->devices[i];
+        uint16_t offset = (uint16_t)-map->relocation[i];
+        uint16_t first = (uint16_t)(ops->ranges[0].base + offset);
+
+        printf("  %-12s", ops->name);
+        if (ops->ranges[0].size && device_map_slot(map, first) != i + 1) {
+            printf(" (not mapped)\n");
+            continue;
+        }
+        for (int r = 0; r < DEVICE_MAX_RANGES && ops->ranges[r].size; r++) {
+            uint16_t base = (uint16_t)(ops->ranges[r].base + offset);
+            printf(" 0x%04X-0x%04X", base, base + ops->ranges[r].size - 1);
+        }
+        printf("%s\n", i < device_builtin_count ? "" : " (plugin)");
+    }
+}
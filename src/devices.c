@@ -1,111 +1,827 @@
 #include "devices.h"
 #include "memory.h"
+#include "isa.h"
+#include "uart_sink.h"
+#include "uart_source.h"
+#include "uart_link.h"
+#include "wave.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Global device instances
-uart_device_t g_uart;
-gpio_device_t g_gpio;
-timer_device_t g_timer;
+// Default device set
+device_set_t g_devices;
+
+static void device_set_schedule(device_set_t* set);
+static void* device_set_state(device_set_t* set, int index);
+
+// Sync the timer to the given cycle. An expiry found on the way raises the
+// timer's PIC line as of the cycle it actually happened.
+static void device_set_sync_timer(device_set_t* set, uint64_t now) {
+    timer_device_t* timer = &set->timer;
+    uint64_t expiry = timer->next_expiry < now ? timer->next_expiry : now;
+    uint64_t expirations = timer->expirations;
+    bool was_pending = timer->irq_pending;
+    
+    timer_sync(timer, now);
+    if (!was_pending && timer->irq_pending) {
+        pic_set_line(&set->pic, set->map->irq_line[PIC_SOURCE_TIMER], true, expiry);
+    }
+    
+    // Traced timers are scheduled at every expiry, so this normally covers
+    // one; several only when the period is shorter than an instruction
+    if (set->wave && timer->expirations != expirations) {
+        uint64_t period = (uint64_t)timer->latch * timer->prescaler;
+        for (uint64_t n = expirations; n < timer->expirations; n++) {
+            wave_emit(set->wave, expiry, WAVE_SIGNAL_TIMER, n & 1, (n + 1) & 1, 0);
+            expiry += period;
+        }
+    }
+}
+
+// Trace a GPIO port change
+static void device_set_trace_gpio(device_set_t* set, uint8_t old_port) {
+    if (set->wave && set->gpio.port != old_port) {
+        wave_emit(set->wave, set->now, WAVE_SIGNAL_GPIO, old_port, set->gpio.port,
+                  set->gpio.direction);
+    }
+}
+
+// Device set functions
+// Initialise every registered device; the set dispatches through the
+// registry's map as of this call. False if the map cannot be built.
+bool device_set_init(device_set_t* set) {
+    const device_map_t* map = device_registry_map();
+    if (!map) {
+        return false;
+    }
+    device_set_init_map(set, map);
+    return true;
+}
+
+// Initialise the devices of a map compiled for a machine layout
+void device_set_init_map(device_set_t* set, const device_map_t* map) {
+    set->map = map;
+    memset(set->plugin_state, 0, sizeof(set->plugin_state));
+    set->wave = NULL;
+    set->now = 0;
+    set->next_event = UART_SINK_NO_DEADLINE;
+    set->irq = false;
+    
+    for (int i = 0; i < set->map->count; i++) {
+        const device_ops_t* ops = set->map->devices[i];
+        if (ops->init) {
+            ops->init(set, device_set_state(set, i));
+        }
+    }
+    device_set_schedule(set);
+}
+
+void device_set_tick(device_set_t* set) {
+    uart_tick(&set->uart);
+    gpio_tick(&set->gpio);
+    timer_tick(&set->timer);
+}
+
+// Plugin state of the device at the given map index (NULL if it has none)
+static void* device_set_state(device_set_t* set, int index) {
+    return set->map->devices[index]->state_size ? (uint8_t*)set->plugin_state + set->map->state_offset[index] : NULL;
+}
+
+// Register access, dispatched through the set's device map. Relocated
+// devices see the addresses they registered.
+uint8_t device_set_read(device_set_t* set, uint16_t address) {
+    uint8_t slot = device_map_slot(set->map, address);
+    if (slot == 0 || slot >= DEVICE_SLOT_ROM) {
+        return 0;
+    }
+    
+    const device_ops_t* ops = set->map->devices[slot - 1];
+    address += set->map->relocation[slot - 1];
+    return ops->read ? ops->read(set, device_set_state(set, slot - 1), address) : 0;
+}
+
+void device_set_write(device_set_t* set, uint16_t address, uint8_t value) {
+    uint8_t slot = device_map_slot(set->map, address);
+    if (slot == 0 || slot >= DEVICE_SLOT_ROM) {
+        return;
+    }
+    
+    const device_ops_t* ops = set->map->devices[slot - 1];
+    address += set->map->relocation[slot - 1];
+    if (ops->write) {
+        ops->write(set, device_set_state(set, slot - 1), address, value);
+    }
+    
+    // A write may move a plugin's next event
+    if (ops->next_event) {
+        device_set_schedule(set);
+    }
+}
+
+// In-tree device callbacks
+static void device_uart_init(device_set_t* set, void* state) {
+    (void)state;
+    uart_init(&set->uart);
+}
+
+static uint8_t device_uart_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    uint8_t value = uart_read(&set->uart, address);
+    if (address == UART_RX_ADDR) {
+        device_set_update_irq(set);
+    }
+    return value;
+}
+
+static void device_uart_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    uart_write(&set->uart, address, value);
+    device_set_update_irq(set);
+    if (address == UART_TX_ADDR && set->uart.tx_link) {
+        uart_link_push(set->uart.tx_link, set->now, value);
+    }
+    if (address == UART_TX_ADDR && set->uart.sink) {
+        uint64_t deadline = uart_sink_schedule(set->uart.sink, set->now);
+        if (deadline < set->next_event) {
+            set->next_event = deadline;
+        }
+    }
+}
+
+static void device_gpio_init(device_set_t* set, void* state) {
+    (void)state;
+    gpio_init(&set->gpio);
+}
+
+static uint8_t device_gpio_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return gpio_read(&set->gpio, address);
+}
+
+static void device_gpio_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    uint8_t old_port = set->gpio.port;
+    
+    // Allow writes to set the port value directly (tests expect this behavior)
+    gpio_write(&set->gpio, address, value);
+    if (address == GPIO_PORT_ADDR) {
+        device_set_trace_gpio(set, old_port);
+    } else {
+        device_set_update_irq(set);
+    }
+}
+
+static void device_timer_init(device_set_t* set, void* state) {
+    (void)state;
+    timer_init(&set->timer);
+}
+
+static uint8_t device_timer_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    // Count is computed on demand from the cycle of the access
+    device_set_sync_timer(set, set->now);
+    uint8_t value = timer_read(&set->timer, address);
+    device_set_update_irq(set);
+    return value;
+}
+
+static void device_timer_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    device_set_sync_timer(set, set->now);
+    timer_write(&set->timer, address, value);
+    timer_schedule(&set->timer);
+    device_set_update_irq(set);
+    device_set_schedule(set);
+}
+
+static void device_pic_init(device_set_t* set, void* state) {
+    (void)state;
+    pic_init(&set->pic);
+    
+    // Enable the lines the default sources are wired to
+    set->pic.mask = 0;
+    for (int source = 0; source < PIC_SOURCES; source++) {
+        if (PIC_MASK_DEFAULT & (1 << source)) {
+            set->pic.mask |= 1 << set->map->irq_line[source];
+        }
+    }
+}
+
+static uint8_t device_pic_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    device_set_sync_timer(set, set->now);
+    device_set_update_irq(set);
+    return pic_read(&set->pic, address);
+}
+
+static void device_pic_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    if (address != PIC_PENDING_ADDR) {
+        pic_write(&set->pic, address, value);
+        device_set_update_irq(set);
+        return;
+    }
+    
+    // Writing 1 acknowledges a latched source at the device; level
+    // sources (UART) stay pending until their condition clears
+    const uint8_t* line = set->map->irq_line;
+    device_set_sync_timer(set, set->now);
+    if (value & (1 << line[PIC_SOURCE_TIMER])) {
+        timer_clear_irq(&set->timer);
+    }
+    if (value & (1 << line[PIC_SOURCE_GPIO])) {
+        set->gpio.edges = 0;
+    }
+    if (value & (1 << line[PIC_SOURCE_DMA])) {
+        set->dma.done = false;
+    }
+    if (value & (1 << line[PIC_SOURCE_BLOCK])) {
+        set->block.done = false;
+    }
+    timer_schedule(&set->timer);
+    device_set_update_irq(set);
+    device_set_schedule(set);
+}
+
+static void device_dma_init(device_set_t* set, void* state) {
+    (void)state;
+    dma_init(&set->dma);
+}
+
+static uint8_t device_dma_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return dma_read(&set->dma, address);
+}
+
+static void device_dma_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    // A started transfer runs when the CPU next polls its devices
+    dma_write(&set->dma, address, value);
+    device_set_update_irq(set);
+}
+
+static void device_block_init(device_set_t* set, void* state) {
+    (void)state;
+    block_init(&set->block);
+}
+
+static uint8_t device_block_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return block_read(&set->block, address);
+}
+
+static void device_block_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    // A command runs when the CPU next polls its devices
+    block_write(&set->block, address, value);
+    device_set_update_irq(set);
+}
+
+static void device_fb_init(device_set_t* set, void* state) {
+    (void)state;
+    fb_init(&set->fb);
+}
+
+static uint8_t device_fb_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return fb_read(&set->fb, address);
+}
+
+static void device_fb_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    // A requested present happens when the CPU next polls its devices
+    fb_write(&set->fb, address, value);
+}
+
+static void device_mmu_init(device_set_t* set, void* state) {
+    (void)state;
+    mmu_init(&set->mmu, MEMORY_SIZE);
+}
+
+static uint8_t device_mmu_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return mmu_read(&set->mmu, address);
+}
+
+static void device_mmu_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    mmu_write(&set->mmu, address, value);
+}
+
+static void device_ipi_init(device_set_t* set, void* state) {
+    (void)state;
+    ipi_init(&set->ipi);
+}
+
+static uint8_t device_ipi_read(device_set_t* set, void* state, uint16_t address) {
+    (void)state;
+    return ipi_read(&set->ipi, address);
+}
+
+static void device_ipi_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)state;
+    // Cores notice the pending bit at their next device poll
+    ipi_write(&set->ipi, address, value);
+}
+
+// In-tree devices. Their timing is handled by device_set_service() itself.
+static const device_ops_t device_uart_ops = {
+    DEVICE_PLUGIN_ABI, "uart",
+    {{UART_TX_ADDR, 1, DEVICE_ACCESS_WRITE}, {UART_RX_ADDR, 1, DEVICE_ACCESS_READ},
+     {UART_STATUS_ADDR, 1, DEVICE_ACCESS_RW}, {UART_CTRL_ADDR, 1, DEVICE_ACCESS_RW}},
+    0, device_uart_init, NULL, device_uart_read, device_uart_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_gpio_ops = {
+    DEVICE_PLUGIN_ABI, "gpio",
+    {{GPIO_PORT_ADDR, 1, DEVICE_ACCESS_RW}, {GPIO_EDGE_ADDR, 1, DEVICE_ACCESS_RW}},
+    0, device_gpio_init, NULL, device_gpio_read, device_gpio_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_timer_ops = {
+    DEVICE_PLUGIN_ABI, "timer",
+    {{TIMER_LATCH_ADDR, TIMER_IRQ_ADDR - TIMER_LATCH_ADDR + 1, DEVICE_ACCESS_RW},
+     {TIMER_PRESCALER_ADDR, 1, DEVICE_ACCESS_RW}},
+    0, device_timer_init, NULL, device_timer_read, device_timer_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_pic_ops = {
+    DEVICE_PLUGIN_ABI, "pic",
+    {{PIC_PENDING_ADDR, PIC_SOURCE_ADDR - PIC_PENDING_ADDR, DEVICE_ACCESS_RW},
+     {PIC_SOURCE_ADDR, 2, DEVICE_ACCESS_READ},
+     {PIC_IN_SERVICE_ADDR + 1, PIC_VECTOR_ADDR + 2 * PIC_SOURCES - PIC_IN_SERVICE_ADDR - 1, DEVICE_ACCESS_RW}},
+    0, device_pic_init, NULL, device_pic_read, device_pic_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_dma_ops = {
+    DEVICE_PLUGIN_ABI, "dma",
+    {{DMA_SRC_ADDR, DMA_CYCLES_ADDR - DMA_SRC_ADDR + 1, DEVICE_ACCESS_RW}},
+    0, device_dma_init, NULL, device_dma_read, device_dma_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_block_ops = {
+    DEVICE_PLUGIN_ABI, "block",
+    {{BLOCK_SECTOR_ADDR, BLOCK_CTRL_ADDR - BLOCK_SECTOR_ADDR + 1, DEVICE_ACCESS_RW},
+     {BLOCK_SIZE_ADDR, 2, DEVICE_ACCESS_READ}},
+    0, device_block_init, NULL, device_block_read, device_block_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_fb_ops = {
+    DEVICE_PLUGIN_ABI, "framebuffer",
+    {{FB_CTRL_ADDR, 2, DEVICE_ACCESS_RW}},
+    0, device_fb_init, NULL, device_fb_read, device_fb_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_mmu_ops = {
+    DEVICE_PLUGIN_ABI, "mmu",
+    {{MMU_CTRL_ADDR, MMU_BANK_ADDR_H - MMU_CTRL_ADDR + 1, DEVICE_ACCESS_RW},
+     {MMU_SIZE_ADDR, 1, DEVICE_ACCESS_READ}},
+    0, device_mmu_init, NULL, device_mmu_read, device_mmu_write, NULL, NULL, NULL
+};
+
+static const device_ops_t device_ipi_ops = {
+    DEVICE_PLUGIN_ABI, "ipi",
+    {{IPI_CORE_ADDR, 2, DEVICE_ACCESS_READ}, {IPI_SEND_ADDR, 1, DEVICE_ACCESS_WRITE},
+     {IPI_PENDING_ADDR, 1, DEVICE_ACCESS_RW}},
+    0, device_ipi_init, NULL, device_ipi_read, device_ipi_write, NULL, NULL, NULL
+};
+
+const device_ops_t* const device_builtin_ops[] = {
+    &device_uart_ops, &device_gpio_ops, &device_timer_ops, &device_pic_ops,
+    &device_dma_ops, &device_block_ops, &device_fb_ops, &device_mmu_ops, &device_ipi_ops
+};
+const int device_builtin_count = sizeof(device_builtin_ops) / sizeof(device_builtin_ops[0]);
+
+// Deliver received bytes that are due at the baud rate pacing
+static void device_set_service_rx(device_set_t* set, uint64_t now) {
+    uart_device_t* uart = &set->uart;
+    uint8_t byte;
+    
+    while (uart->rx_next <= now) {
+        if (uart->rx_ready && uart->rx_fifo_count == UART_RX_FIFO_SIZE) {
+            // Overrun is not modelled: the host keeps the byte until there is room
+            uart->rx_next = now + uart->rx_cycles_per_byte;
+            break;
+        }
+        if (!uart_source_get(uart->source, &byte)) {
+            uart->rx_next = uart_source_finished(uart->source) ? UART_SINK_NO_DEADLINE
+                                                               : now + uart->rx_cycles_per_byte;
+            break;
+        }
+        uart_receive(uart, byte);
+        uart->rx_next += uart->rx_cycles_per_byte;
+    }
+    device_set_update_irq(set);
+}
+
+// Deliver bytes from another board that are due, at most one per
+// rx_cycles_per_byte
+static void device_set_service_link(device_set_t* set, uint64_t now) {
+    uart_device_t* uart = &set->uart;
+    uint64_t cycle;
+    uint8_t byte;
+    
+    while (uart->rx_next <= now && uart_link_peek(uart->rx_link, &cycle, &byte) && cycle <= now) {
+        if (!uart_receive(uart, byte)) {
+            // As for sources, the byte waits on the line until there is room
+            uart->rx_next = now + uart->rx_cycles_per_byte;
+            break;
+        }
+        uart_link_pop(uart->rx_link);
+        uart->rx_next = (cycle > uart->rx_next ? cycle : uart->rx_next) + uart->rx_cycles_per_byte;
+    }
+    device_set_update_irq(set);
+}
+
+// Cycle the link's next byte can be delivered at
+static uint64_t device_set_link_next(device_set_t* set) {
+    uint64_t cycle;
+    uint8_t byte;
+    
+    if (!uart_link_peek(set->uart.rx_link, &cycle, &byte)) {
+        return UART_SINK_NO_DEADLINE;
+    }
+    return cycle > set->uart.rx_next ? cycle : set->uart.rx_next;
+}
+
+// Earliest pending device event
+static void device_set_schedule(device_set_t* set) {
+    uint64_t next = set->timer.next_expiry;
+    
+    if (set->uart.sink && set->uart.sink->deadline < next) {
+        next = set->uart.sink->deadline;
+    }
+    if (set->uart.source && set->uart.rx_next < next) {
+        next = set->uart.rx_next;
+    }
+    if (set->uart.rx_link) {
+        uint64_t link = device_set_link_next(set);
+        if (link < next) {
+            next = link;
+        }
+    }
+    for (int i = device_builtin_count; i < set->map->count; i++) {
+        const device_ops_t* ops = set->map->devices[i];
+        if (ops->next_event) {
+            uint64_t event = ops->next_event(set, device_set_state(set, i));
+            if (event < next) {
+                next = event;
+            }
+        }
+    }
+    set->next_event = next;
+}
+
+// Run device work that is due by the given cycle and compute the next event
+void device_set_service(device_set_t* set, uint64_t now) {
+    uart_sink_t* sink = set->uart.sink;
+    
+    set->now = now;
+    if (sink && sink->deadline <= now) {
+        uart_sink_flush(sink);
+    }
+    if (set->uart.source && set->uart.rx_next <= now) {
+        device_set_service_rx(set, now);
+    }
+    if (set->uart.rx_link && set->uart.rx_next <= now) {
+        device_set_service_link(set, now);
+    }
+    if (set->timer.next_expiry <= now) {
+        device_set_sync_timer(set, now);
+        timer_schedule(&set->timer);
+        device_set_update_irq(set);
+    }
+    for (int i = device_builtin_count; i < set->map->count; i++) {
+        const device_ops_t* ops = set->map->devices[i];
+        void* state = device_set_state(set, i);
+        if (ops->service && ops->next_event && ops->next_event(set, state) <= now) {
+            ops->service(set, state, now);
+        }
+    }
+    device_set_schedule(set);
+}
+
+// Push all pending host output (halt, reset, end of run)
+void device_set_flush(device_set_t* set) {
+    if (set->uart.sink) {
+        uart_sink_flush(set->uart.sink);
+    }
+    device_set_schedule(set);
+}
+
+// Flush host output and make the given cycle the new cycle 0 (CPU reset,
+// position-independent state encoding)
+void device_set_rebase(device_set_t* set, uint64_t now) {
+    if (set->uart.sink) {
+        uart_sink_flush(set->uart.sink);
+    }
+    
+    device_set_sync_timer(set, now);
+    set->timer.sync_cycle = 0;
+    timer_schedule(&set->timer);
+    
+    for (int i = 0; i < PIC_SOURCES; i++) {
+        uint64_t* asserted = &set->pic.asserted_at[i];
+        *asserted = *asserted > now ? *asserted - now : 0;
+    }
+    
+    if ((set->uart.source || set->uart.rx_link) && set->uart.rx_next != UART_SINK_NO_DEADLINE) {
+        set->uart.rx_next = set->uart.rx_next > now ? set->uart.rx_next - now : 0;
+    }
+    set->fb.next_auto = set->fb.next_auto > now ? set->fb.next_auto - now : 0;
+    for (int i = device_builtin_count; i < set->map->count; i++) {
+        const device_ops_t* ops = set->map->devices[i];
+        if (ops->reset) {
+            ops->reset(set, device_set_state(set, i), now);
+        }
+    }
+    set->now = 0;
+    device_set_update_irq(set);
+    device_set_schedule(set);
+}
+
+// Feed each source's request level to the interrupt controller and
+// recompute its output to the CPU (level triggered)
+void device_set_update_irq(device_set_t* set) {
+    pic_device_t* pic = &set->pic;
+    const uart_device_t* uart = &set->uart;
+    const uint8_t* line = set->map->irq_line;
+    uint8_t old_lines = pic->lines;
+    bool old_irq = set->irq;
+    
+    pic_set_line(pic, line[PIC_SOURCE_TIMER], set->timer.irq_pending, set->now);
+    pic_set_line(pic, line[PIC_SOURCE_UART_RX], (uart->control & UART_CTRL_RX_IRQ) && uart->rx_ready, set->now);
+    pic_set_line(pic, line[PIC_SOURCE_UART_TX], (uart->control & UART_CTRL_TX_IRQ) && uart->tx_empty, set->now);
+    pic_set_line(pic, line[PIC_SOURCE_GPIO], set->gpio.edges != 0, set->now);
+    pic_set_line(pic, line[PIC_SOURCE_DMA], set->dma.done && (set->dma.control & DMA_CTRL_IRQ), set->now);
+    pic_set_line(pic, line[PIC_SOURCE_BLOCK], set->block.done && (set->block.control & BLOCK_CTRL_IRQ), set->now);
+    set->irq = pic_highest(pic) != PIC_NO_SOURCE;
+    
+    if (set->wave) {
+        if (pic->lines != old_lines) {
+            wave_emit(set->wave, set->now, WAVE_SIGNAL_PIC, old_lines, pic->lines, 0);
+        }
+        if (set->irq != old_irq) {
+            wave_emit(set->wave, set->now, WAVE_SIGNAL_IRQ, old_irq, set->irq, 0);
+        }
+    }
+}
+
+// Drive a GPIO input pin from the host; a change latches an edge
+void device_set_set_pin(device_set_t* set, uint8_t pin, bool state) {
+    uint8_t old_port = set->gpio.port;
+    
+    gpio_set_pin(&set->gpio, pin, state);
+    device_set_trace_gpio(set, old_port);
+    device_set_update_irq(set);
+}
+
+// Interrupt entry: take the highest-priority request and record its
+// latency; the vector table replaces the handler address when it supplies
+// one. False when no request is pending.
+bool device_set_acknowledge_irq(device_set_t* set, uint64_t now, uint16_t* vector) {
+    pic_device_t* pic = &set->pic;
+    uint8_t source = pic_acknowledge(pic, now);
+    
+    set->irq = pic_highest(pic) != PIC_NO_SOURCE;
+    if (source == PIC_NO_SOURCE) {
+        return false;
+    }
+    if ((pic->control & PIC_CTRL_VECTORED) && pic->vector[source] != 0) {
+        *vector = pic->vector[source];
+    }
+    return true;
+}
+
+// Start or stop (NULL) tracing signal changes. Tracing starts with one
+// event per signal recording its current value.
+void device_set_attach_wave(device_set_t* set, struct wave_queue* queue) {
+    device_set_sync_timer(set, set->now);
+    set->wave = queue;
+    set->timer.traced = queue != NULL;
+    timer_schedule(&set->timer);
+    device_set_schedule(set);
+    
+    if (queue) {
+        uint8_t timer_out = set->timer.expirations & 1;
+        wave_emit(queue, set->now, WAVE_SIGNAL_GPIO, set->gpio.port, set->gpio.port, set->gpio.direction);
+        wave_emit(queue, set->now, WAVE_SIGNAL_TIMER, timer_out, timer_out, 0);
+        wave_emit(queue, set->now, WAVE_SIGNAL_PIC, set->pic.lines, set->pic.lines, 0);
+        wave_emit(queue, set->now, WAVE_SIGNAL_IRQ, set->irq, set->irq, 0);
+    }
+}
+
+// Reset counters and timestamps that are not machine state, so equal
+// machines compare byte-for-byte (explorer state encoding)
+void device_set_clear_stats(device_set_t* set) {
+    pic_device_t* pic = &set->pic;
+    
+    set->timer.expirations = 0;
+    set->dma.bytes = 0;
+    set->dma.transfers = 0;
+    set->block.sectors_read = 0;
+    set->block.sectors_written = 0;
+    set->fb.frames = 0;
+    memset(pic->asserted_at, 0, sizeof(pic->asserted_at));
+    memset(pic->dispatches, 0, sizeof(pic->dispatches));
+    memset(pic->latency_total, 0, sizeof(pic->latency_total));
+    memset(pic->latency_max, 0, sizeof(pic->latency_max));
+}
+
+// Feed the UART receiver from a host source, one byte per cycles_per_byte
+void device_set_attach_source(device_set_t* set, struct uart_source* source, uint32_t cycles_per_byte) {
+    set->uart.source = source;
+    set->uart.rx_cycles_per_byte = cycles_per_byte ? cycles_per_byte : 1;
+    set->uart.rx_next = set->now;
+    device_set_schedule(set);
+}
+
+// Connect the UART to other boards: TX bytes are queued on tx, and bytes
+// from rx are delivered when due, one per cycles_per_byte. Either may be
+// NULL; rx replaces a host source.
+void device_set_attach_links(device_set_t* set, struct uart_link* tx, struct uart_link* rx, uint32_t cycles_per_byte) {
+    set->uart.tx_link = tx;
+    set->uart.rx_link = rx;
+    if (rx) {
+        set->uart.source = NULL;
+        set->uart.rx_cycles_per_byte = cycles_per_byte ? cycles_per_byte : 1;
+        set->uart.rx_next = set->now;
+    }
+    device_set_schedule(set);
+}
+
+// Recompute the next device event after input changed outside the
+// machine (a link's horizon moved)
+void device_set_reschedule(device_set_t* set) {
+    device_set_schedule(set);
+}
+
+// Back the block device with a host image of the given size in sectors
+// (NULL detaches it; commands then fail with ERROR)
+void device_set_attach_block(device_set_t* set, struct block_image* image, uint32_t sectors) {
+    set->block.image = image;
+    set->block.sectors = image ? sectors : 0;
+}
+
+// Publish presented frames to a host display (NULL detaches). The next
+// present sends the whole frame.
+void device_set_attach_display(device_set_t* set, struct fb_display* display) {
+    set->fb.display = display;
+    set->fb.dirty = FB_ALL_ROWS;
+}
+
+// Pack the architecturally visible device state at cycle now into a
+// padding-free buffer of at most DEVICES_STATE_SIZE bytes. Returns the
+// number of bytes written.
+size_t device_set_pack_state(const device_set_t* set, uint64_t now, uint8_t* buffer) {
+    const uart_device_t* uart = &set->uart;
+    const gpio_device_t* gpio = &set->gpio;
+    const pic_device_t* pic = &set->pic;
+    const dma_device_t* dma = &set->dma;
+    const block_device_t* block = &set->block;
+    const fb_device_t* fb = &set->fb;
+    const mmu_device_t* mmu = &set->mmu;
+    const ipi_device_t* ipi = &set->ipi;
+    size_t n = 0;
+    
+    // The timer is stored relative to its last sync; pack it as of now
+    timer_device_t synced = set->timer;
+    timer_device_t* timer = &synced;
+    timer_sync(timer, now);
+    
+    buffer[n++] = uart->tx_data;
+    buffer[n++] = uart->rx_data;
+    buffer[n++] = uart->status;
+    buffer[n++] = (uart->tx_ready ? 0x01 : 0) | (uart->rx_ready ? 0x02 : 0) |
+                  (uart->tx_empty ? 0x04 : 0) | (uart->rx_full ? 0x08 : 0);
+    buffer[n++] = uart->control;
+    buffer[n++] = uart->rx_fifo_count;
+    for (int i = 0; i < uart->rx_fifo_count; i++) {
+        buffer[n++] = uart->rx_fifo[(uart->rx_fifo_head + i) % UART_RX_FIFO_SIZE];
+    }
+    
+    buffer[n++] = gpio->port;
+    buffer[n++] = gpio->direction;
+    buffer[n++] = gpio->pullup;
+    buffer[n++] = gpio->edges;
+    
+    buffer[n++] = timer->latch & 0xFF;
+    buffer[n++] = timer->latch >> 8;
+    buffer[n++] = timer->count & 0xFF;
+    buffer[n++] = timer->count >> 8;
+    buffer[n++] = timer->control;
+    buffer[n++] = (timer->irq_enabled ? 0x01 : 0) | (timer->irq_pending ? 0x02 : 0) |
+                  (timer->running ? 0x04 : 0);
+    for (int i = 0; i < 4; i++) {
+        buffer[n++] = (timer->prescaler >> (8 * i)) & 0xFF;
+    }
+    for (int i = 0; i < 4; i++) {
+        buffer[n++] = (timer->prescaler_count >> (8 * i)) & 0xFF;
+    }
+    
+    // Request lines are derived from the devices above
+    buffer[n++] = pic->mask;
+    buffer[n++] = pic->control;
+    buffer[n++] = pic->in_service;
+    for (int i = 0; i < PIC_SOURCES; i++) {
+        buffer[n++] = pic->priority[i];
+        buffer[n++] = pic->vector[i] & 0xFF;
+        buffer[n++] = pic->vector[i] >> 8;
+    }
+    
+    buffer[n++] = dma->source & 0xFF;
+    buffer[n++] = dma->source >> 8;
+    buffer[n++] = dma->dest & 0xFF;
+    buffer[n++] = dma->dest >> 8;
+    buffer[n++] = dma->length & 0xFF;
+    buffer[n++] = dma->length >> 8;
+    buffer[n++] = dma->mode;
+    buffer[n++] = dma->control | (dma->busy ? 0x10 : 0) | (dma->done ? 0x20 : 0);
+    buffer[n++] = dma->cycles_per_byte;
+    
+    buffer[n++] = block->sector & 0xFF;
+    buffer[n++] = block->sector >> 8;
+    buffer[n++] = block->buffer & 0xFF;
+    buffer[n++] = block->buffer >> 8;
+    buffer[n++] = block->count;
+    buffer[n++] = block->command;
+    buffer[n++] = block->control | (block->busy ? 0x10 : 0) | (block->done ? 0x20 : 0) |
+                  (block->error ? 0x40 : 0);
+    
+    buffer[n++] = fb->control | (fb->present_pending ? FB_CTRL_PRESENT : 0);
+    buffer[n++] = fb->format;
+    
+    // The page bases are derived from the bank registers
+    buffer[n++] = mmu->control;
+    buffer[n++] = mmu->window;
+    for (int i = 0; i < MMU_PAGES; i++) {
+        buffer[n++] = mmu->bank[i] & 0xFF;
+        buffer[n++] = mmu->bank[i] >> 8;
+    }
+    
+    // The accessing core is not state
+    buffer[n++] = ipi->cores;
+    buffer[n++] = atomics_load_u8(&ipi->pending, ATOMICS_ACQUIRE);
+    
+    // Plugin devices: their snapshot, or their raw state
+    for (int i = device_builtin_count; i < set->map->count; i++) {
+        const device_ops_t* ops = set->map->devices[i];
+        const uint8_t* state = (const uint8_t*)set->plugin_state + set->map->state_offset[i];
+        if (ops->snapshot) {
+            n += ops->snapshot(set, ops->state_size ? state : NULL, now, &buffer[n]);
+        } else if (ops->state_size) {
+            memcpy(&buffer[n], state, ops->state_size);
+            n += ops->state_size;
+        }
+    }
+    
+    return n;
+}
 
 // Device system functions
-void devices_init(void) {
-    uart_init(&g_uart);
-    gpio_init(&g_gpio);
-    timer_init(&g_timer);
+bool devices_init(void) {
+    if (!device_set_init(&g_devices)) {
+        return false;
+    }
+    uart_set_sink(&g_devices.uart, uart_sink_default());
+    return true;
 }
 
 void devices_cleanup(void) {
-    // Cleanup if needed
+    device_set_flush(&g_devices);
 }
 
 void devices_tick(void) {
-    uart_tick(&g_uart);
-    gpio_tick(&g_gpio);
-    timer_tick(&g_timer);
+    device_set_tick(&g_devices);
 }
 
 // Device access functions
 uint8_t devices_read(uint16_t address) {
-    switch (address) {
-        case UART_TX_ADDR:
-        case UART_RX_ADDR:
-        case UART_STATUS_ADDR:
-            return uart_read(&g_uart, address);
-            
-        case GPIO_PORT_ADDR:
-            return gpio_read(&g_gpio, address);
-            
-        case TIMER_LATCH_ADDR:
-        case TIMER_LATCH_ADDR_H:
-        case TIMER_CTRL_ADDR:
-        case TIMER_COUNT_ADDR:
-        case TIMER_COUNT_ADDR_H:
-        case TIMER_IRQ_ADDR:
-            return timer_read(&g_timer, address);
-            
-        default:
-            return 0;
-    }
+    return device_set_read(&g_devices, address);
 }
 
 void devices_write(uint16_t address, uint8_t value) {
-    switch (address) {
-        case UART_TX_ADDR:
-        case UART_RX_ADDR:
-        case UART_STATUS_ADDR:
-            uart_write(&g_uart, address, value);
-            break;
-            
-        case GPIO_PORT_ADDR:
-            // Allow writes to set the port value directly (tests expect this behavior)
-            gpio_write(&g_gpio, address, value);
-            break;
-            
-        case TIMER_LATCH_ADDR:
-        case TIMER_LATCH_ADDR_H:
-        case TIMER_CTRL_ADDR:
-        case TIMER_COUNT_ADDR:
-        case TIMER_COUNT_ADDR_H:
-        case TIMER_IRQ_ADDR:
-            timer_write(&g_timer, address, value);
-            break;
-    }
+    device_set_write(&g_devices, address, value);
 }
 
+// Access checks use the registry's current map (claimed ranges and their access bits)
 bool devices_is_readable(uint16_t address) {
-    switch (address) {
-        case UART_RX_ADDR:
-        case UART_STATUS_ADDR:
-        case GPIO_PORT_ADDR:
-        case TIMER_LATCH_ADDR:
-        case TIMER_LATCH_ADDR_H:
-        case TIMER_CTRL_ADDR:
-        case TIMER_COUNT_ADDR:
-        case TIMER_COUNT_ADDR_H:
-        case TIMER_IRQ_ADDR:
-            return true;
-        default:
-            return false;
+    const device_map_t* map = device_registry_map();
+    if (!map) {
+        return false;
     }
+    uint8_t page = map->page_table[address >> 8];
+    return map->slot[page][address & 0xFF] != 0 && (map->access[page][address & 0xFF] & DEVICE_ACCESS_READ);
 }
 
 bool devices_is_writable(uint16_t address) {
-    switch (address) {
-        case UART_TX_ADDR:
-        case UART_STATUS_ADDR:
-        case GPIO_PORT_ADDR:
-        case TIMER_LATCH_ADDR:
-        case TIMER_LATCH_ADDR_H:
-        case TIMER_CTRL_ADDR:
-        case TIMER_COUNT_ADDR:
-        case TIMER_COUNT_ADDR_H:
-        case TIMER_IRQ_ADDR:
-            return true;
-        default:
-            return false;
+    const device_map_t* map = device_registry_map();
+    if (!map) {
+        return false;
     }
+    uint8_t page = map->page_table[address >> 8];
+    return map->slot[page][address & 0xFF] != 0 && (map->access[page][address & 0xFF] & DEVICE_ACCESS_WRITE);
 }
 
 // UART implementation
@@ -117,6 +833,15 @@ void uart_init(uart_device_t* uart) {
     uart->rx_ready = false;
     uart->tx_empty = true;
     uart->rx_full = false;
+    uart->control = 0;
+    uart->rx_fifo_head = 0;
+    uart->rx_fifo_count = 0;
+    uart->sink = NULL;
+    uart->source = NULL;
+    uart->tx_link = NULL;
+    uart->rx_link = NULL;
+    uart->rx_cycles_per_byte = 1;
+    uart->rx_next = UART_SINK_NO_DEADLINE;
 }
 
 void uart_tick(uart_device_t* uart) {
@@ -126,9 +851,22 @@ void uart_tick(uart_device_t* uart) {
 
 uint8_t uart_read(uart_device_t* uart, uint16_t address) {
     switch (address) {
-        case UART_RX_ADDR:
-            uart->rx_ready = false;
-            return uart->rx_data;
+        case UART_RX_ADDR: {
+            // Reading the data register moves the next queued byte up
+            uint8_t value = uart->rx_data;
+            if (uart->rx_fifo_count > 0) {
+                uart->rx_data = uart->rx_fifo[uart->rx_fifo_head];
+                uart->rx_fifo_head = (uart->rx_fifo_head + 1) % UART_RX_FIFO_SIZE;
+                uart->rx_fifo_count--;
+            } else {
+                uart->rx_ready = false;
+            }
+            uart->rx_full = false;
+            return value;
+        }
+            
+        case UART_CTRL_ADDR:
+            return uart->control;
             
         case UART_STATUS_ADDR:
             return (uart->tx_ready ? 0x01 : 0x00) | 
@@ -148,9 +886,10 @@ void uart_write(uart_device_t* uart, uint16_t address, uint8_t value) {
             uart->tx_ready = false;
             uart->tx_empty = false;
             
-            // Simulate character output
-            printf("%c", value);
-            fflush(stdout);
+            // Buffered host output; the sink decides when to flush
+            if (uart->sink) {
+                uart_sink_put(uart->sink, value);
+            }
             
             // Mark as ready for next character
             uart->tx_ready = true;
@@ -160,7 +899,28 @@ void uart_write(uart_device_t* uart, uint16_t address, uint8_t value) {
         case UART_STATUS_ADDR:
             // Status register is read-only
             break;
+            
+        case UART_CTRL_ADDR:
+            uart->control = value;
+            break;
+    }
+}
+
+// Latch a received byte; false when the data register and FIFO are full
+bool uart_receive(uart_device_t* uart, uint8_t byte) {
+    if (!uart->rx_ready) {
+        uart->rx_data = byte;
+        uart->rx_ready = true;
+        return true;
+    }
+    if (uart->rx_fifo_count == UART_RX_FIFO_SIZE) {
+        return false;
     }
+    
+    uart->rx_fifo[(uart->rx_fifo_head + uart->rx_fifo_count) % UART_RX_FIFO_SIZE] = byte;
+    uart->rx_fifo_count++;
+    uart->rx_full = uart->rx_fifo_count == UART_RX_FIFO_SIZE;
+    return true;
 }
 
 void uart_send_char(uart_device_t* uart, char c) {
@@ -169,8 +929,7 @@ void uart_send_char(uart_device_t* uart, char c) {
 
 char uart_receive_char(uart_device_t* uart) {
     if (uart->rx_ready) {
-        uart->rx_ready = false;
-        return uart->rx_data;
+        return uart_read(uart, UART_RX_ADDR);
     }
     return 0;
 }
@@ -183,11 +942,19 @@ bool uart_is_rx_ready(uart_device_t* uart) {
     return uart->rx_ready;
 }
 
+void uart_set_sink(uart_device_t* uart, struct uart_sink* sink) {
+    if (uart->sink && uart->sink != sink) {
+        uart_sink_flush(uart->sink);
+    }
+    uart->sink = sink;
+}
+
 // GPIO implementation
 void gpio_init(gpio_device_t* gpio) {
     gpio->port = 0;
     gpio->direction = 0; // All inputs by default
     gpio->pullup = 0;    // No pullups by default
+    gpio->edges = 0;
 }
 
 void gpio_tick(gpio_device_t* gpio) {
@@ -199,6 +966,9 @@ uint8_t gpio_read(gpio_device_t* gpio, uint16_t address) {
         case GPIO_PORT_ADDR:
             return gpio->port;
             
+        case GPIO_EDGE_ADDR:
+            return gpio->edges;
+            
         default:
             return 0;
     }
@@ -210,11 +980,20 @@ void gpio_write(gpio_device_t* gpio, uint16_t address, uint8_t value) {
             // Write the full value to the port. Tests expect writes to set the value directly.
             gpio->port = value;
             break;
+            
+        case GPIO_EDGE_ADDR:
+            // Write 1 to clear
+            gpio->edges &= ~value;
+            break;
     }
 }
 
 void gpio_set_pin(gpio_device_t* gpio, uint8_t pin, bool state) {
     if (pin < 8) {
+        // Latch an edge when an input pin changes level
+        if (!(gpio->direction & (1 << pin)) && gpio_get_pin(gpio, pin) != state) {
+            gpio->edges |= (1 << pin);
+        }
         if (state) {
             gpio->port |= (1 << pin);
         } else {
@@ -240,35 +1019,72 @@ void timer_init(timer_device_t* timer) {
     timer->running = false;
     timer->prescaler = 1;
     timer->prescaler_count = 0;
+    timer->sync_cycle = 0;
+    timer->next_expiry = UART_SINK_NO_DEADLINE;
+    timer->expirations = 0;
+    timer->traced = false;
 }
 
-void timer_tick(timer_device_t* timer) {
-    if (!timer->running) {
+// Advance the timer by a number of cycles in O(1). Equivalent to calling
+// timer_tick() that many times: every prescaler-th cycle decrements count,
+// reaching zero raises the IRQ and, in continuous mode, reloads the latch.
+void timer_advance(timer_device_t* timer, uint64_t cycles) {
+    if (!timer->running || cycles == 0) {
         return;
     }
     
-    timer->prescaler_count++;
-    if (timer->prescaler_count >= timer->prescaler) {
-        timer->prescaler_count = 0;
-        
-        if (timer->count > 0) {
-            timer->count--;
-            
-            if (timer->count == 0) {
-                // Timer expired
-                if (timer->irq_enabled) {
-                    timer->irq_pending = true;
-                }
-                
-                // Reload from latch if in continuous mode
-                if (timer->control & 0x01) {
-                    timer->count = timer->latch;
-                }
-            }
-        }
+    uint64_t total = timer->prescaler_count + cycles;
+    uint64_t decrements = total / timer->prescaler;
+    timer->prescaler_count = (uint32_t)(total % timer->prescaler);
+    
+    if (decrements == 0 || timer->count == 0) {
+        return;
+    }
+    if (decrements < timer->count) {
+        timer->count -= (uint16_t)decrements;
+        return;
+    }
+    
+    // At least one expiry; in continuous mode one more every latch decrements
+    uint64_t after = decrements - timer->count;
+    uint64_t expiries = 1;
+    if ((timer->control & 0x01) && timer->latch > 0) {
+        expiries += after / timer->latch;
+        timer->count = (uint16_t)(timer->latch - after % timer->latch);
+    } else {
+        timer->count = (timer->control & 0x01) ? timer->latch : 0;
+    }
+    
+    timer->expirations += expiries;
+    if (timer->irq_enabled) {
+        timer->irq_pending = true;
     }
 }
 
+// Bring count and prescaler phase up to date at the given cycle
+void timer_sync(timer_device_t* timer, uint64_t now) {
+    if (now > timer->sync_cycle) {
+        timer_advance(timer, now - timer->sync_cycle);
+    }
+    timer->sync_cycle = now;
+}
+
+// Compute the cycle of the next expiry that raises an IRQ (of every
+// expiry while traced)
+void timer_schedule(timer_device_t* timer) {
+    if (!timer->running || !(timer->irq_enabled || timer->traced) || timer->count == 0) {
+        timer->next_expiry = UART_SINK_NO_DEADLINE;
+        return;
+    }
+    timer->next_expiry = timer->sync_cycle + (uint64_t)timer->count * timer->prescaler -
+                         timer->prescaler_count;
+}
+
+void timer_tick(timer_device_t* timer) {
+    timer_advance(timer, 1);
+    timer->sync_cycle++;
+}
+
 uint8_t timer_read(timer_device_t* timer, uint16_t address) {
     switch (address) {
         case TIMER_LATCH_ADDR:
@@ -289,6 +1105,9 @@ uint8_t timer_read(timer_device_t* timer, uint16_t address) {
         case TIMER_IRQ_ADDR:
             return timer->irq_pending ? 0x01 : 0x00;
             
+        case TIMER_PRESCALER_ADDR:
+            return (uint8_t)(timer->prescaler - 1);
+            
         default:
             return 0;
     }
@@ -328,6 +1147,12 @@ void timer_write(timer_device_t* timer, uint16_t address, uint8_t value) {
                 timer_clear_irq(timer);
             }
             break;
+            
+        case TIMER_PRESCALER_ADDR:
+            // Divide by value + 1; restarts the prescaler phase
+            timer->prescaler = (uint32_t)value + 1;
+            timer->prescaler_count = 0;
+            break;
     }
 }
 
@@ -353,3 +1178,549 @@ bool timer_is_irq_pending(timer_device_t* timer) {
 void timer_clear_irq(timer_device_t* timer) {
     timer->irq_pending = false;
 }
+
+// DMA implementation
+void dma_init(dma_device_t* dma) {
+    memset(dma, 0, sizeof(*dma));
+    dma->cycles_per_byte = 1;
+}
+
+uint8_t dma_read(dma_device_t* dma, uint16_t address) {
+    switch (address) {
+        case DMA_SRC_ADDR:
+            return dma->source & 0xFF;
+            
+        case DMA_SRC_ADDR_H:
+            return dma->source >> 8;
+            
+        case DMA_DST_ADDR:
+            return dma->dest & 0xFF;
+            
+        case DMA_DST_ADDR_H:
+            return dma->dest >> 8;
+            
+        case DMA_LEN_ADDR:
+            return dma->length & 0xFF;
+            
+        case DMA_LEN_ADDR_H:
+            return dma->length >> 8;
+            
+        case DMA_MODE_ADDR:
+            return dma->mode;
+            
+        case DMA_CTRL_ADDR:
+            return (dma->busy ? DMA_STATUS_BUSY : 0) | (dma->control & DMA_CTRL_IRQ) |
+                   (dma->done ? DMA_STATUS_DONE : 0);
+            
+        case DMA_CYCLES_ADDR:
+            return dma->cycles_per_byte;
+            
+        default:
+            return 0;
+    }
+}
+
+void dma_write(dma_device_t* dma, uint16_t address, uint8_t value) {
+    switch (address) {
+        case DMA_SRC_ADDR:
+            dma->source = (dma->source & 0xFF00) | value;
+            break;
+            
+        case DMA_SRC_ADDR_H:
+            dma->source = (dma->source & 0x00FF) | (value << 8);
+            break;
+            
+        case DMA_DST_ADDR:
+            dma->dest = (dma->dest & 0xFF00) | value;
+            break;
+            
+        case DMA_DST_ADDR_H:
+            dma->dest = (dma->dest & 0x00FF) | (value << 8);
+            break;
+            
+        case DMA_LEN_ADDR:
+            dma->length = (dma->length & 0xFF00) | value;
+            break;
+            
+        case DMA_LEN_ADDR_H:
+            dma->length = (dma->length & 0x00FF) | (value << 8);
+            break;
+            
+        case DMA_MODE_ADDR:
+            dma->mode = value & 0x03;
+            break;
+            
+        case DMA_CTRL_ADDR:
+            // Any control write clears the completion flag
+            dma->control = value & DMA_CTRL_IRQ;
+            dma->done = false;
+            if (value & DMA_CTRL_START) {
+                dma->busy = true;
+            }
+            break;
+            
+        case DMA_CYCLES_ADDR:
+            dma->cycles_per_byte = value;
+            break;
+    }
+}
+
+// Mark the current transfer finished
+void dma_complete(dma_device_t* dma) {
+    dma->busy = false;
+    dma->done = true;
+    dma->transfers++;
+}
+
+// Block device implementation
+void block_init(block_device_t* block) {
+    memset(block, 0, sizeof(*block));
+    block->count = 1;
+}
+
+uint8_t block_read(block_device_t* block, uint16_t address) {
+    // Images beyond 16-bit sector numbers report the addressable part
+    uint16_t size = block->sectors > 0xFFFF ? 0xFFFF : block->sectors;
+    
+    switch (address) {
+        case BLOCK_SECTOR_ADDR:
+            return block->sector & 0xFF;
+            
+        case BLOCK_SECTOR_ADDR_H:
+            return block->sector >> 8;
+            
+        case BLOCK_BUFFER_ADDR:
+            return block->buffer & 0xFF;
+            
+        case BLOCK_BUFFER_ADDR_H:
+            return block->buffer >> 8;
+            
+        case BLOCK_COUNT_ADDR:
+            return block->count;
+            
+        case BLOCK_CMD_ADDR:
+            return block->command;
+            
+        case BLOCK_STATUS_ADDR:
+            return (block->busy ? BLOCK_STATUS_BUSY : 0) | (block->error ? BLOCK_STATUS_ERROR : 0) |
+                   (block->done ? BLOCK_STATUS_DONE : 0);
+            
+        case BLOCK_CTRL_ADDR:
+            return block->control;
+            
+        case BLOCK_SIZE_ADDR:
+            return size & 0xFF;
+            
+        case BLOCK_SIZE_ADDR_H:
+            return size >> 8;
+            
+        default:
+            return 0;
+    }
+}
+
+void block_write(block_device_t* block, uint16_t address, uint8_t value) {
+    switch (address) {
+        case BLOCK_SECTOR_ADDR:
+            block->sector = (block->sector & 0xFF00) | value;
+            break;
+            
+        case BLOCK_SECTOR_ADDR_H:
+            block->sector = (block->sector & 0x00FF) | (value << 8);
+            break;
+            
+        case BLOCK_BUFFER_ADDR:
+            block->buffer = (block->buffer & 0xFF00) | value;
+            break;
+            
+        case BLOCK_BUFFER_ADDR_H:
+            block->buffer = (block->buffer & 0x00FF) | (value << 8);
+            break;
+            
+        case BLOCK_COUNT_ADDR:
+            block->count = value;
+            break;
+            
+        case BLOCK_CMD_ADDR:
+            // A command written while busy is ignored
+            if (block->busy || value == BLOCK_CMD_NONE || value > BLOCK_CMD_FLUSH) {
+                break;
+            }
+            block->command = value;
+            block->busy = true;
+            block->done = false;
+            block->error = false;
+            break;
+            
+        case BLOCK_STATUS_ADDR:
+            block->done = false;
+            block->error = false;
+            break;
+            
+        case BLOCK_CTRL_ADDR:
+            block->control = value & BLOCK_CTRL_IRQ;
+            break;
+    }
+}
+
+// Mark the current command finished
+void block_complete(block_device_t* block, bool error) {
+    block->busy = false;
+    block->done = true;
+    block->error = error;
+}
+
+// Framebuffer implementation
+void fb_init(fb_device_t* fb) {
+    memset(fb, 0, sizeof(*fb));
+    fb->control = FB_CTRL_AUTO;
+    fb->format = FB_FORMAT_MONO;
+    fb->dirty = FB_ALL_ROWS;
+}
+
+uint8_t fb_read(fb_device_t* fb, uint16_t address) {
+    switch (address) {
+        case FB_CTRL_ADDR:
+            return fb->control | (fb->present_pending ? FB_CTRL_PRESENT : 0);
+            
+        case FB_FORMAT_ADDR:
+            return fb->format;
+            
+        default:
+            return 0;
+    }
+}
+
+void fb_write(fb_device_t* fb, uint16_t address, uint8_t value) {
+    switch (address) {
+        case FB_CTRL_ADDR:
+            fb->control = value & FB_CTRL_AUTO;
+            if (value & FB_CTRL_PRESENT) {
+                fb->present_pending = true;
+            }
+            break;
+            
+        case FB_FORMAT_ADDR:
+            // Every row reads differently in the new format
+            if ((value & 0x01) != fb->format) {
+                fb->format = value & 0x01;
+                fb->dirty = FB_ALL_ROWS;
+            }
+            break;
+    }
+}
+
+// Bus hook for writes to framebuffer memory: mark the row written. Every
+// core of an SMP machine writes here, so the bitmap is updated atomically.
+void fb_mark_dirty(fb_device_t* fb, uint16_t address) {
+    uint32_t row = (uint32_t)(address - FB_START) / FB_ROW_BYTES(fb->format);
+    if (row < FB_HEIGHT) {
+        atomics_fetch_or_u64(&fb->dirty, 1ULL << row, ATOMICS_RELAXED);
+    }
+}
+
+// MMU implementation
+void mmu_init(mmu_device_t* mmu, uint32_t physical_size) {
+    memset(mmu, 0, sizeof(*mmu));
+    mmu->physical_size = physical_size;
+    mmu_reset(mmu);
+}
+
+// Recompute the physical base of every page from the bank registers
+static void mmu_remap(mmu_device_t* mmu) {
+    uint32_t window_size = mmu_window_size(mmu);
+    uint32_t pages_per_window = window_size >> MMU_PAGE_SHIFT;
+    uint32_t bank_mask = mmu->physical_size / window_size - 1;
+    
+    for (uint32_t page = 0; page < MMU_PAGES; page++) {
+        if (mmu->control & MMU_CTRL_ENABLE) {
+            uint32_t bank = mmu->bank[page / pages_per_window] & bank_mask;
+            mmu->base[page] = bank * window_size + ((page % pages_per_window) << MMU_PAGE_SHIFT);
+        } else {
+            mmu->base[page] = page << MMU_PAGE_SHIFT;
+        }
+    }
+}
+
+// Power-on mapping: translation off, window i holding bank i
+void mmu_reset(mmu_device_t* mmu) {
+    mmu->control = 0;
+    mmu->window = 0;
+    for (int i = 0; i < MMU_PAGES; i++) {
+        mmu->bank[i] = (uint16_t)i;
+    }
+    mmu_remap(mmu);
+}
+
+uint32_t mmu_window_size(const mmu_device_t* mmu) {
+    return (mmu->control & MMU_CTRL_8K) ? 2u << MMU_PAGE_SHIFT : 1u << MMU_PAGE_SHIFT;
+}
+
+uint8_t mmu_read(mmu_device_t* mmu, uint16_t address) {
+    switch (address) {
+        case MMU_CTRL_ADDR:
+            return mmu->control;
+            
+        case MMU_WINDOW_ADDR:
+            return mmu->window;
+            
+        case MMU_BANK_ADDR:
+            return mmu->bank[mmu->window] & 0xFF;
+            
+        case MMU_BANK_ADDR_H:
+            return mmu->bank[mmu->window] >> 8;
+            
+        case MMU_SIZE_ADDR:
+            return (uint8_t)((mmu->physical_size >> 16) - 1);
+            
+        default:
+            return 0;
+    }
+}
+
+void mmu_write(mmu_device_t* mmu, uint16_t address, uint8_t value) {
+    uint16_t* bank = &mmu->bank[mmu->window];
+    
+    switch (address) {
+        case MMU_CTRL_ADDR:
+            mmu->control = value & (MMU_CTRL_ENABLE | MMU_CTRL_8K);
+            // Fewer windows in 8 KiB mode
+            mmu->window &= (MMU_PAGES << MMU_PAGE_SHIFT) / mmu_window_size(mmu) - 1;
+            break;
+            
+        case MMU_WINDOW_ADDR:
+            mmu->window = value & ((MMU_PAGES << MMU_PAGE_SHIFT) / mmu_window_size(mmu) - 1);
+            return;
+            
+        case MMU_BANK_ADDR:
+            *bank = (*bank & 0xFF00) | value;
+            break;
+            
+        case MMU_BANK_ADDR_H:
+            *bank = ((*bank & 0x00FF) | (value << 8)) & MMU_BANK_MASK;
+            break;
+            
+        default:
+            return;
+    }
+    mmu_remap(mmu);
+}
+
+// True when CPU addresses [address, address + length) map to the same
+// physical addresses (the bulk copy fast paths rely on it)
+bool mmu_is_identity(const mmu_device_t* mmu, uint16_t address, uint32_t length) {
+    if (length == 0) {
+        return true;
+    }
+    uint32_t last = (uint32_t)address + length - 1;
+    if (last > 0xFFFF) {
+        return false;
+    }
+    for (uint32_t page = address >> MMU_PAGE_SHIFT; page <= last >> MMU_PAGE_SHIFT; page++) {
+        if (mmu->base[page] != page << MMU_PAGE_SHIFT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Inter-processor interrupt implementation. Setting a bit is a release
+// and cores poll it with an acquire, so whatever the sender stored before
+// SEND is visible to the handler it starts.
+void ipi_init(ipi_device_t* ipi) {
+    ipi->core = 0;
+    ipi->cores = 1;
+    atomics_store_u8(&ipi->pending, 0, ATOMICS_RELEASE);
+}
+
+uint8_t ipi_read(ipi_device_t* ipi, uint16_t address) {
+    switch (address) {
+        case IPI_CORE_ADDR:
+            return ipi->core;
+            
+        case IPI_COUNT_ADDR:
+            return ipi->cores;
+            
+        case IPI_PENDING_ADDR:
+            return atomics_load_u8(&ipi->pending, ATOMICS_ACQUIRE);
+            
+        default:
+            return 0;
+    }
+}
+
+void ipi_write(ipi_device_t* ipi, uint16_t address, uint8_t value) {
+    uint8_t cores = (uint8_t)((1u << ipi->cores) - 1);
+    
+    switch (address) {
+        case IPI_SEND_ADDR:
+            atomics_fetch_or_u8(&ipi->pending, value & cores, ATOMICS_RELEASE);
+            break;
+            
+        case IPI_PENDING_ADDR:
+            atomics_fetch_and_u8(&ipi->pending, (uint8_t)~value, ATOMICS_ACQ_REL);
+            break;
+    }
+}
+
+// Interrupt controller implementation
+void pic_init(pic_device_t* pic) {
+    memset(pic, 0, sizeof(*pic));
+    pic->mask = PIC_MASK_DEFAULT;
+}
+
+uint8_t pic_read(pic_device_t* pic, uint16_t address) {
+    switch (address) {
+        case PIC_PENDING_ADDR:
+            return pic->lines;
+            
+        case PIC_MASK_ADDR:
+            return pic->mask;
+            
+        case PIC_CTRL_ADDR:
+            return pic->control;
+            
+        case PIC_SOURCE_ADDR:
+            return pic_highest(pic);
+            
+        case PIC_IN_SERVICE_ADDR:
+            return pic->in_service;
+            
+        default:
+            if (address >= PIC_PRIORITY_ADDR && address < PIC_PRIORITY_ADDR + PIC_SOURCES) {
+                return pic->priority[address - PIC_PRIORITY_ADDR];
+            }
+            if (address >= PIC_VECTOR_ADDR && address < PIC_VECTOR_ADDR + 2 * PIC_SOURCES) {
+                uint16_t vector = pic->vector[(address - PIC_VECTOR_ADDR) / 2];
+                return (address - PIC_VECTOR_ADDR) % 2 ? vector >> 8 : vector & 0xFF;
+            }
+            return 0;
+    }
+}
+
+void pic_write(pic_device_t* pic, uint16_t address, uint8_t value) {
+    switch (address) {
+        case PIC_MASK_ADDR:
+            pic->mask = value;
+            break;
+            
+        case PIC_CTRL_ADDR:
+            pic->control = value;
+            if (!(value & PIC_CTRL_VECTORED)) {
+                pic->in_service = 0;
+            }
+            break;
+            
+        case PIC_EOI_ADDR:
+            // End of interrupt for the given source number
+            if (value < PIC_SOURCES) {
+                pic->in_service &= ~(1 << value);
+            }
+            break;
+            
+        default:
+            if (address >= PIC_PRIORITY_ADDR && address < PIC_PRIORITY_ADDR + PIC_SOURCES) {
+                pic->priority[address - PIC_PRIORITY_ADDR] = value;
+            } else if (address >= PIC_VECTOR_ADDR && address < PIC_VECTOR_ADDR + 2 * PIC_SOURCES) {
+                uint16_t* vector = &pic->vector[(address - PIC_VECTOR_ADDR) / 2];
+                if ((address - PIC_VECTOR_ADDR) % 2) {
+                    *vector = (*vector & 0x00FF) | (value << 8);
+                } else {
+                    *vector = (*vector & 0xFF00) | value;
+                }
+            }
+            break;
+    }
+}
+
+// Set a source's request level; a rising edge timestamps the assertion
+void pic_set_line(pic_device_t* pic, uint8_t source, bool level, uint64_t now) {
+    uint8_t bit = 1 << source;
+    
+    if (level && !(pic->lines & bit)) {
+        pic->asserted_at[source] = now;
+    }
+    pic->lines = level ? (pic->lines | bit) : (pic->lines & ~bit);
+}
+
+// Highest-priority enabled request, or PIC_NO_SOURCE. In vectored mode a
+// request must outrank every source still in service.
+uint8_t pic_highest(const pic_device_t* pic) {
+    uint8_t requests = pic->lines & pic->mask;
+    int ceiling = -1;
+    uint8_t best = PIC_NO_SOURCE;
+    
+    if (pic->control & PIC_CTRL_VECTORED) {
+        for (int i = 0; i < PIC_SOURCES; i++) {
+            if ((pic->in_service & (1 << i)) && pic->priority[i] > ceiling) {
+                ceiling = pic->priority[i];
+            }
+        }
+    }
+    
+    for (int i = 0; i < PIC_SOURCES; i++) {
+        if (!(requests & (1 << i)) || pic->priority[i] <= ceiling) {
+            continue;
+        }
+        if (best == PIC_NO_SOURCE || pic->priority[i] > pic->priority[best]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// CPU interrupt entry at cycle now: returns the source being dispatched
+uint8_t pic_acknowledge(pic_device_t* pic, uint64_t now) {
+    uint8_t source = pic_highest(pic);
+    if (source == PIC_NO_SOURCE) {
+        return source;
+    }
+    
+    uint64_t latency = now > pic->asserted_at[source] ? now - pic->asserted_at[source] : 0;
+    pic->dispatches[source]++;
+    pic->latency_total[source] += latency;
+    if (latency > pic->latency_max[source]) {
+        pic->latency_max[source] = latency;
+    }
+    
+    if (pic->control & PIC_CTRL_VECTORED) {
+        pic->in_service |= 1 << source;
+    }
+    return source;
+}
+
+const char* pic_source_name(uint8_t source) {
+    switch (source) {
+        case PIC_SOURCE_TIMER:
+            return "timer";
+        case PIC_SOURCE_UART_RX:
+            return "uart-rx";
+        case PIC_SOURCE_UART_TX:
+            return "uart-tx";
+        case PIC_SOURCE_GPIO:
+            return "gpio";
+        case PIC_SOURCE_DMA:
+            return "dma";
+        case PIC_SOURCE_BLOCK:
+            return "block";
+        default:
+            return NULL;
+    }
+}
+
+// Print dispatch counts and assertion-to-handler latency per source
+void pic_print_stats(const pic_device_t* pic) {
+    printf("Interrupt latency (cycles from assertion to handler entry):\n");
+    printf("  %-8s %10s %10s %10s\n", "Source", "Count", "Average", "Max");
+    for (int i = 0; i < PIC_SOURCES; i++) {
+        const char* name = pic_source_name(i);
+        if (!name && pic->dispatches[i] == 0) {
+            continue;
+        }
+        double average = pic->dispatches[i] ?
+                         (double)pic->latency_total[i] / (double)pic->dispatches[i] : 0.0;
+        printf("  %-8s %10llu %10.1f %10llu\n", name ? name : "-",
+               (unsigned long long)pic->dispatches[i], average,
+               (unsigned long long)pic->latency_max[i]);
+    }
+}
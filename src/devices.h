@@ -1,8 +1,211 @@
 #ifndef DEVICES_H
 #define DEVICES_H
 
+#include "atomics.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+struct uart_sink;
+struct uart_source;
+struct uart_link;
+struct wave_queue;
+struct block_image;
+struct fb_display;
+struct device_set;
+
+// UART receive FIFO depth behind the RX data register
+#define UART_RX_FIFO_SIZE 16
+
+// UART_CTRL bits
+#define UART_CTRL_RX_IRQ 0x01       // Interrupt while received data is waiting
+#define UART_CTRL_TX_IRQ 0x02       // Interrupt while the transmitter is empty
+
+// Interrupt controller sources, in default priority order
+#define PIC_SOURCES 8
+#define PIC_NO_SOURCE 0xFF
+#define PIC_SOURCE_TIMER 0
+#define PIC_SOURCE_UART_RX 1
+#define PIC_SOURCE_UART_TX 2
+#define PIC_SOURCE_GPIO 3
+#define PIC_SOURCE_DMA 4
+#define PIC_SOURCE_BLOCK 5
+
+// PIC_CTRL bits
+#define PIC_CTRL_VECTORED 0x01      // Dispatch through the vector table, track in-service
+
+// Sources enabled after reset; GPIO edges stay masked until firmware opts in
+#define PIC_MASK_DEFAULT ((1 << PIC_SOURCE_TIMER) | (1 << PIC_SOURCE_UART_RX) | \
+                          (1 << PIC_SOURCE_UART_TX) | (1 << PIC_SOURCE_DMA) | \
+                          (1 << PIC_SOURCE_BLOCK))
+
+// DMA transfer modes
+#define DMA_MODE_COPY 0             // Memory to memory
+#define DMA_MODE_FILL 1             // Low byte of SRC into every destination byte
+#define DMA_MODE_TO_UART 2          // Memory to UART TX
+#define DMA_MODE_FROM_UART 3        // UART RX to memory, as bytes arrive
+
+// DMA_CTRL bits (write)
+#define DMA_CTRL_START 0x01
+#define DMA_CTRL_IRQ 0x02           // Interrupt on completion
+// DMA_CTRL bits (read)
+#define DMA_STATUS_BUSY 0x01
+#define DMA_STATUS_DONE 0x80
+
+// Block device commands
+#define BLOCK_CMD_NONE 0
+#define BLOCK_CMD_READ 1            // Image sectors into guest memory
+#define BLOCK_CMD_WRITE 2           // Guest memory into image sectors
+#define BLOCK_CMD_FLUSH 3           // Make written sectors durable on the host
+
+// Block device limits
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_MAX_COUNT 128         // Sectors per command (64 KiB, the address space)
+
+// BLOCK_STATUS bits (writing any value clears DONE and ERROR)
+#define BLOCK_STATUS_BUSY 0x01
+#define BLOCK_STATUS_ERROR 0x40     // No image, sector range outside it, or host I/O failed
+#define BLOCK_STATUS_DONE 0x80
+
+// BLOCK_CTRL bits
+#define BLOCK_CTRL_IRQ 0x01         // Interrupt on completion
+
+// Framebuffer geometry and formats
+#define FB_WIDTH 128
+#define FB_HEIGHT 64
+#define FB_ALL_ROWS UINT64_MAX      // Dirty bitmap with every row set
+#define FB_FORMAT_MONO 0            // 1 bit per pixel, MSB leftmost
+#define FB_FORMAT_RGB332 1          // 1 byte per pixel, RRRGGGBB
+#define FB_ROW_BYTES(format) ((format) == FB_FORMAT_MONO ? FB_WIDTH / 8 : FB_WIDTH)
+
+// FB_CTRL bits
+#define FB_CTRL_PRESENT 0x01        // Write: publish the frame after this instruction; read: pending
+#define FB_CTRL_AUTO 0x02           // Publish changes every FB_AUTO_CYCLES without PRESENT
+#define FB_AUTO_CYCLES 16384
+
+// Memory management unit. The 16-bit space is cut into windows of 4 or
+// 8 KiB, each showing one bank of a physical memory of up to 16 MiB.
+#define MMU_PAGE_SHIFT 12           // Translation granule: 4 KiB pages
+#define MMU_PAGES 16
+#define MMU_MAX_PHYSICAL (16u * 1024 * 1024)
+#define MMU_BANK_MASK 0x0FFF        // Bank numbers are 12 bits
+
+// MMU_CTRL bits
+#define MMU_CTRL_ENABLE 0x01        // Translate through the bank registers (else identity)
+#define MMU_CTRL_8K 0x02            // Eight 8 KiB windows instead of sixteen 4 KiB ones
+
+// Inter-processor interrupts: one pending bit per core
+#define IPI_MAX_CORES 8
+
+// Device registration. Every device, in-tree or plugin, is described by
+// a device_ops_t claiming address ranges in the MMIO window. The registry
+// compiles the claims into a device_map_t: a page table over the 64 KiB
+// space pointing at per-page slot tables, so an access finds its device
+// with two table lookups however many devices there are.
+#define DEVICE_PLUGIN_ABI 1
+#define DEVICE_MAX 16                   // Registered devices, in-tree ones included
+#define DEVICE_MAX_RANGES 4             // Address ranges per device
+#define DEVICE_MAP_PAGES 32             // Distinct slot tables, the all-memory one included
+#define DEVICE_PLUGIN_STATE_SIZE 64     // Per-set state bytes shared by plugin devices
+#define DEVICE_STATE_SLICE(size) (((size) + 7) & ~(size_t)7)
+#define DEVICE_PLUGIN_SYMBOL "cpu_device_plugin"
+
+// Access bits of a claimed range
+#define DEVICE_ACCESS_READ 0x01
+#define DEVICE_ACCESS_WRITE 0x02
+#define DEVICE_ACCESS_RW (DEVICE_ACCESS_READ | DEVICE_ACCESS_WRITE)
+
+// Slots that are not devices: ROM (reads memory, writes ignored) and open
+// bus (reads 0, writes ignored; the device page where nothing is claimed)
+#define DEVICE_SLOT_ROM 0xFE
+#define DEVICE_SLOT_OPEN 0xFF
+
+typedef struct {
+    uint16_t base;
+    uint16_t size;              // 0 ends the range list
+    uint8_t access;             // What memory_is_readable/writable report
+} device_range_t;
+
+// Device callbacks. state is the device's slice of the set's plugin state
+// (NULL for in-tree devices, whose state is a member of device_set_t).
+// Accesses reach read/write with set->now at the cycle of the access.
+// snapshot writes at most state_size bytes of architecturally visible
+// state for hashing and comparison; without it the raw state is used.
+// Any callback may be NULL.
+typedef struct device_ops {
+    uint32_t abi_version;       // DEVICE_PLUGIN_ABI
+    const char* name;
+    device_range_t ranges[DEVICE_MAX_RANGES];
+    size_t state_size;          // Plugin state bytes per device set
+    void (*init)(struct device_set* set, void* state);
+    void (*reset)(struct device_set* set, void* state, uint64_t now);     // CPU reset; cycle now becomes 0
+    uint8_t (*read)(struct device_set* set, void* state, uint16_t address);
+    void (*write)(struct device_set* set, void* state, uint16_t address, uint8_t value);
+    uint64_t (*next_event)(const struct device_set* set, const void* state);  // Cycle of the next service
+    void (*service)(struct device_set* set, void* state, uint64_t now);
+    size_t (*snapshot)(const struct device_set* set, const void* state, uint64_t now, uint8_t* buffer);
+} device_ops_t;
+
+// Machine layout a map is compiled for (see machine.h). Devices are
+// placed by name; a relocated device keeps its register order and its
+// callbacks still see the addresses it registered. Regions are applied in
+// order before devices claim their ranges, so devices may sit on RAM or
+// open regions but not on ROM.
+#define DEVICE_MAX_REGIONS 8
+
+#define DEVICE_NAME_SIZE 32
+
+typedef struct {
+    char device[DEVICE_NAME_SIZE];
+    bool disabled;              // Not mapped (its state still exists)
+    bool relocate;
+    uint16_t base;              // New address of the device's first range
+} device_placement_t;
+
+typedef struct {
+    uint16_t start;
+    uint16_t end;
+    uint8_t slot;               // 0 (RAM), DEVICE_SLOT_ROM or DEVICE_SLOT_OPEN
+} device_region_t;
+
+typedef struct {
+    device_placement_t placements[DEVICE_MAX];
+    int placement_count;
+    device_region_t regions[DEVICE_MAX_REGIONS];
+    int region_count;
+    uint8_t irq_line[PIC_SOURCES];      // PIC line of each interrupt source
+} device_layout_t;
+
+// Compiled dispatch table. Immutable once built and shared by every set
+// created from the same registrations and layout.
+typedef struct device_map {
+    const device_ops_t* devices[DEVICE_MAX];
+    uint16_t state_offset[DEVICE_MAX];
+    uint16_t relocation[DEVICE_MAX];            // Added to an address before dispatch
+    int count;
+    uint8_t irq_line[PIC_SOURCES];
+    uint8_t page_table[256];                    // Page number to slot table (0 = unmapped)
+    uint8_t slot[DEVICE_MAP_PAGES][256];        // Device index + 1, 0 = memory
+    uint8_t access[DEVICE_MAP_PAGES][256];
+} device_map_t;
+
+// Slot of an address: 0 for memory, ROM, open bus or a device index + 1
+static inline uint8_t device_map_slot(const device_map_t* map, uint16_t address) {
+    return map->slot[map->page_table[address >> 8]][address & 0xFF];
+}
+
+// Registry (not thread-safe; register before creating machines)
+bool device_register(const device_ops_t* ops);
+void device_unregister(const device_ops_t* ops);
+bool device_plugin_load(const char* path);
+const device_map_t* device_registry_map(void);
+void device_layout_default(device_layout_t* layout);
+const device_map_t* device_registry_layout(const device_layout_t* layout);
+void device_map_print(const device_map_t* map);
+
+// True when every address in [address, address + length) is plain memory:
+// no device, ROM or open bus (the bulk copy fast paths rely on it)
+bool device_map_is_memory(const device_map_t* map, uint16_t address, uint32_t length);
 
 // Device types
 typedef enum {
@@ -20,6 +223,16 @@ typedef struct {
     bool rx_ready;
     bool tx_empty;
     bool rx_full;
+    uint8_t control;
+    uint8_t rx_fifo[UART_RX_FIFO_SIZE];     // Received bytes queued behind rx_data
+    uint8_t rx_fifo_head;
+    uint8_t rx_fifo_count;
+    struct uart_sink* sink;     // Host output (NULL discards), not machine state
+    struct uart_source* source; // Host input (NULL = none), not machine state
+    struct uart_link* tx_link;  // Output to another board (NULL = none), not machine state
+    struct uart_link* rx_link;  // Input from another board instead of a source, not machine state
+    uint32_t rx_cycles_per_byte;    // Delivery pacing derived from the baud rate
+    uint64_t rx_next;           // Cycle of the next delivery attempt
 } uart_device_t;
 
 // GPIO device
@@ -27,6 +240,7 @@ typedef struct {
     uint8_t port;
     uint8_t direction; // 0=input, 1=output
     uint8_t pullup;   // 0=disabled, 1=enabled
+    uint8_t edges;    // Input pins that changed since last cleared
 } gpio_device_t;
 
 // Timer device
@@ -39,10 +253,150 @@ typedef struct {
     bool running;
     uint32_t prescaler;
     uint32_t prescaler_count;
+    uint64_t sync_cycle;        // Cycle at which count and prescaler_count are exact
+    uint64_t next_expiry;       // Cycle of the next IRQ-raising expiry
+    uint64_t expirations;       // Total expiries (statistics)
+    bool traced;                // Schedule every expiry for signal tracing (host setting)
 } timer_device_t;
 
-// Device system functions
-void devices_init(void);
+// DMA controller. SRC, DST and LEN advance as bytes move, so LEN reads
+// the bytes still to go.
+typedef struct {
+    uint16_t source;
+    uint16_t dest;
+    uint16_t length;
+    uint8_t mode;
+    uint8_t control;            // DMA_CTRL_IRQ
+    bool busy;
+    bool done;
+    uint8_t cycles_per_byte;    // CPU cycles charged per byte moved
+    uint64_t bytes;             // Statistics
+    uint64_t transfers;
+} dma_device_t;
+
+// Block device. A command runs against the host image at the CPU's next
+// device poll (see blockdev.h).
+typedef struct {
+    uint16_t sector;
+    uint16_t buffer;
+    uint8_t count;
+    uint8_t command;            // Last command written
+    uint8_t control;            // BLOCK_CTRL_IRQ
+    bool busy;
+    bool done;
+    bool error;
+    uint32_t sectors;           // Image size, 0 = no image
+    struct block_image* image;  // Host backend (NULL = none), not machine state
+    uint64_t sectors_read;      // Statistics
+    uint64_t sectors_written;
+} block_device_t;
+
+// Framebuffer. Pixels live in guest memory at FB_START, which acts as the
+// back buffer; presenting copies the rows written since the last present
+// to the attached display (see framebuffer.h).
+typedef struct {
+    uint8_t control;            // FB_CTRL_AUTO
+    uint8_t format;
+    bool present_pending;
+    uint64_t dirty;             // Rows written since the last present, bit per row
+    uint64_t next_auto;         // Earliest cycle of the next automatic present
+    struct fb_display* display; // Host consumer side (NULL = none), not machine state
+    uint64_t frames;            // Statistics
+} fb_device_t;
+
+// Bank-select MMU. base[] holds the physical address of each 4 KiB page
+// of the CPU's space and is recomputed whenever a register changes, so a
+// bank switch rewrites a few entries and an access costs one lookup.
+// Device registers are dispatched on the CPU address before translation
+// and stay visible whatever is mapped.
+typedef struct {
+    uint8_t control;                // MMU_CTRL_ENABLE, MMU_CTRL_8K
+    uint8_t window;                 // Selected window
+    uint16_t bank[MMU_PAGES];       // Bank of each window (8 KiB mode uses the first 8)
+    uint32_t physical_size;         // Bytes of physical memory, a power of two
+    uint32_t base[MMU_PAGES];       // Physical address of each page
+} mmu_device_t;
+
+// Physical address of a CPU address
+static inline uint32_t mmu_translate(const mmu_device_t* mmu, uint16_t address) {
+    return mmu->base[address >> MMU_PAGE_SHIFT] | (address & ((1u << MMU_PAGE_SHIFT) - 1));
+}
+
+// Inter-processor interrupt register. pending is read by every core
+// without the bus lock, so it is only accessed with host atomics.
+typedef struct {
+    uint8_t core;               // Core making the current access
+    uint8_t cores;              // Cores in the machine (1 unless SMP)
+    uint8_t pending;            // Bit per core with an IPI not yet cleared
+} ipi_device_t;
+
+// True while the given core has an IPI pending (acquire: the sender's
+// earlier stores are visible once the bit is seen)
+static inline bool ipi_pending(const ipi_device_t* ipi, uint8_t core) {
+    return (atomics_load_u8(&ipi->pending, ATOMICS_ACQUIRE) >> core) & 1;
+}
+
+// Interrupt controller
+typedef struct {
+    uint8_t lines;              // Request level of each source
+    uint8_t mask;               // 1 = source enabled
+    uint8_t control;
+    uint8_t in_service;         // Sources whose handler has not signalled EOI (vectored mode)
+    uint8_t priority[PIC_SOURCES];      // Higher wins; ties go to the lower source number
+    uint16_t vector[PIC_SOURCES];       // Handler address (0 = use the 0xFFFE vector)
+    
+    // Latency statistics (not machine state)
+    uint64_t asserted_at[PIC_SOURCES];  // Cycle the source's line last went high
+    uint64_t dispatches[PIC_SOURCES];
+    uint64_t latency_total[PIC_SOURCES];
+    uint64_t latency_max[PIC_SOURCES];
+} pic_device_t;
+
+// Per-machine device set
+typedef struct device_set {
+    uart_device_t uart;
+    gpio_device_t gpio;
+    timer_device_t timer;
+    pic_device_t pic;
+    dma_device_t dma;
+    block_device_t block;
+    fb_device_t fb;
+    mmu_device_t mmu;
+    ipi_device_t ipi;
+    const device_map_t* map;    // Address dispatch, shared and immutable
+    uint64_t plugin_state[DEVICE_PLUGIN_STATE_SIZE / 8];    // 8-byte aligned slices
+    uint64_t now;               // Cycle of the access being serviced
+    uint64_t next_event;        // Earliest cycle device_set_service() has work
+    bool irq;                   // Interrupt controller output to the CPU
+    struct wave_queue* wave;    // Signal change trace (NULL = off), not machine state
+} device_set_t;
+
+// Device set functions
+bool device_set_init(device_set_t* set);
+void device_set_init_map(device_set_t* set, const device_map_t* map);
+void device_set_tick(device_set_t* set);
+uint8_t device_set_read(device_set_t* set, uint16_t address);
+void device_set_write(device_set_t* set, uint16_t address, uint8_t value);
+void device_set_service(device_set_t* set, uint64_t now);
+void device_set_flush(device_set_t* set);
+void device_set_rebase(device_set_t* set, uint64_t now);
+void device_set_update_irq(device_set_t* set);
+void device_set_attach_source(device_set_t* set, struct uart_source* source, uint32_t cycles_per_byte);
+void device_set_attach_links(device_set_t* set, struct uart_link* tx, struct uart_link* rx, uint32_t cycles_per_byte);
+void device_set_reschedule(device_set_t* set);
+void device_set_set_pin(device_set_t* set, uint8_t pin, bool state);
+bool device_set_acknowledge_irq(device_set_t* set, uint64_t now, uint16_t* vector);
+void device_set_clear_stats(device_set_t* set);
+void device_set_attach_wave(device_set_t* set, struct wave_queue* queue);
+void device_set_attach_block(device_set_t* set, struct block_image* image, uint32_t sectors);
+void device_set_attach_display(device_set_t* set, struct fb_display* display);
+
+// Device state serialization (hashing and exact comparison)
+#define DEVICES_STATE_SIZE (128 + DEVICE_PLUGIN_STATE_SIZE)
+size_t device_set_pack_state(const device_set_t* set, uint64_t now, uint8_t* buffer);
+
+// Device system functions (operate on the default device set)
+bool devices_init(void);
 void devices_cleanup(void);
 void devices_tick(void);
 
@@ -61,6 +415,8 @@ void uart_send_char(uart_device_t* uart, char c);
 char uart_receive_char(uart_device_t* uart);
 bool uart_is_tx_ready(uart_device_t* uart);
 bool uart_is_rx_ready(uart_device_t* uart);
+void uart_set_sink(uart_device_t* uart, struct uart_sink* sink);
+bool uart_receive(uart_device_t* uart, uint8_t byte);
 
 // GPIO functions
 void gpio_init(gpio_device_t* gpio);
@@ -73,6 +429,9 @@ bool gpio_get_pin(gpio_device_t* gpio, uint8_t pin);
 // Timer functions
 void timer_init(timer_device_t* timer);
 void timer_tick(timer_device_t* timer);
+void timer_advance(timer_device_t* timer, uint64_t cycles);
+void timer_sync(timer_device_t* timer, uint64_t now);
+void timer_schedule(timer_device_t* timer);
 uint8_t timer_read(timer_device_t* timer, uint16_t address);
 void timer_write(timer_device_t* timer, uint16_t address, uint8_t value);
 void timer_start(timer_device_t* timer);
@@ -81,10 +440,53 @@ void timer_reset(timer_device_t* timer);
 bool timer_is_irq_pending(timer_device_t* timer);
 void timer_clear_irq(timer_device_t* timer);
 
-// Global device instances
-extern uart_device_t g_uart;
-extern gpio_device_t g_gpio;
-extern timer_device_t g_timer;
+// DMA functions (transfers are run by dma_run(), which owns the memory side)
+void dma_init(dma_device_t* dma);
+uint8_t dma_read(dma_device_t* dma, uint16_t address);
+void dma_write(dma_device_t* dma, uint16_t address, uint8_t value);
+void dma_complete(dma_device_t* dma);
+
+// Block device functions (commands are run by blockdev_run())
+void block_init(block_device_t* block);
+uint8_t block_read(block_device_t* block, uint16_t address);
+void block_write(block_device_t* block, uint16_t address, uint8_t value);
+void block_complete(block_device_t* block, bool error);
+
+// Framebuffer functions (frames are published by framebuffer_present())
+void fb_init(fb_device_t* fb);
+uint8_t fb_read(fb_device_t* fb, uint16_t address);
+void fb_write(fb_device_t* fb, uint16_t address, uint8_t value);
+void fb_mark_dirty(fb_device_t* fb, uint16_t address);
+
+// MMU functions
+void mmu_init(mmu_device_t* mmu, uint32_t physical_size);
+void mmu_reset(mmu_device_t* mmu);
+uint8_t mmu_read(mmu_device_t* mmu, uint16_t address);
+void mmu_write(mmu_device_t* mmu, uint16_t address, uint8_t value);
+uint32_t mmu_window_size(const mmu_device_t* mmu);
+bool mmu_is_identity(const mmu_device_t* mmu, uint16_t address, uint32_t length);
+
+// Inter-processor interrupt functions
+void ipi_init(ipi_device_t* ipi);
+uint8_t ipi_read(ipi_device_t* ipi, uint16_t address);
+void ipi_write(ipi_device_t* ipi, uint16_t address, uint8_t value);
+
+// Interrupt controller functions
+void pic_init(pic_device_t* pic);
+uint8_t pic_read(pic_device_t* pic, uint16_t address);
+void pic_write(pic_device_t* pic, uint16_t address, uint8_t value);
+void pic_set_line(pic_device_t* pic, uint8_t source, bool level, uint64_t now);
+uint8_t pic_highest(const pic_device_t* pic);
+uint8_t pic_acknowledge(pic_device_t* pic, uint64_t now);
+void pic_print_stats(const pic_device_t* pic);
+const char* pic_source_name(uint8_t source);
+
+// In-tree devices, registered ahead of any plugin
+extern const device_ops_t* const device_builtin_ops[];
+extern const int device_builtin_count;
+
+// Default device set, shared by cpu_create() and the devices_* functions
+extern device_set_t g_devices;
 
 #endif // DEVICES_H
 
@@ -1,4 +1,5 @@
 #include "isa.h"
+#include "devices.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,11 @@
 // Disassembler state
 typedef struct {
     uint8_t* memory;
+    uint32_t memory_size;       // Physical image size (64 KiB or more)
+    bool banked;                // Show a bank of the image in a window
+    uint16_t bank;
+    uint16_t window_start;
+    uint32_t window_size;
     uint16_t start_address;
     uint16_t end_address;
     bool verbose;
@@ -20,6 +26,9 @@ void print_help(void);
 bool parse_cli_options(int argc, char* argv[], disasm_state_t* state);
 void disassemble_memory(disasm_state_t* state);
 void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes_consumed);
+bool load_image(disasm_state_t* state, const char* path);
+uint8_t read_byte(disasm_state_t* state, uint16_t address);
+const char* format_address(disasm_state_t* state, uint16_t address);
 const char* get_addressing_mode_string(addressing_mode_t mode);
 const char* get_register_name(register_t reg);
 
@@ -44,17 +53,21 @@ int main(int argc, char* argv[]) {
 }
 
 void print_usage(const char* program_name) {
-    printf("Usage: %s [OPTIONS] [MEMORY_DATA]\n", program_name);
+    printf("Usage: %s [OPTIONS] [IMAGE]\n", program_name);
     printf("\nOptions:\n");
     printf("  -s, --start ADDRESS     Start address (default: 0x0200)\n");
     printf("  -e, --end ADDRESS       End address (default: 0x0300)\n");
     printf("  -v, --verbose          Verbose output\n");
     printf("  -a, --addresses        Show addresses\n");
     printf("  -x, --hex              Show hex dump\n");
+    printf("  -b, --bank N           Show bank N of the image in the window\n");
+    printf("  -w, --window ADDRESS   Window the bank is mapped at (default: 0x8000)\n");
+    printf("  -p, --page-size KB     Window size, 4 or 8 KiB (default: 4)\n");
     printf("  -h, --help             Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s -s 0x0200 -e 0x0300\n", program_name);
     printf("  %s -s 0x0200 -e 0x0300 -a -x\n", program_name);
+    printf("  %s -b 5 -w 0xA000 -s 0xA000 -e 0xA0FF -a firmware.bin\n", program_name);
     printf("  %s --help\n", program_name);
 }
 
@@ -66,6 +79,10 @@ void print_help(void) {
     printf("  - Shows register names\n");
     printf("  - Shows hex dump\n");
     printf("  - Shows addresses\n");
+    printf("  - Shows banked addresses as BANK:ADDRESS\n");
+    printf("\nIMAGE is physical memory from address 0 (up to 16 MiB). With --bank,\n");
+    printf("window addresses read bank N * window size + offset and are shown\n");
+    printf("as BANK:ADDRESS; other addresses read the image directly.\n");
     printf("\nSupported Instructions:\n");
     printf("  Load/Store: LDI, LDA, STA, MOV\n");
     printf("  Arithmetic: ADD, SUB, CMP, INC, DEC\n");
@@ -83,6 +100,9 @@ bool parse_cli_options(int argc, char* argv[], disasm_state_t* state) {
         {"verbose", no_argument, 0, 'v'},
         {"addresses", no_argument, 0, 'a'},
         {"hex", no_argument, 0, 'x'},
+        {"bank", required_argument, 0, 'b'},
+        {"window", required_argument, 0, 'w'},
+        {"page-size", required_argument, 0, 'p'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -97,8 +117,12 @@ bool parse_cli_options(int argc, char* argv[], disasm_state_t* state) {
     state->verbose = false;
     state->show_addresses = false;
     state->show_hex = false;
+    state->banked = false;
+    state->bank = 0;
+    state->window_start = 0x8000;
+    state->window_size = 4096;
     
-    while ((c = getopt_long(argc, argv, "s:e:vaxh", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "s:e:vaxb:w:p:h", long_options, &option_index)) != -1) {
         switch (c) {
             case 's':
                 state->start_address = strtol(optarg, NULL, 0);
@@ -115,6 +139,20 @@ bool parse_cli_options(int argc, char* argv[], disasm_state_t* state) {
             case 'x':
                 state->show_hex = true;
                 break;
+            case 'b':
+                state->banked = true;
+                state->bank = strtol(optarg, NULL, 0) & MMU_BANK_MASK;
+                break;
+            case 'w':
+                state->window_start = strtol(optarg, NULL, 0);
+                break;
+            case 'p':
+                if (strcmp(optarg, "4") != 0 && strcmp(optarg, "8") != 0) {
+                    fprintf(stderr, "Window size must be 4 or 8 KiB\n");
+                    return false;
+                }
+                state->window_size = atoi(optarg) * 1024;
+                break;
             case 'h':
                 print_help();
                 return false;
@@ -125,9 +163,18 @@ bool parse_cli_options(int argc, char* argv[], disasm_state_t* state) {
         }
     }
     
-    // For now, create a simple memory buffer
-    // In a real implementation, this would load from a file
+    if (state->window_start % state->window_size != 0) {
+        fprintf(stderr, "Window 0x%04X is not aligned to its size\n", state->window_start);
+        return false;
+    }
+    
+    if (optind < argc) {
+        return load_image(state, argv[optind]);
+    }
+    
+    // Without an image, disassemble a small built-in sample
     state->memory = malloc(65536);
+    state->memory_size = 65536;
     if (state->memory) {
         memset(state->memory, 0, 65536);
         
@@ -146,6 +193,50 @@ bool parse_cli_options(int argc, char* argv[], disasm_state_t* state) {
     return true;
 }
 
+// Load a physical memory image; addresses past its end read as 0
+bool load_image(disasm_state_t* state, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    
+    state->memory_size = 65536;
+    state->memory = calloc(MMU_MAX_PHYSICAL, 1);
+    if (!state->memory) {
+        fclose(file);
+        return false;
+    }
+    size_t size = fread(state->memory, 1, MMU_MAX_PHYSICAL, file);
+    fclose(file);
+    while (state->memory_size < size) {
+        state->memory_size *= 2;
+    }
+    return true;
+}
+
+// Byte at a CPU address, through the bank window
+uint8_t read_byte(disasm_state_t* state, uint16_t address) {
+    if (state->banked && address >= state->window_start &&
+        (uint32_t)(address - state->window_start) < state->window_size) {
+        uint32_t physical = state->bank * state->window_size + (address - state->window_start);
+        return state->memory[physical % state->memory_size];
+    }
+    return state->memory[address];
+}
+
+// Address as printed: BANK:ADDRESS inside the window
+const char* format_address(disasm_state_t* state, uint16_t address) {
+    static char text[16];
+    if (state->banked && address >= state->window_start &&
+        (uint32_t)(address - state->window_start) < state->window_size) {
+        snprintf(text, sizeof(text), "%02X:%04X", state->bank, address);
+    } else {
+        snprintf(text, sizeof(text), "%04X", address);
+    }
+    return text;
+}
+
 void disassemble_memory(disasm_state_t* state) {
     printf("Disassembly from 0x%04X to 0x%04X:\n", 
            state->start_address, state->end_address);
@@ -157,11 +248,11 @@ void disassemble_memory(disasm_state_t* state) {
         int bytes_consumed = 0;
         
         if (state->show_addresses) {
-            printf("0x%04X: ", address);
+            printf("%s: ", format_address(state, address));
         }
         
         if (state->show_hex) {
-            printf("%02X ", state->memory[address]);
+            printf("%02X ", read_byte(state, address));
         }
         
         disassemble_instruction(state, address, &bytes_consumed);
@@ -179,7 +270,7 @@ void disassemble_memory(disasm_state_t* state) {
 }
 
 void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes_consumed) {
-    uint8_t opcode = state->memory[address];
+    uint8_t opcode = read_byte(state, address);
     *bytes_consumed = 1;
     
     // Get instruction info
@@ -195,7 +286,7 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
     switch (inst->opcode) {
         case OP_LDI:
             if (address + 1 <= state->end_address) {
-                uint8_t value = state->memory[address + 1];
+                uint8_t value = read_byte(state, address + 1);
                 printf(" #$%02X", value);
                 *bytes_consumed = 2;
             }
@@ -204,16 +295,16 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
         case OP_LDA:
         case OP_STA:
             if (address + 2 <= state->end_address) {
-                uint16_t addr = state->memory[address + 1] | 
-                               (state->memory[address + 2] << 8);
-                printf(" [$%04X]", addr);
+                uint16_t addr = read_byte(state, address + 1) | 
+                               (read_byte(state, address + 2) << 8);
+                printf(" [$%s]", format_address(state, addr));
                 *bytes_consumed = 3;
             }
             break;
             
         case OP_MOV:
             if (address + 1 <= state->end_address) {
-                uint8_t reg = state->memory[address + 1];
+                uint8_t reg = read_byte(state, address + 1);
                 printf(" %s", get_register_name((register_t)reg));
                 *bytes_consumed = 2;
             }
@@ -223,7 +314,7 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
         case OP_SUB:
         case OP_CMP:
             if (address + 1 <= state->end_address) {
-                uint8_t operand = state->memory[address + 1];
+                uint8_t operand = read_byte(state, address + 1);
                 printf(" #$%02X", operand);
                 *bytes_consumed = 2;
             }
@@ -232,9 +323,9 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
         case OP_JMP:
         case OP_JSR:
             if (address + 2 <= state->end_address) {
-                uint16_t addr = state->memory[address + 1] | 
-                               (state->memory[address + 2] << 8);
-                printf(" $%04X", addr);
+                uint16_t addr = read_byte(state, address + 1) | 
+                               (read_byte(state, address + 2) << 8);
+                printf(" $%s", format_address(state, addr));
                 *bytes_consumed = 3;
             }
             break;
@@ -248,9 +339,9 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
         case OP_BVS:
         case OP_BVC:
             if (address + 1 <= state->end_address) {
-                int8_t offset = (int8_t)state->memory[address + 1];
+                int8_t offset = (int8_t)read_byte(state, address + 1);
                 uint16_t target = address + 2 + offset;
-                printf(" $%04X", target);
+                printf(" $%s", format_address(state, target));
                 *bytes_consumed = 2;
             }
             break;
@@ -258,7 +349,7 @@ void disassemble_instruction(disasm_state_t* state, uint16_t address, int* bytes
         case OP_PUSH:
         case OP_POP:
             if (address + 1 <= state->end_address) {
-                uint8_t reg = state->memory[address + 1];
+                uint8_t reg = read_byte(state, address + 1);
                 printf(" %s", get_register_name((register_t)reg));
                 *bytes_consumed = 2;
             }
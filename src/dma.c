@@ -0,0 +1,135 @@
+#include "dma.h"
+#include "memory.h"
+#include "devices.h"
+#include "statehash.h"
+
+// True when [address, address + length) is plain RAM in the machine's
+// device map (no ROM, open bus or relocated device) that the MMU maps
+// straight through, outside SMP machines (where other cores must see
+// each byte through the atomic memory path)
+static bool dma_in_ram(cpu_state_t* cpu, uint16_t address, uint16_t length) {
+    return !cpu->smp && (uint32_t)address + length <= RAM_END + 1 &&
+           device_map_is_memory(cpu->devices->map, address, length) &&
+           mmu_is_identity(&cpu->devices->mmu, address, length);
+}
+
+// Fold a RAM range in or out of the incremental memory hash (XOR is its own inverse)
+static void dma_hash_range(cpu_state_t* cpu, uint16_t address, uint16_t length) {
+    if (!cpu->hash_enabled) {
+        return;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        cpu->memory_hash ^= statehash_memory_key(address + i, cpu->memory[address + i]);
+    }
+}
+
+static uint32_t dma_copy(cpu_state_t* cpu, dma_device_t* dma) {
+    uint16_t length = dma->length;
+
+    if (dma_in_ram(cpu, dma->source, length) && dma_in_ram(cpu, dma->dest, length)) {
+        dma_hash_range(cpu, dma->dest, length);
+        memory_copy(cpu->memory, dma->dest, dma->source, length);
+        dma_hash_range(cpu, dma->dest, length);
+    } else if (dma->dest > dma->source) {
+        // Byte path: copy backwards so an overlapping move still acts like memmove
+        for (uint16_t i = length; i > 0; i--) {
+            uint8_t value = isa_read_memory(cpu, dma->source + i - 1);
+            isa_write_memory(cpu, dma->dest + i - 1, value);
+        }
+    } else {
+        for (uint16_t i = 0; i < length; i++) {
+            isa_write_memory(cpu, dma->dest + i, isa_read_memory(cpu, dma->source + i));
+        }
+    }
+
+    dma->source += length;
+    dma->dest += length;
+    dma->length = 0;
+    return length;
+}
+
+static uint32_t dma_fill(cpu_state_t* cpu, dma_device_t* dma) {
+    uint16_t length = dma->length;
+    uint8_t value = dma->source & 0xFF;
+
+    if (dma_in_ram(cpu, dma->dest, length)) {
+        if (length > 0) {
+            dma_hash_range(cpu, dma->dest, length);
+            memory_fill(cpu->memory, dma->dest, dma->dest + length - 1, value);
+            dma_hash_range(cpu, dma->dest, length);
+        }
+    } else {
+        for (uint16_t i = 0; i < length; i++) {
+            isa_write_memory(cpu, dma->dest + i, value);
+        }
+    }
+
+    dma->dest += length;
+    dma->length = 0;
+    return length;
+}
+
+// Each byte reaches the UART at the cycle the burst has got to
+static uint32_t dma_to_uart(cpu_state_t* cpu, dma_device_t* dma) {
+    device_set_t* devices = cpu->devices;
+    uint32_t moved = 0;
+
+    while (dma->length > 0) {
+        uint8_t value = isa_read_memory(cpu, dma->source);
+        devices->now = cpu->cycle_count + (uint64_t)moved * dma->cycles_per_byte;
+        device_set_write(devices, UART_TX_ADDR, value);
+        dma->source++;
+        dma->length--;
+        moved++;
+    }
+    return moved;
+}
+
+// Takes what the receiver holds now; the rest arrives on later polls
+static uint32_t dma_from_uart(cpu_state_t* cpu, dma_device_t* dma) {
+    device_set_t* devices = cpu->devices;
+    uint32_t moved = 0;
+
+    while (dma->length > 0 && devices->uart.rx_ready) {
+        devices->now = cpu->cycle_count + (uint64_t)moved * dma->cycles_per_byte;
+        uint8_t value = device_set_read(devices, UART_RX_ADDR);
+        isa_write_memory(cpu, dma->dest, value);
+        dma->dest++;
+        dma->length--;
+        moved++;
+    }
+    return moved;
+}
+
+bool dma_run(cpu_state_t* cpu) {
+    device_set_t* devices = cpu->devices;
+    dma_device_t* dma = &devices->dma;
+    uint32_t moved = 0;
+
+    switch (dma->mode) {
+        case DMA_MODE_COPY:
+            moved = dma_copy(cpu, dma);
+            break;
+        case DMA_MODE_FILL:
+            moved = dma_fill(cpu, dma);
+            break;
+        case DMA_MODE_TO_UART:
+            moved = dma_to_uart(cpu, dma);
+            break;
+        case DMA_MODE_FROM_UART:
+            moved = dma_from_uart(cpu, dma);
+            break;
+    }
+
+    // Burst mode: the CPU waits while the controller owns the bus
+    cpu->cycle_count += (uint64_t)moved * dma->cycles_per_byte;
+    dma->bytes += moved;
+
+    if (dma->length > 0) {
+        return false;
+    }
+    dma_complete(dma);
+    devices->now = cpu->cycle_count;
+    device_set_update_irq(devices);
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// DMA transfer engine.
+// The guest programs the DMA registers in the device set and sets START;
+// the transfer runs at the CPU's next device poll (the end of that
+// instruction, or of the native block). The CPU is stalled for
+// cycles_per_byte cycles per byte moved (burst mode).
+//
+// RAM-to-RAM copies and RAM fills are done host-side with memory_copy()
+// and memory_fill(). Transfers that touch the MMIO window, or the vectors,
+// go through the CPU's memory handlers one byte at a time. UART-to-memory
+// transfers take bytes as they arrive and stay busy until LEN reaches zero.
+
+// Run as much of the pending transfer as possible; true if it completed
+bool dma_run(cpu_state_t* cpu);
+
+#endif // DMA_H
@@ -0,0 +1,896 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "explore.h"
+#include "statehash.h"
+#include "devices.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Visited set geometry
+#define EXPLORE_SHARD_BITS 6
+#define EXPLORE_SHARD_COUNT (1 << EXPLORE_SHARD_BITS)
+#define EXPLORE_SHARD_INITIAL 1024
+
+// Frontier items handed to a worker at a time
+#define EXPLORE_CHUNK 16
+
+// Root record has no parent
+#define EXPLORE_NO_PARENT 0xFFFFFFFFu
+
+// One shard of the visited set: open addressing over 64-bit state hashes
+typedef struct {
+    pthread_mutex_t lock;
+    uint64_t* slots;
+    size_t capacity;
+    size_t count;
+    bool spilled;
+} explore_shard_t;
+
+// Sharded concurrent visited set. Its RAM budget is shared with the
+// frontier's encoded states
+typedef struct {
+    explore_shard_t shards[EXPLORE_SHARD_COUNT];
+    pthread_mutex_t alloc_lock;
+    size_t ram_bytes;
+    size_t spilled_bytes;
+    size_t memory_limit;
+    const char* spill_dir;
+    uint64_t count;
+} explore_visited_t;
+
+// Encoded machine state: fixed header followed by (address, value) triples
+// for every byte that differs from the initial image
+typedef struct {
+    uint8_t regs[8];
+    uint8_t flags;
+    bool irq_pending;
+    bool irq_raised;
+    bool nmi_pending;
+    device_set_t devices;
+    uint32_t diff_count;
+} explore_state_header_t;
+
+// Encoded states of one level, appended by one worker
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    bool spilled;
+} explore_buffer_t;
+
+// Frontier entry
+typedef struct {
+    uint32_t id;
+    const uint8_t* state;                   // In a frontier buffer
+} explore_item_t;
+
+// Successor produced by a worker, merged into the next level
+typedef struct {
+    explore_record_t record;
+    size_t offset;                          // In the worker's buffer
+} explore_successor_t;
+
+struct explore_worker;
+
+// Shared exploration context
+typedef struct {
+    const explore_config_t* config;
+    explore_result_t* result;
+    uint64_t base_hash;
+    explore_visited_t visited;
+
+    explore_item_t* frontier;
+    explore_buffer_t* frontier_states;      // One per worker
+    size_t frontier_count;
+    size_t frontier_next;
+    uint32_t depth;
+
+    pthread_mutex_t lock;
+    bool stop;
+    bool failed;
+} explore_t;
+
+// Per-thread state
+typedef struct explore_worker {
+    explore_t* ex;
+    pthread_t thread;
+    cpu_state_t* cpu;
+    explore_successor_t* next;
+    size_t next_count;
+    size_t next_capacity;
+    explore_buffer_t next_states;
+    uint64_t transitions;
+    uint64_t halted;
+    uint64_t truncated;
+} explore_worker_t;
+
+// Outcome of one transition
+typedef enum {
+    SEGMENT_BRANCH,
+    SEGMENT_HALTED,
+    SEGMENT_VIOLATION,
+    SEGMENT_TRUNCATED
+} explore_segment_t;
+
+// Default settings
+void explore_config_init(explore_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    config->entry_address = 0x0200;
+    config->rx_values[0] = 0x00;
+    config->rx_values[1] = 0x0D;
+    config->rx_values[2] = 0x41;
+    config->rx_value_count = 3;
+    config->threads = 1;
+    config->max_states = 1000000;
+    config->max_depth = 0xFFFFFFFFu;
+    config->max_steps = 100000;
+    config->memory_limit = (size_t)1024 * 1024 * 1024;
+    config->spill_dir = "/tmp";
+    config->max_violations = 16;
+}
+
+// Allocate zeroed storage, in RAM while under budget and in a spill file after
+static void* explore_alloc(explore_visited_t* visited, size_t bytes, bool* spilled) {
+    void* memory = NULL;
+
+    pthread_mutex_lock(&visited->alloc_lock);
+    if (visited->ram_bytes + bytes <= visited->memory_limit) {
+        memory = calloc(1, bytes);
+        if (memory) {
+            visited->ram_bytes += bytes;
+            *spilled = false;
+        }
+    } else {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/cpu-explore-XXXXXX", visited->spill_dir);
+        int fd = mkstemp(path);
+        if (fd >= 0) {
+            // The mapping keeps the file alive; nothing is left behind on exit
+            unlink(path);
+            if (ftruncate(fd, (off_t)bytes) == 0) {
+                void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (map != MAP_FAILED) {
+                    memory = map;
+                    visited->spilled_bytes += bytes;
+                    *spilled = true;
+                }
+            }
+            close(fd);
+        }
+    }
+    pthread_mutex_unlock(&visited->alloc_lock);
+
+    return memory;
+}
+
+static void explore_free(explore_visited_t* visited, void* memory, size_t bytes, bool spilled) {
+    pthread_mutex_lock(&visited->alloc_lock);
+    if (spilled) {
+        munmap(memory, bytes);
+        visited->spilled_bytes -= bytes;
+    } else {
+        free(memory);
+        visited->ram_bytes -= bytes;
+    }
+    pthread_mutex_unlock(&visited->alloc_lock);
+}
+
+static uint64_t* explore_alloc_slots(explore_visited_t* visited, size_t capacity, bool* spilled) {
+    return explore_alloc(visited, capacity * sizeof(uint64_t), spilled);
+}
+
+static void explore_free_slots(explore_visited_t* visited, uint64_t* slots, size_t capacity, bool spilled) {
+    explore_free(visited, slots, capacity * sizeof(uint64_t), spilled);
+}
+
+// Room for bytes more at the end of a state buffer; a full buffer moves to
+// one twice the size, which may be in a spill file
+static uint8_t* explore_buffer_reserve(explore_visited_t* visited, explore_buffer_t* buffer, size_t bytes) {
+    if (buffer->size + bytes > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        while (capacity < buffer->size + bytes) {
+            capacity *= 2;
+        }
+        bool spilled;
+        uint8_t* data = explore_alloc(visited, capacity, &spilled);
+        if (!data) {
+            return NULL;
+        }
+        if (buffer->data) {
+            memcpy(data, buffer->data, buffer->size);
+            explore_free(visited, buffer->data, buffer->capacity, buffer->spilled);
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+        buffer->spilled = spilled;
+    }
+    uint8_t* space = buffer->data + buffer->size;
+    buffer->size += bytes;
+    return space;
+}
+
+static void explore_buffer_free(explore_visited_t* visited, explore_buffer_t* buffer) {
+    if (buffer->data) {
+        explore_free(visited, buffer->data, buffer->capacity, buffer->spilled);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+static bool explore_visited_init(explore_visited_t* visited, size_t memory_limit, const char* spill_dir) {
+    memset(visited, 0, sizeof(*visited));
+    visited->memory_limit = memory_limit;
+    visited->spill_dir = spill_dir;
+    pthread_mutex_init(&visited->alloc_lock, NULL);
+
+    for (int i = 0; i < EXPLORE_SHARD_COUNT; i++) {
+        explore_shard_t* shard = &visited->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->capacity = EXPLORE_SHARD_INITIAL;
+        shard->slots = explore_alloc_slots(visited, shard->capacity, &shard->spilled);
+        if (!shard->slots) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void explore_visited_cleanup(explore_visited_t* visited) {
+    for (int i = 0; i < EXPLORE_SHARD_COUNT; i++) {
+        explore_shard_t* shard = &visited->shards[i];
+        if (shard->slots) {
+            explore_free_slots(visited, shard->slots, shard->capacity, shard->spilled);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    pthread_mutex_destroy(&visited->alloc_lock);
+}
+
+// Insert a state hash. Returns 1 if new, 0 if already visited, -1 on allocation failure.
+static int explore_visited_insert(explore_visited_t* visited, uint64_t hash) {
+    if (hash == 0) {
+        hash = 1;  // 0 marks an empty slot
+    }
+
+    explore_shard_t* shard = &visited->shards[hash >> (64 - EXPLORE_SHARD_BITS)];
+    pthread_mutex_lock(&shard->lock);
+
+    // Grow at 70% load
+    if ((shard->count + 1) * 10 > shard->capacity * 7) {
+        size_t capacity = shard->capacity * 2;
+        bool spilled;
+        uint64_t* slots = explore_alloc_slots(visited, capacity, &spilled);
+        if (!slots) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < shard->capacity; i++) {
+            uint64_t value = shard->slots[i];
+            if (value != 0) {
+                size_t index = value & (capacity - 1);
+                while (slots[index] != 0) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                slots[index] = value;
+            }
+        }
+        explore_free_slots(visited, shard->slots, shard->capacity, shard->spilled);
+        shard->slots = slots;
+        shard->capacity = capacity;
+        shard->spilled = spilled;
+    }
+
+    size_t index = hash & (shard->capacity - 1);
+    while (shard->slots[index] != 0) {
+        if (shard->slots[index] == hash) {
+            pthread_mutex_unlock(&shard->lock);
+            return 0;
+        }
+        index = (index + 1) & (shard->capacity - 1);
+    }
+    shard->slots[index] = hash;
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+// Encode the CPU state relative to the initial image at the end of a
+// state buffer
+static bool explore_encode(explore_t* ex, cpu_state_t* cpu, explore_buffer_t* buffer) {
+    const uint8_t* base = ex->config->image;
+    uint32_t diff_count = 0;
+
+    for (uint32_t address = 0; address < MEMORY_SIZE; address += 8) {
+        if (memcmp(&cpu->memory[address], &base[address], 8) != 0) {
+            for (uint32_t i = address; i < address + 8; i++) {
+                diff_count += cpu->memory[i] != base[i];
+            }
+        }
+    }
+
+    uint8_t* state = explore_buffer_reserve(&ex->visited, buffer, sizeof(explore_state_header_t) + diff_count * 3);
+    if (!state) {
+        return false;
+    }
+
+    explore_state_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.regs, cpu->regs, sizeof(header.regs));
+    header.flags = cpu->flags;
+    header.irq_pending = cpu->irq_pending;
+    header.irq_raised = cpu->irq_raised;
+    header.nmi_pending = cpu->nmi_pending;
+    header.devices = *cpu->devices;
+    device_set_rebase(&header.devices, cpu->cycle_count);   // Stored relative to cycle 0
+    device_set_clear_stats(&header.devices);
+    header.diff_count = diff_count;
+    memcpy(state, &header, sizeof(header));
+
+    uint8_t* diff = state + sizeof(header);
+    for (uint32_t address = 0; address < MEMORY_SIZE; address += 8) {
+        if (memcmp(&cpu->memory[address], &base[address], 8) != 0) {
+            for (uint32_t i = address; i < address + 8; i++) {
+                if (cpu->memory[i] != base[i]) {
+                    *diff++ = i & 0xFF;
+                    *diff++ = i >> 8;
+                    *diff++ = cpu->memory[i];
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Load an encoded state into a worker CPU
+static void explore_decode(explore_t* ex, const uint8_t* state, cpu_state_t* cpu) {
+    const uint8_t* base = ex->config->image;
+    explore_state_header_t header;
+    memcpy(&header, state, sizeof(header));
+
+    memcpy(cpu->memory, base, MEMORY_SIZE);
+    cpu->memory_hash = ex->base_hash;
+
+    const uint8_t* diff = state + sizeof(header);
+    for (uint32_t i = 0; i < header.diff_count; i++, diff += 3) {
+        uint16_t address = diff[0] | (diff[1] << 8);
+        statehash_update(&cpu->memory_hash, address, base[address], diff[2]);
+        cpu->memory[address] = diff[2];
+    }
+
+    memcpy(cpu->regs, header.regs, sizeof(header.regs));
+    cpu->flags = header.flags;
+    cpu->irq_pending = header.irq_pending;
+    cpu->irq_raised = header.irq_raised;
+    cpu->nmi_pending = header.nmi_pending;
+    *cpu->devices = header.devices;
+    cpu->cycle_count = 0;
+    cpu->running = true;
+}
+
+// Determine whether the next instruction is an input point
+static explore_input_t explore_input_point(explore_t* ex, cpu_state_t* cpu, uint16_t* address) {
+    const explore_config_t* config = ex->config;
+    uint16_t pc = isa_get_register16(cpu, REG_PC);
+    uint8_t opcode = cpu->memory[isa_physical_address(cpu, pc)];
+    const instruction_t* inst = isa_get_instruction((opcode_t)opcode);
+
+    if (!inst || inst->opcode == OP_STA || inst->opcode == OP_JMP || inst->opcode == OP_JSR) {
+        return EXPLORE_INPUT_NONE;
+    }
+    if (inst->addr_mode != ADDR_ABSOLUTE && inst->addr_mode != ADDR_X_INDEXED &&
+        inst->addr_mode != ADDR_Y_INDEXED) {
+        return EXPLORE_INPUT_NONE;
+    }
+
+    *address = isa_get_address(cpu, inst->addr_mode, cpu->memory[isa_physical_address(cpu, pc + 1)],
+                               cpu->memory[isa_physical_address(cpu, pc + 2)]);
+
+    if (*address == UART_RX_ADDR && config->rx_value_count > 0) {
+        return EXPLORE_INPUT_RX;
+    }
+    if (*address == UART_STATUS_ADDR && config->rx_value_count > 0) {
+        return EXPLORE_INPUT_RX_STATUS;
+    }
+    if (*address == GPIO_PORT_ADDR && config->gpio_mask != 0) {
+        return EXPLORE_INPUT_GPIO;
+    }
+    return EXPLORE_INPUT_NONE;
+}
+
+// Whether an IRQ could be delivered before the next instruction
+static bool explore_irq_point(explore_t* ex, cpu_state_t* cpu) {
+    return ex->config->irq && !cpu->irq_pending && !isa_get_flag(cpu, FLAG_INTERRUPT);
+}
+
+// Present an input value to the guest at an input point
+static void explore_inject(cpu_state_t* cpu, uint16_t address, uint8_t value) {
+    device_set_t* devices = cpu->devices;
+    switch (address) {
+        case UART_RX_ADDR:
+            devices->uart.rx_data = value;
+            devices->uart.rx_ready = true;
+            break;
+        case UART_STATUS_ADDR:
+            devices->uart.rx_ready = (value & 0x02) != 0;
+            break;
+        case GPIO_PORT_ADDR:
+            devices->gpio.port = value;
+            break;
+    }
+    device_set_update_irq(devices);
+}
+
+// Input register value without the read side effects
+static uint8_t explore_peek(cpu_state_t* cpu, uint16_t address) {
+    const device_set_t* devices = cpu->devices;
+    switch (address) {
+        case UART_STATUS_ADDR:
+            return (devices->uart.tx_ready ? 0x01 : 0x00) | (devices->uart.rx_ready ? 0x02 : 0x00) |
+                   (devices->uart.tx_empty ? 0x04 : 0x00) | (devices->uart.rx_full ? 0x08 : 0x00);
+        case GPIO_PORT_ADDR:
+            return devices->gpio.port;
+        default:
+            return 0;
+    }
+}
+
+// Record a violation, keeping one entry per (type, PC)
+static void explore_report(explore_t* ex, explore_violation_type_t type, cpu_state_t* cpu,
+                           uint8_t opcode, const explore_record_t* step) {
+    explore_result_t* result = ex->result;
+    uint16_t pc = isa_get_register16(cpu, REG_PC);
+
+    pthread_mutex_lock(&ex->lock);
+    bool known = false;
+    for (int i = 0; i < result->violation_count; i++) {
+        if (result->violations[i].type == type && result->violations[i].pc == pc) {
+            known = true;
+            break;
+        }
+    }
+    if (!known && result->violation_count < EXPLORE_MAX_VIOLATIONS) {
+        explore_violation_t* violation = &result->violations[result->violation_count++];
+        violation->type = type;
+        violation->pc = pc;
+        violation->sp = isa_get_register16(cpu, REG_SP);
+        violation->opcode = opcode;
+        violation->depth = ex->depth + 1;
+        violation->step = *step;
+        if (result->violation_count >= ex->config->max_violations) {
+            ex->stop = true;
+        }
+    }
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// Run from an input point until the next one, a halt or a violation
+static explore_segment_t explore_segment(explore_t* ex, cpu_state_t* cpu, const explore_record_t* step,
+                                         uint16_t input_address) {
+    const explore_config_t* config = ex->config;
+
+    if (step->input == EXPLORE_INPUT_IRQ) {
+        cpu_irq(cpu);
+        cpu_handle_interrupts(cpu);
+    } else if (step->input != EXPLORE_INPUT_NONE) {
+        explore_inject(cpu, input_address, step->value);
+    }
+
+    for (uint64_t steps = 0; ; ) {
+        uint8_t opcode = cpu->memory[isa_physical_address(cpu, isa_get_register16(cpu, REG_PC))];
+        if (!isa_is_valid_opcode(opcode)) {
+            explore_report(ex, EXPLORE_VIOLATION_INVALID_OPCODE, cpu, opcode, step);
+            return SEGMENT_VIOLATION;
+        }
+
+        cpu_step(cpu);
+        steps++;
+
+        if (!cpu->running) {
+            return SEGMENT_HALTED;
+        }
+
+        if (config->stack_limit != 0 && isa_get_register16(cpu, REG_SP) < config->stack_limit) {
+            explore_report(ex, EXPLORE_VIOLATION_STACK_OVERFLOW, cpu, opcode, step);
+            return SEGMENT_VIOLATION;
+        }
+
+        uint16_t pc = isa_get_register16(cpu, REG_PC);
+        for (int i = 0; i < config->assert_count; i++) {
+            if (pc == config->asserts[i]) {
+                explore_report(ex, EXPLORE_VIOLATION_ASSERTION, cpu, cpu->memory[isa_physical_address(cpu, pc)], step);
+                return SEGMENT_VIOLATION;
+            }
+        }
+
+        uint16_t address;
+        if (explore_input_point(ex, cpu, &address) != EXPLORE_INPUT_NONE || explore_irq_point(ex, cpu)) {
+            return SEGMENT_BRANCH;
+        }
+
+        if (steps >= config->max_steps) {
+            return SEGMENT_TRUNCATED;
+        }
+    }
+}
+
+// Keep a newly reached state for the next level
+static bool explore_push(explore_worker_t* worker, const explore_record_t* record) {
+    explore_t* ex = worker->ex;
+    uint64_t hash = cpu_state_hash(worker->cpu);
+
+    int inserted = explore_visited_insert(&ex->visited, hash);
+    if (inserted < 0) {
+        return false;
+    }
+    if (inserted == 0) {
+        return true;
+    }
+
+    pthread_mutex_lock(&ex->lock);
+    ex->visited.count++;
+    if (ex->visited.count >= ex->config->max_states) {
+        ex->stop = true;
+    }
+    pthread_mutex_unlock(&ex->lock);
+
+    if (worker->next_count == worker->next_capacity) {
+        size_t capacity = worker->next_capacity ? worker->next_capacity * 2 : 256;
+        explore_successor_t* next = realloc(worker->next, capacity * sizeof(explore_successor_t));
+        if (!next) {
+            return false;
+        }
+        worker->next = next;
+        worker->next_capacity = capacity;
+    }
+
+    size_t offset = worker->next_states.size;
+    if (!explore_encode(ex, worker->cpu, &worker->next_states)) {
+        return false;
+    }
+    worker->next[worker->next_count].record = *record;
+    worker->next[worker->next_count].offset = offset;
+    worker->next_count++;
+    return true;
+}
+
+// Expand every successor of one frontier state
+static bool explore_expand(explore_worker_t* worker, const explore_item_t* item) {
+    explore_t* ex = worker->ex;
+    const explore_config_t* config = ex->config;
+    cpu_state_t* cpu = worker->cpu;
+
+    explore_decode(ex, item->state, cpu);
+
+    uint16_t pc = isa_get_register16(cpu, REG_PC);
+    uint16_t address = 0;
+    explore_input_t input = explore_input_point(ex, cpu, &address);
+    bool irq = explore_irq_point(ex, cpu);
+
+    // Enumerate the input values offered at this point
+    uint8_t values[256];
+    int value_count = 0;
+    uint8_t current = explore_peek(cpu, address);
+    switch (input) {
+        case EXPLORE_INPUT_RX:
+            memcpy(values, config->rx_values, config->rx_value_count);
+            value_count = config->rx_value_count;
+            break;
+        case EXPLORE_INPUT_RX_STATUS:
+            values[value_count++] = current & ~0x02;
+            values[value_count++] = current | 0x02;
+            break;
+        case EXPLORE_INPUT_GPIO: {
+            // Every subset of the nondeterministic pins
+            uint8_t mask = config->gpio_mask;
+            uint8_t subset = 0;
+            do {
+                values[value_count++] = (current & ~mask) | subset;
+                subset = (subset - mask) & mask;
+            } while (subset != 0);
+            break;
+        }
+        default:
+            values[value_count++] = 0;
+            break;
+    }
+
+    int choices = value_count + (irq ? 1 : 0);
+    for (int i = 0; i < choices; i++) {
+        explore_record_t record;
+        record.parent = item->id;
+        record.pc = pc;
+        if (i < value_count) {
+            record.input = input;
+            record.value = input == EXPLORE_INPUT_NONE ? 0 : values[i];
+        } else {
+            record.input = EXPLORE_INPUT_IRQ;
+            record.value = 0;
+        }
+
+        if (i > 0) {
+            explore_decode(ex, item->state, cpu);
+        }
+
+        worker->transitions++;
+        switch (explore_segment(ex, cpu, &record, address)) {
+            case SEGMENT_BRANCH:
+                if (!explore_push(worker, &record)) {
+                    return false;
+                }
+                break;
+            case SEGMENT_HALTED:
+                worker->halted++;
+                break;
+            case SEGMENT_TRUNCATED:
+                worker->truncated++;
+                break;
+            case SEGMENT_VIOLATION:
+                break;
+        }
+    }
+
+    return true;
+}
+
+// Worker thread: take frontier chunks until the level is done
+static void* explore_worker_main(void* arg) {
+    explore_worker_t* worker = arg;
+    explore_t* ex = worker->ex;
+
+    while (true) {
+        pthread_mutex_lock(&ex->lock);
+        bool stop = ex->stop || ex->failed;
+        size_t begin = ex->frontier_next;
+        size_t end = begin + EXPLORE_CHUNK;
+        if (end > ex->frontier_count) {
+            end = ex->frontier_count;
+        }
+        ex->frontier_next = end;
+        pthread_mutex_unlock(&ex->lock);
+
+        if (stop || begin >= end) {
+            break;
+        }
+
+        for (size_t i = begin; i < end; i++) {
+            if (!explore_expand(worker, &ex->frontier[i])) {
+                pthread_mutex_lock(&ex->lock);
+                ex->failed = true;
+                pthread_mutex_unlock(&ex->lock);
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Append a record; returns its state id
+static bool explore_add_record(explore_result_t* result, const explore_record_t* record, uint64_t* capacity) {
+    if (result->record_count == *capacity) {
+        uint64_t grown = *capacity ? *capacity * 2 : 1024;
+        explore_record_t* records = realloc(result->records, grown * sizeof(explore_record_t));
+        if (!records) {
+            return false;
+        }
+        result->records = records;
+        *capacity = grown;
+    }
+    result->records[result->record_count++] = *record;
+    return true;
+}
+
+// Explore the state space reachable from config->image
+bool explore_run(const explore_config_t* config, explore_result_t* result) {
+    explore_t ex;
+    memset(&ex, 0, sizeof(ex));
+    memset(result, 0, sizeof(*result));
+    ex.config = config;
+    ex.result = result;
+    ex.base_hash = statehash_memory(config->image, 0, MEMORY_SIZE);
+    pthread_mutex_init(&ex.lock, NULL);
+
+    int thread_count = config->threads > 0 ? config->threads : 1;
+    explore_worker_t* workers = calloc(thread_count, sizeof(explore_worker_t));
+    ex.frontier_states = calloc(thread_count, sizeof(explore_buffer_t));
+    uint64_t record_capacity = 0;
+    bool ok = workers != NULL && ex.frontier_states != NULL && explore_visited_init(&ex.visited, config->memory_limit, config->spill_dir);
+
+    for (int i = 0; ok && i < thread_count; i++) {
+        workers[i].ex = &ex;
+        workers[i].cpu = cpu_create_isolated();
+        if (!workers[i].cpu) {
+            ok = false;
+            break;
+        }
+        cpu_enable_state_hash(workers[i].cpu, true);
+    }
+
+    // Root state
+    if (ok) {
+        cpu_state_t* cpu = workers[0].cpu;
+        memcpy(cpu->memory, config->image, MEMORY_SIZE);
+        cpu_rehash_memory(cpu);
+        cpu_reset_to_address(cpu, config->entry_address);
+        cpu->running = true;
+
+        explore_record_t root = {EXPLORE_NO_PARENT, config->entry_address, EXPLORE_INPUT_NONE, 0};
+        ex.frontier = malloc(sizeof(explore_item_t));
+        ok = ex.frontier != NULL && explore_add_record(result, &root, &record_capacity);
+        if (ok) {
+            ok = explore_encode(&ex, cpu, &ex.frontier_states[0]);
+            ex.frontier[0].id = 0;
+            ex.frontier[0].state = ex.frontier_states[0].data;
+            ex.frontier_count = ok ? 1 : 0;
+            if (ex.frontier_states[0].spilled) {
+                result->frontier_spilled_bytes = ex.frontier_states[0].capacity;
+            }
+            explore_visited_insert(&ex.visited, cpu_state_hash(cpu));
+            ex.visited.count = 1;
+        }
+    }
+
+    // Level-synchronous breadth-first search
+    while (ok && ex.frontier_count > 0 && !ex.stop && ex.depth < config->max_depth) {
+        ex.frontier_next = 0;
+
+        for (int i = 0; i < thread_count; i++) {
+            workers[i].next_count = 0;
+            if (pthread_create(&workers[i].thread, NULL, explore_worker_main, &workers[i]) != 0) {
+                explore_worker_main(&workers[i]);
+                workers[i].thread = pthread_self();
+            }
+        }
+        for (int i = 0; i < thread_count; i++) {
+            if (!pthread_equal(workers[i].thread, pthread_self())) {
+                pthread_join(workers[i].thread, NULL);
+            }
+        }
+
+        // Merge successors into the next frontier; the states stay in the
+        // workers' buffers, which become the frontier's
+        size_t spilled = 0;
+        for (int i = 0; i < thread_count; i++) {
+            explore_buffer_free(&ex.visited, &ex.frontier_states[i]);
+            ex.frontier_states[i] = workers[i].next_states;
+            memset(&workers[i].next_states, 0, sizeof(explore_buffer_t));
+            if (ex.frontier_states[i].spilled) {
+                spilled += ex.frontier_states[i].capacity;
+            }
+        }
+        if (spilled > result->frontier_spilled_bytes) {
+            result->frontier_spilled_bytes = spilled;
+        }
+
+        size_t next_count = 0;
+        for (int i = 0; i < thread_count; i++) {
+            next_count += workers[i].next_count;
+        }
+
+        explore_item_t* next = next_count ? malloc(next_count * sizeof(explore_item_t)) : NULL;
+        if (next_count && !next) {
+            ok = false;
+        }
+
+        size_t n = 0;
+        for (int i = 0; i < thread_count; i++) {
+            for (size_t j = 0; j < workers[i].next_count; j++) {
+                explore_successor_t* successor = &workers[i].next[j];
+                if (ok && explore_add_record(result, &successor->record, &record_capacity)) {
+                    next[n].id = (uint32_t)(result->record_count - 1);
+                    next[n].state = ex.frontier_states[i].data + successor->offset;
+                    n++;
+                } else {
+                    ok = false;
+                }
+            }
+            workers[i].next_count = 0;
+        }
+
+        free(ex.frontier);
+        ex.frontier = next;
+        ex.frontier_count = n;
+        ex.depth++;
+
+        if (ex.failed) {
+            ok = false;
+        }
+    }
+
+    result->states = ex.visited.count;
+    result->depth = ex.depth;
+    result->complete = ok && ex.frontier_count == 0 && !ex.stop;
+    for (int i = 0; i < EXPLORE_SHARD_COUNT; i++) {
+        size_t bytes = ex.visited.shards[i].capacity * sizeof(uint64_t);
+        result->visited_bytes += bytes;
+        result->spilled_bytes += ex.visited.shards[i].spilled ? bytes : 0;
+    }
+
+    // Cleanup
+    free(ex.frontier);
+    for (int i = 0; ex.frontier_states && i < thread_count; i++) {
+        explore_buffer_free(&ex.visited, &ex.frontier_states[i]);
+    }
+    free(ex.frontier_states);
+    if (workers) {
+        for (int i = 0; i < thread_count; i++) {
+            explore_buffer_free(&ex.visited, &workers[i].next_states);
+            result->transitions += workers[i].transitions;
+            result->halted += workers[i].halted;
+            result->truncated += workers[i].truncated;
+            free(workers[i].next);
+            if (workers[i].cpu) {
+                cpu_destroy(workers[i].cpu);
+            }
+        }
+        free(workers);
+    }
+    explore_visited_cleanup(&ex.visited);
+    pthread_mutex_destroy(&ex.lock);
+
+    if (!ok) {
+        fprintf(stderr, "Exploration aborted: out of memory\n");
+    }
+    return ok;
+}
+
+static const char* explore_input_name(uint8_t input) {
+    switch (input) {
+        case EXPLORE_INPUT_RX: return "RX";
+        case EXPLORE_INPUT_RX_STATUS: return "RX status";
+        case EXPLORE_INPUT_GPIO: return "GPIO";
+        case EXPLORE_INPUT_IRQ: return "IRQ";
+        default: return NULL;
+    }
+}
+
+static void explore_print_step(const explore_record_t* record, FILE* out) {
+    const char* name = explore_input_name(record->input);
+    if (!name) {
+        return;
+    }
+    if (record->input == EXPLORE_INPUT_IRQ) {
+        fprintf(out, "  0x%04X: %s\n", record->pc, name);
+    } else {
+        fprintf(out, "  0x%04X: %s 0x%02X\n", record->pc, name, record->value);
+    }
+}
+
+// Print a violation and the shortest input sequence that reaches it
+void explore_print_violation(const explore_result_t* result, const explore_violation_t* violation, FILE* out) {
+    switch (violation->type) {
+        case EXPLORE_VIOLATION_INVALID_OPCODE:
+            fprintf(out, "Invalid opcode 0x%02X at PC=0x%04X", violation->opcode, violation->pc);
+            break;
+        case EXPLORE_VIOLATION_STACK_OVERFLOW:
+            fprintf(out, "Stack overflow (SP=0x%04X) at PC=0x%04X", violation->sp, violation->pc);
+            break;
+        case EXPLORE_VIOLATION_ASSERTION:
+            fprintf(out, "Assertion address reached at PC=0x%04X", violation->pc);
+            break;
+    }
+    fprintf(out, " (depth %u)\n", violation->depth);
+
+    // Walk back to the root, then print inputs in execution order
+    uint32_t path[256];
+    int length = 0;
+    for (uint32_t id = violation->step.parent;
+         id != EXPLORE_NO_PARENT && id < result->record_count && length < 256;
+         id = result->records[id].parent) {
+        path[length++] = id;
+    }
+    for (int i = length - 1; i >= 0; i--) {
+        explore_print_step(&result->records[path[i]], out);
+    }
+    explore_print_step(&violation->step, out);
+}
+
+void explore_result_free(explore_result_t* result) {
+    free(result->records);
+    result->records = NULL;
+    result->record_count = 0;
+}
@@ -0,0 +1,104 @@
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include "cpu.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Explicit-state model checking.
+// The machine is forked at every nondeterministic input point (a read of
+// UART RX data or status, a read of nondeterministic GPIO pins, or an
+// instruction boundary where an IRQ could arrive) and the reachable state
+// space is explored breadth-first. Between input points execution is
+// deterministic and runs as a single transition.
+//
+// Visited states are kept as 64-bit whole-machine hashes (hash compaction)
+// in a sharded hash set shared by all worker threads. The frontier's
+// states are encoded as a diff against the initial image into per-worker
+// buffers. Both draw on one RAM budget; once it is spent, further hash
+// tables and state buffers are placed in memory-mapped spill files. Only
+// the per-state bookkeeping (a 16-byte frontier entry and an 8-byte
+// record) always stays in RAM.
+
+#define EXPLORE_MAX_ASSERTS 16
+#define EXPLORE_MAX_VIOLATIONS 64
+
+// Input that led into a transition
+typedef enum {
+    EXPLORE_INPUT_NONE = 0,
+    EXPLORE_INPUT_RX,           // Byte returned by UART RX data
+    EXPLORE_INPUT_RX_STATUS,    // UART status with or without RX ready
+    EXPLORE_INPUT_GPIO,         // GPIO port with nondeterministic pins
+    EXPLORE_INPUT_IRQ           // IRQ arrives before the instruction
+} explore_input_t;
+
+// Property violations
+typedef enum {
+    EXPLORE_VIOLATION_INVALID_OPCODE = 0,
+    EXPLORE_VIOLATION_STACK_OVERFLOW,
+    EXPLORE_VIOLATION_ASSERTION
+} explore_violation_type_t;
+
+// Exploration settings
+typedef struct {
+    const uint8_t* image;                   // Full 64 KiB initial memory image
+    uint16_t entry_address;
+    uint16_t stack_limit;                   // SP below this is an overflow (0 = off)
+    uint16_t asserts[EXPLORE_MAX_ASSERTS];  // Addresses that must never be reached
+    int assert_count;
+    uint8_t rx_values[256];                 // Candidate RX bytes
+    int rx_value_count;
+    uint8_t gpio_mask;                      // Nondeterministic GPIO input pins
+    bool irq;                               // Branch on IRQ arrival
+    int threads;
+    uint64_t max_states;
+    uint32_t max_depth;
+    uint64_t max_steps;                     // Instructions per transition
+    size_t memory_limit;                    // Visited-set and frontier bytes kept in RAM
+    const char* spill_dir;
+    int max_violations;
+} explore_config_t;
+
+// One explored state: how it was reached from its parent
+typedef struct {
+    uint32_t parent;
+    uint16_t pc;                            // Parent PC at the input point
+    uint8_t input;                          // explore_input_t
+    uint8_t value;
+} explore_record_t;
+
+// A reachable property violation
+typedef struct {
+    explore_violation_type_t type;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t opcode;
+    uint32_t depth;
+    explore_record_t step;                  // Last transition, from state step.parent
+} explore_violation_t;
+
+// Exploration results
+typedef struct {
+    uint64_t states;
+    uint64_t transitions;
+    uint64_t halted;
+    uint64_t truncated;
+    uint32_t depth;
+    bool complete;                          // Exhausted within all limits
+    size_t visited_bytes;
+    size_t spilled_bytes;
+    size_t frontier_spilled_bytes;          // Largest level spilled
+    int violation_count;
+    explore_violation_t violations[EXPLORE_MAX_VIOLATIONS];
+    explore_record_t* records;
+    uint64_t record_count;
+} explore_result_t;
+
+void explore_config_init(explore_config_t* config);
+bool explore_run(const explore_config_t* config, explore_result_t* result);
+void explore_print_violation(const explore_result_t* result, const explore_violation_t* violation, FILE* out);
+void explore_result_free(explore_result_t* result);
+
+#endif // EXPLORE_H
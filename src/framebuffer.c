@@ -0,0 +1,134 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "framebuffer.h"
+#include "memory.h"
+#include "atomics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The display lock is taken by the CPU thread and the GUI thread
+#ifdef _WIN32
+#include <windows.h>
+typedef CRITICAL_SECTION fb_lock_t;
+#define FB_LOCK_INIT(lock) InitializeCriticalSection(lock)
+#define FB_LOCK_DESTROY(lock) DeleteCriticalSection(lock)
+#define FB_LOCK(lock) EnterCriticalSection(lock)
+#define FB_UNLOCK(lock) LeaveCriticalSection(lock)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t fb_lock_t;
+#define FB_LOCK_INIT(lock) pthread_mutex_init(lock, NULL)
+#define FB_LOCK_DESTROY(lock) pthread_mutex_destroy(lock)
+#define FB_LOCK(lock) pthread_mutex_lock(lock)
+#define FB_UNLOCK(lock) pthread_mutex_unlock(lock)
+#endif
+
+struct fb_display {
+    fb_lock_t lock;
+    uint8_t format;
+    uint32_t frame;                     // Latest published frame
+    uint32_t row_frame[FB_HEIGHT];      // Frame in which each row last changed
+    uint8_t pixels[FB_MAX_BYTES];       // Front buffer
+};
+
+fb_display_t* fb_display_create(void) {
+    fb_display_t* display = calloc(1, sizeof(fb_display_t));
+    if (display) {
+        FB_LOCK_INIT(&display->lock);
+        display->format = FB_FORMAT_MONO;
+    }
+    return display;
+}
+
+void fb_display_destroy(fb_display_t* display) {
+    if (display) {
+        FB_LOCK_DESTROY(&display->lock);
+        free(display);
+    }
+}
+
+void fb_display_publish(fb_display_t* display, const uint8_t* memory, uint8_t format, uint64_t rows) {
+    size_t row_bytes = FB_ROW_BYTES(format);
+
+    FB_LOCK(&display->lock);
+    if (format != display->format) {
+        display->format = format;
+        rows = FB_ALL_ROWS;
+    }
+    display->frame++;
+    for (int row = 0; row < FB_HEIGHT; row++) {
+        if (rows & (1ULL << row)) {
+            memcpy(display->pixels + row * row_bytes, memory + row * row_bytes, row_bytes);
+            display->row_frame[row] = display->frame;
+        }
+    }
+    FB_UNLOCK(&display->lock);
+}
+
+uint64_t fb_display_fetch(fb_display_t* display, fb_view_t* view) {
+    uint64_t rows = 0;
+
+    FB_LOCK(&display->lock);
+    bool full = view->format != display->format;
+    size_t row_bytes = FB_ROW_BYTES(display->format);
+
+    for (int row = 0; row < FB_HEIGHT; row++) {
+        if (full || display->row_frame[row] > view->frame) {
+            memcpy(view->pixels + row * row_bytes, display->pixels + row * row_bytes, row_bytes);
+            rows |= 1ULL << row;
+        }
+    }
+    view->format = display->format;
+    view->frame = display->frame;
+    FB_UNLOCK(&display->lock);
+    return rows;
+}
+
+uint32_t fb_view_pixel(const fb_view_t* view, int x, int y) {
+    if (view->format == FB_FORMAT_MONO) {
+        uint8_t byte = view->pixels[y * FB_ROW_BYTES(FB_FORMAT_MONO) + x / 8];
+        return (byte & (0x80 >> (x % 8))) ? 0xFFFFFF : 0x000000;
+    }
+
+    // Expand RRRGGGBB to full-range channels
+    uint8_t value = view->pixels[y * FB_WIDTH + x];
+    uint32_t r = ((value >> 5) & 0x07) * 255 / 7;
+    uint32_t g = ((value >> 2) & 0x07) * 255 / 7;
+    uint32_t b = (value & 0x03) * 255 / 3;
+    return (r << 16) | (g << 8) | b;
+}
+
+bool fb_view_write_ppm(const fb_view_t* view, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot write frame to %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", FB_WIDTH, FB_HEIGHT);
+    for (int y = 0; y < FB_HEIGHT; y++) {
+        uint8_t line[FB_WIDTH * 3];
+        for (int x = 0; x < FB_WIDTH; x++) {
+            uint32_t rgb = fb_view_pixel(view, x, y);
+            line[x * 3] = rgb >> 16;
+            line[x * 3 + 1] = (rgb >> 8) & 0xFF;
+            line[x * 3 + 2] = rgb & 0xFF;
+        }
+        fwrite(line, 1, sizeof(line), file);
+    }
+    return fclose(file) == 0;
+}
+
+void framebuffer_present(cpu_state_t* cpu) {
+    fb_device_t* fb = &cpu->devices->fb;
+
+    // Other cores may be marking rows while this runs; take the bitmap atomically
+    uint64_t dirty = atomics_exchange_u64(&fb->dirty, 0, ATOMICS_ACQ_REL);
+    if (fb->display && dirty) {
+        fb_display_publish(fb->display, cpu->memory + FB_START, fb->format, dirty);
+    }
+    fb->present_pending = false;
+    fb->next_auto = cpu->cycle_count + FB_AUTO_CYCLES;
+    fb->frames++;
+}
@@ -0,0 +1,48 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "cpu.h"
+#include "devices.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Framebuffer display side.
+// The guest draws into framebuffer memory, which is the back buffer. A
+// present (FB_CTRL bit 0, or automatically every FB_AUTO_CYCLES) copies
+// only the rows written since the previous present into the display's
+// front buffer and stamps them with the new frame number. Consumers (the
+// GUI, frame dumps, tests) keep their own view and fetch the rows stamped
+// after the frame they last saw. Both sides hold the display lock only
+// while copying changed rows, so a consumer always sees a whole frame and
+// the cost per frame follows the number of rows changed.
+
+#define FB_MAX_BYTES (FB_HEIGHT * FB_WIDTH)
+
+// Display shared between the CPU thread and consumers (opaque outside framebuffer.c)
+typedef struct fb_display fb_display_t;
+
+// A consumer's copy of the presented frame. Zero-initialise before the
+// first fetch.
+typedef struct {
+    uint8_t format;
+    uint32_t frame;             // Last frame fetched
+    uint8_t pixels[FB_MAX_BYTES];
+} fb_view_t;
+
+fb_display_t* fb_display_create(void);
+void fb_display_destroy(fb_display_t* display);
+
+// Producer: copy the given rows of framebuffer memory as the next frame
+void fb_display_publish(fb_display_t* display, const uint8_t* memory, uint8_t format, uint64_t rows);
+
+// Consumer: bring the view up to the latest frame; returns the rows updated
+uint64_t fb_display_fetch(fb_display_t* display, fb_view_t* view);
+
+// Pixel colour as 0xRRGGBB, and the view as a binary PPM
+uint32_t fb_view_pixel(const fb_view_t* view, int x, int y);
+bool fb_view_write_ppm(const fb_view_t* view, const char* path);
+
+// Present the CPU's framebuffer to its display (called from cpu_poll_devices)
+void framebuffer_present(cpu_state_t* cpu);
+
+#endif // FRAMEBUFFER_H
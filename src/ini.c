@@ -0,0 +1,142 @@
+#include "ini.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool ini_error(const ini_reader_t* reader, const char* message, const char* detail) {
+    fprintf(stderr, "%s:%d: %s%s%s\n", reader->origin, reader->line, message,
+            detail ? ": " : "", detail ? detail : "");
+    return false;
+}
+
+// Strip leading and trailing whitespace in place
+char* ini_trim(char* text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return text;
+}
+
+// strtoul would accept a sign and leading blanks
+static bool ini_digits(const char* text, unsigned long* number, char** end) {
+    if (!isdigit((unsigned char)text[0])) {
+        return false;
+    }
+    *number = strtoul(text, end, 0);
+    return true;
+}
+
+bool ini_number(const char* text, uint32_t max, uint32_t* value) {
+    unsigned long number;
+    char* end;
+    if (!ini_digits(text, &number, &end) || *end != '\0' || number > max) {
+        return false;
+    }
+    *value = (uint32_t)number;
+    return true;
+}
+
+// Byte count with an optional K or M suffix
+bool ini_size(const char* text, uint32_t max, uint32_t* value) {
+    unsigned long number;
+    unsigned long unit = 1;
+    char* end;
+    if (!ini_digits(text, &number, &end)) {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        unit = 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        unit = 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || number > max / unit) {
+        return false;
+    }
+    *value = (uint32_t)(number * unit);
+    return true;
+}
+
+bool ini_flag(const char* text, bool* value) {
+    if (strcmp(text, "yes") == 0 || strcmp(text, "true") == 0 || strcmp(text, "on") == 0 ||
+        strcmp(text, "1") == 0) {
+        *value = true;
+        return true;
+    }
+    if (strcmp(text, "no") == 0 || strcmp(text, "false") == 0 || strcmp(text, "off") == 0 ||
+        strcmp(text, "0") == 0) {
+        *value = false;
+        return true;
+    }
+    return false;
+}
+
+// "[kind]" or "[kind argument]", brackets removed
+static bool ini_section(ini_reader_t* reader, char* header) {
+    char* argument = header;
+    while (*argument && !isspace((unsigned char)*argument)) {
+        argument++;
+    }
+    if (*argument) {
+        *argument++ = '\0';
+        argument = ini_trim(argument);
+    }
+    return reader->section(reader->context, header, argument);
+}
+
+bool ini_read(ini_reader_t* reader, const char* text) {
+    size_t length = strlen(text);
+    char* buffer = malloc(length + 1);
+    if (!buffer) {
+        return ini_error(reader, "out of memory", NULL);
+    }
+    memcpy(buffer, text, length + 1);
+
+    bool ok = true;
+    char* next = buffer;
+    reader->line = 0;
+    while (ok && next) {
+        char* line = next;
+        next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+        reader->line++;
+
+        char* comment = strpbrk(line, ";#");
+        if (comment) {
+            *comment = '\0';
+        }
+        line = ini_trim(line);
+        if (*line == '\0') {
+            continue;
+        }
+
+        if (*line == '[') {
+            char* close = strchr(line, ']');
+            if (!close || close[1] != '\0') {
+                ok = ini_error(reader, "malformed section header", line);
+                break;
+            }
+            *close = '\0';
+            ok = ini_section(reader, ini_trim(line + 1));
+            continue;
+        }
+
+        char* equals = strchr(line, '=');
+        if (!equals) {
+            ok = ini_error(reader, "expected key = value", line);
+            break;
+        }
+        *equals = '\0';
+        ok = reader->set(reader->context, ini_trim(line), ini_trim(equals + 1));
+    }
+    free(buffer);
+    return ok;
+}
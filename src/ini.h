@@ -0,0 +1,48 @@
+#ifndef INI_H
+#define INI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reader for the INI-style text files: machine descriptions (machine.h),
+// net topologies (net.h) and linker scripts (linker.h).
+//
+//   ; comment, or # comment, also after a setting
+//   [kind argument]   section; the argument is optional
+//   key = value
+//
+// Blank lines and comments are skipped and keys, values, kinds and
+// arguments are trimmed. Each section header and setting is passed to a
+// callback, which reports its own errors with ini_error and stops the
+// read by returning false.
+
+typedef bool (*ini_section_fn)(void* context, char* kind, char* argument);
+typedef bool (*ini_set_fn)(void* context, const char* key, const char* value);
+
+typedef struct {
+    const char* origin;         // File name (or description) for messages
+    int line;                   // Line being read, from 1
+    ini_section_fn section;
+    ini_set_fn set;
+    void* context;
+} ini_reader_t;
+
+// Read a whole text; false on the first error
+bool ini_read(ini_reader_t* reader, const char* text);
+
+// Print "origin:line: message: detail" (detail may be NULL); false
+bool ini_error(const ini_reader_t* reader, const char* message, const char* detail);
+
+// Strip leading and trailing whitespace in place
+char* ini_trim(char* text);
+
+// Unsigned decimal, 0x hex or 0 octal number up to max
+bool ini_number(const char* text, uint32_t max, uint32_t* value);
+
+// Byte count with an optional K or M suffix, up to max
+bool ini_size(const char* text, uint32_t max, uint32_t* value);
+
+// yes/true/on/1 or no/false/off/0
+bool ini_flag(const char* text, bool* value);
+
+#endif // INI_H
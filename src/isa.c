@@ -1,4 +1,9 @@
 #include "isa.h"
+#include "statehash.h"
+#include "memory.h"
+#include "devices.h"
+#include "smp.h"
+#include "atomics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -84,7 +89,11 @@ static const instruction_t instruction_table[] = {
     {OP_SEI, ADDR_IMMEDIATE, 0, 0, 2, "SEI"},
     {OP_CLI, ADDR_IMMEDIATE, 0, 0, 2, "CLI"},
     {OP_NOP, ADDR_IMMEDIATE, 0, 0, 1, "NOP"},
-    {OP_HLT, ADDR_IMMEDIATE, 0, 0, 1, "HLT"}
+    {OP_HLT, ADDR_IMMEDIATE, 0, 0, 1, "HLT"},
+    
+    // Atomic instructions
+    {OP_TAS, ADDR_ABSOLUTE, 0, 0, 5, "TAS"},
+    {OP_CAS, ADDR_ABSOLUTE, 0, 0, 6, "CAS"}
 };
 
 #define INSTRUCTION_COUNT (sizeof(instruction_table) / sizeof(instruction_table[0]))
@@ -112,6 +121,37 @@ uint8_t isa_get_cycles(opcode_t opcode) {
     return inst ? inst->cycles : 0;
 }
 
+// Cycles per opcode from the instruction table, indexed by opcode byte
+const uint8_t* isa_default_cycles(void) {
+    static uint8_t table[256];
+    static bool built = false;
+    
+    if (!built) {
+        for (int opcode = 0; opcode < 256; opcode++) {
+            table[opcode] = isa_get_cycles((opcode_t)opcode);
+        }
+        built = true;
+    }
+    return table;
+}
+
+// Encoded size in bytes (opcode plus the operands fetched for its addressing mode)
+uint8_t isa_get_length(opcode_t opcode) {
+    const instruction_t* inst = isa_get_instruction(opcode);
+    if (!inst) {
+        return 1;
+    }
+    
+    switch (inst->addr_mode) {
+        case ADDR_ABSOLUTE:
+        case ADDR_X_INDEXED:
+        case ADDR_Y_INDEXED:
+            return 3;
+        default:
+            return 2;
+    }
+}
+
 bool isa_is_valid_opcode(uint8_t opcode) {
     return isa_get_instruction((opcode_t)opcode) != NULL;
 }
@@ -183,14 +223,104 @@ uint16_t isa_get_address(cpu_state_t* cpu, addressing_mode_t mode, uint8_t opera
     }
 }
 
+// Bookkeeping for a store to physical memory
+static void isa_memory_written(cpu_state_t* cpu, uint32_t physical, uint8_t old, uint8_t value) {
+    // Framebuffer memory is plain memory whose written rows are tracked;
+    // it sits at a physical address, so a bank can map it elsewhere
+    if (physical >= FB_START && physical <= FB_END && cpu->devices) {
+        fb_mark_dirty(&cpu->devices->fb, (uint16_t)physical);
+    }
+    
+    // Hash keys are physical addresses
+    if (cpu->hash_enabled) {
+        statehash_update(&cpu->memory_hash, physical, old, value);
+    }
+}
+
 uint8_t isa_read_memory(cpu_state_t* cpu, uint16_t address) {
-    // address is a uint16_t and memory buffer covers full 16-bit space; direct access
-    return cpu->memory[address];
+    // Registered device addresses go to the machine's device set; ROM
+    // reads like memory
+    uint8_t slot = cpu->devices ? device_map_slot(cpu->devices->map, address) : 0;
+    if (slot && slot != DEVICE_SLOT_ROM) {
+        if (cpu->smp) {
+            return smp_device_read(cpu, address);
+        }
+        cpu->devices->now = cpu->cycle_count;
+        return device_set_read(cpu->devices, address);
+    }
+    
+    // Everything else is memory, through the MMU's page bases. Loads are
+    // acquires and stores releases, so other cores of an SMP machine see
+    // a core's stores in program order (free on x86 hosts).
+    return atomics_load_u8(&cpu->memory[isa_physical_address(cpu, address)], ATOMICS_ACQUIRE);
 }
 
 void isa_write_memory(cpu_state_t* cpu, uint16_t address, uint8_t value) {
-    // address is a uint16_t and memory buffer covers full 16-bit space; direct write
-    cpu->memory[address] = value;
+    // Device registers are not backed by memory and are hashed with the
+    // device state; writes to ROM and open bus are dropped
+    uint8_t slot = cpu->devices ? device_map_slot(cpu->devices->map, address) : 0;
+    if (slot) {
+        if (cpu->smp) {
+            smp_device_write(cpu, address, value);
+            return;
+        }
+        cpu->devices->now = cpu->cycle_count;
+        device_set_write(cpu->devices, address, value);
+        return;
+    }
+    
+    uint32_t physical = isa_physical_address(cpu, address);
+    isa_memory_written(cpu, physical, atomics_load_u8(&cpu->memory[physical], ATOMICS_RELAXED), value);
+    atomics_store_u8(&cpu->memory[physical], value, ATOMICS_RELEASE);
+}
+
+// Atomically exchange a memory byte, returning the old value. Device
+// registers, ROM and open bus take the ordinary read and write path.
+uint8_t isa_swap_memory(cpu_state_t* cpu, uint16_t address, uint8_t value) {
+    if (cpu->devices && device_map_slot(cpu->devices->map, address)) {
+        uint8_t old = isa_read_memory(cpu, address);
+        isa_write_memory(cpu, address, value);
+        return old;
+    }
+    
+    uint32_t physical = isa_physical_address(cpu, address);
+    uint8_t old = atomics_exchange_u8(&cpu->memory[physical], value, ATOMICS_SEQ_CST);
+    isa_memory_written(cpu, physical, old, value);
+    return old;
+}
+
+// Atomically store value if the byte holds expected; returns the byte's
+// old value either way (equal to expected on success)
+uint8_t isa_compare_swap_memory(cpu_state_t* cpu, uint16_t address, uint8_t expected, uint8_t value) {
+    if (cpu->devices && device_map_slot(cpu->devices->map, address)) {
+        uint8_t old = isa_read_memory(cpu, address);
+        if (old == expected) {
+            isa_write_memory(cpu, address, value);
+        }
+        return old;
+    }
+    
+    uint32_t physical = isa_physical_address(cpu, address);
+    uint8_t old = expected;
+    if (atomics_cas_u8(&cpu->memory[physical], &old, value, ATOMICS_SEQ_CST)) {
+        isa_memory_written(cpu, physical, old, value);
+    }
+    return old;
+}
+
+// Physical address the MMU maps a CPU address to (identity without devices)
+uint32_t isa_physical_address(cpu_state_t* cpu, uint16_t address) {
+    return cpu->devices ? mmu_translate(&cpu->devices->mmu, address) : address;
+}
+
+// Stop the CPU and hand any buffered device output to the host
+void isa_halt(cpu_state_t* cpu) {
+    cpu->running = false;
+    
+    // The cores of an SMP machine share the devices; smp_run() flushes
+    if (cpu->devices && !cpu->smp) {
+        device_set_flush(cpu->devices);
+    }
 }
 
 // Flag operations
@@ -593,9 +723,32 @@ bool isa_execute_instruction(cpu_state_t* cpu) {
             break;
             
         case OP_HLT:
-            cpu->running = false;
+            isa_halt(cpu);
             break;
             
+        case OP_TAS: {
+            // A takes the old byte, which becomes 0xFF; Z set means it was
+            // clear (a lock was acquired)
+            uint16_t addr = isa_get_address(cpu, inst->addr_mode, operand1, operand2);
+            uint8_t old = isa_swap_memory(cpu, addr, 0xFF);
+            isa_set_register(cpu, REG_A, old);
+            isa_update_flags(cpu, old, false, false);
+            break;
+        }
+        
+        case OP_CAS: {
+            // Store B if the byte equals A; A takes the old byte and the
+            // flags are set as CMP of A with it, so Z means success
+            uint16_t addr = isa_get_address(cpu, inst->addr_mode, operand1, operand2);
+            uint8_t expected = isa_get_register(cpu, REG_A);
+            uint8_t old = isa_compare_swap_memory(cpu, addr, expected, isa_get_register(cpu, REG_B));
+            uint8_t result = expected - old;
+            bool overflow = ((expected ^ result) & (old ^ result) & 0x80) != 0;
+            isa_set_register(cpu, REG_A, old);
+            isa_update_flags(cpu, result, expected < old, overflow);
+            break;
+        }
+            
         default:
             printf("Unimplemented instruction: 0x%02X\n", opcode);
             result = false;
@@ -603,7 +756,7 @@ bool isa_execute_instruction(cpu_state_t* cpu) {
     }
     
     // Update cycle count
-    cpu->cycle_count += inst->cycles;
+    cpu->cycle_count += cpu->cycle_table[opcode];
     cpu->instruction_count++;
     
     return result;
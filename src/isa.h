@@ -1,17 +1,12 @@
 #ifndef ISA_H
 #define ISA_H
 
+#include "memory.h"
 #include <stdint.h>
 #include <stdbool.h>
 
-// CPU Configuration
+// CPU Configuration (the memory map is in memory.h)
 #define MEMORY_SIZE (64 * 1024)  // 64 KiB
-#define RAM_START 0x0000
-#define RAM_END 0x7FFF
-#define MMIO_START 0x8000
-#define MMIO_END 0xFEFF
-#define VECTOR_START 0xFF00
-#define VECTOR_END 0xFFFF
 
 // Register definitions
 typedef enum {
@@ -99,7 +94,11 @@ typedef enum {
     OP_SEI = 0x70,    // Set interrupt disable
     OP_CLI = 0x71,    // Clear interrupt disable
     OP_NOP = 0x72,    // No operation
-    OP_HLT = 0x73     // Halt
+    OP_HLT = 0x73,    // Halt
+    
+    // Atomic read-modify-write
+    OP_TAS = 0x80,    // Test and set
+    OP_CAS = 0x81     // Compare and swap
 } opcode_t;
 
 // Instruction structure
@@ -112,18 +111,34 @@ typedef struct {
     const char* mnemonic;
 } instruction_t;
 
+// Per-machine device set (see devices.h)
+struct device_set;
+
+// Multi-core machine a core belongs to (see smp.h)
+struct smp_machine;
+
 // CPU state structure
 typedef struct {
     // Registers
     uint8_t regs[8];      // A, B, C, D (8-bit), X, Y, SP, PC (16-bit)
     uint8_t flags;        // Status flags
     
-    // Memory
+    // Memory (physical; more than the 64 KiB address space when banked)
     uint8_t* memory;
+    uint32_t memory_size;
+    
+    // Incremental state hashing (see statehash.h)
+    bool hash_enabled;
+    uint64_t memory_hash;
+    
+    // Devices
+    struct device_set* devices;
+    bool owns_devices;
     
     // Control
     bool running;
-    bool irq_pending;
+    bool irq_pending;           // Interrupt line, resampled after every instruction
+    bool irq_raised;            // Raised by cpu_irq(), held until taken
     bool nmi_pending;
     uint64_t cycle_count;
     uint32_t instruction_count;
@@ -135,10 +150,17 @@ typedef struct {
     uint16_t watch_addr;
     bool watch_hit;
     
+    // Cycles charged per opcode (isa_default_cycles() or a machine's table)
+    const uint8_t* cycle_table;
+    
     // Clock control
     uint32_t frequency_hz;
     uint64_t last_tick_time;
     uint32_t cycles_per_second;
+    
+    // Multi-core machines (NULL and 0 for a single CPU)
+    struct smp_machine* smp;
+    uint8_t core_id;
 } cpu_state_t;
 
 // Function declarations
@@ -146,6 +168,8 @@ void isa_init(void);
 const instruction_t* isa_get_instruction(opcode_t opcode);
 const char* isa_get_mnemonic(opcode_t opcode);
 uint8_t isa_get_cycles(opcode_t opcode);
+const uint8_t* isa_default_cycles(void);
+uint8_t isa_get_length(opcode_t opcode);
 bool isa_is_valid_opcode(uint8_t opcode);
 void isa_print_instruction_table(void);
 
@@ -156,6 +180,10 @@ uint16_t isa_fetch_word(cpu_state_t* cpu);
 uint16_t isa_get_address(cpu_state_t* cpu, addressing_mode_t mode, uint8_t operand1, uint8_t operand2);
 uint8_t isa_read_memory(cpu_state_t* cpu, uint16_t address);
 void isa_write_memory(cpu_state_t* cpu, uint16_t address, uint8_t value);
+uint32_t isa_physical_address(cpu_state_t* cpu, uint16_t address);
+uint8_t isa_swap_memory(cpu_state_t* cpu, uint16_t address, uint8_t value);
+uint8_t isa_compare_swap_memory(cpu_state_t* cpu, uint16_t address, uint8_t expected, uint8_t value);
+void isa_halt(cpu_state_t* cpu);
 
 // Flag operations
 void isa_set_flag(cpu_state_t* cpu, uint8_t flag);
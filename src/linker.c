@@ -0,0 +1,497 @@
+#include "linker.h"
+#include "ini.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    LINKER_SECTION_NONE = 0,
+    LINKER_SECTION_IMAGE,
+    LINKER_SECTION_RULE
+} linker_section_t;
+
+// Script parser position
+typedef struct {
+    ini_reader_t reader;
+    linker_t* linker;
+    linker_section_t section;
+} linker_parser_t;
+
+static char* linker_strdup(const char* text) {
+    char* copy = malloc(strlen(text) + 1);
+    if (copy) {
+        strcpy(copy, text);
+    }
+    return copy;
+}
+
+static linker_rule_t* linker_find_rule(const linker_t* linker, const char* name) {
+    for (int i = 0; i < linker->rule_count; i++) {
+        if (strcmp(linker->rules[i].name, name) == 0) {
+            return &linker->rules[i];
+        }
+    }
+    return NULL;
+}
+
+linker_t* linker_create(void) {
+    linker_t* linker = calloc(1, sizeof(linker_t));
+    if (!linker) {
+        return NULL;
+    }
+    linker->image = calloc(1, 0x10000);
+    linker->scope = assembler_create();
+    if (!linker->image || !linker->scope) {
+        linker_destroy(linker);
+        return NULL;
+    }
+    return linker;
+}
+
+void linker_destroy(linker_t* linker) {
+    if (!linker) {
+        return;
+    }
+
+    for (int i = 0; i < linker->rule_count; i++) {
+        free(linker->rules[i].name);
+    }
+    for (int i = 0; i < linker->module_count; i++) {
+        free(linker->modules[i].path);
+        free(linker->modules[i].addresses);
+        object_destroy(linker->modules[i].object);
+    }
+    assembler_destroy(linker->scope);
+    free(linker->rules);
+    free(linker->modules);
+    free(linker->outputs);
+    free(linker->pieces);
+    free(linker->globals);
+    free(linker->image);
+    free(linker);
+}
+
+static bool linker_begin_section(void* context, char* header, char* name) {
+    linker_parser_t* parser = context;
+    linker_t* linker = parser->linker;
+    if (strcmp(header, "image") == 0 && !*name) {
+        parser->section = LINKER_SECTION_IMAGE;
+        return true;
+    }
+    if (strcmp(header, "section") == 0 && *name) {
+        parser->section = LINKER_SECTION_RULE;
+        if (linker_find_rule(linker, name)) {
+            return ini_error(&parser->reader, "section listed twice", name);
+        }
+        linker_rule_t* rules = realloc(linker->rules, (linker->rule_count + 1) * sizeof(linker_rule_t));
+        if (!rules) {
+            return ini_error(&parser->reader, "out of memory", NULL);
+        }
+        linker->rules = rules;
+        linker_rule_t* rule = &rules[linker->rule_count];
+        memset(rule, 0, sizeof(*rule));
+        rule->name = linker_strdup(name);
+        if (!rule->name) {
+            return ini_error(&parser->reader, "out of memory", NULL);
+        }
+        linker->rule_count++;
+        return true;
+    }
+    return ini_error(&parser->reader, "unknown section", header);
+}
+
+static bool linker_set(void* context, const char* key, const char* value) {
+    linker_parser_t* parser = context;
+    linker_t* linker = parser->linker;
+    uint32_t number;
+
+    if (parser->section == LINKER_SECTION_IMAGE && strcmp(key, "origin") == 0) {
+        if (!ini_number(value, 0xFFFF, &number)) {
+            return ini_error(&parser->reader, "invalid origin", value);
+        }
+        linker->origin = (uint16_t)number;
+        return true;
+    }
+    if (parser->section == LINKER_SECTION_RULE) {
+        linker_rule_t* rule = &linker->rules[linker->rule_count - 1];
+        if (strcmp(key, "address") == 0) {
+            if (!ini_number(value, 0xFFFF, &number)) {
+                return ini_error(&parser->reader, "invalid address", value);
+            }
+            rule->address = (uint16_t)number;
+            rule->placed = true;
+            return true;
+        }
+        if (strcmp(key, "align") == 0) {
+            if (!ini_number(value, 0x8000, &number) || (number & (number - 1)) != 0) {
+                return ini_error(&parser->reader, "alignment must be a power of two", value);
+            }
+            rule->align = (uint16_t)number;
+            return true;
+        }
+    }
+    if (parser->section == LINKER_SECTION_NONE) {
+        return ini_error(&parser->reader, "setting outside a section", key);
+    }
+    return ini_error(&parser->reader, "unknown setting", key);
+}
+
+bool linker_parse_script(linker_t* linker, const char* text, const char* origin) {
+    linker_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.reader = (ini_reader_t){origin, 0, linker_begin_section, linker_set, &parser};
+    parser.linker = linker;
+    return ini_read(&parser.reader, text);
+}
+
+bool linker_load_script(linker_t* linker, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open linker script %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    bool ok = text && fread(text, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+
+    if (ok) {
+        text[size] = '\0';
+        ok = linker_parse_script(linker, text, path);
+    } else {
+        fprintf(stderr, "Cannot read linker script %s\n", path);
+    }
+    free(text);
+    return ok;
+}
+
+bool linker_add_object(linker_t* linker, const char* path) {
+    if (linker->module_count == LINKER_MAX_OBJECTS) {
+        fprintf(stderr, "%s: more than %d objects\n", path, LINKER_MAX_OBJECTS);
+        return false;
+    }
+    linker_module_t* modules = realloc(linker->modules, (linker->module_count + 1) * sizeof(linker_module_t));
+    if (!modules) {
+        return false;
+    }
+    linker->modules = modules;
+
+    linker_module_t* module = &modules[linker->module_count];
+    memset(module, 0, sizeof(*module));
+    module->object = object_load(path);
+    if (!module->object) {
+        return false;
+    }
+    module->path = linker_strdup(path);
+    module->addresses = calloc(module->object->section_count + 1, sizeof(uint32_t));
+    if (!module->path || !module->addresses) {
+        free(module->path);
+        free(module->addresses);
+        object_destroy(module->object);
+        return false;
+    }
+    linker->module_count++;
+    return true;
+}
+
+// Put an object section at the end of the last output section
+static void linker_add_piece(linker_t* linker, int module, int section) {
+    linker_output_t* output = &linker->outputs[linker->output_count - 1];
+    linker_piece_t* piece = &linker->pieces[linker->piece_count++];
+    piece->module = module;
+    piece->section = section;
+    piece->output = linker->output_count - 1;
+    piece->address = output->address + output->size;
+    piece->size = linker->modules[module].object->sections[section].size;
+    linker->modules[module].addresses[section] = piece->address;
+    output->size += piece->size;
+}
+
+static void linker_add_output(linker_t* linker, const char* name, bool fixed, uint32_t address) {
+    linker_output_t* output = &linker->outputs[linker->output_count++];
+    output->name = name;
+    output->address = address;
+    output->fixed = fixed;
+}
+
+// Add an output section holding every movable section of one name
+static void linker_place(linker_t* linker, const char* name, uint32_t address) {
+    linker_add_output(linker, name, false, address);
+    for (int i = 0; i < linker->module_count; i++) {
+        object_t* object = linker->modules[i].object;
+        for (int j = 0; j < object->section_count; j++) {
+            if (!object->sections[j].fixed && strcmp(object->sections[j].name, name) == 0) {
+                linker_add_piece(linker, i, j);
+            }
+        }
+    }
+}
+
+static bool linker_is_placed(const linker_t* linker, const char* name) {
+    for (int i = 0; i < linker->output_count; i++) {
+        if (!linker->outputs[i].fixed && strcmp(linker->outputs[i].name, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int linker_compare_pieces(const void* a, const void* b) {
+    const linker_piece_t* left = a;
+    const linker_piece_t* right = b;
+    return left->address < right->address ? -1 : left->address > right->address;
+}
+
+// Give every section an address and copy it into the image
+static bool linker_place_sections(linker_t* linker) {
+    int sections = 0;
+    for (int i = 0; i < linker->module_count; i++) {
+        sections += linker->modules[i].object->section_count;
+    }
+    linker->outputs = calloc(sections + linker->rule_count + 1, sizeof(linker_output_t));
+    linker->pieces = calloc(sections + 1, sizeof(linker_piece_t));
+    if (!linker->outputs || !linker->pieces) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    // Sections the script lists, then the others as they appear
+    uint32_t address = linker->origin;
+    for (int i = 0; i < linker->rule_count; i++) {
+        const linker_rule_t* rule = &linker->rules[i];
+        if (rule->placed) {
+            address = rule->address;
+        }
+        if (rule->align) {
+            address = (address + rule->align - 1) & ~(uint32_t)(rule->align - 1);
+        }
+        linker_place(linker, rule->name, address);
+        address += linker->outputs[linker->output_count - 1].size;
+    }
+    for (int i = 0; i < linker->module_count; i++) {
+        object_t* object = linker->modules[i].object;
+        for (int j = 0; j < object->section_count; j++) {
+            object_section_t* section = &object->sections[j];
+            if (section->fixed) {
+                linker_add_output(linker, section->name, true, section->address);
+                linker_add_piece(linker, i, j);
+            } else if (!linker_is_placed(linker, section->name)) {
+                linker_place(linker, section->name, address);
+                address += linker->outputs[linker->output_count - 1].size;
+            }
+        }
+    }
+
+    // Everything must fit in the address space without overlapping
+    linker_piece_t* sorted = malloc((linker->piece_count + 1) * sizeof(linker_piece_t));
+    if (!sorted) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+    int count = 0;
+    for (int i = 0; i < linker->piece_count; i++) {
+        if (linker->pieces[i].size > 0) {
+            sorted[count++] = linker->pieces[i];
+        }
+    }
+    qsort(sorted, count, sizeof(linker_piece_t), linker_compare_pieces);
+
+    bool ok = true;
+    for (int i = 0; ok && i < count; i++) {
+        const linker_piece_t* piece = &sorted[i];
+        const char* name = linker->modules[piece->module].object->sections[piece->section].name;
+        const char* path = linker->modules[piece->module].path;
+        if (piece->address + piece->size > 0x10000) {
+            fprintf(stderr, "%s: section %s at 0x%04X does not fit in 64 KiB\n", path, name, piece->address);
+            ok = false;
+        } else if (i > 0 && piece->address < sorted[i - 1].address + sorted[i - 1].size) {
+            const linker_piece_t* before = &sorted[i - 1];
+            fprintf(stderr, "%s: section %s at 0x%04X overlaps section %s of %s\n", path, name, piece->address,
+                    linker->modules[before->module].object->sections[before->section].name,
+                    linker->modules[before->module].path);
+            ok = false;
+        }
+    }
+    if (ok && count > 0) {
+        linker->image_start = sorted[0].address;
+        linker->image_end = sorted[count - 1].address + sorted[count - 1].size;
+    }
+    free(sorted);
+
+    for (int i = 0; ok && i < linker->piece_count; i++) {
+        const linker_piece_t* piece = &linker->pieces[i];
+        const object_section_t* section = &linker->modules[piece->module].object->sections[piece->section];
+        memcpy(linker->image + piece->address, section->data, piece->size);
+    }
+    return ok;
+}
+
+// Collect every module's global labels
+static bool linker_collect_globals(linker_t* linker) {
+    int symbols = 0;
+    for (int i = 0; i < linker->module_count; i++) {
+        symbols += linker->modules[i].object->symbol_count;
+    }
+    linker->globals = calloc(symbols + 1, sizeof(linker_global_t));
+    if (!linker->globals) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < linker->module_count; i++) {
+        const linker_module_t* module = &linker->modules[i];
+        for (int j = 0; j < module->object->symbol_count; j++) {
+            const object_symbol_t* symbol = &module->object->symbols[j];
+            if (!symbol->global) {
+                continue;
+            }
+            symbol_t* defined = assembler_find_symbol(linker->scope, symbol->name);
+            if (defined) {
+                for (int k = 0; k < linker->global_count; k++) {
+                    if (strcmp(linker->globals[k].name, symbol->name) == 0) {
+                        fprintf(stderr, "%s: global label %s is also defined in %s\n", module->path,
+                                symbol->name, linker->modules[linker->globals[k].module].path);
+                    }
+                }
+                ok = false;
+                continue;
+            }
+
+            linker_global_t* global = &linker->globals[linker->global_count++];
+            global->name = symbol->name;
+            global->address = (uint16_t)(module->addresses[symbol->section] + symbol->offset);
+            global->module = i;
+            if (!assembler_add_symbol(linker->scope, symbol->name, global->address)) {
+                return false;
+            }
+        }
+    }
+    return ok;
+}
+
+// Evaluate every relocation of one module and patch the image
+static bool linker_relocate(linker_t* linker, int index) {
+    const linker_module_t* module = &linker->modules[index];
+    const object_t* object = module->object;
+    assembler_t* scope = linker->scope;
+
+    // The module's own labels come first, then the globals
+    assembler_reset_labels(scope);
+    scope->filename = object->source;
+    for (int i = 0; i < object->symbol_count; i++) {
+        const object_symbol_t* symbol = &object->symbols[i];
+        scope->line_number = 0;
+        if (!assembler_add_label(scope, symbol->name,
+                                 (uint16_t)(module->addresses[symbol->section] + symbol->offset))) {
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (int i = 0; i < object->relocation_count; i++) {
+        const object_relocation_t* relocation = &object->relocations[i];
+        scope->line_number = relocation->line;
+        uint16_t value;
+        if (!assembler_evaluate(scope, relocation->expression, strlen(relocation->expression), &value)) {
+            ok = false;
+            continue;
+        }
+
+        uint32_t address = module->addresses[relocation->section];
+        if (relocation->relative) {
+            int offset = (int16_t)(value - (uint16_t)(address + relocation->base));
+            if (offset < -128 || offset > 127) {
+                assembler_error(scope, "Branch offset out of range: %d", offset);
+                ok = false;
+                continue;
+            }
+            value = (uint16_t)offset;
+        }
+
+        address += relocation->offset;
+        linker->image[address] = value & 0xFF;
+        if (relocation->width == 2) {
+            linker->image[address + 1] = (value >> 8) & 0xFF;
+        }
+    }
+    return ok;
+}
+
+bool linker_link(linker_t* linker) {
+    if (!linker_place_sections(linker) || !linker_collect_globals(linker)) {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < linker->module_count; i++) {
+        ok = linker_relocate(linker, i) && ok;
+    }
+    return ok;
+}
+
+bool linker_save_image(const linker_t* linker, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    size_t size = linker->image_end - linker->image_start;
+    size_t written = fwrite(linker->image + linker->image_start, 1, size, file);
+    return fclose(file) == 0 && written == size;
+}
+
+static int linker_compare_globals(const void* a, const void* b) {
+    const linker_global_t* left = a;
+    const linker_global_t* right = b;
+    if (left->address != right->address) {
+        return left->address < right->address ? -1 : 1;
+    }
+    return strcmp(left->name, right->name);
+}
+
+bool linker_save_map(const linker_t* linker, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    fprintf(file, "Image 0x%04X-0x%04X, %u bytes\n", linker->image_start,
+            linker->image_end > linker->image_start ? linker->image_end - 1 : linker->image_start,
+            linker->image_end - linker->image_start);
+
+    fprintf(file, "\nSections\n");
+    for (int i = 0; i < linker->output_count; i++) {
+        const linker_output_t* output = &linker->outputs[i];
+        fprintf(file, "  0x%04X  %6u  %s%s\n", output->address, output->size, output->name,
+                output->fixed ? " (fixed)" : "");
+        for (int j = 0; j < linker->piece_count; j++) {
+            const linker_piece_t* piece = &linker->pieces[j];
+            if (piece->output == i) {
+                fprintf(file, "    0x%04X  %6u  %s\n", piece->address, piece->size,
+                        linker->modules[piece->module].path);
+            }
+        }
+    }
+
+    // Globals by address
+    linker_global_t* sorted = malloc((linker->global_count + 1) * sizeof(linker_global_t));
+    if (!sorted) {
+        fclose(file);
+        return false;
+    }
+    memcpy(sorted, linker->globals, linker->global_count * sizeof(linker_global_t));
+    qsort(sorted, linker->global_count, sizeof(linker_global_t), linker_compare_globals);
+
+    fprintf(file, "\nGlobal labels\n");
+    for (int i = 0; i < linker->global_count; i++) {
+        fprintf(file, "  0x%04X  %-24s %s\n", sorted[i].address, sorted[i].name,
+                linker->modules[sorted[i].module].path);
+    }
+    free(sorted);
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,93 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "assembler.h"
+#include "object.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Linking relocatable objects (see object.h) into one image.
+// A linker script places the output sections:
+//
+//   [image]          origin = ADDRESS (where placement starts, default 0)
+//   [section NAME]   address = ADDRESS (start here instead of after the
+//                    section before), align = N (start on a multiple of N)
+//
+// Sections are placed in script order, then in the order they first
+// appear in the objects. The sections of one name from every object are
+// concatenated in object order; a section fixed with .org stays at its
+// own address. A module's labels are visible inside it, its .global
+// labels everywhere; a name defined global twice is an error. The image
+// runs from the lowest placed byte to the highest, gaps filled with zeros.
+
+#define LINKER_MAX_OBJECTS 4096
+
+// Output section settings from the script
+typedef struct {
+    char* name;
+    bool placed;                // Has an address
+    uint16_t address;
+    uint16_t align;             // 0 = none
+} linker_rule_t;
+
+// Object being linked and where its sections went
+typedef struct {
+    char* path;
+    object_t* object;
+    uint32_t* addresses;        // Per section
+} linker_module_t;
+
+// Output section; a fixed section is one of its own
+typedef struct {
+    const char* name;           // In an object or a rule
+    uint32_t address;
+    uint32_t size;
+    bool fixed;
+} linker_output_t;
+
+// Object section placed in an output section
+typedef struct {
+    int module;
+    int section;
+    int output;
+    uint32_t address;
+    uint32_t size;
+} linker_piece_t;
+
+typedef struct {
+    const char* name;           // In the object
+    uint16_t address;
+    int module;
+} linker_global_t;
+
+typedef struct {
+    linker_rule_t* rules;
+    int rule_count;
+    uint16_t origin;
+
+    linker_module_t* modules;
+    int module_count;
+
+    // Results of linker_link
+    linker_output_t* outputs;
+    int output_count;
+    linker_piece_t* pieces;     // By output, in placement order
+    int piece_count;
+    linker_global_t* globals;
+    int global_count;
+    uint8_t* image;             // 64 KiB, by address
+    uint32_t image_start;
+    uint32_t image_end;         // Equal to image_start: nothing placed
+    assembler_t* scope;         // Evaluates relocations
+} linker_t;
+
+linker_t* linker_create(void);
+void linker_destroy(linker_t* linker);
+bool linker_load_script(linker_t* linker, const char* path);
+bool linker_parse_script(linker_t* linker, const char* text, const char* origin);
+bool linker_add_object(linker_t* linker, const char* path);    // Loads an object file
+bool linker_link(linker_t* linker);
+bool linker_save_image(const linker_t* linker, const char* path);
+bool linker_save_map(const linker_t* linker, const char* path);
+
+#endif // LINKER_H
@@ -0,0 +1,84 @@
+#include "livelock.h"
+#include <stdio.h>
+#include <string.h>
+
+// Prepare a detector; enables incremental memory hashing on the CPU
+bool livelock_init(livelock_detector_t* detector, cpu_state_t* cpu) {
+    memset(detector, 0, sizeof(*detector));
+
+    detector->tortoise = cpu_snapshot_create();
+    if (!detector->tortoise) {
+        return false;
+    }
+
+    if (!cpu->hash_enabled) {
+        cpu_enable_state_hash(cpu, true);
+    }
+
+    detector->power = 1;
+    if (!cpu_snapshot_save(cpu, detector->tortoise)) {
+        livelock_cleanup(detector);
+        return false;
+    }
+    detector->tortoise_hash = cpu_state_hash(cpu);
+    return true;
+}
+
+// Release detector resources
+void livelock_cleanup(livelock_detector_t* detector) {
+    cpu_snapshot_destroy(detector->tortoise);
+    detector->tortoise = NULL;
+}
+
+// Record one sample; returns true once an exact state repetition is proven
+bool livelock_sample(livelock_detector_t* detector, cpu_state_t* cpu) {
+    uint64_t hash = cpu_state_hash(cpu);
+
+    detector->samples++;
+    detector->length++;
+
+    if (hash == detector->tortoise_hash && cpu_snapshot_matches(cpu, detector->tortoise)) {
+        detector->detected = true;
+        detector->cycle_samples = detector->length;
+        detector->pc = isa_get_register16(cpu, REG_PC);
+        return true;
+    }
+
+    // Brent: move the tortoise to the hare at every power of two. If it
+    // cannot be saved the old tortoise stays, still a state of this run.
+    if (detector->length == detector->power) {
+        if (cpu_snapshot_save(cpu, detector->tortoise)) {
+            detector->tortoise_hash = hash;
+        }
+        detector->power *= 2;
+        detector->length = 0;
+    }
+
+    return false;
+}
+
+// cpu_run with livelock detection; returns false when the CPU stopped
+bool livelock_run(livelock_detector_t* detector, cpu_state_t* cpu, uint64_t max_cycles) {
+    cpu->running = true;
+    uint64_t start_cycles = cpu->cycle_count;
+
+    while (cpu->running && (cpu->cycle_count - start_cycles) < max_cycles) {
+        uint16_t pc = isa_get_register16(cpu, REG_PC);
+        if (!cpu_step(cpu)) {
+            break;
+        }
+
+        // Every loop iteration contains at least one backward transfer
+        if (isa_get_register16(cpu, REG_PC) <= pc && livelock_sample(detector, cpu)) {
+            cpu->running = false;
+            break;
+        }
+
+        cpu_throttle(cpu);
+    }
+
+    if (cpu->devices) {
+        device_set_flush(cpu->devices);
+    }
+    return cpu->running;
+}
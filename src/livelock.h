@@ -0,0 +1,34 @@
+#ifndef LIVELOCK_H
+#define LIVELOCK_H
+
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Livelock detection.
+// The whole-machine state hash (registers, flags, devices, memory) is sampled
+// at backward control transfers, the only place a loop can close, and fed to
+// Brent's cycle detection. A hash match is confirmed against a full snapshot,
+// so a reported livelock is an exact state repetition: the deterministic
+// machine will repeat the same cycle forever.
+//
+// Only valid while nothing outside the CPU changes machine state (no host
+// input, no externally raised interrupts).
+
+typedef struct {
+    cpu_snapshot_t* tortoise;   // State at the last power-of-two sample
+    uint64_t tortoise_hash;
+    uint64_t power;
+    uint64_t length;
+    uint64_t samples;
+    uint64_t cycle_samples;     // Samples per loop iteration once detected
+    bool detected;
+    uint16_t pc;                // PC where the repetition was confirmed
+} livelock_detector_t;
+
+bool livelock_init(livelock_detector_t* detector, cpu_state_t* cpu);
+void livelock_cleanup(livelock_detector_t* detector);
+bool livelock_sample(livelock_detector_t* detector, cpu_state_t* cpu);
+bool livelock_run(livelock_detector_t* detector, cpu_state_t* cpu, uint64_t max_cycles);
+
+#endif // LIVELOCK_H
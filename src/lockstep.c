@@ -0,0 +1,281 @@
+#include "lockstep.h"
+#include "statehash.h"
+#include "cpu.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum number of differing memory bytes listed by lockstep_dump
+#define LOCKSTEP_DUMP_LIMIT 16
+
+// Reference engine adapter for cpu.c/isa.c
+static void* isa_engine_create(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (cpu) {
+        cpu_enable_state_hash(cpu, true);
+    }
+    return cpu;
+}
+
+static void isa_engine_destroy(void* engine) {
+    cpu_destroy(engine);
+}
+
+static void isa_engine_start(void* engine, const uint8_t* image, uint16_t entry) {
+    cpu_state_t* cpu = engine;
+    memcpy(cpu->memory, image, MEMORY_SIZE);
+    cpu_rehash_memory(cpu);
+    cpu_reset_to_address(cpu, entry);
+    cpu->running = true;
+}
+
+static bool isa_engine_step(void* engine) {
+    cpu_state_t* cpu = engine;
+    if (!cpu->running) {
+        return false;
+    }
+    return cpu_step(cpu);
+}
+
+static void isa_engine_get_registers(void* engine, lockstep_regs_t* regs) {
+    cpu_state_t* cpu = engine;
+    memcpy(regs->regs, cpu->regs, sizeof(regs->regs));
+    regs->flags = cpu->flags;
+    regs->running = cpu->running;
+}
+
+static uint8_t isa_engine_read_memory(void* engine, uint16_t address) {
+    return ((cpu_state_t*)engine)->memory[address];
+}
+
+static uint64_t isa_engine_memory_hash(void* engine) {
+    return ((cpu_state_t*)engine)->memory_hash;
+}
+
+static void* isa_engine_snapshot(void* engine) {
+    cpu_snapshot_t* snapshot = cpu_snapshot_create();
+    if (snapshot && !cpu_snapshot_save(engine, snapshot)) {
+        cpu_snapshot_destroy(snapshot);
+        return NULL;
+    }
+    return snapshot;
+}
+
+static bool isa_engine_save(void* engine, void* snapshot) {
+    return cpu_snapshot_save(engine, snapshot);
+}
+
+static void isa_engine_restore(void* engine, const void* snapshot) {
+    cpu_snapshot_restore(engine, snapshot);
+}
+
+static void isa_engine_free_snapshot(void* snapshot) {
+    cpu_snapshot_destroy(snapshot);
+}
+
+const lockstep_engine_t lockstep_isa_engine = {
+    "isa",
+    isa_engine_create,
+    isa_engine_destroy,
+    isa_engine_start,
+    isa_engine_step,
+    isa_engine_get_registers,
+    isa_engine_read_memory,
+    isa_engine_memory_hash,
+    isa_engine_snapshot,
+    isa_engine_save,
+    isa_engine_restore,
+    isa_engine_free_snapshot
+};
+
+// Hash of registers, flags, run state and memory
+uint64_t lockstep_state_hash(const lockstep_engine_t* ops, void* engine) {
+    lockstep_regs_t regs;
+    uint8_t state[10];
+
+    ops->get_registers(engine, &regs);
+    memcpy(state, regs.regs, sizeof(regs.regs));
+    state[8] = regs.flags;
+    state[9] = regs.running;
+
+    return statehash_bytes(0, state, sizeof(state)) ^ ops->memory_hash(engine);
+}
+
+// Step both engines n times, stopping early once both have halted
+static uint64_t lockstep_step_both(const lockstep_engine_t* ops_a, void* engine_a,
+                                   const lockstep_engine_t* ops_b, void* engine_b,
+                                   uint64_t n) {
+    lockstep_regs_t regs_a, regs_b;
+    uint64_t executed = 0;
+
+    while (executed < n) {
+        ops_a->get_registers(engine_a, &regs_a);
+        ops_b->get_registers(engine_b, &regs_b);
+        if (!regs_a.running && !regs_b.running) {
+            break;
+        }
+        ops_a->step(engine_a);
+        ops_b->step(engine_b);
+        executed++;
+    }
+
+    return executed;
+}
+
+// Save the engine's current state as its checkpoint, allocating the
+// checkpoint the first time
+static bool lockstep_checkpoint(const lockstep_engine_t* ops, void* engine, void** snapshot) {
+    if (*snapshot) {
+        return ops->save(engine, *snapshot);
+    }
+    *snapshot = ops->snapshot(engine);
+    return *snapshot != NULL;
+}
+
+// Run both engines until divergence, halt or max_instructions.
+// Both engines must already be started on the same image.
+bool lockstep_run(const lockstep_engine_t* ops_a, void* engine_a,
+                  const lockstep_engine_t* ops_b, void* engine_b,
+                  const lockstep_config_t* config, lockstep_result_t* result) {
+    memset(result, 0, sizeof(*result));
+
+    uint64_t interval = config->check_interval ? config->check_interval : 1;
+    void* checkpoint_a = NULL;
+    void* checkpoint_b = NULL;
+    uint64_t checkpoint = 0;
+    bool ok = true;
+
+    // The starting states must already agree
+    result->checks++;
+    if (lockstep_state_hash(ops_a, engine_a) != lockstep_state_hash(ops_b, engine_b)) {
+        printf("Engines differ before the first instruction\n");
+        result->diverged = true;
+        return true;
+    }
+
+    if (!lockstep_checkpoint(ops_a, engine_a, &checkpoint_a) ||
+        !lockstep_checkpoint(ops_b, engine_b, &checkpoint_b)) {
+        printf("Failed to allocate lockstep checkpoint\n");
+        ok = false;
+        goto cleanup;
+    }
+
+    while (checkpoint < config->max_instructions) {
+        uint64_t n = config->max_instructions - checkpoint;
+        if (n > interval) {
+            n = interval;
+        }
+
+        uint64_t executed = lockstep_step_both(ops_a, engine_a, ops_b, engine_b, n);
+        uint64_t position = checkpoint + executed;
+
+        result->checks++;
+        if (lockstep_state_hash(ops_a, engine_a) == lockstep_state_hash(ops_b, engine_b)) {
+            if (config->verbose) {
+                printf("Checkpoint %llu: 0x%016llX\n", (unsigned long long)position,
+                       (unsigned long long)lockstep_state_hash(ops_a, engine_a));
+            }
+            result->instructions = position;
+            if (executed < n) {
+                break;  // Both engines halted in agreement
+            }
+            if (!lockstep_checkpoint(ops_a, engine_a, &checkpoint_a) ||
+                !lockstep_checkpoint(ops_b, engine_b, &checkpoint_b)) {
+                printf("Failed to allocate lockstep checkpoint\n");
+                ok = false;
+                goto cleanup;
+            }
+            checkpoint = position;
+            continue;
+        }
+
+        // Bisect: states agree at lo and differ at hi
+        uint64_t lo = checkpoint;
+        uint64_t hi = position;
+        while (hi - lo > 1) {
+            uint64_t mid = lo + (hi - lo) / 2;
+
+            ops_a->restore(engine_a, checkpoint_a);
+            ops_b->restore(engine_b, checkpoint_b);
+            lockstep_step_both(ops_a, engine_a, ops_b, engine_b, mid - lo);
+
+            result->checks++;
+            if (lockstep_state_hash(ops_a, engine_a) == lockstep_state_hash(ops_b, engine_b)) {
+                // Move the checkpoint forward so the next probe replays less
+                if (!lockstep_checkpoint(ops_a, engine_a, &checkpoint_a) ||
+                    !lockstep_checkpoint(ops_b, engine_b, &checkpoint_b)) {
+                    printf("Failed to allocate lockstep checkpoint\n");
+                    ok = false;
+                    goto cleanup;
+                }
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        // Replay the single diverging instruction
+        lockstep_regs_t regs;
+        ops_a->restore(engine_a, checkpoint_a);
+        ops_b->restore(engine_b, checkpoint_b);
+        ops_a->get_registers(engine_a, &regs);
+        lockstep_step_both(ops_a, engine_a, ops_b, engine_b, 1);
+
+        result->diverged = true;
+        result->instructions = hi;
+        result->divergence_index = hi;
+        result->divergence_pc = regs.regs[6] | (regs.regs[7] << 8);
+        break;
+    }
+
+cleanup:
+    if (checkpoint_a) {
+        ops_a->free_snapshot(checkpoint_a);
+    }
+    if (checkpoint_b) {
+        ops_b->free_snapshot(checkpoint_b);
+    }
+    return ok;
+}
+
+// Print both register sets and the memory bytes that differ
+void lockstep_dump(const lockstep_engine_t* ops_a, void* engine_a,
+                   const lockstep_engine_t* ops_b, void* engine_b) {
+    static const char* names[] = {"A", "B", "C", "D", "SP.lo", "SP.hi", "PC.lo", "PC.hi"};
+    lockstep_regs_t regs_a, regs_b;
+
+    ops_a->get_registers(engine_a, &regs_a);
+    ops_b->get_registers(engine_b, &regs_b);
+
+    printf("%-8s %-10s %-10s\n", "", ops_a->name, ops_b->name);
+    for (int i = 0; i < 8; i++) {
+        printf("%-8s 0x%02X       0x%02X%s\n", names[i], regs_a.regs[i], regs_b.regs[i],
+               regs_a.regs[i] != regs_b.regs[i] ? "  <--" : "");
+    }
+    printf("%-8s 0x%02X       0x%02X%s\n", "Flags", regs_a.flags, regs_b.flags,
+           regs_a.flags != regs_b.flags ? "  <--" : "");
+    printf("%-8s %-10s %-10s%s\n", "Running", regs_a.running ? "yes" : "no",
+           regs_b.running ? "yes" : "no", regs_a.running != regs_b.running ? "  <--" : "");
+
+    if (ops_a->memory_hash(engine_a) == ops_b->memory_hash(engine_b)) {
+        printf("Memory identical\n");
+        return;
+    }
+
+    uint32_t differences = 0;
+    for (uint32_t address = 0; address < MEMORY_SIZE; address++) {
+        uint8_t a = ops_a->read_memory(engine_a, address);
+        uint8_t b = ops_b->read_memory(engine_b, address);
+        if (a != b) {
+            if (differences < LOCKSTEP_DUMP_LIMIT) {
+                printf("  [0x%04X] 0x%02X       0x%02X\n", address, a, b);
+            }
+            differences++;
+        }
+    }
+    if (differences > LOCKSTEP_DUMP_LIMIT) {
+        printf("  ... %u more\n", differences - LOCKSTEP_DUMP_LIMIT);
+    }
+    printf("Memory differs at %u address(es)\n", differences);
+}
@@ -0,0 +1,74 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lockstep differential execution.
+// Two engines run the same memory image side by side. Every check_interval
+// instructions a 64-bit hash of registers and memory is compared; memory
+// hashes are maintained incrementally on writes, so a check is O(1). On a
+// mismatch both engines are rewound to the last matching checkpoint and the
+// interval is bisected down to the first diverging instruction.
+//
+// This header deliberately does not include isa.h so that standalone
+// interpreters with their own register macros can provide an engine.
+
+// Architectural state compared by the harness
+typedef struct {
+    uint8_t regs[8];      // A, B, C, D, SP (4-5), PC (6-7)
+    uint8_t flags;
+    bool running;
+} lockstep_regs_t;
+
+// Engine operations
+typedef struct {
+    const char* name;
+    void* (*create)(void);
+    void (*destroy)(void* engine);
+    // Reset registers, copy a full 64 KiB image and start running at entry
+    void (*start)(void* engine, const uint8_t* image, uint16_t entry);
+    // Execute one instruction; a halted engine must not change state
+    bool (*step)(void* engine);
+    void (*get_registers)(void* engine, lockstep_regs_t* regs);
+    uint8_t (*read_memory)(void* engine, uint16_t address);
+    uint64_t (*memory_hash)(void* engine);
+    // A checkpoint is allocated once by snapshot and overwritten in place
+    // by save, so a clean interval costs no allocation; both fail (NULL,
+    // false) when memory runs out
+    void* (*snapshot)(void* engine);
+    bool (*save)(void* engine, void* snapshot);
+    void (*restore)(void* engine, const void* snapshot);
+    void (*free_snapshot)(void* snapshot);
+} lockstep_engine_t;
+
+// Run configuration
+typedef struct {
+    uint64_t check_interval;
+    uint64_t max_instructions;
+    bool verbose;
+} lockstep_config_t;
+
+// Run result
+typedef struct {
+    bool diverged;
+    uint64_t instructions;        // Instructions executed by each engine
+    uint64_t divergence_index;    // 1-based index of the first diverging instruction
+    uint16_t divergence_pc;       // PC (engine A) before the diverging instruction
+    uint64_t checks;              // Hash comparisons performed
+} lockstep_result_t;
+
+// Built-in engines
+extern const lockstep_engine_t lockstep_isa_engine;
+extern const lockstep_engine_t lockstep_simple_engine;
+
+// Harness
+uint64_t lockstep_state_hash(const lockstep_engine_t* ops, void* engine);
+bool lockstep_run(const lockstep_engine_t* ops_a, void* engine_a,
+                  const lockstep_engine_t* ops_b, void* engine_b,
+                  const lockstep_config_t* config, lockstep_result_t* result);
+void lockstep_dump(const lockstep_engine_t* ops_a, void* engine_a,
+                   const lockstep_engine_t* ops_b, void* engine_b);
+
+#endif // LOCKSTEP_H
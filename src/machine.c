@@ -0,0 +1,422 @@
+#include "machine.h"
+#include "ini.h"
+#include "isa.h"
+#include "memory.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    MACHINE_SECTION_NONE = 0,
+    MACHINE_SECTION_MACHINE,
+    MACHINE_SECTION_REGION,
+    MACHINE_SECTION_DEVICE,
+    MACHINE_SECTION_IRQ,
+    MACHINE_SECTION_CYCLES
+} machine_section_t;
+
+// Parser position and the section being filled in
+typedef struct {
+    ini_reader_t reader;
+    machine_config_t* config;
+    machine_section_t section;
+    device_region_t* region;
+    bool region_start;
+    bool region_end;
+    device_placement_t* placement;
+} machine_parser_t;
+
+void machine_config_default(machine_config_t* config) {
+    memset(config, 0, sizeof(*config));
+    strcpy(config->name, "reference");
+    config->clock_hz = CPU_FREQUENCY_HZ;
+    config->memory_size = MEMORY_SIZE;
+    config->cores = 1;
+    config->quantum = SMP_DEFAULT_QUANTUM;
+    config->schedule = SMP_SCHEDULE_THREADS;
+    device_layout_default(&config->layout);
+    memcpy(config->cycles, isa_default_cycles(), sizeof(config->cycles));
+    config->default_cycles = true;
+}
+
+// Interrupt source by name, or -1
+static int machine_source(const char* name) {
+    for (int source = 0; source < PIC_SOURCES; source++) {
+        const char* known = pic_source_name((uint8_t)source);
+        if (known && strcmp(known, name) == 0) {
+            return source;
+        }
+    }
+    return -1;
+}
+
+// Check the section just finished
+static bool machine_end_section(machine_parser_t* parser) {
+    if (parser->section == MACHINE_SECTION_REGION) {
+        if (!parser->region_start || !parser->region_end) {
+            return ini_error(&parser->reader, "region needs start and end", NULL);
+        }
+        if (parser->region->end < parser->region->start) {
+            return ini_error(&parser->reader, "region ends before it starts", NULL);
+        }
+    }
+    parser->section = MACHINE_SECTION_NONE;
+    return true;
+}
+
+// "[kind]" or "[kind argument]", after checking the section before it
+static bool machine_begin_section(void* context, char* header, char* argument) {
+    machine_parser_t* parser = context;
+    machine_config_t* config = parser->config;
+
+    if (!machine_end_section(parser)) {
+        return false;
+    }
+
+    if (strcmp(header, "machine") == 0 || strcmp(header, "irq") == 0 || strcmp(header, "cycles") == 0) {
+        if (*argument) {
+            return ini_error(&parser->reader, "unexpected section argument", argument);
+        }
+        parser->section = header[0] == 'm' ? MACHINE_SECTION_MACHINE :
+                          header[0] == 'i' ? MACHINE_SECTION_IRQ : MACHINE_SECTION_CYCLES;
+        return true;
+    }
+
+    if (strcmp(header, "ram") == 0 || strcmp(header, "rom") == 0 || strcmp(header, "open") == 0) {
+        device_layout_t* layout = &config->layout;
+        if (layout->region_count == DEVICE_MAX_REGIONS) {
+            return ini_error(&parser->reader, "too many regions", NULL);
+        }
+        parser->region = &layout->regions[layout->region_count++];
+        parser->region->slot = header[1] == 'a' ? 0 : header[1] == 'o' ? DEVICE_SLOT_ROM : DEVICE_SLOT_OPEN;
+        parser->region_start = false;
+        parser->region_end = false;
+        parser->section = MACHINE_SECTION_REGION;
+        return true;
+    }
+
+    if (strcmp(header, "device") == 0) {
+        device_layout_t* layout = &config->layout;
+        if (!*argument || strlen(argument) >= DEVICE_NAME_SIZE) {
+            return ini_error(&parser->reader, "device section needs a device name", NULL);
+        }
+        parser->placement = NULL;
+        for (int i = 0; i < layout->placement_count; i++) {
+            if (strcmp(layout->placements[i].device, argument) == 0) {
+                parser->placement = &layout->placements[i];
+            }
+        }
+        if (!parser->placement) {
+            if (layout->placement_count == DEVICE_MAX) {
+                return ini_error(&parser->reader, "too many devices", NULL);
+            }
+            parser->placement = &layout->placements[layout->placement_count++];
+            strcpy(parser->placement->device, argument);
+        }
+        parser->section = MACHINE_SECTION_DEVICE;
+        return true;
+    }
+
+    return ini_error(&parser->reader, "unknown section", header);
+}
+
+// Cycle cost for an opcode number or for every opcode of a mnemonic
+static bool machine_set_cycles(machine_parser_t* parser, const char* key, uint32_t cycles) {
+    uint32_t opcode;
+    bool found = false;
+
+    if (isdigit((unsigned char)key[0])) {
+        if (!ini_number(key, 0xFF, &opcode) || !isa_is_valid_opcode((uint8_t)opcode)) {
+            return ini_error(&parser->reader, "unknown opcode", key);
+        }
+        parser->config->cycles[opcode] = (uint8_t)cycles;
+        return true;
+    }
+
+    for (opcode = 0; opcode < 256; opcode++) {
+        const char* mnemonic = isa_get_mnemonic((opcode_t)opcode);
+        bool same = isa_is_valid_opcode((uint8_t)opcode) && strlen(mnemonic) == strlen(key);
+        for (size_t i = 0; same && key[i]; i++) {
+            same = toupper((unsigned char)key[i]) == mnemonic[i];
+        }
+        if (same) {
+            parser->config->cycles[opcode] = (uint8_t)cycles;
+            found = true;
+        }
+    }
+    return found || ini_error(&parser->reader, "unknown mnemonic", key);
+}
+
+static bool machine_set(void* context, const char* key, const char* value) {
+    machine_parser_t* parser = context;
+    machine_config_t* config = parser->config;
+    uint32_t number;
+
+    switch (parser->section) {
+        case MACHINE_SECTION_MACHINE:
+            if (strcmp(key, "name") == 0) {
+                if (strlen(value) >= MACHINE_NAME_SIZE) {
+                    return ini_error(&parser->reader, "name too long", NULL);
+                }
+                strcpy(config->name, value);
+                return true;
+            }
+            if (strcmp(key, "clock") == 0) {
+                if (!ini_number(value, UINT32_MAX, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid clock", value);
+                }
+                config->clock_hz = number;
+                return true;
+            }
+            if (strcmp(key, "memory") == 0) {
+                if (!ini_size(value, MMU_MAX_PHYSICAL, &number) || number < MEMORY_SIZE || (number & (number - 1)) != 0) {
+                    return ini_error(&parser->reader, "memory must be a power of two from 64K to 16M", value);
+                }
+                config->memory_size = number;
+                return true;
+            }
+            if (strcmp(key, "cores") == 0) {
+                if (!ini_number(value, SMP_MAX_CORES, &number) || number == 0) {
+                    return ini_error(&parser->reader, "cores must be 1 to 8", value);
+                }
+                config->cores = (int)number;
+                return true;
+            }
+            if (strcmp(key, "quantum") == 0) {
+                if (!ini_number(value, UINT32_MAX, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid quantum", value);
+                }
+                config->quantum = number;
+                return true;
+            }
+            if (strcmp(key, "schedule") == 0) {
+                if (strcmp(value, "threads") == 0) {
+                    config->schedule = SMP_SCHEDULE_THREADS;
+                } else if (strcmp(value, "round-robin") == 0) {
+                    config->schedule = SMP_SCHEDULE_ROUND_ROBIN;
+                } else {
+                    return ini_error(&parser->reader, "schedule must be threads or round-robin", value);
+                }
+                return true;
+            }
+            break;
+
+        case MACHINE_SECTION_REGION:
+            if (strcmp(key, "start") == 0 || strcmp(key, "end") == 0) {
+                if (!ini_number(value, 0xFFFF, &number)) {
+                    return ini_error(&parser->reader, "invalid address", value);
+                }
+                if (key[0] == 's') {
+                    parser->region->start = (uint16_t)number;
+                    parser->region_start = true;
+                } else {
+                    parser->region->end = (uint16_t)number;
+                    parser->region_end = true;
+                }
+                return true;
+            }
+            if (strcmp(key, "image") == 0 && parser->region->slot == DEVICE_SLOT_ROM) {
+                if (strlen(value) >= MACHINE_PATH_SIZE) {
+                    return ini_error(&parser->reader, "image path too long", NULL);
+                }
+                strcpy(config->rom_image[parser->region - config->layout.regions], value);
+                return true;
+            }
+            break;
+
+        case MACHINE_SECTION_DEVICE:
+            if (strcmp(key, "base") == 0) {
+                if (!ini_number(value, 0xFFFF, &number)) {
+                    return ini_error(&parser->reader, "invalid address", value);
+                }
+                parser->placement->relocate = true;
+                parser->placement->base = (uint16_t)number;
+                return true;
+            }
+            if (strcmp(key, "enabled") == 0) {
+                bool enabled;
+                if (!ini_flag(value, &enabled)) {
+                    return ini_error(&parser->reader, "expected yes or no", value);
+                }
+                parser->placement->disabled = !enabled;
+                return true;
+            }
+            break;
+
+        case MACHINE_SECTION_IRQ: {
+            int source = machine_source(key);
+            if (source < 0) {
+                return ini_error(&parser->reader, "unknown interrupt source", key);
+            }
+            if (!ini_number(value, PIC_SOURCES - 1, &number)) {
+                return ini_error(&parser->reader, "invalid interrupt line", value);
+            }
+            config->layout.irq_line[source] = (uint8_t)number;
+            return true;
+        }
+
+        case MACHINE_SECTION_CYCLES:
+            if (!ini_number(value, 0xFF, &number) || number == 0) {
+                return ini_error(&parser->reader, "invalid cycle count", value);
+            }
+            return machine_set_cycles(parser, key, number);
+
+        default:
+            return ini_error(&parser->reader, "setting outside a section", key);
+    }
+    return ini_error(&parser->reader, "unknown setting", key);
+}
+
+// Settings that only make sense together
+static bool machine_validate(machine_parser_t* parser) {
+    const uint8_t* line = parser->config->layout.irq_line;
+
+    for (int a = 0; a < PIC_SOURCES; a++) {
+        for (int b = a + 1; b < PIC_SOURCES; b++) {
+            if (pic_source_name((uint8_t)a) && pic_source_name((uint8_t)b) && line[a] == line[b]) {
+                fprintf(stderr, "%s: %s and %s share interrupt line %d\n", parser->reader.origin,
+                        pic_source_name((uint8_t)a), pic_source_name((uint8_t)b), line[a]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool machine_config_parse(machine_config_t* config, const char* text, const char* origin) {
+    machine_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.reader = (ini_reader_t){origin, 0, machine_begin_section, machine_set, &parser};
+    parser.config = config;
+
+    bool ok = ini_read(&parser.reader, text);
+    ok = ok && machine_end_section(&parser) && machine_validate(&parser);
+    if (!ok) {
+        return false;
+    }
+
+    config->default_cycles = memcmp(config->cycles, isa_default_cycles(), sizeof(config->cycles)) == 0;
+    config->map = device_registry_layout(&config->layout);
+    if (!config->map) {
+        fprintf(stderr, "%s: devices do not fit the described layout\n", origin);
+        return false;
+    }
+    return true;
+}
+
+// Make a relative ROM image path relative to the description's directory
+static bool machine_resolve_image(char* image, const char* description) {
+    const char* slash = strrchr(description, '/');
+    if (!image[0] || image[0] == '/' || !slash) {
+        return true;
+    }
+
+    size_t directory = (size_t)(slash - description) + 1;
+    if (directory + strlen(image) >= MACHINE_PATH_SIZE) {
+        fprintf(stderr, "%s: image path too long\n", description);
+        return false;
+    }
+    memmove(image + directory, image, strlen(image) + 1);
+    memcpy(image, description, directory);
+    return true;
+}
+
+bool machine_config_load(machine_config_t* config, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open machine description %s\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    bool ok = text && fread(text, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+
+    if (ok) {
+        text[size] = '\0';
+        machine_config_default(config);
+        ok = machine_config_parse(config, text, path);
+        for (int i = 0; ok && i < config->layout.region_count; i++) {
+            ok = machine_resolve_image(config->rom_image[i], path);
+        }
+    } else {
+        fprintf(stderr, "Cannot read machine description %s\n", path);
+    }
+    free(text);
+    return ok;
+}
+
+// Copy a ROM image into memory at its region
+static bool machine_load_rom(cpu_state_t* cpu, const device_region_t* region, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open ROM image %s\n", path);
+        return false;
+    }
+
+    size_t capacity = (size_t)(region->end - region->start) + 1;
+    size_t size = fread(cpu->memory + region->start, 1, capacity, file);
+    bool fits = size < capacity || fgetc(file) == EOF;
+    fclose(file);
+
+    if (!fits) {
+        fprintf(stderr, "ROM image %s is larger than its %zu-byte region\n", path, capacity);
+    }
+    return fits;
+}
+
+cpu_state_t* cpu_create_from_config(const machine_config_t* config) {
+    const device_map_t* map = config->map ? config->map : device_registry_layout(&config->layout);
+    if (!map) {
+        return NULL;
+    }
+
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!cpu) {
+        return NULL;
+    }
+    device_set_init_map(cpu->devices, map);
+    cpu->frequency_hz = config->clock_hz;
+    cpu->cycle_table = config->cycles;
+    if (config->memory_size != MEMORY_SIZE && !cpu_set_memory_size(cpu, config->memory_size)) {
+        cpu_destroy(cpu);
+        return NULL;
+    }
+
+    for (int i = 0; i < config->layout.region_count; i++) {
+        if (config->rom_image[i][0] && !machine_load_rom(cpu, &config->layout.regions[i], config->rom_image[i])) {
+            cpu_destroy(cpu);
+            return NULL;
+        }
+    }
+    return cpu;
+}
+
+void machine_config_print(const machine_config_t* config) {
+    const device_layout_t* layout = &config->layout;
+
+    printf("Machine %s, %u Hz, %u KiB physical memory%s\n", config->name, config->clock_hz,
+           config->memory_size / 1024, config->default_cycles ? "" : ", custom cycle costs");
+    if (config->cores > 1) {
+        printf("  %d cores, %u-cycle quanta, %s\n", config->cores, config->quantum,
+               config->schedule == SMP_SCHEDULE_ROUND_ROBIN ? "round-robin" : "one thread per core");
+    }
+    for (int i = 0; i < layout->region_count; i++) {
+        const device_region_t* region = &layout->regions[i];
+        const char* kind = region->slot == DEVICE_SLOT_ROM ? "rom" : region->slot == DEVICE_SLOT_OPEN ? "open" : "ram";
+        printf("  %-12s 0x%04X-0x%04X %s\n", kind, region->start, region->end, config->rom_image[i]);
+    }
+    for (int source = 0; source < PIC_SOURCES; source++) {
+        if (pic_source_name((uint8_t)source) && layout->irq_line[source] != source) {
+            printf("  %-12s line %d\n", pic_source_name((uint8_t)source), layout->irq_line[source]);
+        }
+    }
+    const device_map_t* map = config->map ? config->map : device_registry_map();
+    if (map) {
+        device_map_print(map);
+    }
+}
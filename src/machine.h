@@ -0,0 +1,66 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "cpu.h"
+#include "devices.h"
+#include "smp.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Machine descriptions.
+// A board is described in an INI file:
+//
+//   [machine]        name = NAME, clock = HZ, memory = BYTES (K/M suffix;
+//                    physical memory the MMU banks into, up to 16M),
+//                    cores = N (up to 8, see smp.h), quantum = CYCLES,
+//                    schedule = threads|round-robin
+//   [ram]            start = ADDRESS, end = ADDRESS
+//   [rom]            start, end, image = PATH (optional, loaded at start)
+//   [open]           start, end (reads 0, writes ignored)
+//   [device NAME]    base = ADDRESS (move the device), enabled = yes|no
+//   [irq]            SOURCE = LINE (timer, uart-rx, uart-tx, gpio, dma, block)
+//   [cycles]         MNEMONIC = CYCLES, or 0xOPCODE = CYCLES
+//
+// Anything not described keeps today's layout: addresses are RAM, devices
+// sit at their registered addresses, the rest of the device page is open
+// and each interrupt source has its own line. Regions apply in file order.
+//
+// The description is parsed once and compiled into a device map, the same
+// flat page/slot tables every machine dispatches through, plus a cycle
+// table indexed by opcode; a configured machine costs nothing extra per
+// access or per instruction.
+
+#define MACHINE_NAME_SIZE 64
+#define MACHINE_PATH_SIZE 256
+
+typedef struct {
+    char name[MACHINE_NAME_SIZE];
+    uint32_t clock_hz;
+    uint32_t memory_size;
+    int cores;                      // 1 = no SMP
+    uint32_t quantum;
+    smp_schedule_t schedule;
+    device_layout_t layout;
+    char rom_image[DEVICE_MAX_REGIONS][MACHINE_PATH_SIZE];     // Per region, "" = none
+    uint8_t cycles[256];
+    bool default_cycles;            // Cycle table is the instruction table's
+    const device_map_t* map;        // Compiled layout (NULL until parsed)
+} machine_config_t;
+
+// Today's machine
+void machine_config_default(machine_config_t* config);
+
+// Parse a description on top of the defaults; origin names it in errors
+bool machine_config_parse(machine_config_t* config, const char* text, const char* origin);
+bool machine_config_load(machine_config_t* config, const char* path);
+
+// Create a CPU with a private device set laid out as described. Device
+// plugins must be registered before the description is parsed, and the
+// config must outlive the CPU (its cycle table is shared). Multi-core
+// machines are made from it with smp_create().
+cpu_state_t* cpu_create_from_config(const machine_config_t* config);
+
+// Print the machine's clock, regions and device map
+void machine_config_print(const machine_config_t* config);
+
+#endif // MACHINE_H
@@ -97,15 +97,29 @@ void memory_dump_disasm(uint8_t* memory, uint16_t start, uint16_t end) {
 }
 
 // Memory fill functions
+// Fill the RAM and vector parts of start..end (inclusive) with one memset
+// each; the MMIO window in between is skipped
 void memory_fill(uint8_t* memory, uint16_t start, uint16_t end, uint8_t value) {
-    for (uint16_t addr = start; addr <= end; addr++) {
-        if (memory_is_ram(addr) || memory_is_vector(addr)) {
-            memory[addr] = value;
-        }
+    if (start > end) {
+        return;
+    }
+    if (start <= RAM_END) {
+        uint16_t last = end < RAM_END ? end : RAM_END;
+        memset(&memory[start], value, (size_t)last - start + 1);
+    }
+    if (end >= VECTOR_START) {
+        uint16_t first = start > VECTOR_START ? start : VECTOR_START;
+        memset(&memory[first], value, (size_t)end - first + 1);
     }
 }
 
+// Copy size bytes; RAM-to-RAM copies are a single memmove (overlap safe),
+// anything touching MMIO goes through the device handlers byte by byte
 void memory_copy(uint8_t* memory, uint16_t dest, uint16_t src, uint16_t size) {
+    if ((uint32_t)src + size <= RAM_END + 1 && (uint32_t)dest + size <= RAM_END + 1) {
+        memmove(&memory[dest], &memory[src], size);
+        return;
+    }
     for (uint16_t i = 0; i < size; i++) {
         uint8_t value = memory_read(memory, src + i);
         memory_write(memory, dest + i, value);
@@ -13,6 +13,10 @@
 #define MMIO_END 0xFEFF
 #define MMIO_SIZE (MMIO_END - MMIO_START + 1)
 
+// Device register page, routed to the machine's device set by the CPU
+#define MMIO_DEVICE_START 0x8000
+#define MMIO_DEVICE_END 0x80FF
+
 #define VECTOR_START 0xFF00
 #define VECTOR_END 0xFFFF
 #define VECTOR_SIZE (VECTOR_END - VECTOR_START + 1)
@@ -31,6 +35,65 @@
 #define TIMER_COUNT_ADDR_H 0x8008
 #define TIMER_IRQ_ADDR 0x8009
 
+#define UART_CTRL_ADDR 0x800A
+#define TIMER_PRESCALER_ADDR 0x800B
+#define GPIO_EDGE_ADDR 0x800C
+
+// Interrupt controller (0x8010-0x802F)
+#define PIC_PENDING_ADDR 0x8010
+#define PIC_MASK_ADDR 0x8011
+#define PIC_CTRL_ADDR 0x8012
+#define PIC_EOI_ADDR 0x8013
+#define PIC_SOURCE_ADDR 0x8014
+#define PIC_IN_SERVICE_ADDR 0x8015
+#define PIC_PRIORITY_ADDR 0x8018    // One byte per source, 0x8018-0x801F
+#define PIC_VECTOR_ADDR 0x8020      // Low/high byte per source, 0x8020-0x802F
+
+// DMA controller
+#define DMA_SRC_ADDR 0x8030
+#define DMA_SRC_ADDR_H 0x8031
+#define DMA_DST_ADDR 0x8032
+#define DMA_DST_ADDR_H 0x8033
+#define DMA_LEN_ADDR 0x8034
+#define DMA_LEN_ADDR_H 0x8035
+#define DMA_MODE_ADDR 0x8036
+#define DMA_CTRL_ADDR 0x8037
+#define DMA_CYCLES_ADDR 0x8038
+
+// Block device
+#define BLOCK_SECTOR_ADDR 0x8040
+#define BLOCK_SECTOR_ADDR_H 0x8041
+#define BLOCK_BUFFER_ADDR 0x8042
+#define BLOCK_BUFFER_ADDR_H 0x8043
+#define BLOCK_COUNT_ADDR 0x8044
+#define BLOCK_CMD_ADDR 0x8045
+#define BLOCK_STATUS_ADDR 0x8046
+#define BLOCK_CTRL_ADDR 0x8047
+#define BLOCK_SIZE_ADDR 0x8048      // Image size in sectors, read only
+#define BLOCK_SIZE_ADDR_H 0x8049
+
+// Framebuffer control
+#define FB_CTRL_ADDR 0x8050
+#define FB_FORMAT_ADDR 0x8051
+
+// Memory management unit (bank select)
+#define MMU_CTRL_ADDR 0x8060
+#define MMU_WINDOW_ADDR 0x8061      // Window MMU_BANK refers to
+#define MMU_BANK_ADDR 0x8062        // Bank mapped into the selected window, 12 bits
+#define MMU_BANK_ADDR_H 0x8063
+#define MMU_SIZE_ADDR 0x8064        // Physical memory in 64 KiB units minus one, read only
+
+// Inter-processor interrupts (SMP machines)
+#define IPI_CORE_ADDR 0x8070        // Number of the core reading it, read only
+#define IPI_COUNT_ADDR 0x8071       // Cores in the machine, read only
+#define IPI_SEND_ADDR 0x8072        // Write a mask of cores to interrupt
+#define IPI_PENDING_ADDR 0x8073     // Read: pending mask; write 1s to clear
+
+// Framebuffer memory: 128x64 pixels, rows of 16 bytes (monochrome, up
+// to 0x93FF) or 128 bytes (RGB332). Plain memory; writes are tracked.
+#define FB_START 0x9000
+#define FB_END 0xAFFF
+
 // Memory access types
 typedef enum {
     MEM_READ = 0,
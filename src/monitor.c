@@ -1,6 +1,7 @@
 #include "cpu.h"
 #include "memory.h"
 #include "devices.h"
+#include "machine.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,7 @@ typedef struct {
     cpu_state_t* cpu;
     bool running;
     char* script_file;
+    char* machine_file;
     bool verbose;
 } monitor_state_t;
 
@@ -22,12 +24,15 @@ void run_interactive_monitor(monitor_state_t* state);
 void run_script_monitor(monitor_state_t* state);
 bool execute_command(monitor_state_t* state, const char* command);
 void print_cpu_status(monitor_state_t* state);
-void print_memory_dump(monitor_state_t* state, uint16_t address, uint16_t size);
-void print_disassembly(monitor_state_t* state, uint16_t address, uint16_t size);
+bool parse_address(monitor_state_t* state, const char* text, uint32_t* physical);
+void print_memory_dump(monitor_state_t* state, uint32_t address, uint16_t size);
+void print_disassembly(monitor_state_t* state, uint32_t address, uint16_t size);
+void print_mmu(monitor_state_t* state);
 void print_help_text(void);
 
 int main(int argc, char* argv[]) {
     monitor_state_t state = {0};
+    machine_config_t machine;
     
     // Parse command line options
     if (!parse_cli_options(argc, argv, &state)) {
@@ -35,7 +40,15 @@ int main(int argc, char* argv[]) {
     }
     
     // Create CPU instance
-    state.cpu = cpu_create();
+    if (state.machine_file) {
+        machine_config_default(&machine);
+        if (!machine_config_load(&machine, state.machine_file)) {
+            return 1;
+        }
+        state.cpu = cpu_create_from_config(&machine);
+    } else {
+        state.cpu = cpu_create();
+    }
     if (!state.cpu) {
         fprintf(stderr, "Failed to create CPU instance\n");
         return 1;
@@ -57,11 +70,13 @@ void print_usage(const char* program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("\nOptions:\n");
     printf("  -s, --script FILE       Run script from file\n");
+    printf("  -M, --machine FILE      Board description (see machines/)\n");
     printf("  -v, --verbose          Verbose output\n");
     printf("  -h, --help             Show this help message\n");
     printf("\nExamples:\n");
     printf("  %s\n", program_name);
     printf("  %s -s commands.txt\n", program_name);
+    printf("  %s -M machines/banked.ini\n", program_name);
     printf("  %s --help\n", program_name);
 }
 
@@ -85,13 +100,20 @@ void print_help(void) {
     printf("  freq HZ                Set CPU frequency\n");
     printf("  irq                    Trigger IRQ\n");
     printf("  nmi                    Trigger NMI\n");
+    printf("  pin N 0|1              Drive GPIO input pin N\n");
+    printf("  pic                    Show interrupt controller and latency stats\n");
+    printf("  mmu                    Show the bank mapping\n");
     printf("  quit, q                Exit monitor\n");
     printf("  help                   Show this help\n");
+    printf("\nAddresses are CPU addresses, translated through the current bank\n");
+    printf("mapping, or BANK:ADDRESS for ADDRESS as seen with BANK in its window.\n");
+    printf("Ranges continue in physical memory from there.\n");
 }
 
 bool parse_cli_options(int argc, char* argv[], monitor_state_t* state) {
     static struct option long_options[] = {
         {"script", required_argument, 0, 's'},
+        {"machine", required_argument, 0, 'M'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
@@ -104,13 +126,17 @@ bool parse_cli_options(int argc, char* argv[], monitor_state_t* state) {
     state->cpu = NULL;
     state->running = true;
     state->script_file = NULL;
+    state->machine_file = NULL;
     state->verbose = false;
     
-    while ((c = getopt_long(argc, argv, "s:vh", long_options, &option_index)) != -1) {
+    while ((c = getopt_long(argc, argv, "s:M:vh", long_options, &option_index)) != -1) {
         switch (c) {
             case 's':
                 state->script_file = optarg;
                 break;
+            case 'M':
+                state->machine_file = optarg;
+                break;
             case 'v':
                 state->verbose = true;
                 break;
@@ -195,9 +221,17 @@ bool execute_command(monitor_state_t* state, const char* command) {
         return true;
     } else if (strcmp(cmd, "load") == 0) {
         if (args > 1) {
-            uint16_t addr = (args > 2) ? strtol(arg2, NULL, 0) : 0x0200;
-            if (cpu_load_file(state->cpu, arg1, addr)) {
-                printf("Loaded %s at 0x%04X\n", arg1, addr);
+            uint32_t addr = 0x0200;
+            if (args > 2 && !parse_address(state, arg2, &addr)) {
+                return true;
+            }
+            FILE* file = fopen(arg1, "rb");
+            size_t size = 0;
+            if (file) {
+                size = fread(&state->cpu->memory[addr], 1, state->cpu->memory_size - addr, file);
+                fclose(file);
+                cpu_rehash_memory(state->cpu);
+                printf("Loaded %s (%zu bytes) at 0x%04X\n", arg1, size, addr);
             } else {
                 printf("Failed to load %s\n", arg1);
             }
@@ -206,14 +240,20 @@ bool execute_command(monitor_state_t* state, const char* command) {
         }
         return true;
     } else if (strcmp(cmd, "save") == 0) {
-        if (args > 2) {
-            uint16_t addr = strtol(arg2, NULL, 0);
-            uint16_t size = strtol(arg3, NULL, 0);
+        if (args > 3) {
+            uint32_t addr;
+            if (!parse_address(state, arg2, &addr)) {
+                return true;
+            }
+            uint32_t size = strtoul(arg3, NULL, 0);
+            if (size > state->cpu->memory_size - addr) {
+                size = state->cpu->memory_size - addr;
+            }
             FILE* file = fopen(arg1, "wb");
             if (file) {
                 fwrite(&state->cpu->memory[addr], 1, size, file);
                 fclose(file);
-                printf("Saved %d bytes from 0x%04X to %s\n", size, addr, arg1);
+                printf("Saved %u bytes from 0x%04X to %s\n", size, addr, arg1);
             } else {
                 printf("Failed to save to %s\n", arg1);
             }
@@ -222,7 +262,9 @@ bool execute_command(monitor_state_t* state, const char* command) {
         }
         return true;
     } else if (strcmp(cmd, "step") == 0 || strcmp(cmd, "s") == 0) {
-        if (cpu_step(state->cpu)) {
+        bool stepped = cpu_step(state->cpu);
+        device_set_flush(state->cpu->devices);
+        if (stepped) {
             print_cpu_status(state);
         } else {
             printf("Execution stopped\n");
@@ -254,19 +296,23 @@ bool execute_command(monitor_state_t* state, const char* command) {
         print_cpu_status(state);
         return true;
     } else if (strcmp(cmd, "mem") == 0) {
-        if (args > 1) {
-            uint16_t addr = strtol(arg1, NULL, 0);
+        uint32_t addr;
+        if (args > 1 && parse_address(state, arg1, &addr)) {
             uint16_t size = (args > 2) ? strtol(arg2, NULL, 0) : 16;
             print_memory_dump(state, addr, size);
+        } else if (args > 1) {
+            return true;
         } else {
             printf("Usage: mem ADDRESS [SIZE]\n");
         }
         return true;
     } else if (strcmp(cmd, "disasm") == 0) {
-        if (args > 1) {
-            uint16_t addr = strtol(arg1, NULL, 0);
+        uint32_t addr;
+        if (args > 1 && parse_address(state, arg1, &addr)) {
             uint16_t size = (args > 2) ? strtol(arg2, NULL, 0) : 16;
             print_disassembly(state, addr, size);
+        } else if (args > 1) {
+            return true;
         } else {
             printf("Usage: disasm ADDRESS [SIZE]\n");
         }
@@ -315,6 +361,28 @@ bool execute_command(monitor_state_t* state, const char* command) {
         cpu_nmi(state->cpu);
         printf("NMI triggered\n");
         return true;
+    } else if (strcmp(cmd, "pin") == 0) {
+        if (args > 2) {
+            uint8_t pin = strtol(arg1, NULL, 0);
+            bool level = strtol(arg2, NULL, 0) != 0;
+            state->cpu->devices->now = state->cpu->cycle_count;
+            device_set_set_pin(state->cpu->devices, pin, level);
+            cpu_poll_devices(state->cpu);
+            printf("GPIO pin %u set %s\n", pin, level ? "high" : "low");
+        } else {
+            printf("Usage: pin N 0|1\n");
+        }
+        return true;
+    } else if (strcmp(cmd, "pic") == 0) {
+        pic_device_t* pic = &state->cpu->devices->pic;
+        printf("Pending: 0x%02X  Mask: 0x%02X  In service: 0x%02X  Mode: %s\n",
+               pic->lines, pic->mask, pic->in_service,
+               (pic->control & PIC_CTRL_VECTORED) ? "vectored" : "single vector");
+        pic_print_stats(pic);
+        return true;
+    } else if (strcmp(cmd, "mmu") == 0) {
+        print_mmu(state);
+        return true;
     }
     
     return false;
@@ -329,45 +397,91 @@ void print_cpu_status(monitor_state_t* state) {
            cpu_get_instruction_count(state->cpu));
 }
 
-void print_memory_dump(monitor_state_t* state, uint16_t address, uint16_t size) {
-    printf("Memory dump from 0x%04X to 0x%04X:\n", address, address + size - 1);
+// Resolve an address argument to a physical address
+bool parse_address(monitor_state_t* state, const char* text, uint32_t* physical) {
+    const mmu_device_t* mmu = &state->cpu->devices->mmu;
+    char* end;
+    unsigned long value = strtoul(text, &end, 0);
+    
+    if (end == text) {
+        printf("Invalid address: %s\n", text);
+        return false;
+    }
+    if (*end == '\0') {
+        if (value > 0xFFFF) {
+            printf("Address out of range: %s (use BANK:ADDRESS beyond 64 KiB)\n", text);
+            return false;
+        }
+        *physical = mmu_translate(mmu, (uint16_t)value);
+        return true;
+    }
+    
+    // BANK:ADDRESS, in the current window size
+    uint32_t window_size = mmu_window_size(mmu);
+    unsigned long bank = value;
+    const char* offset_text = end + 1;
+    if (*end != ':') {
+        printf("Invalid address: %s\n", text);
+        return false;
+    }
+    value = strtoul(offset_text, &end, 0);
+    if (end == offset_text || *end != '\0' || value > 0xFFFF || bank >= state->cpu->memory_size / window_size) {
+        printf("Invalid address: %s\n", text);
+        return false;
+    }
+    *physical = (uint32_t)bank * window_size + (uint32_t)value % window_size;
+    return true;
+}
+
+void print_memory_dump(monitor_state_t* state, uint32_t address, uint16_t size) {
+    uint32_t end = address + size;
+    if (end > state->cpu->memory_size) {
+        end = state->cpu->memory_size;
+    }
+    
+    printf("Memory dump from 0x%04X to 0x%04X:\n", address, end - 1);
     printf("Address  ");
     for (int i = 0; i < 16; i++) {
         printf("%02X ", i);
     }
     printf("\n");
     
-    for (uint16_t addr = address; addr < address + size; addr += 16) {
+    for (uint32_t addr = address; addr < end; addr += 16) {
         printf("0x%04X: ", addr);
-        for (int i = 0; i < 16 && addr + i < address + size; i++) {
+        for (uint32_t i = 0; i < 16 && addr + i < end; i++) {
             printf("%02X ", state->cpu->memory[addr + i]);
         }
         printf("\n");
     }
 }
 
-void print_disassembly(monitor_state_t* state, uint16_t address, uint16_t size) {
-    printf("Disassembly from 0x%04X to 0x%04X:\n", address, address + size - 1);
+void print_disassembly(monitor_state_t* state, uint32_t address, uint16_t size) {
+    const uint8_t* memory = state->cpu->memory;
+    uint32_t end = address + size;
+    if (end > state->cpu->memory_size) {
+        end = state->cpu->memory_size;
+    }
+    
+    printf("Disassembly from 0x%04X to 0x%04X:\n", address, end - 1);
     printf("Address  Instruction\n");
     printf("-------- -----------\n");
     
-    uint16_t addr = address;
-    while (addr < address + size) {
+    uint32_t addr = address;
+    while (addr < end) {
         printf("0x%04X: ", addr);
         
-        uint8_t opcode = state->cpu->memory[addr];
+        uint8_t opcode = memory[addr];
         const instruction_t* inst = isa_get_instruction((opcode_t)opcode);
         
         if (inst) {
             printf("%s", inst->mnemonic);
             
             // Parse operands (simplified)
-            if (inst->opcode == OP_LDI && addr + 1 < address + size) {
-                printf(" #$%02X", state->cpu->memory[addr + 1]);
+            if (inst->opcode == OP_LDI && addr + 1 < end) {
+                printf(" #$%02X", memory[addr + 1]);
                 addr += 2;
-            } else if (inst->opcode == OP_LDA && addr + 2 < address + size) {
-                uint16_t target = state->cpu->memory[addr + 1] | 
-                                 (state->cpu->memory[addr + 2] << 8);
+            } else if (inst->opcode == OP_LDA && addr + 2 < end) {
+                uint16_t target = memory[addr + 1] | (memory[addr + 2] << 8);
                 printf(" [$%04X]", target);
                 addr += 3;
             } else {
@@ -382,6 +496,21 @@ void print_disassembly(monitor_state_t* state, uint16_t address, uint16_t size)
     }
 }
 
+// Show which bank each window holds and where it lands physically
+void print_mmu(monitor_state_t* state) {
+    const mmu_device_t* mmu = &state->cpu->devices->mmu;
+    uint32_t window_size = mmu_window_size(mmu);
+    
+    printf("MMU %s, %u KiB windows, %u KiB physical memory\n",
+           (mmu->control & MMU_CTRL_ENABLE) ? "enabled" : "disabled (identity)",
+           window_size / 1024, state->cpu->memory_size / 1024);
+    for (uint32_t window = 0; window < 0x10000 / window_size; window++) {
+        uint16_t start = (uint16_t)(window * window_size);
+        printf("  0x%04X-0x%04X  bank %3u  -> 0x%06X\n", start, start + window_size - 1,
+               mmu->bank[window], mmu_translate(mmu, start));
+    }
+}
+
 void print_help_text(void) {
     printf("Monitor Commands:\n");
     printf("  load FILE ADDRESS      Load program from file\n");
@@ -401,7 +530,13 @@ void print_help_text(void) {
     printf("  freq HZ                Set CPU frequency\n");
     printf("  irq                    Trigger IRQ\n");
     printf("  nmi                    Trigger NMI\n");
+    printf("  pin N 0|1              Drive GPIO input pin N\n");
+    printf("  pic                    Show interrupt controller and latency stats\n");
+    printf("  mmu                    Show the bank mapping\n");
     printf("  quit, q                Exit monitor\n");
     printf("  help                   Show this help\n");
+    printf("\nAddresses are CPU addresses, translated through the current bank\n");
+    printf("mapping, or BANK:ADDRESS for ADDRESS as seen with BANK in its window.\n");
+    printf("Ranges continue in physical memory from there.\n");
 }
 
@@ -0,0 +1,686 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "net.h"
+#include "ini.h"
+#include "statehash.h"
+#include "atomics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    NET_SECTION_NONE = 0,
+    NET_SECTION_NET,
+    NET_SECTION_BOARD,
+    NET_SECTION_LINK,
+    NET_SECTION_RING
+} net_section_t;
+
+// A link or ring as written; resolved once every board is known
+typedef struct {
+    char from[NET_NAME_SIZE];           // Ring: the board name prefix
+    char to[NET_NAME_SIZE];
+    uint32_t latency;                   // 0 = the net's default
+    bool ring;
+    int line;
+} net_wire_t;
+
+// Parser position and the section being filled in
+typedef struct {
+    ini_reader_t reader;
+    net_t* net;
+    net_section_t section;
+    net_board_t board;                  // Board section settings
+    int board_index;                    // Existing board the section changes, or -1
+    uint32_t count;
+    net_wire_t* wires;
+    int wire_count;
+} net_parser_t;
+
+static bool net_copy(char* destination, size_t size, const char* text) {
+    if (strlen(text) >= size) {
+        return false;
+    }
+    strcpy(destination, text);
+    return true;
+}
+
+int net_find_board(const net_t* net, const char* name) {
+    for (int i = 0; i < net->board_count; i++) {
+        if (strcmp(net->boards[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool net_add_board(net_parser_t* parser, const net_board_t* board) {
+    net_t* net = parser->net;
+    if (net->board_count == NET_MAX_BOARDS) {
+        return ini_error(&parser->reader, "too many boards", board->name);
+    }
+    if (net_find_board(net, board->name) >= 0) {
+        return ini_error(&parser->reader, "board defined twice", board->name);
+    }
+
+    net_board_t* boards = realloc(net->boards, (net->board_count + 1) * sizeof(net_board_t));
+    if (!boards) {
+        return ini_error(&parser->reader, "out of memory", NULL);
+    }
+    net->boards = boards;
+    net->boards[net->board_count++] = *board;
+    return true;
+}
+
+// Store the board section: one board, a board's new settings, or count
+// numbered boards
+static bool net_end_section(net_parser_t* parser) {
+    if (parser->section != NET_SECTION_BOARD) {
+        return true;
+    }
+
+    if (parser->board_index >= 0) {
+        if (parser->count) {
+            return ini_error(&parser->reader, "count applies to new boards only", parser->board.name);
+        }
+        parser->net->boards[parser->board_index] = parser->board;
+        return true;
+    }
+    if (!parser->count) {
+        return net_add_board(parser, &parser->board);
+    }
+
+    net_board_t board = parser->board;
+    for (uint32_t i = 0; i < parser->count; i++) {
+        int length = snprintf(board.name, sizeof(board.name), "%s%u", parser->board.name, i);
+        if (length >= (int)sizeof(board.name)) {
+            return ini_error(&parser->reader, "board name too long", parser->board.name);
+        }
+        if (!net_add_board(parser, &board)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// "[kind]" or "[kind name]", after storing the section before it
+static bool net_begin_section(void* context, char* header, char* name) {
+    net_parser_t* parser = context;
+    if (!net_end_section(parser)) {
+        return false;
+    }
+
+    parser->count = 0;
+    if (strcmp(header, "net") == 0 && !*name) {
+        parser->section = NET_SECTION_NET;
+        return true;
+    }
+    if (strcmp(header, "board") == 0 && *name) {
+        parser->section = NET_SECTION_BOARD;
+        parser->board_index = net_find_board(parser->net, name);
+        if (parser->board_index >= 0) {
+            parser->board = parser->net->boards[parser->board_index];
+            return true;
+        }
+        memset(&parser->board, 0, sizeof(parser->board));
+        parser->board.address = NET_DEFAULT_ADDRESS;
+        if (!net_copy(parser->board.name, sizeof(parser->board.name), name)) {
+            return ini_error(&parser->reader, "board name too long", name);
+        }
+        return true;
+    }
+    if ((strcmp(header, "link") == 0 && !*name) || (strcmp(header, "ring") == 0 && *name)) {
+        net_wire_t* wires = realloc(parser->wires, (parser->wire_count + 1) * sizeof(net_wire_t));
+        if (!wires) {
+            return ini_error(&parser->reader, "out of memory", NULL);
+        }
+        parser->wires = wires;
+        net_wire_t* wire = &wires[parser->wire_count++];
+        memset(wire, 0, sizeof(*wire));
+        wire->line = parser->reader.line;
+        wire->ring = *name != '\0';
+        if (wire->ring && !net_copy(wire->from, sizeof(wire->from), name)) {
+            return ini_error(&parser->reader, "board name too long", name);
+        }
+        parser->section = wire->ring ? NET_SECTION_RING : NET_SECTION_LINK;
+        return true;
+    }
+    return ini_error(&parser->reader, "unknown section", header);
+}
+
+static bool net_set(void* context, const char* key, const char* value) {
+    net_parser_t* parser = context;
+    net_t* net = parser->net;
+    net_board_t* board = &parser->board;
+    net_wire_t* wire = parser->wire_count ? &parser->wires[parser->wire_count - 1] : NULL;
+    uint32_t number;
+
+    switch (parser->section) {
+        case NET_SECTION_NET:
+            if (strcmp(key, "latency") == 0) {
+                if (!ini_number(value, UINT32_MAX, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid latency", value);
+                }
+                net->latency = number;
+                return true;
+            }
+            if (strcmp(key, "baud") == 0) {
+                if (!ini_number(value, UINT32_MAX, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid baud rate", value);
+                }
+                net->baud = number;
+                return true;
+            }
+            break;
+
+        case NET_SECTION_BOARD:
+            if (strcmp(key, "machine") == 0 || strcmp(key, "program") == 0 || strcmp(key, "output") == 0) {
+                char* field = key[0] == 'm' ? board->machine : key[0] == 'p' ? board->program : board->output;
+                if (!net_copy(field, MACHINE_PATH_SIZE, value)) {
+                    return ini_error(&parser->reader, "path too long", value);
+                }
+                return true;
+            }
+            if (strcmp(key, "address") == 0) {
+                if (!ini_number(value, 0xFFFF, &number)) {
+                    return ini_error(&parser->reader, "invalid address", value);
+                }
+                board->address = (uint16_t)number;
+                return true;
+            }
+            if (strcmp(key, "count") == 0) {
+                if (!ini_number(value, NET_MAX_BOARDS, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid board count", value);
+                }
+                parser->count = number;
+                return true;
+            }
+            break;
+
+        case NET_SECTION_LINK:
+        case NET_SECTION_RING:
+            if (strcmp(key, "latency") == 0) {
+                if (!ini_number(value, UINT32_MAX, &number) || number == 0) {
+                    return ini_error(&parser->reader, "invalid latency", value);
+                }
+                wire->latency = number;
+                return true;
+            }
+            if (parser->section == NET_SECTION_LINK && (strcmp(key, "from") == 0 || strcmp(key, "to") == 0)) {
+                if (!net_copy(key[0] == 'f' ? wire->from : wire->to, NET_NAME_SIZE, value)) {
+                    return ini_error(&parser->reader, "board name too long", value);
+                }
+                return true;
+            }
+            break;
+
+        default:
+            return ini_error(&parser->reader, "key outside a section", key);
+    }
+    return ini_error(&parser->reader, "unknown key", key);
+}
+
+static bool net_connect(net_parser_t* parser, int from, int to, uint32_t latency) {
+    net_t* net = parser->net;
+    if (net->boards[from].tx) {
+        return ini_error(&parser->reader, "board already sends on a link", net->boards[from].name);
+    }
+    if (net->boards[to].rx) {
+        return ini_error(&parser->reader, "board already receives from a link", net->boards[to].name);
+    }
+
+    net_link_t* links = realloc(net->links, (net->link_count + 1) * sizeof(net_link_t));
+    uart_link_t* queue = uart_link_create(latency);
+    if (!links || !queue) {
+        if (links) {
+            net->links = links;
+        }
+        uart_link_destroy(queue);
+        return ini_error(&parser->reader, "out of memory", NULL);
+    }
+    net->links = links;
+    net->links[net->link_count++] = (net_link_t){from, to, latency, queue};
+    net->boards[from].tx = queue;
+    net->boards[to].rx = queue;
+    return true;
+}
+
+// Turn links and rings into queues between boards
+static bool net_resolve_wires(net_parser_t* parser) {
+    net_t* net = parser->net;
+
+    for (int i = 0; i < parser->wire_count; i++) {
+        net_wire_t* wire = &parser->wires[i];
+        uint32_t latency = wire->latency ? wire->latency : net->latency;
+        parser->reader.line = wire->line;
+
+        if (!wire->ring) {
+            int from = net_find_board(net, wire->from);
+            int to = net_find_board(net, wire->to);
+            if (from < 0 || to < 0) {
+                return ini_error(&parser->reader, "unknown board", from < 0 ? wire->from : wire->to);
+            }
+            if (from == to) {
+                return ini_error(&parser->reader, "a board cannot link to itself", wire->from);
+            }
+            if (!net_connect(parser, from, to, latency)) {
+                return false;
+            }
+            continue;
+        }
+
+        // Ring members in numeric order
+        int members[NET_MAX_BOARDS];
+        int count = 0;
+        char name[NET_NAME_SIZE + 16];
+        for (int n = 0; n < NET_MAX_BOARDS; n++) {
+            snprintf(name, sizeof(name), "%s%d", wire->from, n);
+            int index = net_find_board(net, name);
+            if (index < 0) {
+                break;
+            }
+            members[count++] = index;
+        }
+        if (count < 2) {
+            return ini_error(&parser->reader, "a ring needs boards PREFIX0 and PREFIX1", wire->from);
+        }
+        for (int n = 0; n < count; n++) {
+            if (!net_connect(parser, members[n], members[(n + 1) % count], latency)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Make a relative path relative to the topology's directory
+static bool net_resolve_path(char* path, const char* origin) {
+    const char* slash = strrchr(origin, '/');
+    if (!path[0] || path[0] == '/' || !slash) {
+        return true;
+    }
+
+    size_t directory = (size_t)(slash - origin) + 1;
+    if (directory + strlen(path) >= MACHINE_PATH_SIZE) {
+        fprintf(stderr, "%s: path too long\n", origin);
+        return false;
+    }
+    memmove(path + directory, path, strlen(path) + 1);
+    memcpy(path, origin, directory);
+    return true;
+}
+
+// Output specs with a path carry a kind prefix (file:PATH, unix:PATH)
+static bool net_resolve_output(char* spec, const char* origin) {
+    char* colon = strchr(spec, ':');
+    if (strncmp(spec, "file:", 5) != 0 && strncmp(spec, "unix:", 5) != 0) {
+        return true;
+    }
+
+    char path[MACHINE_PATH_SIZE];
+    strcpy(path, colon + 1);
+    if (!net_resolve_path(path, origin) || (size_t)(colon - spec) + 1 + strlen(path) >= MACHINE_PATH_SIZE) {
+        return false;
+    }
+    strcpy(colon + 1, path);
+    return true;
+}
+
+// Create a board's machine and attach its host output
+static bool net_create_board(net_board_t* board, const char* origin) {
+    board->config = malloc(sizeof(machine_config_t));
+    if (!board->config) {
+        return false;
+    }
+
+    bool ok;
+    if (board->machine[0]) {
+        ok = net_resolve_path(board->machine, origin) && machine_config_load(board->config, board->machine);
+    } else {
+        machine_config_default(board->config);
+        ok = machine_config_parse(board->config, "", origin);
+    }
+    if (ok && board->config->cores > 1) {
+        fprintf(stderr, "%s: board %s: boards in a net are single-core\n", origin, board->name);
+        ok = false;
+    }
+    ok = ok && net_resolve_path(board->program, origin) && net_resolve_output(board->output, origin);
+    if (!ok) {
+        return false;
+    }
+
+    board->cpu = cpu_create_from_config(board->config);
+    if (!board->cpu) {
+        fprintf(stderr, "%s: cannot create board %s\n", origin, board->name);
+        return false;
+    }
+    if (board->output[0]) {
+        board->sink = uart_sink_open(board->output);
+        if (!board->sink) {
+            return false;
+        }
+    }
+    uart_set_sink(&board->cpu->devices->uart, board->sink);
+    return true;
+}
+
+net_t* net_parse(const char* text, const char* origin) {
+    net_t* net = calloc(1, sizeof(net_t));
+    if (!net) {
+        return NULL;
+    }
+    net->latency = NET_DEFAULT_LATENCY;
+    net->baud = NET_DEFAULT_BAUD;
+#if NET_THREADS
+    pthread_mutex_init(&net->lock, NULL);
+    pthread_cond_init(&net->turn, NULL);
+#endif
+
+    net_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.reader = (ini_reader_t){origin, 0, net_begin_section, net_set, &parser};
+    parser.net = net;
+    parser.board_index = -1;
+    bool ok = ini_read(&parser.reader, text);
+    ok = ok && net_end_section(&parser);
+    if (ok && net->board_count == 0) {
+        fprintf(stderr, "%s: no boards\n", origin);
+        ok = false;
+    }
+    ok = ok && net_resolve_wires(&parser);
+    free(parser.wires);
+
+    // The lookahead is the shortest time a byte spends on a link
+    net->lookahead = net->latency;
+    for (int i = 0; ok && i < net->link_count; i++) {
+        if (i == 0 || net->links[i].latency < net->lookahead) {
+            net->lookahead = net->links[i].latency;
+        }
+    }
+
+    for (int i = 0; ok && i < net->board_count; i++) {
+        ok = net_create_board(&net->boards[i], origin);
+    }
+    for (int i = 0; ok && i < net->board_count; i++) {
+        net_board_t* board = &net->boards[i];
+        uint32_t cycles_per_byte = (uint32_t)((uint64_t)board->config->clock_hz * 10 / net->baud);
+        device_set_attach_links(board->cpu->devices, board->tx, board->rx, cycles_per_byte);
+    }
+
+    if (!ok) {
+        net_destroy(net);
+        return NULL;
+    }
+    return net;
+}
+
+net_t* net_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open topology %s\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    bool ok = text && fread(text, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+
+    net_t* net = NULL;
+    if (ok) {
+        text[size] = '\0';
+        net = net_parse(text, path);
+    } else {
+        fprintf(stderr, "Cannot read topology %s\n", path);
+    }
+    free(text);
+    return net;
+}
+
+void net_destroy(net_t* net) {
+    if (!net) {
+        return;
+    }
+
+    for (int i = 0; i < net->board_count; i++) {
+        net_board_t* board = &net->boards[i];
+        if (board->cpu) {
+            device_set_attach_links(board->cpu->devices, NULL, NULL, 1);
+            cpu_destroy(board->cpu);
+        }
+        uart_sink_destroy(board->sink);
+        free(board->config);
+    }
+    for (int i = 0; i < net->link_count; i++) {
+        uart_link_destroy(net->links[i].queue);
+    }
+#if NET_THREADS
+    pthread_cond_destroy(&net->turn);
+    pthread_mutex_destroy(&net->lock);
+#endif
+    free(net->boards);
+    free(net->links);
+    free(net);
+}
+
+bool net_reset(net_t* net) {
+    net->window_end = 0;
+    for (int i = 0; i < net->board_count; i++) {
+        net_board_t* board = &net->boards[i];
+        if (board->program[0] && !cpu_load_file(board->cpu, board->program, board->address)) {
+            return false;
+        }
+        cpu_reset_to_address(board->cpu, board->address);
+        board->stopped = false;
+    }
+    return true;
+}
+
+// Run one board to the end of the window. The board's link horizon
+// moves up first, so it sees exactly the bytes due before the window
+// end, all of which were sent in earlier windows.
+static void net_run_board(net_t* net, net_board_t* board) {
+    cpu_state_t* cpu = board->cpu;
+    uint64_t end = net->window_end;
+
+    if (board->rx) {
+        board->rx->horizon = end;
+        device_set_reschedule(cpu->devices);
+    }
+
+    // A halted board wakes on its interrupt line, resampled by the poll
+    if (!cpu->running && !board->stopped) {
+        cpu_poll_devices(cpu);
+        cpu->running = cpu->irq_pending;
+    }
+
+    while (cpu->running && cpu->cycle_count < end) {
+        if (!cpu_step(cpu)) {
+            board->stopped = true;
+            cpu->running = false;
+        }
+    }
+    if (cpu->cycle_count < end) {
+        cpu->cycle_count = end;
+    }
+}
+
+// Between windows, with every thread waiting: the run is over when no
+// board runs or can be woken and no byte is still on its way
+static void net_next_window(net_t* net) {
+    bool active = false;
+
+    for (int i = 0; i < net->board_count && !active; i++) {
+        net_board_t* board = &net->boards[i];
+        cpu_state_t* cpu = board->cpu;
+        if (cpu->running) {
+            active = true;
+        } else if (!board->stopped) {
+            cpu_poll_devices(cpu);
+            active = cpu->devices->irq;
+        }
+    }
+
+    // Bytes due at or before the receiver's clock are waiting for room
+    // in its FIFO, which a halted board will not make
+    for (int i = 0; i < net->link_count && !active; i++) {
+        uint64_t cycle;
+        net_link_t* link = &net->links[i];
+        active = uart_link_next(link->queue, &cycle) && cycle > net->boards[link->to].cpu->cycle_count;
+    }
+
+    net->done = !active || net->window_end >= net->limit;
+    if (!net->done) {
+        uint64_t remaining = net->limit - net->window_end;
+        net->window_end += remaining < net->lookahead ? remaining : net->lookahead;
+        net->next_board = 0;
+        net->windows++;
+    }
+}
+
+#if NET_THREADS
+
+// Wait until every thread has finished the window; the last to arrive
+// opens the next one. False when the run is over.
+static bool net_barrier(net_t* net) {
+    pthread_mutex_lock(&net->lock);
+    uint64_t generation = net->generation;
+    if (++net->arrived == net->participants) {
+        net_next_window(net);
+        net->arrived = 0;
+        net->generation++;
+        pthread_cond_broadcast(&net->turn);
+    } else {
+        while (generation == net->generation) {
+            pthread_cond_wait(&net->turn, &net->lock);
+        }
+    }
+    bool done = net->done;
+    pthread_mutex_unlock(&net->lock);
+    return !done;
+}
+
+#else
+
+// The only thread opens every window
+static bool net_barrier(net_t* net) {
+    net_next_window(net);
+    return !net->done;
+}
+
+#endif
+
+// Worker: claim boards until the window's are all taken
+static void* net_worker(void* arg) {
+    net_t* net = arg;
+
+    while (net_barrier(net)) {
+        int index;
+        while ((index = atomics_fetch_add_int(&net->next_board, 1, ATOMICS_RELAXED)) < net->board_count) {
+            net_run_board(net, &net->boards[index]);
+        }
+    }
+    return NULL;
+}
+
+#if NET_THREADS
+
+// The calling thread is a worker too; if threads cannot be started the
+// ones that could share the boards
+static void net_run_workers(net_t* net, int threads) {
+    pthread_t workers[NET_MAX_THREADS];
+    int started = 1;
+
+    net->participants = threads;
+    while (started < threads && pthread_create(&workers[started], NULL, net_worker, net) == 0) {
+        started++;
+    }
+    if (started < threads) {
+        fprintf(stderr, "Started %d of %d threads\n", started, threads);
+        pthread_mutex_lock(&net->lock);
+        net->participants = started;
+        pthread_mutex_unlock(&net->lock);
+    }
+
+    net_worker(net);
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+#else
+
+static void net_run_workers(net_t* net, int threads) {
+    if (threads > 1) {
+        fprintf(stderr, "Threads are not supported on this platform; running the boards on one\n");
+    }
+    net->participants = 1;
+    net_worker(net);
+}
+
+#endif
+
+bool net_run(net_t* net, uint64_t max_cycles, int threads) {
+    uint64_t start = net->window_end;
+
+    for (int i = 0; i < net->board_count; i++) {
+        net->boards[i].cpu->running = true;
+        net->boards[i].stopped = false;
+        if (net->boards[i].cpu->cycle_count > start) {
+            start = net->boards[i].cpu->cycle_count;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > NET_MAX_THREADS) {
+        threads = NET_MAX_THREADS;
+    }
+
+    net->window_end = start;
+    net->limit = start + max_cycles;
+    net->arrived = 0;
+    net_run_workers(net, threads);
+
+    bool running = false;
+    for (int i = 0; i < net->board_count; i++) {
+        device_set_flush(net->boards[i].cpu->devices);
+        running = running || net->boards[i].cpu->running;
+    }
+    return running;
+}
+
+uint64_t net_digest(const net_t* net) {
+    uint64_t hash = 0;
+
+    for (int i = 0; i < net->board_count; i++) {
+        const cpu_state_t* cpu = net->boards[i].cpu;
+        hash = statehash_bytes(hash, cpu->regs, sizeof(cpu->regs));
+        hash = statehash_bytes(hash, &cpu->flags, sizeof(cpu->flags));
+        hash = statehash_bytes(hash, &cpu->cycle_count, sizeof(cpu->cycle_count));
+        hash = statehash_bytes(hash, &cpu->instruction_count, sizeof(cpu->instruction_count));
+        hash ^= statehash_mix(statehash_memory(cpu->memory, 0, cpu->memory_size) + (uint64_t)i);
+    }
+    return hash;
+}
+
+void net_print_topology(const net_t* net) {
+    printf("%d boards, %d links, %u-cycle windows\n", net->board_count, net->link_count, net->lookahead);
+    for (int i = 0; i < net->link_count; i++) {
+        const net_link_t* link = &net->links[i];
+        printf("  %s -> %s, %u cycles\n", net->boards[link->from].name, net->boards[link->to].name,
+               link->latency);
+    }
+}
+
+void net_print_status(net_t* net) {
+    for (int i = 0; i < net->board_count; i++) {
+        net_board_t* board = &net->boards[i];
+        const char* state = board->stopped ? "stopped" : board->cpu->running ? "running" : "halted";
+        printf("Board %s (%s): %s, Instructions: %u, Sent: %llu\n", board->name, state,
+               cpu_get_status_string(board->cpu), board->cpu->instruction_count,
+               (unsigned long long)(board->tx ? board->tx->bytes : 0));
+    }
+}
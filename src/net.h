@@ -0,0 +1,119 @@
+#ifndef NET_H
+#define NET_H
+
+#include "cpu.h"
+#include "machine.h"
+#include "uart_link.h"
+#include "uart_sink.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Worker threads need POSIX threads; elsewhere one thread runs every board
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define NET_THREADS 1
+#else
+#define NET_THREADS 0
+#endif
+
+// Networks of boards.
+// A topology file names the boards and the serial lines between them:
+//
+//   [net]            latency = CYCLES (default link latency),
+//                    baud = RATE (receive pacing)
+//   [board NAME]     machine = PATH (default: reference machine),
+//                    program = PATH, address = ADDRESS (default 0x0200),
+//                    output = SPEC (UART TX to the host, as cpu-sim --uart),
+//                    count = N (boards NAME0 .. NAME<N-1> alike)
+//   [link]           from = NAME, to = NAME, latency = CYCLES
+//   [ring PREFIX]    latency = CYCLES: PREFIX0 -> PREFIX1 -> ... -> PREFIX0
+//
+// A section for a board that already exists changes its settings. Paths
+// are relative to the topology file. A link carries UART TX of one board
+// to UART RX of another (see uart_link.h); a UART sends on at most one
+// link and receives from at most one.
+//
+// Every board runs on its own clock. The boards advance in windows of
+// the lookahead, the smallest link latency: a byte sent in a window is
+// due at its receiver no earlier than the end of that window, so within
+// a window the boards are independent and run in parallel on a pool of
+// host threads, which meet at a barrier between windows. Receivers see
+// bytes stamped before the current window's end only, so the results
+// are the same for any thread count. A halted board idles to the end of
+// the window and wakes at a window boundary when an interrupt is pending.
+
+#define NET_MAX_BOARDS 1024
+#define NET_MAX_THREADS 256
+#define NET_NAME_SIZE 32
+#define NET_DEFAULT_LATENCY 1000
+#define NET_DEFAULT_BAUD 115200
+#define NET_DEFAULT_ADDRESS 0x0200
+
+typedef struct {
+    char name[NET_NAME_SIZE];
+    char machine[MACHINE_PATH_SIZE];    // "" = reference machine
+    char program[MACHINE_PATH_SIZE];    // "" = none
+    char output[MACHINE_PATH_SIZE];     // "" = TX only goes to the link
+    uint16_t address;
+
+    machine_config_t* config;
+    cpu_state_t* cpu;
+    uart_sink_t* sink;
+    uart_link_t* tx;
+    uart_link_t* rx;
+    bool stopped;                       // Invalid opcode or breakpoint
+} net_board_t;
+
+typedef struct {
+    int from;
+    int to;
+    uint32_t latency;
+    uart_link_t* queue;
+} net_link_t;
+
+typedef struct net {
+    net_board_t* boards;
+    int board_count;
+    net_link_t* links;
+    int link_count;
+    uint32_t latency;
+    uint32_t baud;
+    uint32_t lookahead;                 // Window length in cycles
+
+    // Window barrier
+#if NET_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+#endif
+    int participants;
+    int arrived;
+    uint64_t generation;
+    int next_board;                     // Boards are claimed with an atomic increment
+    uint64_t window_end;
+    uint64_t limit;
+    uint64_t windows;
+    bool done;
+} net_t;
+
+// Parse a topology and create its boards and links; origin names it in
+// errors and relative paths start from its directory
+net_t* net_parse(const char* text, const char* origin);
+net_t* net_load(const char* path);
+void net_destroy(net_t* net);
+
+int net_find_board(const net_t* net, const char* name);
+
+// Load every board's program and start it at its address at cycle 0
+bool net_reset(net_t* net);
+
+// Run for max_cycles on the given number of host threads; true if a
+// board is still running
+bool net_run(net_t* net, uint64_t max_cycles, int threads);
+
+// Hash of every board's registers, clock and memory, for comparing runs
+uint64_t net_digest(const net_t* net);
+
+void net_print_topology(const net_t* net);
+void net_print_status(net_t* net);
+
+#endif // NET_H
@@ -0,0 +1,303 @@
+#include "object.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Copy length bytes of text into a new string
+static char* object_strndup(const char* text, size_t length) {
+    char* copy = malloc(length + 1);
+    if (copy) {
+        memcpy(copy, text, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+// Make room for one more entry in a growing array
+static bool object_reserve(void** items, int count, size_t item_size) {
+    // Capacities are the powers of two from 8, so a full array has a
+    // power-of-two count
+    if (count < 8 ? count > 0 : (count & (count - 1)) != 0) {
+        return true;
+    }
+    void* grown = realloc(*items, (size_t)(count < 8 ? 8 : count * 2) * item_size);
+    if (!grown) {
+        return false;
+    }
+    *items = grown;
+    return true;
+}
+
+object_t* object_create(const char* source) {
+    object_t* object = calloc(1, sizeof(object_t));
+    if (!object) {
+        return NULL;
+    }
+    object->source = object_strndup(source, strlen(source));
+    if (!object->source) {
+        free(object);
+        return NULL;
+    }
+    return object;
+}
+
+void object_destroy(object_t* object) {
+    if (!object) {
+        return;
+    }
+    for (int i = 0; i < object->section_count; i++) {
+        free(object->sections[i].name);
+        free(object->sections[i].data);
+    }
+    for (int i = 0; i < object->symbol_count; i++) {
+        free(object->symbols[i].name);
+    }
+    for (int i = 0; i < object->relocation_count; i++) {
+        free(object->relocations[i].expression);
+    }
+    free(object->sections);
+    free(object->symbols);
+    free(object->relocations);
+    free(object->source);
+    free(object);
+}
+
+object_section_t* object_add_section(object_t* object, const char* name, const uint8_t* data, uint32_t size) {
+    if (!object_reserve((void**)&object->sections, object->section_count, sizeof(object_section_t))) {
+        return NULL;
+    }
+    object_section_t* section = &object->sections[object->section_count];
+    memset(section, 0, sizeof(*section));
+    section->name = object_strndup(name, strlen(name));
+    section->data = malloc(size ? size : 1);
+    if (!section->name || !section->data) {
+        free(section->name);
+        free(section->data);
+        return NULL;
+    }
+    if (data) {
+        memcpy(section->data, data, size);
+    }
+    section->size = size;
+    object->section_count++;
+    return section;
+}
+
+object_symbol_t* object_add_symbol(object_t* object, const char* name, int section, uint16_t offset, bool global) {
+    if (!object_reserve((void**)&object->symbols, object->symbol_count, sizeof(object_symbol_t))) {
+        return NULL;
+    }
+    object_symbol_t* symbol = &object->symbols[object->symbol_count];
+    symbol->name = object_strndup(name, strlen(name));
+    if (!symbol->name) {
+        return NULL;
+    }
+    symbol->section = section;
+    symbol->offset = offset;
+    symbol->global = global;
+    object->symbol_count++;
+    return symbol;
+}
+
+object_relocation_t* object_add_relocation(object_t* object, int section, const char* expression, size_t length) {
+    if (!object_reserve((void**)&object->relocations, object->relocation_count, sizeof(object_relocation_t))) {
+        return NULL;
+    }
+    object_relocation_t* relocation = &object->relocations[object->relocation_count];
+    memset(relocation, 0, sizeof(*relocation));
+    relocation->expression = object_strndup(expression, length);
+    if (!relocation->expression) {
+        return NULL;
+    }
+    relocation->section = section;
+    relocation->width = 2;
+    object->relocation_count++;
+    return relocation;
+}
+
+// Little-endian writers
+static void object_put_u8(FILE* file, uint8_t value) {
+    fputc(value, file);
+}
+
+static void object_put_u16(FILE* file, uint16_t value) {
+    fputc(value & 0xFF, file);
+    fputc(value >> 8, file);
+}
+
+static void object_put_u32(FILE* file, uint32_t value) {
+    object_put_u16(file, value & 0xFFFF);
+    object_put_u16(file, value >> 16);
+}
+
+static void object_put_string(FILE* file, const char* text) {
+    size_t length = strlen(text);
+    object_put_u16(file, (uint16_t)length);
+    fwrite(text, 1, length, file);
+}
+
+bool object_save(const object_t* object, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    fwrite(OBJECT_MAGIC, 1, 4, file);
+    object_put_u16(file, OBJECT_VERSION);
+    object_put_string(file, object->source);
+
+    object_put_u16(file, (uint16_t)object->section_count);
+    for (int i = 0; i < object->section_count; i++) {
+        const object_section_t* section = &object->sections[i];
+        object_put_string(file, section->name);
+        object_put_u8(file, section->fixed);
+        object_put_u16(file, section->address);
+        object_put_u32(file, section->size);
+        fwrite(section->data, 1, section->size, file);
+    }
+
+    object_put_u32(file, (uint32_t)object->symbol_count);
+    for (int i = 0; i < object->symbol_count; i++) {
+        const object_symbol_t* symbol = &object->symbols[i];
+        object_put_string(file, symbol->name);
+        object_put_u16(file, (uint16_t)symbol->section);
+        object_put_u16(file, symbol->offset);
+        object_put_u8(file, symbol->global);
+    }
+
+    object_put_u32(file, (uint32_t)object->relocation_count);
+    for (int i = 0; i < object->relocation_count; i++) {
+        const object_relocation_t* relocation = &object->relocations[i];
+        object_put_u16(file, (uint16_t)relocation->section);
+        object_put_u16(file, relocation->offset);
+        object_put_u16(file, relocation->base);
+        object_put_u8(file, relocation->width);
+        object_put_u8(file, relocation->relative);
+        object_put_u32(file, (uint32_t)relocation->line);
+        object_put_string(file, relocation->expression);
+    }
+
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
+
+// Little-endian readers; a short read leaves the reader failed
+typedef struct {
+    FILE* file;
+    bool failed;
+} object_reader_t;
+
+static uint32_t object_get(object_reader_t* reader, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int c = fgetc(reader->file);
+        if (c == EOF) {
+            reader->failed = true;
+            return 0;
+        }
+        value |= (uint32_t)c << (8 * i);
+    }
+    return value;
+}
+
+// A string read into a new buffer, or NULL
+static char* object_get_string(object_reader_t* reader) {
+    size_t length = object_get(reader, 2);
+    char* text = reader->failed ? NULL : malloc(length + 1);
+    if (!text) {
+        reader->failed = true;
+        return NULL;
+    }
+    if (fread(text, 1, length, reader->file) != length) {
+        reader->failed = true;
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+object_t* object_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open object file\n", path);
+        return NULL;
+    }
+
+    object_reader_t reader = {file, false};
+    char magic[4];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, OBJECT_MAGIC, 4) != 0 ||
+        object_get(&reader, 2) != OBJECT_VERSION) {
+        fprintf(stderr, "%s: not an object file (or a different version)\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    char* source = object_get_string(&reader);
+    object_t* object = source ? object_create(source) : NULL;
+    free(source);
+
+    int sections = object ? (int)object_get(&reader, 2) : 0;
+    for (int i = 0; i < sections && !reader.failed; i++) {
+        char* name = object_get_string(&reader);
+        bool fixed = object_get(&reader, 1) != 0;
+        uint16_t address = (uint16_t)object_get(&reader, 2);
+        uint32_t size = object_get(&reader, 4);
+        object_section_t* section = name && !reader.failed && size <= 0x10000 ?
+                                    object_add_section(object, name, NULL, size) : NULL;
+        free(name);
+        if (!section || fread(section->data, 1, size, file) != size) {
+            reader.failed = true;
+            break;
+        }
+        section->fixed = fixed;
+        section->address = address;
+    }
+
+    uint32_t symbols = reader.failed || !object ? 0 : object_get(&reader, 4);
+    for (uint32_t i = 0; i < symbols && !reader.failed; i++) {
+        char* name = object_get_string(&reader);
+        int section = (int)object_get(&reader, 2);
+        uint16_t offset = (uint16_t)object_get(&reader, 2);
+        bool global = object_get(&reader, 1) != 0;
+        if (!name || reader.failed || section >= object->section_count ||
+            !object_add_symbol(object, name, section, offset, global)) {
+            reader.failed = true;
+        }
+        free(name);
+    }
+
+    uint32_t relocations = reader.failed || !object ? 0 : object_get(&reader, 4);
+    for (uint32_t i = 0; i < relocations && !reader.failed; i++) {
+        int section = (int)object_get(&reader, 2);
+        uint16_t offset = (uint16_t)object_get(&reader, 2);
+        uint16_t base = (uint16_t)object_get(&reader, 2);
+        uint8_t width = (uint8_t)object_get(&reader, 1);
+        bool relative = object_get(&reader, 1) != 0;
+        int line = (int)object_get(&reader, 4);
+        char* expression = object_get_string(&reader);
+        object_relocation_t* relocation = expression && !reader.failed && section < object->section_count &&
+                                          (width == 1 || width == 2) &&
+                                          offset + width <= object->sections[section].size ?
+                                          object_add_relocation(object, section, expression, strlen(expression)) :
+                                          NULL;
+        free(expression);
+        if (!relocation) {
+            reader.failed = true;
+            break;
+        }
+        relocation->offset = offset;
+        relocation->base = base;
+        relocation->width = width;
+        relocation->relative = relative;
+        relocation->line = line;
+    }
+
+    fclose(file);
+    if (!object || reader.failed) {
+        fprintf(stderr, "%s: truncated or corrupt object file\n", path);
+        object_destroy(object);
+        return NULL;
+    }
+    return object;
+}
@@ -0,0 +1,77 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Relocatable object files (asm -c), combined into an image by cpu-link.
+// An object holds the sections of one source module, its labels and a
+// relocation for every operand that refers to a label. A relocation keeps
+// its operand expression's source text: the linker evaluates it once every
+// section is placed, against the module's own labels first and then the
+// global labels of all modules, so any expression the assembler accepts
+// may name a label in another module.
+//
+// File layout, little-endian; a string is a u16 length and its bytes:
+//
+//   "SBCO", u16 version, string source
+//   u16 sections     { string name, u8 fixed, u16 address, u32 size, bytes }
+//   u32 symbols      { string name, u16 section, u16 offset, u8 global }
+//   u32 relocations  { u16 section, u16 offset, u16 base, u8 width,
+//                      u8 relative, u32 line, string expression }
+//
+// A section placed with .org is fixed at its address; the others are
+// placed by the linker. Symbol offsets, relocation offsets and relative
+// bases count from the start of their section.
+
+#define OBJECT_MAGIC "SBCO"
+#define OBJECT_VERSION 1
+
+typedef struct {
+    char* name;
+    uint8_t* data;
+    uint32_t size;
+    bool fixed;
+    uint16_t address;           // Fixed sections only
+} object_section_t;
+
+typedef struct {
+    char* name;
+    int section;
+    uint16_t offset;
+    bool global;                // .global: visible to other modules
+} object_symbol_t;
+
+typedef struct {
+    int section;
+    uint16_t offset;            // Operand position
+    uint16_t base;              // Relative: position the branch counts from
+    uint8_t width;              // 1 or 2 bytes
+    bool relative;
+    int line;                   // Source line, for messages
+    char* expression;
+} object_relocation_t;
+
+typedef struct {
+    char* source;               // Source file name, for messages
+    object_section_t* sections;
+    int section_count;
+    object_symbol_t* symbols;
+    int symbol_count;
+    object_relocation_t* relocations;
+    int relocation_count;
+} object_t;
+
+object_t* object_create(const char* source);
+void object_destroy(object_t* object);
+
+// Building an object; each returns the new entry or NULL when out of memory
+object_section_t* object_add_section(object_t* object, const char* name, const uint8_t* data, uint32_t size);
+object_symbol_t* object_add_symbol(object_t* object, const char* name, int section, uint16_t offset, bool global);
+object_relocation_t* object_add_relocation(object_t* object, int section, const char* expression, size_t length);
+
+bool object_save(const object_t* object, const char* path);
+object_t* object_load(const char* path);
+
+#endif // OBJECT_H
@@ -0,0 +1,447 @@
+#include "recomp.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+// Per-address decode flags used while recovering the control flow graph
+#define RECOMP_CODE    0x01  // An instruction starts here
+#define RECOMP_LEADER  0x02  // A basic block starts here
+#define RECOMP_VISITED 0x04  // Block has been decoded
+
+// FNV-1a checksum used to tie a native module to the image it was built from
+uint32_t recomp_checksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Opcodes the generator can translate. This mirrors the cases implemented by
+// isa_execute_instruction; anything else is left to the interpreter.
+static bool recomp_is_translatable(uint8_t opcode) {
+    switch (opcode) {
+        case OP_LDI: case OP_LDA: case OP_STA: case OP_MOV:
+        case OP_ADD: case OP_SUB: case OP_CMP: case OP_INC: case OP_DEC:
+        case OP_AND: case OP_OR: case OP_XOR:
+        case OP_JMP: case OP_JSR: case OP_RTS:
+        case OP_BEQ: case OP_BNE: case OP_BCS: case OP_BCC:
+        case OP_PHA: case OP_PLA: case OP_PHP: case OP_PLP:
+        case OP_PUSH: case OP_POP:
+        case OP_SEI: case OP_CLI: case OP_NOP: case OP_HLT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions that end a basic block
+static bool recomp_ends_block(uint8_t opcode) {
+    switch (opcode) {
+        case OP_JMP: case OP_JSR: case OP_RTS: case OP_HLT:
+        case OP_BEQ: case OP_BNE: case OP_BCS: case OP_BCC:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool recomp_in_image(uint32_t address, uint32_t length, uint16_t load_address, size_t image_size) {
+    return address >= load_address && address + length <= load_address + image_size;
+}
+
+static const char* recomp_branch_flag(uint8_t opcode) {
+    switch (opcode) {
+        case OP_BEQ: return "isa_get_flag(cpu, FLAG_ZERO)";
+        case OP_BNE: return "!isa_get_flag(cpu, FLAG_ZERO)";
+        case OP_BCS: return "isa_get_flag(cpu, FLAG_CARRY)";
+        default:     return "!isa_get_flag(cpu, FLAG_CARRY)";
+    }
+}
+
+// Helpers emitted at the top of every translation unit. They repeat the
+// flag semantics of isa_execute_instruction so both engines agree exactly.
+static const char* recomp_prelude =
+    "#include \"isa.h\"\n"
+    "#include \"recomp.h\"\n"
+    "\n"
+    "#define RC_RETIRE(cpu, n) ((cpu)->cycle_count += (n), (cpu)->instruction_count++)\n"
+    "\n"
+    "static void rc_add(cpu_state_t* cpu, uint8_t value) {\n"
+    "    uint8_t a = isa_get_register(cpu, REG_A);\n"
+    "    uint16_t result = a + value;\n"
+    "    bool overflow = ((a ^ result) & (value ^ result) & 0x80) != 0;\n"
+    "    isa_set_register(cpu, REG_A, result & 0xFF);\n"
+    "    isa_update_flags(cpu, result & 0xFF, result > 0xFF, overflow);\n"
+    "}\n"
+    "\n"
+    "static void rc_sub(cpu_state_t* cpu, uint8_t value, bool store) {\n"
+    "    uint8_t a = isa_get_register(cpu, REG_A);\n"
+    "    uint16_t result = a - value;\n"
+    "    bool overflow = ((a ^ result) & (value ^ result) & 0x80) != 0;\n"
+    "    if (store) {\n"
+    "        isa_set_register(cpu, REG_A, result & 0xFF);\n"
+    "    }\n"
+    "    isa_update_flags(cpu, result & 0xFF, a < value, overflow);\n"
+    "}\n"
+    "\n"
+    "static void rc_logic(cpu_state_t* cpu, uint8_t result) {\n"
+    "    isa_set_register(cpu, REG_A, result);\n"
+    "    isa_update_flags(cpu, result, false, false);\n"
+    "}\n"
+    "\n"
+    "static void rc_step_register(cpu_state_t* cpu, register_t reg, int delta) {\n"
+    "    uint8_t value = isa_get_register(cpu, reg) + delta;\n"
+    "    isa_set_register(cpu, reg, value);\n"
+    "    isa_update_flags(cpu, value, false, false);\n"
+    "}\n"
+    "\n";
+
+// Emit the C statements for one instruction
+static void recomp_emit_instruction(FILE* out, const uint8_t* memory, uint16_t pc) {
+    uint8_t opcode = memory[pc];
+    uint8_t op1 = memory[(uint16_t)(pc + 1)];
+    uint8_t op2 = memory[(uint16_t)(pc + 2)];
+    uint16_t abs = op1 | (op2 << 8);
+    uint16_t next = pc + isa_get_length((opcode_t)opcode);
+
+    fprintf(out, "    /* %04X: %s */\n", pc, isa_get_mnemonic((opcode_t)opcode));
+
+    switch (opcode) {
+        case OP_LDI:
+            fprintf(out, "    isa_set_register(cpu, REG_A, 0x%02X);\n", op1);
+            break;
+        case OP_LDA:
+            fprintf(out, "    isa_set_register(cpu, REG_A, isa_read_memory(cpu, 0x%04X));\n", abs);
+            break;
+        case OP_STA:
+            fprintf(out, "    isa_write_memory(cpu, 0x%04X, isa_get_register(cpu, REG_A));\n", abs);
+            break;
+        case OP_MOV:
+            fprintf(out, "    isa_set_register(cpu, REG_A, isa_get_register(cpu, (register_t)%u));\n", op1);
+            break;
+        case OP_ADD:
+            fprintf(out, "    rc_add(cpu, 0x%02X);\n", op1);
+            break;
+        case OP_SUB:
+            fprintf(out, "    rc_sub(cpu, 0x%02X, true);\n", op1);
+            break;
+        case OP_CMP:
+            fprintf(out, "    rc_sub(cpu, 0x%02X, false);\n", op1);
+            break;
+        case OP_INC:
+            fprintf(out, "    rc_step_register(cpu, (register_t)%u, 1);\n", op1);
+            break;
+        case OP_DEC:
+            fprintf(out, "    rc_step_register(cpu, (register_t)%u, -1);\n", op1);
+            break;
+        case OP_AND:
+            fprintf(out, "    rc_logic(cpu, isa_get_register(cpu, REG_A) & 0x%02X);\n", op1);
+            break;
+        case OP_OR:
+            fprintf(out, "    rc_logic(cpu, isa_get_register(cpu, REG_A) | 0x%02X);\n", op1);
+            break;
+        case OP_XOR:
+            fprintf(out, "    rc_logic(cpu, isa_get_register(cpu, REG_A) ^ 0x%02X);\n", op1);
+            break;
+        case OP_JMP:
+            fprintf(out, "    isa_set_register16(cpu, REG_PC, 0x%04X);\n", abs);
+            break;
+        case OP_JSR:
+            fprintf(out, "    isa_push16(cpu, 0x%04X);\n", next);
+            fprintf(out, "    isa_set_register16(cpu, REG_PC, 0x%04X);\n", abs);
+            break;
+        case OP_RTS:
+            fprintf(out, "    isa_set_register16(cpu, REG_PC, isa_pop16(cpu));\n");
+            break;
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BCS:
+        case OP_BCC:
+            fprintf(out, "    isa_set_register16(cpu, REG_PC, %s ? 0x%04X : 0x%04X);\n",
+                    recomp_branch_flag(opcode), (uint16_t)(next + (int8_t)op1), next);
+            break;
+        case OP_PHA:
+            fprintf(out, "    isa_push(cpu, isa_get_register(cpu, REG_A));\n");
+            break;
+        case OP_PLA:
+            fprintf(out, "    isa_set_register(cpu, REG_A, isa_pop(cpu));\n");
+            break;
+        case OP_PHP:
+            fprintf(out, "    isa_push(cpu, cpu->flags);\n");
+            break;
+        case OP_PLP:
+            fprintf(out, "    cpu->flags = isa_pop(cpu);\n");
+            break;
+        case OP_PUSH:
+            fprintf(out, "    isa_push(cpu, isa_get_register(cpu, (register_t)%u));\n", op1);
+            break;
+        case OP_POP:
+            fprintf(out, "    isa_set_register(cpu, (register_t)%u, isa_pop(cpu));\n", op1);
+            break;
+        case OP_SEI:
+            fprintf(out, "    isa_set_flag(cpu, FLAG_INTERRUPT);\n");
+            break;
+        case OP_CLI:
+            fprintf(out, "    isa_clear_flag(cpu, FLAG_INTERRUPT);\n");
+            break;
+        case OP_HLT:
+            fprintf(out, "    isa_halt(cpu);\n");
+            fprintf(out, "    isa_set_register16(cpu, REG_PC, 0x%04X);\n", next);
+            break;
+        default:
+            // NOP
+            break;
+    }
+
+    fprintf(out, "    RC_RETIRE(cpu, %u);\n", isa_get_cycles((opcode_t)opcode));
+}
+
+// Recover the control flow graph by recursive descent from the entry point
+// and the NMI/reset/IRQ vectors, marking instruction starts and block leaders.
+static void recomp_discover(const uint8_t* memory, uint16_t load_address, size_t image_size,
+                            uint16_t entry_address, uint8_t* flags) {
+    uint16_t* worklist = malloc(MEMORY_SIZE * 2 * sizeof(uint16_t));
+    size_t pending = 0;
+    if (!worklist) {
+        return;
+    }
+
+    worklist[pending++] = entry_address;
+    for (uint32_t vector = 0xFFFA; vector < MEMORY_SIZE; vector += 2) {
+        worklist[pending++] = memory[vector] | (memory[vector + 1] << 8);
+    }
+
+    while (pending > 0) {
+        uint16_t pc = worklist[--pending];
+        if (flags[pc] & RECOMP_VISITED) {
+            continue;
+        }
+        if (!recomp_in_image(pc, 1, load_address, image_size) || !recomp_is_translatable(memory[pc])) {
+            continue;
+        }
+        flags[pc] |= RECOMP_LEADER | RECOMP_VISITED;
+
+        while (recomp_in_image(pc, 1, load_address, image_size)) {
+            uint8_t opcode = memory[pc];
+            uint8_t length = isa_get_length((opcode_t)opcode);
+            if (!recomp_is_translatable(opcode) || !recomp_in_image(pc, length, load_address, image_size)) {
+                break;
+            }
+            flags[pc] |= RECOMP_CODE;
+
+            uint16_t next = pc + length;
+            if (recomp_ends_block(opcode)) {
+                uint16_t target = memory[(uint16_t)(pc + 1)] | (memory[(uint16_t)(pc + 2)] << 8);
+                if (opcode == OP_JMP || opcode == OP_JSR) {
+                    worklist[pending++] = target;
+                } else if (opcode != OP_RTS && opcode != OP_HLT) {
+                    worklist[pending++] = next + (int8_t)memory[(uint16_t)(pc + 1)];
+                }
+                if (opcode != OP_JMP && opcode != OP_RTS && opcode != OP_HLT) {
+                    // Branch fall-through, or the return site of a subroutine call
+                    worklist[pending++] = next;
+                }
+                break;
+            }
+
+            pc = next;
+            if (flags[pc] & RECOMP_VISITED) {
+                break;
+            }
+        }
+
+        // Each decoded instruction pushes at most two entries
+        if (pending > MEMORY_SIZE * 2 - 4) {
+            break;
+        }
+    }
+
+    free(worklist);
+}
+
+// Generate a C translation unit with one function per basic block.
+// Returns the number of blocks emitted, or -1 on error.
+int recomp_generate(const uint8_t* memory, uint16_t load_address, size_t image_size,
+                    uint16_t entry_address, FILE* out) {
+    if (image_size == 0 || load_address + image_size > MEMORY_SIZE) {
+        return -1;
+    }
+
+    uint8_t* flags = calloc(MEMORY_SIZE, 1);
+    if (!flags) {
+        return -1;
+    }
+
+    recomp_discover(memory, load_address, image_size, entry_address, flags);
+
+    fprintf(out, "/* Generated by cpu-recomp: image 0x%04X..0x%04X, entry 0x%04X. Do not edit. */\n",
+            load_address, (unsigned)(load_address + image_size - 1), entry_address);
+    fputs(recomp_prelude, out);
+
+    int block_count = 0;
+    for (uint32_t start = 0; start < MEMORY_SIZE; start++) {
+        if (!(flags[start] & RECOMP_LEADER)) {
+            continue;
+        }
+
+        fprintf(out, "static bool block_%04X(cpu_state_t* cpu) {\n", start);
+        uint16_t pc = start;
+        while (true) {
+            uint8_t opcode = memory[pc];
+            if (pc != start && (flags[pc] & RECOMP_LEADER)) {
+                // Fall through into the next block
+                fprintf(out, "    isa_set_register16(cpu, REG_PC, 0x%04X);\n", pc);
+                break;
+            }
+            if (!(flags[pc] & RECOMP_CODE)) {
+                // Untranslated code: the interpreter takes over from here
+                fprintf(out, "    isa_set_register16(cpu, REG_PC, 0x%04X);\n", pc);
+                break;
+            }
+
+            recomp_emit_instruction(out, memory, pc);
+            if (recomp_ends_block(opcode)) {
+                break;
+            }
+            pc += isa_get_length((opcode_t)opcode);
+        }
+        fprintf(out, "    return true;\n}\n\n");
+        block_count++;
+    }
+
+    fprintf(out, "bool recomp_execute(cpu_state_t* cpu) {\n");
+    fprintf(out, "    switch (isa_get_register16(cpu, REG_PC)) {\n");
+    for (uint32_t start = 0; start < MEMORY_SIZE; start++) {
+        if (flags[start] & RECOMP_LEADER) {
+            fprintf(out, "        case 0x%04X: return block_%04X(cpu);\n", start, start);
+        }
+    }
+    fprintf(out, "        default: return false;\n");
+    fprintf(out, "    }\n}\n\n");
+
+    fprintf(out, "const recomp_info_t recomp_info = {\n");
+    fprintf(out, "    %d, 0x%04X, 0x%04X, %u, 0x%08Xu, %d, sizeof(cpu_state_t)\n",
+            RECOMP_ABI_VERSION, load_address, entry_address, (unsigned)image_size,
+            recomp_checksum(&memory[load_address], image_size), block_count);
+    fprintf(out, "};\n");
+
+    free(flags);
+    return block_count;
+}
+
+// Load a native module compiled from recomp_generate output
+recomp_module_t* recomp_load(const char* path) {
+    recomp_module_t* module = calloc(1, sizeof(recomp_module_t));
+    if (!module) {
+        return NULL;
+    }
+
+#ifdef _WIN32
+    HMODULE handle = LoadLibraryA(path);
+    if (!handle) {
+        fprintf(stderr, "Failed to load native module %s\n", path);
+        free(module);
+        return NULL;
+    }
+    module->handle = handle;
+    module->info = (const recomp_info_t*)GetProcAddress(handle, RECOMP_INFO_SYMBOL);
+    module->execute = (recomp_execute_fn)GetProcAddress(handle, RECOMP_EXECUTE_SYMBOL);
+#else
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Failed to load native module %s: %s\n", path, dlerror());
+        free(module);
+        return NULL;
+    }
+    module->handle = handle;
+    module->info = (const recomp_info_t*)dlsym(handle, RECOMP_INFO_SYMBOL);
+    *(void**)(&module->execute) = dlsym(handle, RECOMP_EXECUTE_SYMBOL);
+#endif
+
+    if (!module->info || !module->execute) {
+        fprintf(stderr, "%s is not a native CPU module\n", path);
+        recomp_unload(module);
+        return NULL;
+    }
+
+    if (module->info->abi_version != RECOMP_ABI_VERSION) {
+        fprintf(stderr, "%s was built for module ABI %u (expected %d)\n",
+                path, module->info->abi_version, RECOMP_ABI_VERSION);
+        recomp_unload(module);
+        return NULL;
+    }
+    if (module->info->state_size != sizeof(cpu_state_t)) {
+        fprintf(stderr, "%s was built for a %u-byte CPU state (expected %u)\n",
+                path, module->info->state_size, (unsigned)sizeof(cpu_state_t));
+        recomp_unload(module);
+        return NULL;
+    }
+
+    return module;
+}
+
+// Unload a native module
+void recomp_unload(recomp_module_t* module) {
+    if (module) {
+        if (module->handle) {
+#ifdef _WIN32
+            FreeLibrary((HMODULE)module->handle);
+#else
+            dlclose(module->handle);
+#endif
+        }
+        free(module);
+    }
+}
+
+// Check that memory holds the image the module was translated from
+bool recomp_matches_image(const recomp_module_t* module, const uint8_t* memory) {
+    const recomp_info_t* info = module->info;
+    if (info->load_address + info->image_size > MEMORY_SIZE) {
+        return false;
+    }
+    return recomp_checksum(&memory[info->load_address], info->image_size) == info->image_checksum;
+}
+
+// Run like cpu_run, executing translated blocks natively. Interrupts are
+// sampled at block boundaries; untranslated code goes through cpu_step.
+bool recomp_run(recomp_module_t* module, cpu_state_t* cpu, uint64_t max_cycles) {
+    cpu->running = true;
+    uint64_t start_cycles = cpu->cycle_count;
+
+    while (cpu->running && (cpu->cycle_count - start_cycles) < max_cycles) {
+        // Breakpoints and tracing need instruction granularity
+        if (cpu->trace_enabled || cpu->breakpoint_addr != 0) {
+            if (!cpu_step(cpu)) {
+                break;
+            }
+        } else {
+            cpu_handle_interrupts(cpu);
+            if (module->execute(cpu)) {
+                module->native_blocks++;
+                cpu_poll_devices(cpu);
+            } else {
+                module->fallback_steps++;
+                if (!cpu_step(cpu)) {
+                    break;
+                }
+            }
+        }
+
+        cpu_throttle(cpu);
+    }
+
+    if (cpu->devices) {
+        device_set_flush(cpu->devices);
+    }
+    return cpu->running;
+}
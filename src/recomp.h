@@ -0,0 +1,52 @@
+#ifndef RECOMP_H
+#define RECOMP_H
+
+#include "isa.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Native module ABI. Bump when the generated code or cpu_state_t layout
+// changes; a module also records the cpu_state_t size it was compiled
+// against, so a layout change that missed the bump is still refused.
+#define RECOMP_ABI_VERSION 7
+#define RECOMP_INFO_SYMBOL "recomp_info"
+#define RECOMP_EXECUTE_SYMBOL "recomp_execute"
+
+// Describes the image a native module was generated from
+typedef struct {
+    uint32_t abi_version;
+    uint16_t load_address;
+    uint16_t entry_address;
+    uint32_t image_size;
+    uint32_t image_checksum;
+    uint32_t block_count;
+    uint32_t state_size;        // sizeof(cpu_state_t) in the module
+} recomp_info_t;
+
+// Runs one translated basic block starting at the current PC.
+// Returns false without touching the CPU if the PC is not translated.
+typedef bool (*recomp_execute_fn)(cpu_state_t* cpu);
+
+// Loaded native module
+typedef struct {
+    void* handle;
+    const recomp_info_t* info;
+    recomp_execute_fn execute;
+    uint64_t native_blocks;
+    uint64_t fallback_steps;
+} recomp_module_t;
+
+// Translation (offline)
+uint32_t recomp_checksum(const uint8_t* data, size_t size);
+int recomp_generate(const uint8_t* memory, uint16_t load_address, size_t image_size,
+                    uint16_t entry_address, FILE* out);
+
+// Loading and execution
+recomp_module_t* recomp_load(const char* path);
+void recomp_unload(recomp_module_t* module);
+bool recomp_matches_image(const recomp_module_t* module, const uint8_t* memory);
+bool recomp_run(recomp_module_t* module, cpu_state_t* cpu, uint64_t max_cycles);
+
+#endif // RECOMP_H
@@ -3,13 +3,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdarg.h>
+#include "statehash.h"
+#include "lockstep.h"
 
 // Simple CPU state
 typedef struct {
-    uint8_t regs[8];      // A, B, C, D, X, Y, SP, PC
+    uint8_t regs[8];      // A, B, C, D; X/Y alias A-D; SP in 4-5, PC in 6-7
     uint8_t flags;        // Status flags
     uint8_t* memory;      // 64KB memory
+    uint64_t memory_hash; // Incremental memory hash (see statehash.h)
     bool running;
+    bool trace_enabled;
     uint64_t cycle_count;
 } simple_cpu_t;
 
@@ -32,6 +37,8 @@ typedef struct {
 // Memory size
 #define MEMORY_SIZE 65536
 
+void simple_cpu_set_register16(simple_cpu_t* cpu, int reg, uint16_t value);
+
 // Simple CPU functions
 simple_cpu_t* simple_cpu_create(void) {
     simple_cpu_t* cpu = malloc(sizeof(simple_cpu_t));
@@ -46,15 +53,15 @@ simple_cpu_t* simple_cpu_create(void) {
     // Initialize
     memset(cpu->regs, 0, sizeof(cpu->regs));
     memset(cpu->memory, 0, MEMORY_SIZE);
+    cpu->memory_hash = statehash_memory(cpu->memory, 0, MEMORY_SIZE);
     cpu->flags = 0;
     cpu->running = false;
+    cpu->trace_enabled = true;
     cpu->cycle_count = 0;
     
     // Set initial PC and SP
-    cpu->regs[REG_PC] = 0xFC;  // Low byte
-    cpu->regs[REG_PC + 1] = 0xFF;  // High byte (0xFFFC)
-    cpu->regs[REG_SP] = 0xFF;  // Low byte
-    cpu->regs[REG_SP + 1] = 0x7F;  // High byte (0x7FFF)
+    simple_cpu_set_register16(cpu, REG_PC, 0xFFFC);
+    simple_cpu_set_register16(cpu, REG_SP, 0x7FFF);
     
     return cpu;
 }
@@ -73,10 +80,8 @@ void simple_cpu_reset(simple_cpu_t* cpu) {
     cpu->cycle_count = 0;
     
     // Set initial PC and SP
-    cpu->regs[REG_PC] = 0xFC;
-    cpu->regs[REG_PC + 1] = 0xFF;
-    cpu->regs[REG_SP] = 0xFF;
-    cpu->regs[REG_SP + 1] = 0x7F;
+    simple_cpu_set_register16(cpu, REG_PC, 0xFFFC);
+    simple_cpu_set_register16(cpu, REG_SP, 0x7FFF);
 }
 
 uint8_t simple_cpu_get_register(simple_cpu_t* cpu, int reg) {
@@ -113,6 +118,7 @@ uint8_t simple_cpu_read_memory(simple_cpu_t* cpu, uint16_t address) {
 
 void simple_cpu_write_memory(simple_cpu_t* cpu, uint16_t address, uint8_t value) {
     if (address < MEMORY_SIZE) {
+        statehash_update(&cpu->memory_hash, address, cpu->memory[address], value);
         cpu->memory[address] = value;
     }
 }
@@ -134,6 +140,18 @@ void simple_cpu_print_status(simple_cpu_t* cpu) {
     printf("  Cycles = %llu\n", (unsigned long long)cpu->cycle_count);
 }
 
+// Print an execution trace line when tracing is on
+static void simple_trace(simple_cpu_t* cpu, const char* format, ...) {
+    if (!cpu->trace_enabled) {
+        return;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
 // Simple instruction execution
 bool simple_cpu_step(simple_cpu_t* cpu) {
     if (!cpu->running) return false;
@@ -141,7 +159,7 @@ bool simple_cpu_step(simple_cpu_t* cpu) {
     uint16_t pc = simple_cpu_get_register16(cpu, REG_PC);
     uint8_t opcode = simple_cpu_read_memory(cpu, pc);
     
-    printf("Executing opcode 0x%02X at PC=0x%04X\n", opcode, pc);
+    simple_trace(cpu, "Executing opcode 0x%02X at PC=0x%04X\n", opcode, pc);
     
     // Simple instruction set
     switch (opcode) {
@@ -150,7 +168,7 @@ bool simple_cpu_step(simple_cpu_t* cpu) {
                 uint8_t value = simple_cpu_read_memory(cpu, pc + 1);
                 simple_cpu_set_register(cpu, REG_A, value);
                 simple_cpu_set_register16(cpu, REG_PC, pc + 2);
-                printf("  LDI #0x%02X\n", value);
+                simple_trace(cpu, "  LDI #0x%02X\n", value);
             }
             break;
             
@@ -162,7 +180,7 @@ bool simple_cpu_step(simple_cpu_t* cpu) {
                 uint8_t value = simple_cpu_read_memory(cpu, addr);
                 simple_cpu_set_register(cpu, REG_A, value);
                 simple_cpu_set_register16(cpu, REG_PC, pc + 3);
-                printf("  LDA [0x%04X] = 0x%02X\n", addr, value);
+                simple_trace(cpu, "  LDA [0x%04X] = 0x%02X\n", addr, value);
             }
             break;
             
@@ -174,18 +192,18 @@ bool simple_cpu_step(simple_cpu_t* cpu) {
                 uint8_t value = simple_cpu_get_register(cpu, REG_A);
                 simple_cpu_write_memory(cpu, addr, value);
                 simple_cpu_set_register16(cpu, REG_PC, pc + 3);
-                printf("  STA [0x%04X] = 0x%02X\n", addr, value);
+                simple_trace(cpu, "  STA [0x%04X] = 0x%02X\n", addr, value);
             }
             break;
             
         case 0x73: // HLT (Halt)
             cpu->running = false;
             simple_cpu_set_register16(cpu, REG_PC, pc + 1);
-            printf("  HLT\n");
+            simple_trace(cpu, "  HLT\n");
             break;
             
         default:
-            printf("  Unknown opcode: 0x%02X\n", opcode);
+            simple_trace(cpu, "  Unknown opcode: 0x%02X\n", opcode);
             cpu->running = false;
             return false;
     }
@@ -215,6 +233,103 @@ bool simple_cpu_load_program(simple_cpu_t* cpu, const uint8_t* program, size_t s
     return true;
 }
 
+// Lockstep engine adapter (see lockstep.h)
+static void* simple_engine_create(void) {
+    simple_cpu_t* cpu = simple_cpu_create();
+    if (cpu) {
+        cpu->trace_enabled = false;
+    }
+    return cpu;
+}
+
+static void simple_engine_destroy(void* engine) {
+    simple_cpu_destroy(engine);
+}
+
+static void simple_engine_start(void* engine, const uint8_t* image, uint16_t entry) {
+    simple_cpu_t* cpu = engine;
+    simple_cpu_reset(cpu);
+    memcpy(cpu->memory, image, MEMORY_SIZE);
+    cpu->memory_hash = statehash_memory(cpu->memory, 0, MEMORY_SIZE);
+    simple_cpu_set_register16(cpu, REG_PC, entry);
+    cpu->running = true;
+}
+
+static bool simple_engine_step(void* engine) {
+    return simple_cpu_step(engine);
+}
+
+static void simple_engine_get_registers(void* engine, lockstep_regs_t* regs) {
+    simple_cpu_t* cpu = engine;
+    memcpy(regs->regs, cpu->regs, sizeof(regs->regs));
+    regs->flags = cpu->flags;
+    regs->running = cpu->running;
+}
+
+static uint8_t simple_engine_read_memory(void* engine, uint16_t address) {
+    return simple_cpu_read_memory(engine, address);
+}
+
+static uint64_t simple_engine_memory_hash(void* engine) {
+    return ((simple_cpu_t*)engine)->memory_hash;
+}
+
+static void* simple_engine_snapshot(void* engine) {
+    simple_cpu_t* cpu = engine;
+    simple_cpu_t* copy = malloc(sizeof(simple_cpu_t));
+    if (!copy) return NULL;
+    
+    *copy = *cpu;
+    copy->memory = malloc(MEMORY_SIZE);
+    if (!copy->memory) {
+        free(copy);
+        return NULL;
+    }
+    memcpy(copy->memory, cpu->memory, MEMORY_SIZE);
+    return copy;
+}
+
+static bool simple_engine_save(void* engine, void* snapshot) {
+    simple_cpu_t* cpu = engine;
+    simple_cpu_t* copy = snapshot;
+    uint8_t* memory = copy->memory;
+    
+    *copy = *cpu;
+    copy->memory = memory;
+    memcpy(copy->memory, cpu->memory, MEMORY_SIZE);
+    return true;
+}
+
+static void simple_engine_restore(void* engine, const void* snapshot) {
+    simple_cpu_t* cpu = engine;
+    const simple_cpu_t* saved = snapshot;
+    uint8_t* memory = cpu->memory;
+    
+    *cpu = *saved;
+    cpu->memory = memory;
+    memcpy(cpu->memory, saved->memory, MEMORY_SIZE);
+}
+
+static void simple_engine_free_snapshot(void* snapshot) {
+    simple_cpu_destroy(snapshot);
+}
+
+const lockstep_engine_t lockstep_simple_engine = {
+    "simple",
+    simple_engine_create,
+    simple_engine_destroy,
+    simple_engine_start,
+    simple_engine_step,
+    simple_engine_get_registers,
+    simple_engine_read_memory,
+    simple_engine_memory_hash,
+    simple_engine_snapshot,
+    simple_engine_save,
+    simple_engine_restore,
+    simple_engine_free_snapshot
+};
+
+#ifndef SIMPLE_CPU_NO_MAIN
 // Interactive mode
 void simple_cpu_interactive(simple_cpu_t* cpu) {
     char line[256];
@@ -363,4 +478,4 @@ int main(int argc, char* argv[]) {
     simple_cpu_destroy(cpu);
     return 0;
 }
-
+#endif // SIMPLE_CPU_NO_MAIN
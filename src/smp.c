@@ -0,0 +1,341 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "smp.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void smp_next_quantum(smp_machine_t* smp);
+
+#if SMP_THREADS
+
+static void smp_locks_init(smp_machine_t* smp) {
+    // Recursive: DMA run by core 0 holds the bus, and its byte path can
+    // reach device registers through the same bus
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&smp->bus, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&smp->lock, NULL);
+    pthread_cond_init(&smp->turn, NULL);
+}
+
+static void smp_locks_destroy(smp_machine_t* smp) {
+    pthread_cond_destroy(&smp->turn);
+    pthread_mutex_destroy(&smp->lock);
+    pthread_mutex_destroy(&smp->bus);
+}
+
+static void smp_bus_lock(smp_machine_t* smp) {
+    pthread_mutex_lock(&smp->bus);
+}
+
+static void smp_bus_unlock(smp_machine_t* smp) {
+    pthread_mutex_unlock(&smp->bus);
+}
+
+#else
+
+// One host thread runs every core, so the bus needs no lock
+static void smp_locks_init(smp_machine_t* smp) {
+    (void)smp;
+}
+
+static void smp_locks_destroy(smp_machine_t* smp) {
+    (void)smp;
+}
+
+static void smp_bus_lock(smp_machine_t* smp) {
+    (void)smp;
+}
+
+static void smp_bus_unlock(smp_machine_t* smp) {
+    (void)smp;
+}
+
+#endif
+
+smp_machine_t* smp_create(cpu_state_t* boot, int cores, uint32_t quantum, smp_schedule_t schedule) {
+    if (cores < 2 || cores > SMP_MAX_CORES) {
+        fprintf(stderr, "An SMP machine has 2 to %d cores\n", SMP_MAX_CORES);
+        return NULL;
+    }
+
+    smp_machine_t* smp = calloc(1, sizeof(smp_machine_t));
+    if (!smp) {
+        return NULL;
+    }
+
+    smp_locks_init(smp);
+    if (schedule == SMP_SCHEDULE_THREADS && !SMP_THREADS) {
+        fprintf(stderr, "Core threads are not supported on this platform; running the cores round-robin\n");
+        schedule = SMP_SCHEDULE_ROUND_ROBIN;
+    }
+
+    smp->quantum = quantum ? quantum : SMP_DEFAULT_QUANTUM;
+    smp->schedule = schedule;
+    smp->cores[0] = boot;
+    smp->core_count = 1;
+
+    // The new cores start as copies of the boot CPU, sharing its memory,
+    // devices, cycle table and clock
+    cpu_enable_state_hash(boot, false);
+    for (int i = 1; i < cores; i++) {
+        cpu_state_t* core = malloc(sizeof(cpu_state_t));
+        if (!core) {
+            smp_destroy(smp);
+            return NULL;
+        }
+        *core = *boot;
+        core->owns_devices = false;
+        smp->cores[smp->core_count++] = core;
+    }
+
+    for (int i = 0; i < cores; i++) {
+        smp->cores[i]->smp = smp;
+        smp->cores[i]->core_id = (uint8_t)i;
+    }
+    boot->devices->ipi.cores = (uint8_t)cores;
+    return smp;
+}
+
+// Detach the boot CPU and free the other cores
+void smp_destroy(smp_machine_t* smp) {
+    if (!smp) {
+        return;
+    }
+
+    cpu_state_t* boot = smp->cores[0];
+    for (int i = 1; i < smp->core_count; i++) {
+        free(smp->cores[i]);
+    }
+    boot->smp = NULL;
+    boot->core_id = 0;
+    boot->devices->ipi.cores = 1;
+
+    smp_locks_destroy(smp);
+    free(smp);
+}
+
+void smp_reset_to_address(smp_machine_t* smp, uint16_t address) {
+    cpu_reset_to_address(smp->cores[0], address);
+
+    // The device timebase was rebased with core 0
+    for (int i = 1; i < smp->core_count; i++) {
+        cpu_state_t* core = smp->cores[i];
+        memset(core->regs, 0, sizeof(core->regs));
+        isa_set_register16(core, REG_PC, address);
+        core->flags = 0;
+        core->running = false;
+        core->irq_pending = false;
+        core->nmi_pending = false;
+        core->cycle_count = 0;
+        core->instruction_count = 0;
+    }
+    for (int i = 0; i < smp->core_count; i++) {
+        isa_set_register16(smp->cores[i], REG_SP, (uint16_t)(0x7FFF - i * SMP_STACK_SIZE));
+        smp->stopped[i] = false;
+    }
+    atomics_store_u8(&smp->cores[0]->devices->ipi.pending, 0, ATOMICS_RELEASE);
+}
+
+// Take the bus: device time moves up to the core's cycle, and the IPI
+// register learns which core is asking
+static void smp_bus_enter(cpu_state_t* cpu) {
+    device_set_t* devices = cpu->devices;
+
+    smp_bus_lock(cpu->smp);
+    if (cpu->cycle_count > devices->now) {
+        devices->now = cpu->cycle_count;
+    }
+    devices->ipi.core = cpu->core_id;
+}
+
+static void smp_bus_leave(cpu_state_t* cpu) {
+    smp_bus_unlock(cpu->smp);
+}
+
+uint8_t smp_device_read(cpu_state_t* cpu, uint16_t address) {
+    smp_bus_enter(cpu);
+    uint8_t value = device_set_read(cpu->devices, address);
+    smp_bus_leave(cpu);
+    return value;
+}
+
+void smp_device_write(cpu_state_t* cpu, uint16_t address, uint8_t value) {
+    smp_bus_enter(cpu);
+    device_set_write(cpu->devices, address, value);
+    smp_bus_leave(cpu);
+}
+
+// Core 0's device poll, at device time
+void smp_service_devices(cpu_state_t* cpu) {
+    smp_bus_enter(cpu);
+    cpu_service_devices(cpu, cpu->devices->now);
+    smp_bus_leave(cpu);
+}
+
+// Interrupt entry at the interrupt controller, which only core 0 sees
+bool smp_acknowledge_irq(cpu_state_t* cpu, uint16_t* vector) {
+    if (cpu->core_id != 0) {
+        return false;
+    }
+
+    smp_bus_enter(cpu);
+    bool taken = device_set_acknowledge_irq(cpu->devices, cpu->devices->now, vector);
+    smp_bus_leave(cpu);
+    return taken;
+}
+
+// Run a core to the end of the current quantum. A core that halts or
+// stops idles to the boundary, keeping every core's clock together.
+static void smp_run_core(smp_machine_t* smp, int index) {
+    cpu_state_t* core = smp->cores[index];
+    uint64_t end = smp->quantum_end;
+
+    while (core->running && core->cycle_count < end) {
+        if (!cpu_step(core)) {
+            smp->stopped[index] = true;
+            core->running = false;
+        }
+    }
+    if (core->cycle_count < end) {
+        core->cycle_count = end;
+    }
+}
+
+// Between quanta, with every core waiting: wake parked cores that have
+// an interrupt pending, decide whether the run is over and open the next
+// quantum
+static void smp_next_quantum(smp_machine_t* smp) {
+    bool running = false;
+
+    for (int i = 0; i < smp->core_count; i++) {
+        cpu_state_t* core = smp->cores[i];
+        if (!core->running && !smp->stopped[i]) {
+            // Polling resamples the core's interrupt line
+            cpu_poll_devices(core);
+            core->running = core->nmi_pending || core->irq_pending;
+        }
+        running = running || core->running;
+    }
+
+    smp->done = !running || smp->quantum_end >= smp->limit;
+    if (!smp->done) {
+        uint64_t remaining = smp->limit - smp->quantum_end;
+        smp->quantum_end += remaining < smp->quantum ? remaining : smp->quantum;
+    }
+}
+
+#if SMP_THREADS
+
+// Wait until every participant has finished the quantum; the last to
+// arrive opens the next one. False when the run is over.
+static bool smp_barrier(smp_machine_t* smp) {
+    pthread_mutex_lock(&smp->lock);
+    uint64_t generation = smp->generation;
+    if (++smp->arrived == smp->participants) {
+        smp_next_quantum(smp);
+        smp->arrived = 0;
+        smp->generation++;
+        pthread_cond_broadcast(&smp->turn);
+    } else {
+        while (generation == smp->generation) {
+            pthread_cond_wait(&smp->turn, &smp->lock);
+        }
+    }
+    bool done = smp->done;
+    pthread_mutex_unlock(&smp->lock);
+    return !done;
+}
+
+static void* smp_core_thread(void* arg) {
+    cpu_state_t* core = arg;
+    smp_machine_t* smp = core->smp;
+
+    while (smp_barrier(smp)) {
+        smp_run_core(smp, core->core_id);
+    }
+    return NULL;
+}
+
+// One host thread per core; the calling thread runs core 0. If a thread
+// cannot be started the run is ended at the first barrier and false
+// returned.
+static bool smp_run_threads(smp_machine_t* smp) {
+    pthread_t threads[SMP_MAX_CORES];
+    int started = 1;
+
+    smp->participants = smp->core_count;
+    while (started < smp->core_count &&
+           pthread_create(&threads[started], NULL, smp_core_thread, smp->cores[started]) == 0) {
+        started++;
+    }
+
+    uint64_t limit = smp->limit;
+    if (started < smp->core_count) {
+        pthread_mutex_lock(&smp->lock);
+        smp->participants = started;
+        smp->limit = smp->quantum_end;
+        pthread_mutex_unlock(&smp->lock);
+    }
+
+    smp_core_thread(smp->cores[0]);
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    smp->limit = limit;
+    return started == smp->core_count;
+}
+
+#else
+
+static bool smp_run_threads(smp_machine_t* smp) {
+    (void)smp;
+    return false;
+}
+
+#endif
+
+bool smp_run(smp_machine_t* smp, uint64_t max_cycles) {
+    uint64_t start = smp->cores[0]->cycle_count;
+
+    for (int i = 0; i < smp->core_count; i++) {
+        smp->cores[i]->running = true;
+        smp->stopped[i] = false;
+    }
+    smp->quantum_end = start;
+    smp->limit = start + max_cycles;
+    smp->arrived = 0;
+
+    bool threaded = smp->schedule == SMP_SCHEDULE_THREADS && smp_run_threads(smp);
+    if (!threaded) {
+        if (smp->schedule == SMP_SCHEDULE_THREADS) {
+            fprintf(stderr, "Cannot start core threads; running the cores round-robin\n");
+        }
+        for (smp_next_quantum(smp); !smp->done; smp_next_quantum(smp)) {
+            for (int i = 0; i < smp->core_count; i++) {
+                smp_run_core(smp, i);
+            }
+        }
+    }
+
+    device_set_flush(smp->cores[0]->devices);
+    for (int i = 0; i < smp->core_count; i++) {
+        if (smp->cores[i]->running) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void smp_print_status(smp_machine_t* smp) {
+    for (int i = 0; i < smp->core_count; i++) {
+        cpu_state_t* core = smp->cores[i];
+        const char* state = smp->stopped[i] ? "stopped" : core->running ? "running" : "halted";
+        printf("Core %d (%s): %s, Instructions: %u\n", i, state, cpu_get_status_string(core),
+               core->instruction_count);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Core threads need POSIX threads; elsewhere every machine runs its cores
+// round-robin
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define SMP_THREADS 1
+#else
+#define SMP_THREADS 0
+#endif
+
+// Multi-core machines.
+// Two to eight cores share one physical memory and one device set (so
+// also the MMU's bank mapping). Each core has its own registers, stack
+// and interrupt line: the interrupt controller is wired to core 0, and
+// every core has a bit in the IPI register (IPI_SEND / IPI_PENDING) that
+// interrupts it through the 0xFFFE vector. All cores start at the same
+// address; firmware tells them apart by reading IPI_CORE. Core n starts
+// with SP = 0x7FFF - n * SMP_STACK_SIZE.
+//
+// Cores advance in quanta of guest cycles. With SMP_SCHEDULE_THREADS each
+// core runs on its own host thread and the cores meet at a barrier at the
+// end of every quantum, so no core gets more than a quantum ahead; how
+// their accesses interleave within a quantum depends on the host. With
+// SMP_SCHEDULE_ROUND_ROBIN one host thread runs the cores for a quantum
+// each in core order, and runs are reproducible (a quantum of 1 cycle
+// interleaves them instruction by instruction).
+//
+// Memory ordering, as seen by guest code:
+//   - Loads are acquires and stores are releases (host atomics), so a core
+//     observes another core's stores in the order they were made: data
+//     written before a flag is visible once the flag is seen set.
+//   - A store followed by a load of a different address may be reordered
+//     (as on x86). TAS and CAS are sequentially consistent and order
+//     everything around them; use them for locks and where a core must
+//     see its own store before its next load elsewhere.
+//   - Device registers are accessed under one bus lock, in host order.
+//     Device time is the latest cycle any core has reached.
+//   - IPI_SEND is a release and the target samples its bit with an
+//     acquire before every instruction, so the handler sees the sender's
+//     earlier stores.
+//
+// HLT parks a core until an interrupt is pending for it (an IPI, or a
+// device interrupt for core 0), checked at quantum boundaries; the run
+// ends when every core is parked with nothing pending, or stopped by an
+// invalid opcode or breakpoint. Core 0 also runs device events, DMA and
+// block commands, at its instruction boundaries or, while parked, at
+// quantum boundaries; those transfers take the byte path so every core
+// sees them through the same atomics. State hashing is off in SMP
+// machines: the interleaving is not part of the machine state.
+
+#define SMP_MAX_CORES IPI_MAX_CORES
+#define SMP_DEFAULT_QUANTUM 1000
+#define SMP_STACK_SIZE 0x400
+
+typedef enum {
+    SMP_SCHEDULE_THREADS = 0,
+    SMP_SCHEDULE_ROUND_ROBIN
+} smp_schedule_t;
+
+typedef struct smp_machine {
+    int core_count;
+    cpu_state_t* cores[SMP_MAX_CORES];  // cores[0] is the boot CPU
+    bool stopped[SMP_MAX_CORES];        // Invalid opcode or breakpoint; not woken by interrupts
+    uint32_t quantum;
+    smp_schedule_t schedule;
+#if SMP_THREADS
+    pthread_mutex_t bus;                // Serialises device access
+
+    // Quantum barrier
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+#endif
+    int participants;                   // Host threads running cores
+    int arrived;
+    uint64_t generation;
+    uint64_t quantum_end;               // Cycle the current quantum runs to
+    uint64_t limit;
+    bool done;
+} smp_machine_t;
+
+// Add cores to a CPU. The boot CPU becomes core 0 and keeps its memory
+// and devices, which the new cores share; it must outlive the machine.
+smp_machine_t* smp_create(cpu_state_t* boot, int cores, uint32_t quantum, smp_schedule_t schedule);
+void smp_destroy(smp_machine_t* smp);
+
+// Start every core at address with its own stack (memory is kept)
+void smp_reset_to_address(smp_machine_t* smp, uint16_t address);
+
+// Run for max_cycles of guest time; true if a core is still running
+bool smp_run(smp_machine_t* smp, uint64_t max_cycles);
+
+// Bus side, called by the cores' memory and interrupt paths
+uint8_t smp_device_read(cpu_state_t* cpu, uint16_t address);
+void smp_device_write(cpu_state_t* cpu, uint16_t address, uint8_t value);
+void smp_service_devices(cpu_state_t* cpu);
+bool smp_acknowledge_irq(cpu_state_t* cpu, uint16_t* vector);
+
+// Print each core's state
+void smp_print_status(smp_machine_t* smp);
+
+#endif // SMP_H
@@ -0,0 +1,36 @@
+#include "statehash.h"
+#include <string.h>
+
+// Full hash of a memory block starting at base_address
+uint64_t statehash_memory(const uint8_t* memory, uint32_t base_address, size_t size) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= statehash_memory_key(base_address + (uint32_t)i, memory[i]);
+    }
+    return hash;
+}
+
+// Hash of a small byte string (registers, device state), chained from seed.
+// Consumes eight bytes per mixing round.
+uint64_t statehash_bytes(uint64_t seed, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    uint64_t hash = statehash_mix(seed ^ size);
+    
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = statehash_mix(hash ^ word);
+        bytes += 8;
+        size -= 8;
+    }
+    
+    if (size > 0) {
+        uint64_t word = 0;
+        for (size_t i = 0; i < size; i++) {
+            word |= (uint64_t)bytes[i] << (8 * i);
+        }
+        hash = statehash_mix(hash ^ word);
+    }
+    
+    return hash;
+}
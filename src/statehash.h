@@ -0,0 +1,41 @@
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Incremental state hashing.
+// Memory is hashed Zobrist-style: the hash is the XOR of one key per
+// (address, value) pair, so a byte write updates it in O(1) instead of
+// rehashing the whole address space:
+//   hash ^= key(address, old_value) ^ key(address, new_value)
+// Keys are derived on the fly with the splitmix64 finalizer, so no key
+// table has to be stored.
+
+// splitmix64 finalizer
+static inline uint64_t statehash_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Zobrist key for one memory byte
+static inline uint64_t statehash_memory_key(uint32_t address, uint8_t value) {
+    return statehash_mix(((uint64_t)address << 8) | value);
+}
+
+// Update a memory hash for a single byte write
+static inline void statehash_update(uint64_t* hash, uint32_t address, uint8_t old_value, uint8_t new_value) {
+    if (old_value != new_value) {
+        *hash ^= statehash_memory_key(address, old_value) ^ statehash_memory_key(address, new_value);
+    }
+}
+
+// Full hash of a memory block starting at base_address
+uint64_t statehash_memory(const uint8_t* memory, uint32_t base_address, size_t size);
+
+// Hash of a small byte string (registers, device state), chained from seed
+uint64_t statehash_bytes(uint64_t seed, const void* data, size_t size);
+
+#endif // STATEHASH_H
@@ -0,0 +1,103 @@
+#include "uart_link.h"
+#include "atomics.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+uart_link_t* uart_link_create(uint32_t latency) {
+    uart_link_t* link = calloc(1, sizeof(uart_link_t));
+    uart_link_block_t* block = calloc(1, sizeof(uart_link_block_t));
+    if (!link || !block) {
+        free(link);
+        free(block);
+        return NULL;
+    }
+
+    link->latency = latency ? latency : 1;
+    link->horizon = UINT64_MAX;
+    link->head_block = block;
+    link->tail_block = block;
+    return link;
+}
+
+void uart_link_destroy(uart_link_t* link) {
+    if (!link) {
+        return;
+    }
+
+    uart_link_block_t* block = link->head_block;
+    while (block) {
+        uart_link_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+    free(link);
+}
+
+// A full block is never written again, so the producer links a new one
+// and the consumer frees the old one once it has read it to the end
+void uart_link_push(uart_link_t* link, uint64_t cycle, uint8_t byte) {
+    uart_link_block_t* block = link->tail_block;
+    size_t count = block->count;
+
+    if (count == UART_LINK_BLOCK_SIZE) {
+        uart_link_block_t* next = calloc(1, sizeof(uart_link_block_t));
+        if (!next) {
+            fprintf(stderr, "Out of memory on a UART link; byte dropped\n");
+            return;
+        }
+        atomics_store_ptr(&block->next, next, ATOMICS_RELEASE);
+        link->tail_block = next;
+        block = next;
+        count = 0;
+    }
+
+    block->entries[count].cycle = cycle + link->latency;
+    block->entries[count].byte = byte;
+    atomics_store_size(&block->count, count + 1, ATOMICS_RELEASE);
+    link->bytes++;
+}
+
+// Oldest queued entry, moving past finished blocks
+static uart_link_entry_t* uart_link_front(uart_link_t* link) {
+    for (;;) {
+        uart_link_block_t* block = link->head_block;
+        if (link->head < atomics_load_size(&block->count, ATOMICS_ACQUIRE)) {
+            return &block->entries[link->head];
+        }
+
+        uart_link_block_t* next = atomics_load_ptr(&block->next, ATOMICS_ACQUIRE);
+        if (link->head < UART_LINK_BLOCK_SIZE || !next) {
+            return NULL;
+        }
+        link->head_block = next;
+        link->head = 0;
+        free(block);
+    }
+}
+
+bool uart_link_peek(uart_link_t* link, uint64_t* cycle, uint8_t* byte) {
+    uart_link_entry_t* entry = uart_link_front(link);
+    if (!entry || entry->cycle >= link->horizon) {
+        return false;
+    }
+
+    *cycle = entry->cycle;
+    *byte = entry->byte;
+    return true;
+}
+
+void uart_link_pop(uart_link_t* link) {
+    if (uart_link_front(link)) {
+        link->head++;
+    }
+}
+
+bool uart_link_next(uart_link_t* link, uint64_t* cycle) {
+    uart_link_entry_t* entry = uart_link_front(link);
+    if (!entry) {
+        return false;
+    }
+
+    *cycle = entry->cycle;
+    return true;
+}
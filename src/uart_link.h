@@ -0,0 +1,57 @@
+#ifndef UART_LINK_H
+#define UART_LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// UART links between boards.
+// A link carries one board's UART TX to another board's UART RX. The
+// sender stamps every byte with the cycle it reaches the receiver (its
+// own cycle plus the link latency) and pushes it into a lock-free
+// single-producer/single-consumer queue; the receiver's device set
+// delivers it once its clock reaches the stamp. The queue grows a block
+// at a time instead of dropping or blocking, so what a receiver sees
+// never depends on host timing. Links are host-side plumbing like sinks
+// and sources and are not part of machine state.
+
+#define UART_LINK_BLOCK_SIZE 1024       // Bytes per queue block
+
+// One byte in flight
+typedef struct {
+    uint64_t cycle;             // Receiver cycle the byte is due at
+    uint8_t byte;
+} uart_link_entry_t;
+
+typedef struct uart_link_block {
+    uart_link_entry_t entries[UART_LINK_BLOCK_SIZE];
+    size_t count;                       // Written by the producer
+    struct uart_link_block* next;       // Written by the producer
+} uart_link_block_t;
+
+typedef struct uart_link {
+    uint32_t latency;           // Cycles from send to delivery, at least 1
+    uint64_t horizon;           // The receiver only sees bytes due before this cycle
+
+    uart_link_block_t* head_block;      // Consumer side
+    size_t head;
+    uart_link_block_t* tail_block;      // Producer side
+
+    uint64_t bytes;
+} uart_link_t;
+
+uart_link_t* uart_link_create(uint32_t latency);
+void uart_link_destroy(uart_link_t* link);
+
+// Sender: queue a byte sent at the given cycle
+void uart_link_push(uart_link_t* link, uint64_t cycle, uint8_t byte);
+
+// Receiver: the oldest byte due before the horizon, and taking it
+bool uart_link_peek(uart_link_t* link, uint64_t* cycle, uint8_t* byte);
+void uart_link_pop(uart_link_t* link);
+
+// Receiver: due cycle of the oldest queued byte, whatever the horizon;
+// false when the link is empty
+bool uart_link_next(uart_link_t* link, uint64_t* cycle);
+
+#endif // UART_LINK_H
@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "uart_sink.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+static uart_sink_t default_sink;
+static bool default_sink_ready = false;
+
+static uart_sink_t* uart_sink_alloc(uart_sink_type_t type) {
+    uart_sink_t* sink = calloc(1, sizeof(uart_sink_t));
+    if (!sink) {
+        return NULL;
+    }
+    sink->type = type;
+    sink->fd = -1;
+    sink->latency_cycles = UART_SINK_DEFAULT_LATENCY;
+    sink->deadline = UART_SINK_NO_DEADLINE;
+    return sink;
+}
+
+// Write to stdout; line_buffered flushes on every newline
+uart_sink_t* uart_sink_create_stdout(bool line_buffered) {
+    uart_sink_t* sink = uart_sink_alloc(UART_SINK_STDOUT);
+    if (sink) {
+        sink->stream = stdout;
+        sink->line_buffered = line_buffered;
+    }
+    return sink;
+}
+
+// Write to a file (truncated)
+uart_sink_t* uart_sink_create_file(const char* path) {
+    FILE* stream = fopen(path, "wb");
+    if (!stream) {
+        fprintf(stderr, "Cannot create UART output file %s\n", path);
+        return NULL;
+    }
+
+    uart_sink_t* sink = uart_sink_alloc(UART_SINK_FILE);
+    if (!sink) {
+        fclose(stream);
+        return NULL;
+    }
+    sink->stream = stream;
+    return sink;
+}
+
+// Keep all output in memory
+uart_sink_t* uart_sink_create_capture(void) {
+    return uart_sink_alloc(UART_SINK_CAPTURE);
+}
+
+// Connect to a listening Unix stream socket
+uart_sink_t* uart_sink_create_socket(const char* path) {
+#ifdef _WIN32
+    fprintf(stderr, "Unix socket UART output is not supported on this platform\n");
+    (void)path;
+    return NULL;
+#else
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return NULL;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create socket for %s\n", path);
+        return NULL;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Cannot connect to %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    uart_sink_t* sink = uart_sink_alloc(UART_SINK_SOCKET);
+    if (!sink) {
+        close(fd);
+        return NULL;
+    }
+    sink->fd = fd;
+    return sink;
+#endif
+}
+
+// Discard all output
+uart_sink_t* uart_sink_create_null(void) {
+    return uart_sink_alloc(UART_SINK_NULL);
+}
+
+// Create a sink from a command line spec:
+// stdout, stdout:block, null, capture, file:PATH, unix:PATH
+uart_sink_t* uart_sink_open(const char* spec) {
+    if (strcmp(spec, "stdout") == 0) {
+        return uart_sink_create_stdout(true);
+    } else if (strcmp(spec, "stdout:block") == 0) {
+        return uart_sink_create_stdout(false);
+    } else if (strcmp(spec, "null") == 0) {
+        return uart_sink_create_null();
+    } else if (strcmp(spec, "capture") == 0) {
+        return uart_sink_create_capture();
+    } else if (strncmp(spec, "file:", 5) == 0) {
+        return uart_sink_create_file(spec + 5);
+    } else if (strncmp(spec, "unix:", 5) == 0) {
+        return uart_sink_create_socket(spec + 5);
+    }
+
+    fprintf(stderr, "Unknown UART output: %s\n", spec);
+    return NULL;
+}
+
+// Flush and release a sink (the default sink is only flushed)
+void uart_sink_destroy(uart_sink_t* sink) {
+    if (!sink) {
+        return;
+    }
+
+    uart_sink_flush(sink);
+    if (sink == &default_sink) {
+        return;
+    }
+
+    if (sink->type == UART_SINK_FILE && sink->stream) {
+        fclose(sink->stream);
+    }
+#ifndef _WIN32
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+#endif
+    free(sink->capture);
+    free(sink);
+}
+
+uart_sink_t* uart_sink_default(void) {
+    if (!default_sink_ready) {
+        memset(&default_sink, 0, sizeof(default_sink));
+        default_sink.type = UART_SINK_STDOUT;
+        default_sink.stream = stdout;
+        default_sink.fd = -1;
+        default_sink.line_buffered = true;
+        default_sink.latency_cycles = UART_SINK_DEFAULT_LATENCY;
+        default_sink.deadline = UART_SINK_NO_DEADLINE;
+        default_sink_ready = true;
+    }
+    return &default_sink;
+}
+
+void uart_sink_set_latency(uart_sink_t* sink, uint64_t cycles) {
+    sink->latency_cycles = cycles;
+}
+
+// Append one guest byte
+void uart_sink_put(uart_sink_t* sink, uint8_t byte) {
+    sink->bytes++;
+    if (sink->type == UART_SINK_NULL) {
+        return;
+    }
+
+    sink->buffer[sink->count++] = byte;
+    if (sink->count == UART_TX_BUFFER_SIZE || (sink->line_buffered && byte == '\n')) {
+        uart_sink_flush(sink);
+    }
+}
+
+// Arm the latency deadline for pending output; returns the flush deadline
+uint64_t uart_sink_schedule(uart_sink_t* sink, uint64_t now) {
+    if (sink->count > 0 && sink->deadline == UART_SINK_NO_DEADLINE && sink->latency_cycles > 0) {
+        sink->deadline = now + sink->latency_cycles;
+    }
+    return sink->deadline;
+}
+
+// Hand buffered output to the host in one call
+void uart_sink_flush(uart_sink_t* sink) {
+    sink->deadline = UART_SINK_NO_DEADLINE;
+    if (sink->count == 0) {
+        return;
+    }
+
+    switch (sink->type) {
+        case UART_SINK_STDOUT:
+        case UART_SINK_FILE:
+            fwrite(sink->buffer, 1, sink->count, sink->stream);
+            fflush(sink->stream);
+            break;
+
+        case UART_SINK_CAPTURE:
+            if (sink->capture_size + sink->count > sink->capture_capacity) {
+                size_t capacity = sink->capture_capacity ? sink->capture_capacity : UART_TX_BUFFER_SIZE;
+                while (capacity < sink->capture_size + sink->count) {
+                    capacity *= 2;
+                }
+                uint8_t* capture = realloc(sink->capture, capacity);
+                if (!capture) {
+                    break;
+                }
+                sink->capture = capture;
+                sink->capture_capacity = capacity;
+            }
+            memcpy(sink->capture + sink->capture_size, sink->buffer, sink->count);
+            sink->capture_size += sink->count;
+            break;
+
+        case UART_SINK_SOCKET: {
+#ifndef _WIN32
+            size_t sent = 0;
+            while (sent < sink->count) {
+                ssize_t n = send(sink->fd, sink->buffer + sent, sink->count - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    // Peer went away: keep running with output discarded
+                    close(sink->fd);
+                    sink->fd = -1;
+                    sink->type = UART_SINK_NULL;
+                    break;
+                }
+                sent += (size_t)n;
+            }
+#endif
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    sink->count = 0;
+    sink->flushes++;
+}
+
+// Captured output (capture sinks only)
+const uint8_t* uart_sink_captured(const uart_sink_t* sink, size_t* size) {
+    *size = sink->capture_size;
+    return sink->capture;
+}
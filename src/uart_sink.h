@@ -0,0 +1,67 @@
+#ifndef UART_SINK_H
+#define UART_SINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// UART transmit sinks.
+// Guest TX bytes are collected in a per-sink buffer and handed to the host
+// in one call when a newline arrives (line mode), the buffer fills, the CPU
+// halts, or the oldest buffered byte exceeds the latency bound in guest
+// cycles. Sinks are host-side plumbing and are not part of machine state.
+
+#define UART_TX_BUFFER_SIZE 4096
+#define UART_SINK_NO_DEADLINE UINT64_MAX
+#define UART_SINK_DEFAULT_LATENCY 10000     // 10 ms at 1 MHz
+
+// Sink kinds
+typedef enum {
+    UART_SINK_STDOUT = 0,
+    UART_SINK_FILE,
+    UART_SINK_CAPTURE,
+    UART_SINK_SOCKET,
+    UART_SINK_NULL
+} uart_sink_type_t;
+
+// Transmit sink
+typedef struct uart_sink {
+    uart_sink_type_t type;
+    FILE* stream;               // stdout and file sinks
+    int fd;                     // socket sink
+    bool line_buffered;         // Flush on '\n'
+    uint64_t latency_cycles;    // Flush bound in guest cycles (0 = none)
+
+    uint8_t buffer[UART_TX_BUFFER_SIZE];
+    size_t count;
+    uint64_t deadline;          // Cycle by which the buffer must be flushed
+
+    uint8_t* capture;           // Capture sink contents
+    size_t capture_size;
+    size_t capture_capacity;
+
+    uint64_t bytes;
+    uint64_t flushes;
+} uart_sink_t;
+
+// Creation
+uart_sink_t* uart_sink_create_stdout(bool line_buffered);
+uart_sink_t* uart_sink_create_file(const char* path);
+uart_sink_t* uart_sink_create_capture(void);
+uart_sink_t* uart_sink_create_socket(const char* path);
+uart_sink_t* uart_sink_create_null(void);
+uart_sink_t* uart_sink_open(const char* spec);
+void uart_sink_destroy(uart_sink_t* sink);
+
+// Shared line-buffered stdout sink used by the default device set
+uart_sink_t* uart_sink_default(void);
+
+// Output
+void uart_sink_set_latency(uart_sink_t* sink, uint64_t cycles);
+void uart_sink_put(uart_sink_t* sink, uint8_t byte);
+uint64_t uart_sink_schedule(uart_sink_t* sink, uint64_t now);
+void uart_sink_flush(uart_sink_t* sink);
+const uint8_t* uart_sink_captured(const uart_sink_t* sink, size_t* size);
+
+#endif // UART_SINK_H
@@ -0,0 +1,330 @@
+#define _XOPEN_SOURCE 700
+
+#include "uart_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+// How often a full ring is re-checked for space (milliseconds)
+#define UART_SOURCE_FULL_POLL_MS 1
+
+struct uart_source {
+    uart_source_type_t type;
+    int fd;
+    bool owns_fd;
+    bool pollable;              // Regular files cannot be added to epoll
+    int slave_fd;               // PTY slave kept open so the master never hangs up
+    char pty_name[64];
+
+    int epoll_fd;
+    int wake_fd[2];             // Shutdown signal for the I/O thread
+    pthread_t thread;
+    bool thread_started;
+
+    // SPSC ring: tail is written by the I/O thread, head by the CPU thread
+    uint8_t ring[UART_SOURCE_RING_SIZE];
+    size_t head;
+    size_t tail;
+    int finished;
+};
+
+// Put a PTY into raw mode so bytes arrive unchanged and unbuffered
+static void uart_source_make_raw(int fd) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        return;
+    }
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSIZE | PARENB);
+    tio.c_cflag |= CS8;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+static bool uart_source_open_pty(uart_source_t* source) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot allocate a pseudo-terminal\n");
+        return false;
+    }
+    if (grantpt(fd) != 0 || unlockpt(fd) != 0 || !ptsname(fd)) {
+        fprintf(stderr, "Cannot unlock pseudo-terminal\n");
+        close(fd);
+        return false;
+    }
+    strncpy(source->pty_name, ptsname(fd), sizeof(source->pty_name) - 1);
+    source->pty_name[sizeof(source->pty_name) - 1] = '\0';
+
+    source->slave_fd = open(source->pty_name, O_RDWR | O_NOCTTY);
+    if (source->slave_fd < 0) {
+        fprintf(stderr, "Cannot open %s\n", source->pty_name);
+        close(fd);
+        return false;
+    }
+    uart_source_make_raw(source->slave_fd);
+
+    source->fd = fd;
+    source->owns_fd = true;
+    return true;
+}
+
+// Watch or stop watching the source descriptor (hang-ups are reported
+// even for an empty event mask, so a full ring removes it entirely)
+static void uart_source_arm(uart_source_t* source, bool armed) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = source->fd;
+    epoll_ctl(source->epoll_fd, armed ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, source->fd, &event);
+}
+
+// Read whatever is available into the free part of the ring.
+// Returns false at end of input or on a hard error.
+static bool uart_source_fill(uart_source_t* source) {
+    size_t tail = source->tail;
+    size_t head = __atomic_load_n(&source->head, __ATOMIC_ACQUIRE);
+    size_t space = UART_SOURCE_RING_SIZE - (tail - head);
+    size_t index = tail & (UART_SOURCE_RING_SIZE - 1);
+    size_t contiguous = UART_SOURCE_RING_SIZE - index;
+
+    if (space == 0) {
+        return true;
+    }
+    if (contiguous > space) {
+        contiguous = space;
+    }
+
+    ssize_t n = read(source->fd, &source->ring[index], contiguous);
+    if (n > 0) {
+        __atomic_store_n(&source->tail, tail + (size_t)n, __ATOMIC_RELEASE);
+        return true;
+    }
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    return false;
+}
+
+// I/O thread: move bytes from the host descriptor into the ring
+static void* uart_source_thread(void* arg) {
+    uart_source_t* source = arg;
+    struct epoll_event events[2];
+    bool armed = source->pollable;
+
+    for (;;) {
+        size_t used = source->tail - __atomic_load_n(&source->head, __ATOMIC_ACQUIRE);
+        bool full = used == UART_SOURCE_RING_SIZE;
+
+        // A full ring stops reading (backpressure) until the CPU catches up
+        if (source->pollable && armed == full) {
+            armed = !full;
+            uart_source_arm(source, armed);
+        }
+
+        int timeout = full ? UART_SOURCE_FULL_POLL_MS : (source->pollable ? -1 : 0);
+        int count = epoll_wait(source->epoll_fd, events, 2, timeout);
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+
+        bool readable = !source->pollable && !full;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == source->wake_fd[0]) {
+                return NULL;
+            }
+            readable = true;
+        }
+
+        if (readable && !uart_source_fill(source)) {
+            break;
+        }
+    }
+
+    __atomic_store_n(&source->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Create a source from a command line spec: stdin, file:PATH, pipe:PATH, pty
+uart_source_t* uart_source_open(const char* spec) {
+    uart_source_t* source = calloc(1, sizeof(uart_source_t));
+    if (!source) {
+        return NULL;
+    }
+    source->fd = -1;
+    source->slave_fd = -1;
+    source->epoll_fd = -1;
+    source->wake_fd[0] = -1;
+    source->wake_fd[1] = -1;
+
+    bool ok = true;
+    if (strcmp(spec, "stdin") == 0) {
+        source->type = UART_SOURCE_STDIN;
+        source->fd = STDIN_FILENO;
+    } else if (strncmp(spec, "file:", 5) == 0) {
+        source->type = UART_SOURCE_FILE;
+        source->fd = open(spec + 5, O_RDONLY);
+        source->owns_fd = true;
+        if (source->fd < 0) {
+            fprintf(stderr, "Cannot open UART input file %s\n", spec + 5);
+            ok = false;
+        }
+    } else if (strncmp(spec, "pipe:", 5) == 0) {
+        // Opened read-write so the FIFO never reports end of input when
+        // a writer disconnects; writers may come and go
+        source->type = UART_SOURCE_PIPE;
+        source->fd = open(spec + 5, O_RDWR);
+        source->owns_fd = true;
+        if (source->fd < 0) {
+            fprintf(stderr, "Cannot open named pipe %s\n", spec + 5);
+            ok = false;
+        }
+    } else if (strcmp(spec, "pty") == 0) {
+        source->type = UART_SOURCE_PTY;
+        ok = uart_source_open_pty(source);
+    } else {
+        fprintf(stderr, "Unknown UART input: %s\n", spec);
+        ok = false;
+    }
+
+    if (ok) {
+        source->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        ok = source->epoll_fd >= 0 && pipe(source->wake_fd) == 0;
+    }
+    if (ok) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = source->wake_fd[0];
+        ok = epoll_ctl(source->epoll_fd, EPOLL_CTL_ADD, source->wake_fd[0], &event) == 0;
+
+        event.data.fd = source->fd;
+        source->pollable = epoll_ctl(source->epoll_fd, EPOLL_CTL_ADD, source->fd, &event) == 0;
+        if (!source->pollable && errno != EPERM) {
+            fprintf(stderr, "Cannot watch UART input %s\n", spec);
+            ok = false;
+        }
+    }
+    if (ok) {
+        ok = pthread_create(&source->thread, NULL, uart_source_thread, source) == 0;
+        source->thread_started = ok;
+    }
+
+    if (!ok) {
+        uart_source_destroy(source);
+        return NULL;
+    }
+    return source;
+}
+
+void uart_source_destroy(uart_source_t* source) {
+    if (!source) {
+        return;
+    }
+
+    if (source->thread_started) {
+        char wake = 0;
+        if (write(source->wake_fd[1], &wake, 1) != 1) {
+            pthread_cancel(source->thread);
+        }
+        pthread_join(source->thread, NULL);
+    }
+
+    if (source->owns_fd && source->fd >= 0) {
+        close(source->fd);
+    }
+    if (source->slave_fd >= 0) {
+        close(source->slave_fd);
+    }
+    if (source->epoll_fd >= 0) {
+        close(source->epoll_fd);
+    }
+    if (source->wake_fd[0] >= 0) {
+        close(source->wake_fd[0]);
+        close(source->wake_fd[1]);
+    }
+    free(source);
+}
+
+bool uart_source_get(uart_source_t* source, uint8_t* byte) {
+    size_t head = source->head;
+    if (head == __atomic_load_n(&source->tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *byte = source->ring[head & (UART_SOURCE_RING_SIZE - 1)];
+    __atomic_store_n(&source->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+size_t uart_source_available(uart_source_t* source) {
+    return __atomic_load_n(&source->tail, __ATOMIC_ACQUIRE) - source->head;
+}
+
+bool uart_source_finished(uart_source_t* source) {
+    // Check finished first: the tail is final once it is set
+    if (!__atomic_load_n(&source->finished, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    return source->head == __atomic_load_n(&source->tail, __ATOMIC_ACQUIRE);
+}
+
+const char* uart_source_pty_name(const uart_source_t* source) {
+    return source->type == UART_SOURCE_PTY ? source->pty_name : NULL;
+}
+
+uart_source_type_t uart_source_type(const uart_source_t* source) {
+    return source->type;
+}
+
+#else
+
+struct uart_source {
+    uart_source_type_t type;
+};
+
+uart_source_t* uart_source_open(const char* spec) {
+    fprintf(stderr, "UART input (%s) is not supported on this platform\n", spec);
+    return NULL;
+}
+
+void uart_source_destroy(uart_source_t* source) {
+    free(source);
+}
+
+bool uart_source_get(uart_source_t* source, uint8_t* byte) {
+    (void)source;
+    (void)byte;
+    return false;
+}
+
+size_t uart_source_available(uart_source_t* source) {
+    (void)source;
+    return 0;
+}
+
+bool uart_source_finished(uart_source_t* source) {
+    (void)source;
+    return true;
+}
+
+const char* uart_source_pty_name(const uart_source_t* source) {
+    (void)source;
+    return NULL;
+}
+
+uart_source_type_t uart_source_type(const uart_source_t* source) {
+    return source->type;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef UART_SOURCE_H
+#define UART_SOURCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// UART receive sources.
+// A host I/O thread waits on the source with epoll and copies incoming
+// bytes into a single-producer/single-consumer ring. The CPU thread only
+// takes bytes from the ring when the UART's next delivery event is due,
+// so it never blocks on host I/O. Linux only; elsewhere opening a source
+// fails with a message.
+
+#define UART_SOURCE_RING_SIZE 4096      // Power of two
+
+// Source kinds
+typedef enum {
+    UART_SOURCE_STDIN = 0,
+    UART_SOURCE_FILE,
+    UART_SOURCE_PIPE,
+    UART_SOURCE_PTY
+} uart_source_type_t;
+
+// Receive source (opaque outside uart_source.c)
+typedef struct uart_source uart_source_t;
+
+// Creation
+uart_source_t* uart_source_open(const char* spec);
+void uart_source_destroy(uart_source_t* source);
+
+// Non-blocking read of one byte; false when nothing is buffered
+bool uart_source_get(uart_source_t* source, uint8_t* byte);
+
+// Bytes buffered and not yet taken
+size_t uart_source_available(uart_source_t* source);
+
+// True once the source has ended and every byte has been taken
+bool uart_source_finished(uart_source_t* source);
+
+// Slave device path of a PTY source (NULL for other kinds)
+const char* uart_source_pty_name(const uart_source_t* source);
+uart_source_type_t uart_source_type(const uart_source_t* source);
+
+#endif // UART_SOURCE_H
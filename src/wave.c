@@ -0,0 +1,417 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "wave.h"
+#include "atomics.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The recorder thread needs POSIX threads
+#if defined(__unix__) || defined(__APPLE__)
+#define WAVE_RECORDER_THREAD 1
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#else
+#define WAVE_RECORDER_THREAD 0
+#endif
+
+// How long the recorder sleeps when the queue is empty (nanoseconds)
+#define WAVE_RECORDER_IDLE_NS 1000000L
+
+static const struct {
+    const char* name;
+    int width;
+    char id;
+} wave_signals[WAVE_SIGNAL_COUNT] = {
+    {"gpio", 8, '!'},
+    {"timer_out", 1, '#'},
+    {"pic_lines", 8, '$'},
+    {"irq", 1, '%'},
+};
+
+// VCD identifier of the GPIO direction register, dumped with GPIO events
+#define WAVE_VCD_DIR_ID '"'
+
+// Event queue
+wave_queue_t* wave_queue_create(bool blocking) {
+    wave_queue_t* queue = calloc(1, sizeof(wave_queue_t));
+    if (queue) {
+        queue->blocking = blocking;
+    }
+    return queue;
+}
+
+void wave_queue_destroy(wave_queue_t* queue) {
+    free(queue);
+}
+
+bool wave_queue_push(wave_queue_t* queue, const wave_event_t* event) {
+    size_t tail = queue->tail;
+    if (tail - atomics_load_size(&queue->head, ATOMICS_ACQUIRE) == WAVE_QUEUE_SIZE) {
+        return false;
+    }
+    queue->events[tail & (WAVE_QUEUE_SIZE - 1)] = *event;
+    atomics_store_size(&queue->tail, tail + 1, ATOMICS_RELEASE);
+    return true;
+}
+
+bool wave_queue_pop(wave_queue_t* queue, wave_event_t* event) {
+    size_t head = queue->head;
+    if (head == atomics_load_size(&queue->tail, ATOMICS_ACQUIRE)) {
+        return false;
+    }
+    *event = queue->events[head & (WAVE_QUEUE_SIZE - 1)];
+    atomics_store_size(&queue->head, head + 1, ATOMICS_RELEASE);
+    return true;
+}
+
+// Record a change; a full queue either waits for the consumer or drops
+void wave_emit(wave_queue_t* queue, uint64_t cycle, uint8_t signal, uint8_t old_value,
+               uint8_t new_value, uint8_t direction) {
+    wave_event_t event = {cycle, signal, old_value, new_value, direction};
+
+    while (!wave_queue_push(queue, &event)) {
+        if (!queue->blocking) {
+            queue->dropped++;
+            return;
+        }
+#if WAVE_RECORDER_THREAD
+        sched_yield();
+#endif
+    }
+}
+
+const char* wave_signal_name(uint8_t signal) {
+    return signal < WAVE_SIGNAL_COUNT ? wave_signals[signal].name : "?";
+}
+
+// VCD writer
+struct wave_vcd {
+    FILE* file;
+    uint64_t time;
+    bool time_written;
+    int direction;              // Last dumped GPIO direction (-1 = none)
+};
+
+wave_vcd_t* wave_vcd_open(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot create VCD file %s\n", path);
+        return NULL;
+    }
+    wave_vcd_t* vcd = calloc(1, sizeof(wave_vcd_t));
+    if (!vcd) {
+        fclose(file);
+        return NULL;
+    }
+    vcd->file = file;
+    vcd->direction = -1;
+
+    fprintf(file, "$version cpu-sim $end\n");
+    fprintf(file, "$comment one time unit is one CPU cycle $end\n");
+    fprintf(file, "$timescale 1 ns $end\n");
+    fprintf(file, "$scope module cpu $end\n");
+    for (int i = 0; i < WAVE_SIGNAL_COUNT; i++) {
+        fprintf(file, "$var wire %d %c %s $end\n", wave_signals[i].width, wave_signals[i].id,
+                wave_signals[i].name);
+    }
+    fprintf(file, "$var wire 8 %c gpio_dir $end\n", WAVE_VCD_DIR_ID);
+    fprintf(file, "$upscope $end\n");
+    fprintf(file, "$enddefinitions $end\n");
+    return vcd;
+}
+
+static void wave_vcd_value(FILE* file, int width, uint8_t value, char id) {
+    if (width == 1) {
+        fprintf(file, "%u%c\n", value & 1, id);
+        return;
+    }
+    char bits[9];
+    for (int i = 0; i < 8; i++) {
+        bits[i] = (value & (0x80 >> i)) ? '1' : '0';
+    }
+    bits[8] = '\0';
+    fprintf(file, "b%s %c\n", bits, id);
+}
+
+static void wave_vcd_time(wave_vcd_t* vcd, uint64_t cycle) {
+    // Time never goes backwards in a VCD
+    if (vcd->time_written && cycle <= vcd->time) {
+        return;
+    }
+    vcd->time = cycle;
+    vcd->time_written = true;
+    fprintf(vcd->file, "#%llu\n", (unsigned long long)cycle);
+}
+
+void wave_vcd_write(wave_vcd_t* vcd, const wave_event_t* event) {
+    if (event->signal >= WAVE_SIGNAL_COUNT) {
+        return;
+    }
+    wave_vcd_time(vcd, event->cycle);
+    wave_vcd_value(vcd->file, wave_signals[event->signal].width, event->new_value,
+                   wave_signals[event->signal].id);
+
+    if (event->signal == WAVE_SIGNAL_GPIO && vcd->direction != event->direction) {
+        vcd->direction = event->direction;
+        wave_vcd_value(vcd->file, 8, event->direction, WAVE_VCD_DIR_ID);
+    }
+}
+
+void wave_vcd_close(wave_vcd_t* vcd, uint64_t end_cycle) {
+    if (!vcd) {
+        return;
+    }
+    // A final timestamp so viewers show the last values up to the end of the run
+    wave_vcd_time(vcd, end_cycle);
+    fclose(vcd->file);
+    free(vcd);
+}
+
+// Run-length-compressed log
+typedef struct {
+    uint64_t delta;
+    uint8_t old_value;
+    uint8_t new_value;
+    uint8_t direction;
+} wave_record_t;
+
+// Per-signal compression state: each signal's own changes are periodic
+// even when several signals interleave
+typedef struct {
+    uint64_t last_cycle;
+    wave_record_t history[WAVE_RLE_MAX_PERIOD];     // Last records of the signal's stream
+    size_t length;
+    unsigned period;            // Length of the group being repeated (0 = none)
+    unsigned matched;           // Records of the current repetition seen so far
+    uint64_t repeats;           // Completed repetitions
+} wave_channel_t;
+
+struct wave_rle {
+    FILE* file;
+    wave_channel_t channels[WAVE_SIGNAL_COUNT];
+    uint64_t events;
+    uint64_t lines;
+};
+
+wave_rle_t* wave_rle_open(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot create wave log %s\n", path);
+        return NULL;
+    }
+    wave_rle_t* rle = calloc(1, sizeof(wave_rle_t));
+    if (!rle) {
+        fclose(file);
+        return NULL;
+    }
+    rle->file = file;
+    fprintf(file, "# cpu-sim wave log: E signal delta old new dir | R signal period times\n");
+    return rle;
+}
+
+// Record p places back in a signal's stream (1 = most recent)
+static const wave_record_t* wave_channel_back(const wave_channel_t* channel, unsigned p) {
+    return &channel->history[(channel->length - p) % WAVE_RLE_MAX_PERIOD];
+}
+
+static void wave_channel_push(wave_channel_t* channel, const wave_record_t* record) {
+    channel->history[channel->length % WAVE_RLE_MAX_PERIOD] = *record;
+    channel->length++;
+}
+
+static bool wave_record_equal(const wave_record_t* a, const wave_record_t* b) {
+    return a->delta == b->delta && a->old_value == b->old_value &&
+           a->new_value == b->new_value && a->direction == b->direction;
+}
+
+static void wave_rle_event_line(wave_rle_t* rle, uint8_t signal, const wave_record_t* record) {
+    fprintf(rle->file, "E %s %llu %02X %02X %02X\n", wave_signal_name(signal),
+            (unsigned long long)record->delta, record->old_value, record->new_value,
+            record->direction);
+    rle->lines++;
+}
+
+// Close a signal's run: one R line for the whole repetitions, then the
+// records of an incomplete repetition spelled out
+static void wave_rle_end_run(wave_rle_t* rle, uint8_t signal) {
+    wave_channel_t* channel = &rle->channels[signal];
+
+    if (channel->repeats > 0) {
+        fprintf(rle->file, "R %s %u %llu\n", wave_signal_name(signal), channel->period,
+                (unsigned long long)channel->repeats);
+        rle->lines++;
+    }
+    for (unsigned i = channel->matched; i > 0; i--) {
+        wave_rle_event_line(rle, signal, wave_channel_back(channel, i));
+    }
+    channel->period = 0;
+    channel->matched = 0;
+    channel->repeats = 0;
+}
+
+void wave_rle_write(wave_rle_t* rle, const wave_event_t* event) {
+    if (event->signal >= WAVE_SIGNAL_COUNT) {
+        return;
+    }
+    wave_channel_t* channel = &rle->channels[event->signal];
+    wave_record_t record = {event->cycle - channel->last_cycle, event->old_value,
+                            event->new_value, event->direction};
+    channel->last_cycle = event->cycle;
+    rle->events++;
+
+    if (channel->period) {
+        if (wave_record_equal(&record, wave_channel_back(channel, channel->period))) {
+            wave_channel_push(channel, &record);
+            if (++channel->matched == channel->period) {
+                channel->repeats++;
+                channel->matched = 0;
+            }
+            return;
+        }
+        wave_rle_end_run(rle, event->signal);
+    }
+
+    // Start a run at the shortest period this record repeats
+    unsigned limit = channel->length < WAVE_RLE_MAX_PERIOD ? (unsigned)channel->length
+                                                           : WAVE_RLE_MAX_PERIOD;
+    for (unsigned p = 1; p <= limit; p++) {
+        if (wave_record_equal(&record, wave_channel_back(channel, p))) {
+            channel->period = p;
+            channel->repeats = 0;
+            channel->matched = 0;
+            wave_channel_push(channel, &record);
+            if (++channel->matched == p) {
+                channel->repeats = 1;
+                channel->matched = 0;
+            }
+            return;
+        }
+    }
+
+    wave_rle_event_line(rle, event->signal, &record);
+    wave_channel_push(channel, &record);
+}
+
+void wave_rle_close(wave_rle_t* rle) {
+    if (!rle) {
+        return;
+    }
+    for (int i = 0; i < WAVE_SIGNAL_COUNT; i++) {
+        wave_rle_end_run(rle, i);
+    }
+    fprintf(rle->file, "# %llu events in %llu lines\n", (unsigned long long)rle->events,
+            (unsigned long long)rle->lines);
+    fclose(rle->file);
+    free(rle);
+}
+
+#if WAVE_RECORDER_THREAD
+
+// Recorder
+struct wave_recorder {
+    wave_queue_t* queue;
+    wave_vcd_t* vcd;
+    wave_rle_t* rle;
+    pthread_t thread;
+    int stop;
+};
+
+static void wave_recorder_drain(wave_recorder_t* recorder) {
+    wave_event_t event;
+    while (wave_queue_pop(recorder->queue, &event)) {
+        if (recorder->vcd) {
+            wave_vcd_write(recorder->vcd, &event);
+        }
+        if (recorder->rle) {
+            wave_rle_write(recorder->rle, &event);
+        }
+    }
+}
+
+static void* wave_recorder_thread(void* arg) {
+    wave_recorder_t* recorder = arg;
+    struct timespec idle = {0, WAVE_RECORDER_IDLE_NS};
+
+    while (!atomics_load_int(&recorder->stop, ATOMICS_ACQUIRE)) {
+        size_t head = recorder->queue->head;
+        wave_recorder_drain(recorder);
+        if (recorder->queue->head == head) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    // The producer has stopped: everything it pushed is visible now
+    wave_recorder_drain(recorder);
+    return NULL;
+}
+
+// Start a recorder writing a VCD and/or a log (either path may be NULL)
+wave_recorder_t* wave_recorder_open(const char* vcd_path, const char* log_path) {
+    wave_recorder_t* recorder = calloc(1, sizeof(wave_recorder_t));
+    if (!recorder) {
+        return NULL;
+    }
+
+    bool ok = (recorder->queue = wave_queue_create(true)) != NULL;
+    if (ok && vcd_path) {
+        ok = (recorder->vcd = wave_vcd_open(vcd_path)) != NULL;
+    }
+    if (ok && log_path) {
+        ok = (recorder->rle = wave_rle_open(log_path)) != NULL;
+    }
+    if (ok && pthread_create(&recorder->thread, NULL, wave_recorder_thread, recorder) != 0) {
+        fprintf(stderr, "Cannot start wave recorder thread\n");
+        ok = false;
+    }
+
+    if (!ok) {
+        wave_vcd_close(recorder->vcd, 0);
+        wave_rle_close(recorder->rle);
+        wave_queue_destroy(recorder->queue);
+        free(recorder);
+        return NULL;
+    }
+    return recorder;
+}
+
+wave_queue_t* wave_recorder_queue(wave_recorder_t* recorder) {
+    return recorder->queue;
+}
+
+// Stop the thread once the queue is drained and finish the files. The
+// producer must already be detached.
+void wave_recorder_close(wave_recorder_t* recorder, uint64_t end_cycle) {
+    if (!recorder) {
+        return;
+    }
+    atomics_store_int(&recorder->stop, 1, ATOMICS_RELEASE);
+    pthread_join(recorder->thread, NULL);
+
+    wave_vcd_close(recorder->vcd, end_cycle);
+    wave_rle_close(recorder->rle);
+    wave_queue_destroy(recorder->queue);
+    free(recorder);
+}
+
+#else
+
+struct wave_recorder {
+    wave_queue_t* queue;
+};
+
+wave_recorder_t* wave_recorder_open(const char* vcd_path, const char* log_path) {
+    fprintf(stderr, "Wave recording is not supported on this platform (%s)\n",
+            vcd_path ? vcd_path : log_path);
+    return NULL;
+}
+
+wave_queue_t* wave_recorder_queue(wave_recorder_t* recorder) {
+    return recorder->queue;
+}
+
+void wave_recorder_close(wave_recorder_t* recorder, uint64_t end_cycle) {
+    (void)recorder;
+    (void)end_cycle;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef WAVE_H
+#define WAVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Signal change tracing.
+// The device set pushes one event per change of a traced signal into a
+// lock-free single-producer/single-consumer queue. Consumers drain it at
+// their own pace: the GUI, a streaming VCD (Value Change Dump) writer for
+// GTKWave, and a run-length-compressed text log.
+
+#define WAVE_QUEUE_SIZE 65536           // Events, power of two
+#define WAVE_RLE_MAX_PERIOD 16          // Longest repeating group of changes the log collapses
+
+// Traced signals
+typedef enum {
+    WAVE_SIGNAL_GPIO = 0,       // 8-bit GPIO port
+    WAVE_SIGNAL_TIMER,          // Timer output, toggles at every expiry
+    WAVE_SIGNAL_PIC,            // 8-bit interrupt controller request lines
+    WAVE_SIGNAL_IRQ,            // Interrupt controller output to the CPU
+    WAVE_SIGNAL_COUNT
+} wave_signal_t;
+
+// One value change. Events with old == new record a signal's value when
+// tracing starts.
+typedef struct {
+    uint64_t cycle;
+    uint8_t signal;
+    uint8_t old_value;
+    uint8_t new_value;
+    uint8_t direction;          // GPIO direction register (0 for other signals)
+} wave_event_t;
+
+// Event queue
+typedef struct wave_queue {
+    wave_event_t events[WAVE_QUEUE_SIZE];
+    size_t head;                // Written by the consumer
+    size_t tail;                // Written by the producer
+    bool blocking;              // Producer waits for room instead of dropping
+    uint64_t dropped;
+} wave_queue_t;
+
+wave_queue_t* wave_queue_create(bool blocking);
+void wave_queue_destroy(wave_queue_t* queue);
+bool wave_queue_push(wave_queue_t* queue, const wave_event_t* event);
+bool wave_queue_pop(wave_queue_t* queue, wave_event_t* event);
+void wave_emit(wave_queue_t* queue, uint64_t cycle, uint8_t signal, uint8_t old_value,
+               uint8_t new_value, uint8_t direction);
+const char* wave_signal_name(uint8_t signal);
+
+// Streaming VCD writer (one time unit per CPU cycle)
+typedef struct wave_vcd wave_vcd_t;
+wave_vcd_t* wave_vcd_open(const char* path);
+void wave_vcd_write(wave_vcd_t* vcd, const wave_event_t* event);
+void wave_vcd_close(wave_vcd_t* vcd, uint64_t end_cycle);
+
+// Run-length-compressed event log, compressed per signal. Lines are
+//   E <signal> <delta> <old> <new> <dir>   one change, delta cycles after the signal's previous one
+//   R <signal> <period> <times>            the signal's last <period> changes repeat <times> more times
+typedef struct wave_rle wave_rle_t;
+wave_rle_t* wave_rle_open(const char* path);
+void wave_rle_write(wave_rle_t* rle, const wave_event_t* event);
+void wave_rle_close(wave_rle_t* rle);
+
+// Background thread draining a blocking queue into a VCD and/or log file
+typedef struct wave_recorder wave_recorder_t;
+wave_recorder_t* wave_recorder_open(const char* vcd_path, const char* log_path);
+wave_queue_t* wave_recorder_queue(wave_recorder_t* recorder);
+void wave_recorder_close(wave_recorder_t* recorder, uint64_t end_cycle);
+
+#endif // WAVE_H
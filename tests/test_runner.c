@@ -1,11 +1,34 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../src/cpu.h"
 #include "../src/memory.h"
 #include "../src/devices.h"
 #include "../src/isa.h"
+#include "../src/recomp.h"
+#include "../src/lockstep.h"
+#include "../src/livelock.h"
+#include "../src/uart_sink.h"
+#include "../src/uart_source.h"
+#include "../src/wave.h"
+#include "../src/framebuffer.h"
+#include "../src/assembler.h"
+#include "../src/linker.h"
+#ifndef _WIN32
+#include "../src/explore.h"
+#include "../src/blockdev.h"
+#include "../src/machine.h"
+#include "../src/net.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+
+// Example programs, from the source tree (set by CMake)
+#ifndef EXAMPLES_DIR
+#define EXAMPLES_DIR "examples"
+#endif
 
 // Test result structure
 typedef struct {
@@ -39,7 +62,40 @@ bool test_cpu_interrupts(void);
 bool test_memory_system(void);
 bool test_device_system(void);
 bool test_isa_instructions(void);
+bool test_recomp_generate(void);
+#ifndef _WIN32
+bool test_recomp_native(void);
+#endif
+bool test_lockstep_divergence(void);
+bool test_livelock_detection(void);
+bool test_explore_assertion(void);
+bool test_uart_tx_sink(void);
+bool test_timer_analytic(void);
+bool test_pic_vectored(void);
+bool test_wave_trace(void);
+bool test_wave_blink(void);
+bool test_dma_transfers(void);
+bool test_framebuffer(void);
+bool test_device_registry(void);
+bool test_machine_config(void);
+bool test_mmu_banking(void);
+#ifndef _WIN32
+bool test_block_device(void);
+bool test_smp_atomics(void);
+bool test_net_ring(void);
+#endif
+#ifdef __linux__
+bool test_uart_rx_source(void);
+#endif
 bool test_assembler_basic(void);
+bool test_assembler_symbols(void);
+bool test_assembler_fixups(void);
+bool test_assembler_string(void);
+bool test_assembler_objects(void);
+bool test_assembler_arena(void);
+bool test_assembler_includes(void);
+bool test_assembler_relaxation(void);
+bool test_assembler_listing(void);
 bool test_integration_hello(void);
 bool test_integration_addloop(void);
 bool test_integration_gpio_blink(void);
@@ -91,8 +147,49 @@ void test_suite_run(test_suite_t* suite) {
     // ISA tests
     run_test(suite, "ISA Instructions", test_isa_instructions);
     
+    // Static recompiler tests
+    run_test(suite, "Recompiler Generate", test_recomp_generate);
+#ifndef _WIN32
+    run_test(suite, "Recompiler Native", test_recomp_native);
+#endif
+    
+    // Lockstep differential tests
+    run_test(suite, "Lockstep Divergence", test_lockstep_divergence);
+    run_test(suite, "Livelock Detection", test_livelock_detection);
+#ifndef _WIN32
+    run_test(suite, "Explore Assertion", test_explore_assertion);
+#endif
+    
+    // Device tests
+    run_test(suite, "UART TX Sink", test_uart_tx_sink);
+    run_test(suite, "Timer Analytic", test_timer_analytic);
+    run_test(suite, "PIC Vectored", test_pic_vectored);
+    run_test(suite, "Wave Trace", test_wave_trace);
+    run_test(suite, "Wave Blink", test_wave_blink);
+    run_test(suite, "DMA Transfers", test_dma_transfers);
+    run_test(suite, "Framebuffer", test_framebuffer);
+    run_test(suite, "Device Registry", test_device_registry);
+    run_test(suite, "Machine Config", test_machine_config);
+    run_test(suite, "MMU Banking", test_mmu_banking);
+#ifndef _WIN32
+    run_test(suite, "Block Device", test_block_device);
+    run_test(suite, "SMP Atomics", test_smp_atomics);
+    run_test(suite, "Net Ring", test_net_ring);
+#endif
+#ifdef __linux__
+    run_test(suite, "UART RX Source", test_uart_rx_source);
+#endif
+    
     // Assembler tests
     run_test(suite, "Assembler Basic", test_assembler_basic);
+    run_test(suite, "Assembler Symbols", test_assembler_symbols);
+    run_test(suite, "Assembler Fixups", test_assembler_fixups);
+    run_test(suite, "Assembler String", test_assembler_string);
+    run_test(suite, "Assembler Objects", test_assembler_objects);
+    run_test(suite, "Assembler Arena", test_assembler_arena);
+    run_test(suite, "Assembler Includes", test_assembler_includes);
+    run_test(suite, "Assembler Relaxation", test_assembler_relaxation);
+    run_test(suite, "Assembler Listing", test_assembler_listing);
     
     // Integration tests
     run_test(suite, "Integration Hello", test_integration_hello);
@@ -412,12 +509,1976 @@ bool test_isa_instructions(void) {
     return true;
 }
 
+bool test_recomp_generate(void) {
+    uint8_t* memory = malloc(MEMORY_SIZE);
+    if (!memory) {
+        return false;
+    }
+    memory_init(memory);
+    
+    // 0x0200: LDI #3; loop: DEC A; BNE loop; HLT
+    uint8_t program[] = {0x00, 0x03, 0x16, 0x00, 0x51, 0xFC, 0x73, 0x00};
+    memcpy(&memory[0x0200], program, sizeof(program));
+    
+    FILE* out = tmpfile();
+    if (!out) {
+        free(memory);
+        return false;
+    }
+    
+    int blocks = recomp_generate(memory, 0x0200, sizeof(program), 0x0200, out);
+    
+    // Expect the entry block, the loop body and the fall-through after BNE
+    char text[8192];
+    rewind(out);
+    size_t length = fread(text, 1, sizeof(text) - 1, out);
+    text[length] = '\0';
+    fclose(out);
+    free(memory);
+    
+    return blocks == 3 &&
+           strstr(text, "static bool block_0200(") != NULL &&
+           strstr(text, "static bool block_0202(") != NULL &&
+           strstr(text, "static bool block_0206(") != NULL &&
+           strstr(text, "case 0x0202: return block_0202(cpu);") != NULL;
+}
+
+#ifndef _WIN32
+// The generated C, built with the host compiler and run through
+// recomp_run, must leave the machine as cpu_run does
+bool test_recomp_native(void) {
+    if (system("cc --version > /dev/null 2>&1") != 0) {
+        printf("(no host C compiler, skipped) ");
+        return true;
+    }
+    
+    // Ten rounds of arithmetic on $1000 and $1002 with a subroutine call,
+    // then the final flags to $1001
+    uint8_t program[0x3C] = {
+        0x00, 0x0A,                         // 0200: LDI #10
+        0x60, 0x00,                         // 0202: PHA
+        0x65, 0x02,                         // 0204: POP C
+        0x00, 0x00,                         // 0206: LDI #0
+        0x02, 0x00, 0x10,                   // 0208: STA [$1000]
+        0x01, 0x00, 0x10,                   // 020B: loop: LDA [$1000]
+        0x10, 0x07,                         // 020E: ADD #7
+        0x22, 0x5A,                         // 0210: XOR #$5A
+        0x02, 0x00, 0x10,                   // 0212: STA [$1000]
+        0x41, 0x30, 0x02,                   // 0215: JSR $0230
+        0x16, 0x02,                         // 0218: DEC C
+        0x51, 0xEF,                         // 021A: BNE loop
+        0x62, 0x00,                         // 021C: PHP
+        0x61, 0x00,                         // 021E: PLA
+        0x02, 0x01, 0x10,                   // 0220: STA [$1001]
+        0x73, 0x00,                         // 0223: HLT
+    };
+    const uint8_t subroutine[] = {
+        0x01, 0x02, 0x10,                   // 0230: LDA [$1002]
+        0x11, 0x03,                         // 0233: SUB #3
+        0x02, 0x02, 0x10,                   // 0235: STA [$1002]
+        0x14, 0x80,                         // 0238: CMP #$80
+        0x42, 0x00                          // 023A: RTS
+    };
+    memcpy(&program[0x30], subroutine, sizeof(subroutine));
+    
+    cpu_state_t* reference = cpu_create_isolated();
+    cpu_state_t* native = cpu_create_isolated();
+    FILE* out = fopen("test_recomp.c", "w");
+    if (!reference || !native || !out) {
+        cpu_destroy(reference);
+        cpu_destroy(native);
+        if (out) {
+            fclose(out);
+        }
+        return false;
+    }
+    cpu_load_program(reference, program, sizeof(program), 0x0200);
+    cpu_load_program(native, program, sizeof(program), 0x0200);
+    
+    int blocks = recomp_generate(native->memory, 0x0200, sizeof(program), 0x0200, out);
+    fclose(out);
+    bool built = blocks > 0 &&
+                 system("cc -O2 -shared -fPIC -I" EXAMPLES_DIR "/../src "
+                        "test_recomp.c -o test_recomp.so") == 0;
+    recomp_module_t* module = built ? recomp_load("./test_recomp.so") : NULL;
+    
+    bool same = false;
+    if (module && recomp_matches_image(module, native->memory)) {
+        cpu_reset_to_address(reference, 0x0200);
+        cpu_reset_to_address(native, 0x0200);
+        cpu_run(reference, 100000);
+        recomp_run(module, native, 100000);
+        same = module->native_blocks > 0 && !reference->running && !native->running &&
+               memcmp(reference->regs, native->regs, sizeof(reference->regs)) == 0 &&
+               reference->flags == native->flags &&
+               reference->cycle_count == native->cycle_count &&
+               reference->instruction_count == native->instruction_count &&
+               memcmp(reference->memory, native->memory, MEMORY_SIZE) == 0 &&
+               reference->memory[0x1002] == (uint8_t)(0 - 30);
+    }
+    
+    recomp_unload(module);
+    cpu_destroy(reference);
+    cpu_destroy(native);
+    remove("test_recomp.c");
+    remove("test_recomp.so");
+    return same;
+}
+#endif
+
+// Reference engine with an injected fault after the 150th instruction
+static bool faulty_engine_step(void* engine) {
+    cpu_state_t* cpu = engine;
+    bool result = lockstep_isa_engine.step(engine);
+    if (cpu->instruction_count == 150) {
+        cpu->regs[REG_B] ^= 0x01;
+    }
+    return result;
+}
+
+// Checkpoints allocated by the faulty engine; the rest are saved in place
+static int faulty_snapshot_count = 0;
+
+static void* faulty_engine_snapshot(void* engine) {
+    faulty_snapshot_count++;
+    return lockstep_isa_engine.snapshot(engine);
+}
+
+bool test_lockstep_divergence(void) {
+    uint8_t* image = malloc(MEMORY_SIZE);
+    if (!image) {
+        return false;
+    }
+    memory_init(image);
+    
+    // 0x0200: LDI #200; loop: DEC A; BNE loop; HLT (402 instructions)
+    uint8_t program[] = {0x00, 0xC8, 0x16, 0x00, 0x51, 0xFC, 0x73, 0x00};
+    memcpy(&image[0x0200], program, sizeof(program));
+    
+    lockstep_engine_t faulty = lockstep_isa_engine;
+    faulty.name = "faulty";
+    faulty.step = faulty_engine_step;
+    faulty.snapshot = faulty_engine_snapshot;
+    faulty_snapshot_count = 0;
+    
+    void* reference = lockstep_isa_engine.create();
+    void* clean = lockstep_isa_engine.create();
+    void* broken = faulty.create();
+    if (!reference || !clean || !broken) {
+        free(image);
+        return false;
+    }
+    
+    lockstep_config_t config = {64, 10000, false};
+    lockstep_result_t same;
+    lockstep_result_t different;
+    
+    // Identical engines agree until both halt
+    lockstep_isa_engine.start(reference, image, 0x0200);
+    lockstep_isa_engine.start(clean, image, 0x0200);
+    bool ok = lockstep_run(&lockstep_isa_engine, reference, &lockstep_isa_engine, clean, &config, &same);
+    
+    // The fault is bisected to the exact instruction
+    lockstep_isa_engine.start(reference, image, 0x0200);
+    faulty.start(broken, image, 0x0200);
+    ok = ok && lockstep_run(&lockstep_isa_engine, reference, &faulty, broken, &config, &different);
+    
+    lockstep_isa_engine.destroy(reference);
+    lockstep_isa_engine.destroy(clean);
+    faulty.destroy(broken);
+    free(image);
+    
+    return ok &&
+           !same.diverged && same.instructions == 402 &&
+           different.diverged && different.divergence_index == 150 &&
+           different.checks < 20 && faulty_snapshot_count == 1;
+}
+
+bool test_livelock_detection(void) {
+    cpu_state_t* cpu = cpu_create();
+    if (!cpu) return false;
+    
+    // 0x0200: loop: INC A; STA $0300; JMP loop (state repeats after 256 iterations)
+    uint8_t counter[] = {0x15, 0x00, 0x02, 0x00, 0x03, 0x40, 0x00, 0x02};
+    cpu_load_program(cpu, counter, sizeof(counter), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    
+    livelock_detector_t detector;
+    if (!livelock_init(&detector, cpu)) {
+        cpu_destroy(cpu);
+        return false;
+    }
+    livelock_run(&detector, cpu, 1000000);
+    bool counter_ok = detector.detected && detector.pc == 0x0200 &&
+                      detector.cycle_samples == 256 && cpu->cycle_count < 1000000;
+    livelock_cleanup(&detector);
+    
+    // 0x0200: LDI #3; loop: DEC A; BNE loop; HLT (terminates, no livelock)
+    uint8_t finite[] = {0x00, 0x03, 0x16, 0x00, 0x51, 0xFC, 0x73, 0x00};
+    cpu_load_program(cpu, finite, sizeof(finite), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    
+    if (!livelock_init(&detector, cpu)) {
+        cpu_destroy(cpu);
+        return false;
+    }
+    livelock_run(&detector, cpu, 1000000);
+    bool finite_ok = !detector.detected && !cpu->running;
+    livelock_cleanup(&detector);
+    
+    cpu_destroy(cpu);
+    return counter_ok && finite_ok;
+}
+
+#ifndef _WIN32
+bool test_explore_assertion(void) {
+    uint8_t* image = malloc(MEMORY_SIZE);
+    if (!image) {
+        return false;
+    }
+    memory_init(image);
+    
+    // 0x0200: LDA $8001; CMP #'A'; BEQ +2; HLT; 0x0209: NOP (assert); HLT
+    uint8_t program[] = {0x01, 0x01, 0x80, 0x14, 0x41, 0x50, 0x02, 0x73, 0x00,
+                         0x72, 0x00, 0x73, 0x00};
+    memcpy(&image[0x0200], program, sizeof(program));
+    
+    explore_config_t config;
+    explore_config_init(&config);
+    config.image = image;
+    config.entry_address = 0x0200;
+    config.asserts[config.assert_count++] = 0x0209;
+    config.rx_values[0] = 0x00;
+    config.rx_values[1] = 0x41;
+    config.rx_value_count = 2;
+    config.threads = 2;
+    config.memory_limit = 0;  // Force the visited set and frontier into spill files
+    
+    explore_result_t result;
+    bool ok = explore_run(&config, &result);
+    
+    bool found = ok && result.complete && result.halted == 1 &&
+                 result.violation_count == 1 &&
+                 result.violations[0].type == EXPLORE_VIOLATION_ASSERTION &&
+                 result.violations[0].pc == 0x0209 &&
+                 result.violations[0].step.input == EXPLORE_INPUT_RX &&
+                 result.violations[0].step.value == 0x41 &&
+                 result.spilled_bytes > 0 && result.frontier_spilled_bytes > 0;
+    
+    explore_result_free(&result);
+    free(image);
+    return found;
+}
+#endif
+
+bool test_uart_tx_sink(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    uart_sink_t* sink = uart_sink_create_capture();
+    if (!cpu || !sink) {
+        cpu_destroy(cpu);
+        uart_sink_destroy(sink);
+        return false;
+    }
+    uart_set_sink(&cpu->devices->uart, sink);
+    
+    // 0x0200: LDI #'H'; STA $8000; LDI #'I'; STA $8000; LDI #'\n'; STA $8000; HLT
+    uint8_t program[] = {0x00, 0x48, 0x02, 0x00, 0x80, 0x00, 0x49, 0x02, 0x00, 0x80,
+                         0x00, 0x0A, 0x02, 0x00, 0x80, 0x73, 0x00};
+    cpu_load_program(cpu, program, sizeof(program), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    cpu->running = true;
+    while (cpu->running && cpu->instruction_count < 100) {
+        cpu_step(cpu);
+    }
+    
+    // Whole line handed over in a single flush at HLT; RAM untouched
+    size_t size;
+    const uint8_t* output = uart_sink_captured(sink, &size);
+    bool ok = size == 3 && memcmp(output, "HI\n", 3) == 0 && sink->flushes == 1 &&
+              sink->bytes == 3 && cpu->memory[UART_TX_ADDR] == 0;
+    
+    cpu_destroy(cpu);
+    uart_sink_destroy(sink);
+    return ok;
+}
+
+bool test_timer_analytic(void) {
+    // O(1) advance must match per-cycle ticking (continuous, /5, latch 3)
+    timer_device_t ticked, advanced;
+    timer_init(&ticked);
+    timer_write(&ticked, TIMER_LATCH_ADDR, 3);
+    timer_write(&ticked, TIMER_COUNT_ADDR, 7);
+    timer_write(&ticked, TIMER_PRESCALER_ADDR, 4);
+    timer_write(&ticked, TIMER_CTRL_ADDR, 0x07);
+    advanced = ticked;
+    for (int i = 0; i < 1003; i++) {
+        timer_tick(&ticked);
+    }
+    timer_advance(&advanced, 1003);
+    bool equivalent = ticked.count == advanced.count &&
+                      ticked.prescaler_count == advanced.prescaler_count &&
+                      ticked.irq_pending == advanced.irq_pending &&
+                      ticked.expirations == advanced.expirations && ticked.expirations == 65;
+    
+    // Every expiry of a fast continuous timer is delivered on time:
+    // latch 10, prescaler /10 -> IRQ every 100 cycles
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!cpu) {
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    uint8_t loop[] = {0x40, 0x00, 0x02};  // 0x0200: JMP $0200 (3 cycles)
+    cpu_load_program(cpu, loop, sizeof(loop), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    isa_set_flag(cpu, FLAG_INTERRUPT);
+    
+    device_set_write(devices, TIMER_LATCH_ADDR, 10);
+    device_set_write(devices, TIMER_COUNT_ADDR, 10);
+    device_set_write(devices, TIMER_PRESCALER_ADDR, 9);
+    device_set_write(devices, TIMER_CTRL_ADDR, 0x07);
+    bool scheduled = devices->next_event == 100;
+    
+    int interrupts = 0;
+    bool on_time = true;
+    while (cpu->cycle_count < 10000) {
+        cpu_step(cpu);
+        if (devices->irq) {
+            interrupts++;
+            uint64_t expiry = (uint64_t)interrupts * 100;
+            on_time = on_time && cpu->cycle_count >= expiry && cpu->cycle_count < expiry + 3;
+            devices->now = cpu->cycle_count;
+            device_set_write(devices, TIMER_IRQ_ADDR, 0x01);
+        }
+    }
+    
+    // Count is computed from the cycle of the read
+    devices->now = 10050;
+    bool count_ok = device_set_read(devices, TIMER_COUNT_ADDR) == 5;
+    
+    cpu_destroy(cpu);
+    return equivalent && scheduled && interrupts == 100 && on_time && count_ok;
+}
+
+bool test_pic_vectored(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!cpu) {
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    uint8_t main_loop[] = {0x40, 0x00, 0x02};   // 0x0200: JMP $0200
+    uint8_t timer_isr[] = {0x40, 0x00, 0x03};   // 0x0300: JMP $0300
+    uint8_t gpio_isr[] = {0x40, 0x10, 0x03};    // 0x0310: JMP $0310
+    cpu_load_program(cpu, main_loop, sizeof(main_loop), 0x0200);
+    cpu_load_program(cpu, timer_isr, sizeof(timer_isr), 0x0300);
+    cpu_load_program(cpu, gpio_isr, sizeof(gpio_isr), 0x0310);
+    cpu_reset_to_address(cpu, 0x0200);
+    isa_clear_flag(cpu, FLAG_INTERRUPT);
+    
+    // Vectored mode: timer priority 1, UART RX 0, GPIO 2
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_TIMER, 0x00);
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_TIMER + 1, 0x03);
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_GPIO, 0x10);
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_GPIO + 1, 0x03);
+    device_set_write(devices, PIC_PRIORITY_ADDR + PIC_SOURCE_TIMER, 1);
+    device_set_write(devices, PIC_PRIORITY_ADDR + PIC_SOURCE_GPIO, 2);
+    device_set_write(devices, PIC_CTRL_ADDR, PIC_CTRL_VECTORED);
+    
+    // One-shot timer expiring at cycle 50
+    device_set_write(devices, TIMER_COUNT_ADDR, 50);
+    device_set_write(devices, TIMER_CTRL_ADDR, 0x06);
+    
+    while (cpu->cycle_count < 100 && isa_get_register16(cpu, REG_PC) != 0x0300) {
+        cpu_step(cpu);
+    }
+    pic_device_t* pic = &devices->pic;
+    bool timer_dispatched = isa_get_register16(cpu, REG_PC) == 0x0300 &&
+                            pic->dispatches[PIC_SOURCE_TIMER] == 1 &&
+                            pic->in_service == (1 << PIC_SOURCE_TIMER) &&
+                            pic->latency_max[PIC_SOURCE_TIMER] <= 3;
+    
+    // A lower-priority request waits while the timer is in service
+    devices->now = cpu->cycle_count;
+    device_set_write(devices, UART_CTRL_ADDR, UART_CTRL_RX_IRQ);
+    uart_receive(&devices->uart, 'x');
+    device_set_update_irq(devices);
+    bool blocked = !devices->irq && device_set_read(devices, PIC_PENDING_ADDR) == 0x03;
+    
+    // GPIO edges are masked after reset; once enabled, a higher-priority
+    // edge nests inside the timer handler
+    device_set_set_pin(devices, 0, true);
+    bool masked = !devices->irq && devices->gpio.edges == 0x01;
+    device_set_write(devices, PIC_MASK_ADDR, PIC_MASK_DEFAULT | (1 << PIC_SOURCE_GPIO));
+    bool source_ok = device_set_read(devices, PIC_SOURCE_ADDR) == PIC_SOURCE_GPIO;
+    isa_clear_flag(cpu, FLAG_INTERRUPT);
+    cpu_step(cpu);
+    cpu_step(cpu);
+    bool nested = isa_get_register16(cpu, REG_PC) == 0x0310 &&
+                  pic->in_service == ((1 << PIC_SOURCE_TIMER) | (1 << PIC_SOURCE_GPIO));
+    
+    // Acknowledge timer and GPIO and end both handlers; the UART request
+    // comes through
+    devices->now = cpu->cycle_count;
+    device_set_write(devices, PIC_PENDING_ADDR, (1 << PIC_SOURCE_TIMER) | (1 << PIC_SOURCE_GPIO));
+    device_set_write(devices, PIC_EOI_ADDR, PIC_SOURCE_GPIO);
+    bool still_blocked = !devices->irq;
+    device_set_write(devices, PIC_EOI_ADDR, PIC_SOURCE_TIMER);
+    bool released = devices->irq && pic_highest(pic) == PIC_SOURCE_UART_RX;
+    cpu_destroy(cpu);
+    
+    // A request firmware handles with interrupts masked is not taken later,
+    // neither through the vector table nor the legacy vector
+    cpu = cpu_create_isolated();
+    if (!cpu) {
+        return false;
+    }
+    devices = cpu->devices;
+    uint8_t legacy_isr[] = {0x40, 0x00, 0x04};  // 0x0400: JMP $0400
+    cpu_load_program(cpu, main_loop, sizeof(main_loop), 0x0200);
+    cpu_load_program(cpu, timer_isr, sizeof(timer_isr), 0x0300);
+    cpu_load_program(cpu, legacy_isr, sizeof(legacy_isr), 0x0400);
+    cpu->memory[0xFFFE] = 0x00;
+    cpu->memory[0xFFFF] = 0x04;
+    cpu_reset_to_address(cpu, 0x0200);
+    isa_set_flag(cpu, FLAG_INTERRUPT);
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_TIMER, 0x00);
+    device_set_write(devices, PIC_VECTOR_ADDR + 2 * PIC_SOURCE_TIMER + 1, 0x03);
+    device_set_write(devices, PIC_CTRL_ADDR, PIC_CTRL_VECTORED);
+    device_set_write(devices, TIMER_COUNT_ADDR, 20);
+    device_set_write(devices, TIMER_CTRL_ADDR, 0x06);
+    while (cpu->cycle_count < 100 && !cpu->irq_pending) {
+        cpu_step(cpu);
+    }
+    bool raised = cpu->irq_pending;
+    devices->now = cpu->cycle_count;
+    device_set_write(devices, PIC_PENDING_ADDR, 1 << PIC_SOURCE_TIMER);
+    device_set_write(devices, TIMER_IRQ_ADDR, 0x01);
+    isa_clear_flag(cpu, FLAG_INTERRUPT);
+    for (int i = 0; i < 10; i++) {
+        cpu_step(cpu);
+    }
+    bool dropped = raised && !devices->irq && !cpu->irq_pending && isa_get_register16(cpu, REG_PC) == 0x0200 &&
+                   devices->pic.dispatches[PIC_SOURCE_TIMER] == 0;
+    
+    // cpu_irq() stays raised while masked and enters at the legacy vector
+    isa_set_flag(cpu, FLAG_INTERRUPT);
+    cpu_irq(cpu);
+    cpu_step(cpu);
+    isa_clear_flag(cpu, FLAG_INTERRUPT);
+    cpu_step(cpu);
+    bool host = isa_get_register16(cpu, REG_PC) == 0x0400 && !cpu->irq_raised;
+    
+    cpu_destroy(cpu);
+    return timer_dispatched && blocked && masked && source_ok && nested && still_blocked && released &&
+           dropped && host;
+}
+
+bool test_wave_trace(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    wave_queue_t* queue = wave_queue_create(false);
+    if (!cpu || !queue) {
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    uint8_t loop[] = {0x40, 0x00, 0x02};    // 0x0200: JMP $0200
+    cpu_load_program(cpu, loop, sizeof(loop), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    device_set_attach_wave(devices, queue);
+    
+    // Continuous timer without IRQ: the traced output still toggles every 100 cycles
+    device_set_write(devices, TIMER_LATCH_ADDR, 100);
+    device_set_write(devices, TIMER_COUNT_ADDR, 100);
+    device_set_write(devices, TIMER_CTRL_ADDR, 0x05);
+    while (cpu->cycle_count < 1000) {
+        cpu_step(cpu);
+    }
+    devices->now = cpu->cycle_count;
+    device_set_write(devices, GPIO_PORT_ADDR, 0x01);
+    device_set_write(devices, GPIO_PORT_ADDR, 0x01);    // No change, no event
+    device_set_attach_wave(devices, NULL);
+    
+    const char* vcd_path = "test_wave.vcd.tmp";
+    const char* log_path = "test_wave.log.tmp";
+    wave_vcd_t* vcd = wave_vcd_open(vcd_path);
+    wave_rle_t* rle = wave_rle_open(log_path);
+    if (!vcd || !rle) {
+        return false;
+    }
+    
+    wave_event_t event;
+    int snapshots = 0, toggles = 0, gpio_changes = 0;
+    bool timed = true;
+    while (wave_queue_pop(queue, &event)) {
+        if (event.old_value == event.new_value) {
+            snapshots++;
+        } else if (event.signal == WAVE_SIGNAL_TIMER) {
+            toggles++;
+            timed = timed && event.cycle == (uint64_t)toggles * 100 && event.new_value == (toggles & 1);
+        } else if (event.signal == WAVE_SIGNAL_GPIO) {
+            gpio_changes++;
+        }
+        wave_vcd_write(vcd, &event);
+        wave_rle_write(rle, &event);
+    }
+    wave_vcd_close(vcd, cpu->cycle_count);
+    wave_rle_close(rle);
+    
+    // The log collapses the periodic toggles into a single repeat line
+    char line[128];
+    int lines = 0;
+    bool repeat = false;
+    FILE* file = fopen(log_path, "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        lines++;
+        repeat = repeat || strcmp(line, "R timer_out 2 4\n") == 0;
+    }
+    if (file) {
+        fclose(file);
+    }
+    
+    bool vcd_ok = false;
+    file = fopen(vcd_path, "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        vcd_ok = vcd_ok || strcmp(line, "#500\n") == 0;
+    }
+    if (file) {
+        fclose(file);
+    }
+    
+    remove(vcd_path);
+    remove(log_path);
+    wave_queue_destroy(queue);
+    cpu_destroy(cpu);
+    return snapshots == 4 && toggles == 10 && timed && gpio_changes == 1 && repeat &&
+           lines < 12 && vcd_ok;
+}
+
+bool test_wave_blink(void) {
+    assembler_t* assembler = assembler_create();
+    cpu_state_t* cpu = cpu_create_isolated();
+    wave_queue_t* queue = wave_queue_create(false);
+    if (!assembler || !cpu || !queue) {
+        return false;
+    }
+    bool assembled = assembler_assemble_file(assembler, EXAMPLES_DIR "/gpio_blink.asm");
+    if (assembled) {
+        cpu_load_program(cpu, assembler->output, assembler->output_size, 0x0200);
+        cpu_reset_to_address(cpu, 0x0200);
+        cpu->running = true;
+        device_set_attach_wave(cpu->devices, queue);
+        while (cpu->running && cpu->cycle_count < 1000000) {
+            cpu_step(cpu);
+        }
+        device_set_attach_wave(cpu->devices, NULL);
+    }
+    
+    // The timer interrupt toggles pin 0 every 4096 cycles
+    const char* log_path = "test_blink.log.tmp";
+    wave_rle_t* rle = wave_rle_open(log_path);
+    if (!rle) {
+        return false;
+    }
+    wave_event_t event;
+    int events = 0, toggles = 0;
+    while (wave_queue_pop(queue, &event)) {
+        events++;
+        toggles += event.signal == WAVE_SIGNAL_GPIO && (event.old_value ^ event.new_value) == 0x01;
+        wave_rle_write(rle, &event);
+    }
+    wave_rle_close(rle);
+    
+    // The periodic blink compresses to a few lines per signal
+    char line[128];
+    int lines = 0;
+    bool repeat = false;
+    FILE* file = fopen(log_path, "r");
+    while (file && fgets(line, sizeof(line), file)) {
+        lines += line[0] != '#';
+        repeat = repeat || strncmp(line, "R gpio 2 ", 9) == 0;
+    }
+    if (file) {
+        fclose(file);
+    }
+    remove(log_path);
+    
+    bool running = cpu->running;
+    wave_queue_destroy(queue);
+    cpu_destroy(cpu);
+    assembler_destroy(assembler);
+    return assembled && running && toggles >= 200 && repeat && lines * 10 < events;
+}
+
+// Program and start a DMA transfer through its registers
+static void start_dma(device_set_t* devices, uint8_t mode, uint16_t source, uint16_t dest, uint16_t length) {
+    device_set_write(devices, DMA_SRC_ADDR, source & 0xFF);
+    device_set_write(devices, DMA_SRC_ADDR_H, source >> 8);
+    device_set_write(devices, DMA_DST_ADDR, dest & 0xFF);
+    device_set_write(devices, DMA_DST_ADDR_H, dest >> 8);
+    device_set_write(devices, DMA_LEN_ADDR, length & 0xFF);
+    device_set_write(devices, DMA_LEN_ADDR_H, length >> 8);
+    device_set_write(devices, DMA_MODE_ADDR, mode);
+    device_set_write(devices, DMA_CTRL_ADDR, DMA_CTRL_START | DMA_CTRL_IRQ);
+}
+
+bool test_dma_transfers(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    uart_sink_t* sink = uart_sink_create_capture();
+    if (!cpu || !sink) {
+        cpu_destroy(cpu);
+        uart_sink_destroy(sink);
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    uart_set_sink(&devices->uart, sink);
+    cpu_enable_state_hash(cpu, true);
+    
+    // Copy 300 bytes at 2 cycles per byte; the CPU stalls for the burst
+    for (int i = 0; i < 300; i++) {
+        cpu->memory[0x1000 + i] = (uint8_t)(i * 7);
+    }
+    cpu_rehash_memory(cpu);
+    device_set_write(devices, DMA_CYCLES_ADDR, 2);
+    start_dma(devices, DMA_MODE_COPY, 0x1000, 0x2000, 300);
+    uint64_t start = cpu->cycle_count;
+    cpu_poll_devices(cpu);
+    bool copied = memcmp(&cpu->memory[0x1000], &cpu->memory[0x2000], 300) == 0 &&
+                  cpu->cycle_count - start == 600 &&
+                  device_set_read(devices, DMA_LEN_ADDR) == 0 &&
+                  device_set_read(devices, DMA_DST_ADDR_H) == 0x21 &&
+                  device_set_read(devices, DMA_CTRL_ADDR) == (DMA_STATUS_DONE | DMA_CTRL_IRQ) &&
+                  devices->irq && pic_highest(&devices->pic) == PIC_SOURCE_DMA;
+    
+    // The incremental memory hash follows the host-side memmove
+    uint64_t hash = cpu->memory_hash;
+    cpu_rehash_memory(cpu);
+    bool hashed = hash == cpu->memory_hash;
+    
+    // Fill; acknowledging through the PIC clears the completion IRQ
+    device_set_write(devices, PIC_PENDING_ADDR, 1 << PIC_SOURCE_DMA);
+    bool acked = !devices->irq;
+    start_dma(devices, DMA_MODE_FILL, 0x00AA, 0x3000, 16);
+    cpu_poll_devices(cpu);
+    bool filled = cpu->memory[0x3000] == 0xAA && cpu->memory[0x300F] == 0xAA && cpu->memory[0x3010] == 0;
+    
+    // Memory to UART goes through the TX register and its sink
+    cpu_load_program(cpu, (const uint8_t*)"DMA\n", 4, 0x4000);
+    start_dma(devices, DMA_MODE_TO_UART, 0x4000, 0, 4);
+    cpu_poll_devices(cpu);
+    uart_sink_flush(sink);
+    size_t size = 0;
+    const uint8_t* captured = uart_sink_captured(sink, &size);
+    bool sent = size == 4 && memcmp(captured, "DMA\n", 4) == 0;
+    
+    // UART to memory waits for bytes to arrive
+    uart_receive(&devices->uart, 'o');
+    uart_receive(&devices->uart, 'k');
+    start_dma(devices, DMA_MODE_FROM_UART, 0, 0x5000, 3);
+    cpu_poll_devices(cpu);
+    bool waiting = devices->dma.busy && device_set_read(devices, DMA_LEN_ADDR) == 1 &&
+                   !devices->uart.rx_ready;
+    uart_receive(&devices->uart, '!');
+    cpu_poll_devices(cpu);
+    bool received = !devices->dma.busy && devices->dma.done && memcmp(&cpu->memory[0x5000], "ok!", 3) == 0;
+    
+    hash = cpu->memory_hash;
+    cpu_rehash_memory(cpu);
+    hashed = hashed && hash == cpu->memory_hash;
+    
+    cpu_destroy(cpu);
+    uart_sink_destroy(sink);
+    return copied && hashed && acked && filled && sent && waiting && received;
+}
+
+bool test_framebuffer(void) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    fb_display_t* display = fb_display_create();
+    fb_view_t* view = calloc(1, sizeof(fb_view_t));
+    if (!cpu || !display || !view) {
+        cpu_destroy(cpu);
+        fb_display_destroy(display);
+        free(view);
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    device_set_attach_display(devices, display);
+    
+    // Attaching sends the whole frame with the first present
+    device_set_write(devices, FB_CTRL_ADDR, FB_CTRL_PRESENT);
+    cpu_poll_devices(cpu);
+    bool full = fb_display_fetch(display, view) == FB_ALL_ROWS && view->frame == 1;
+    
+    // Guest writes mark rows; nothing reaches consumers before the present
+    isa_write_memory(cpu, FB_START + 3 * 16, 0x80);
+    isa_write_memory(cpu, FB_START + 10 * 16 + 15, 0x01);
+    bool tracked = devices->fb.dirty == ((1ULL << 3) | (1ULL << 10));
+    bool held = fb_display_fetch(display, view) == 0 && fb_view_pixel(view, 0, 3) == 0;
+    
+    // Presenting copies only the written rows
+    device_set_write(devices, FB_CTRL_ADDR, FB_CTRL_PRESENT);
+    bool pending = device_set_read(devices, FB_CTRL_ADDR) == FB_CTRL_PRESENT;
+    cpu_poll_devices(cpu);
+    uint64_t rows = fb_display_fetch(display, view);
+    bool presented = rows == ((1ULL << 3) | (1ULL << 10)) && devices->fb.dirty == 0 &&
+                     fb_view_pixel(view, 0, 3) == 0xFFFFFF && fb_view_pixel(view, 1, 3) == 0 &&
+                     fb_view_pixel(view, 127, 10) == 0xFFFFFF;
+    
+    // Automatic mode publishes on its own once the interval has passed
+    device_set_write(devices, FB_CTRL_ADDR, FB_CTRL_AUTO);
+    isa_write_memory(cpu, FB_START + 63 * 16, 0xFF);
+    cpu_poll_devices(cpu);
+    bool waited = fb_display_fetch(display, view) == 0;
+    cpu->cycle_count += FB_AUTO_CYCLES;
+    cpu_poll_devices(cpu);
+    bool automatic = fb_display_fetch(display, view) == (1ULL << 63) && fb_view_pixel(view, 7, 63) == 0xFFFFFF;
+    
+    // Switching format resends every row; RGB332 rows are 128 bytes
+    device_set_write(devices, FB_CTRL_ADDR, 0);
+    device_set_write(devices, FB_FORMAT_ADDR, FB_FORMAT_RGB332);
+    isa_write_memory(cpu, FB_START + 5 * FB_WIDTH + 2, 0xE0);
+    device_set_write(devices, FB_CTRL_ADDR, FB_CTRL_PRESENT);
+    cpu_poll_devices(cpu);
+    bool color = fb_display_fetch(display, view) == FB_ALL_ROWS && view->format == FB_FORMAT_RGB332 &&
+                 fb_view_pixel(view, 2, 5) == 0xFF0000;
+    
+    // Frame dump
+    const char* path = "test_frame.tmp";
+    bool dumped = fb_view_write_ppm(view, path);
+    FILE* file = fopen(path, "rb");
+    char header[16] = {0};
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        dumped = dumped && ftell(file) == 14 + FB_WIDTH * FB_HEIGHT * 3;
+        fseek(file, 0, SEEK_SET);
+        dumped = dumped && fread(header, 1, 14, file) == 14 && strcmp(header, "P6\n128 64\n255\n") == 0;
+        fclose(file);
+    }
+    remove(path);
+    
+    device_set_attach_display(devices, NULL);
+    cpu_destroy(cpu);
+    fb_display_destroy(display);
+    free(view);
+    return full && tracked && held && pending && presented && waited && automatic && color && dumped;
+}
+
+// Test device: a register that counts up once, 10 cycles after each write
+typedef struct {
+    uint8_t value;
+    uint64_t due;
+} test_counter_t;
+
+static void test_counter_init(device_set_t* set, void* state) {
+    (void)set;
+    test_counter_t* counter = state;
+    counter->value = 0;
+    counter->due = UINT64_MAX;
+}
+
+static uint8_t test_counter_read(device_set_t* set, void* state, uint16_t address) {
+    (void)set;
+    (void)address;
+    return ((test_counter_t*)state)->value;
+}
+
+static void test_counter_write(device_set_t* set, void* state, uint16_t address, uint8_t value) {
+    (void)address;
+    test_counter_t* counter = state;
+    counter->value = value;
+    counter->due = set->now + 10;
+}
+
+static uint64_t test_counter_next_event(const device_set_t* set, const void* state) {
+    (void)set;
+    return ((const test_counter_t*)state)->due;
+}
+
+static void test_counter_service(device_set_t* set, void* state, uint64_t now) {
+    (void)set;
+    (void)now;
+    test_counter_t* counter = state;
+    counter->value++;
+    counter->due = UINT64_MAX;
+}
+
+static const device_ops_t test_counter_ops = {
+    DEVICE_PLUGIN_ABI, "counter",
+    {{0x8090, 1, DEVICE_ACCESS_RW}, {0xC000, 1, DEVICE_ACCESS_READ}},
+    sizeof(test_counter_t), test_counter_init, NULL, test_counter_read, test_counter_write,
+    test_counter_next_event, test_counter_service, NULL
+};
+
+bool test_device_registry(void) {
+    cpu_state_t* before = cpu_create_isolated();
+    
+    // Claims must not overlap and must stay in the MMIO window
+    device_ops_t clash = test_counter_ops;
+    clash.ranges[0].base = UART_STATUS_ADDR;
+    device_ops_t outside = test_counter_ops;
+    outside.ranges[1].base = 0x7000;
+    device_ops_t old_abi = test_counter_ops;
+    old_abi.abi_version = DEVICE_PLUGIN_ABI + 1;
+    bool rejected = !device_register(&clash) && !device_register(&outside) && !device_register(&old_abi);
+    
+    bool registered = device_register(&test_counter_ops);
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!before || !cpu || !registered) {
+        cpu_destroy(before);
+        cpu_destroy(cpu);
+        device_unregister(&test_counter_ops);
+        return false;
+    }
+    
+    // In-tree devices keep their addresses alongside the plugin
+    bool builtin = device_set_read(cpu->devices, UART_STATUS_ADDR) == device_set_read(before->devices, UART_STATUS_ADDR) &&
+                   memory_is_readable(UART_RX_ADDR) && !memory_is_writable(UART_RX_ADDR) &&
+                   !memory_is_readable(0x80FE);
+    
+    // Both ranges dispatch to the plugin; the rest of the page stays memory
+    isa_write_memory(cpu, 0x8090, 0x41);
+    bool dispatched = isa_read_memory(cpu, 0xC000) == 0x41 && cpu->memory[0xC000] == 0 &&
+                      memory_is_readable(0xC000) && !memory_is_writable(0xC000);
+    isa_write_memory(cpu, 0xC001, 0x55);
+    bool memory = cpu->memory[0xC001] == 0x55;
+    
+    // The plugin's event is serviced on schedule
+    uint8_t packed[DEVICES_STATE_SIZE];
+    size_t length = device_set_pack_state(cpu->devices, cpu->cycle_count, packed);
+    cpu->cycle_count += 9;
+    cpu_poll_devices(cpu);
+    bool early = isa_read_memory(cpu, 0x8090) == 0x41;
+    cpu->cycle_count += 1;
+    cpu_poll_devices(cpu);
+    bool serviced = isa_read_memory(cpu, 0x8090) == 0x42;
+    
+    // Plugin state is part of the packed device state
+    uint8_t repacked[DEVICES_STATE_SIZE];
+    bool hashed = length <= DEVICES_STATE_SIZE &&
+                  device_set_pack_state(cpu->devices, cpu->cycle_count, repacked) == length &&
+                  memcmp(packed, repacked, length) != 0;
+    
+    // Machines created earlier keep the map they were created with
+    isa_write_memory(before, 0xC000, 0x77);
+    bool isolated = before->memory[0xC000] == 0x77 && device_set_read(before->devices, 0x8090) == 0;
+    
+    device_unregister(&test_counter_ops);
+    bool removed = !memory_is_readable(0xC000);
+    
+    cpu_destroy(before);
+    cpu_destroy(cpu);
+    return rejected && builtin && dispatched && memory && early && serviced && hashed && isolated && removed;
+}
+
+bool test_machine_config(void) {
+    const char* description =
+        "; test board\n"
+        "[machine]\n"
+        "name = test board\n"
+        "clock = 4000000\n"
+        "[ram]\n"
+        "start = 0x8000\n"
+        "end = 0x80FF   ; old device page becomes RAM\n"
+        "[open]\n"
+        "start = 0xFE00\n"
+        "end = 0xFEFF\n"
+        "[rom]\n"
+        "start = 0xC000\n"
+        "end = 0xCFFF\n"
+        "[device uart]\n"
+        "base = 0xFE00\n"
+        "[device block]\n"
+        "enabled = no\n"
+        "[irq]\n"
+        "uart-rx = 6\n"
+        "[cycles]\n"
+        "ldi = 5\n";
+    machine_config_t config;
+    machine_config_default(&config);
+    bool parsed = machine_config_parse(&config, description, "test") &&
+                  strcmp(config.name, "test board") == 0 && config.clock_hz == 4000000 && !config.default_cycles;
+    cpu_state_t* cpu = parsed ? cpu_create_from_config(&config) : NULL;
+    if (!cpu) {
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    
+    // The UART moved with its register order; its old page is plain RAM
+    isa_write_memory(cpu, 0x8002, 0x5A);
+    bool relocated = isa_read_memory(cpu, 0xFE02) == device_set_read(devices, 0xFE02) &&
+                     (isa_read_memory(cpu, 0xFE02) & 0x01) && isa_read_memory(cpu, 0x8002) == 0x5A &&
+                     device_set_read(devices, 0xFE03) == 0;
+    
+    // Devices left in place still answer; the disabled one does not
+    isa_write_memory(cpu, DMA_CYCLES_ADDR, 3);
+    isa_write_memory(cpu, BLOCK_COUNT_ADDR, 7);
+    bool placed = devices->dma.cycles_per_byte == 3 && devices->block.count != 7 &&
+                  cpu->memory[BLOCK_COUNT_ADDR] == 7;
+    
+    // ROM keeps loaded contents; open bus reads 0
+    uint8_t firmware[] = {0x12, 0x34};
+    cpu_load_program(cpu, firmware, sizeof(firmware), 0xC000);
+    isa_write_memory(cpu, 0xC000, 0xFF);
+    isa_write_memory(cpu, 0xFE80, 0xFF);
+    bool rom = isa_read_memory(cpu, 0xC000) == 0x12 && isa_read_memory(cpu, 0xFE80) == 0;
+    
+    // UART RX raises line 6, which is enabled by default in its place
+    isa_write_memory(cpu, 0xFE0A, UART_CTRL_RX_IRQ);
+    uart_receive(&devices->uart, 'x');
+    device_set_update_irq(devices);
+    bool routed = devices->pic.lines == (1 << 6) && (devices->pic.mask & (1 << 6)) &&
+                  !(devices->pic.mask & (1 << PIC_SOURCE_UART_RX)) && devices->irq;
+    
+    // Instruction costs come from the description
+    uint8_t program[] = {0x00, 0x42};
+    cpu_load_program(cpu, program, sizeof(program), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    cpu_step(cpu);
+    bool cycles = cpu->cycle_count == 5 && cpu->frequency_hz == 4000000;
+    cpu_destroy(cpu);
+    
+    // DMA obeys the same map: a fill running from RAM into ROM only lands
+    // in RAM, and a copy into ROM leaves it unchanged
+    machine_config_default(&config);
+    cpu = machine_config_parse(&config, "[rom]\nstart = 0x1000\nend = 0x1FFF\n", "low-rom")
+              ? cpu_create_from_config(&config) : NULL;
+    bool dma_rom = cpu != NULL;
+    if (cpu) {
+        cpu_load_program(cpu, firmware, sizeof(firmware), 0x1000);
+        start_dma(cpu->devices, DMA_MODE_FILL, 0x00EE, 0x0FF8, 16);
+        cpu_poll_devices(cpu);
+        start_dma(cpu->devices, DMA_MODE_COPY, 0x0FF8, 0x1000, 2);
+        cpu_poll_devices(cpu);
+        dma_rom = cpu->memory[0x0FF8] == 0xEE && cpu->memory[0x0FFF] == 0xEE &&
+                  cpu->memory[0x1000] == 0x12 && cpu->memory[0x1001] == 0x34 &&
+                  cpu->memory[0x1007] == 0 && cpu->devices->dma.done;
+        cpu_destroy(cpu);
+    }
+    
+    // Layouts that cannot work are rejected
+    machine_config_t bad;
+    machine_config_default(&bad);
+    bool rejected = !machine_config_parse(&bad, "[irq]\ntimer = 1\n", "shared-line");
+    machine_config_default(&bad);
+    rejected = rejected && !machine_config_parse(&bad, "[rom]\nstart = 0x8000\nend = 0x80FF\n", "rom-over-devices");
+    machine_config_default(&bad);
+    rejected = rejected && !machine_config_parse(&bad, "[device uart]\nbase = 0x8003\n", "overlap");
+    machine_config_default(&bad);
+    rejected = rejected && !machine_config_parse(&bad, "[disk]\n", "section");
+    
+    return parsed && relocated && placed && rom && routed && cycles && dma_rom && rejected;
+}
+
+// Select the bank shown in a window
+static void map_bank(cpu_state_t* cpu, uint8_t window, uint16_t bank) {
+    isa_write_memory(cpu, MMU_WINDOW_ADDR, window);
+    isa_write_memory(cpu, MMU_BANK_ADDR, bank & 0xFF);
+    isa_write_memory(cpu, MMU_BANK_ADDR_H, bank >> 8);
+}
+
+bool test_mmu_banking(void) {
+    machine_config_t config;
+    machine_config_default(&config);
+    bool parsed = machine_config_parse(&config, "[machine]\nmemory = 1M\n", "banked");
+    cpu_state_t* cpu = parsed ? cpu_create_from_config(&config) : NULL;
+    if (!cpu) {
+        return false;
+    }
+    mmu_device_t* mmu = &cpu->devices->mmu;
+    bool sized = cpu->memory_size == 1024 * 1024 && isa_read_memory(cpu, MMU_SIZE_ADDR) == 15;
+    cpu_enable_state_hash(cpu, true);
+    
+    // Until enabled, bank registers do not move anything
+    map_bank(cpu, 0xA, 0x40);
+    isa_write_memory(cpu, 0xA010, 0x11);
+    bool identity = cpu->memory[0xA010] == 0x11 && mmu_is_identity(mmu, 0x0000, 0x10000);
+    
+    // Window 0xA000 shows bank 0x40 (physical 0x40000); switching banks
+    // swaps what the window sees
+    isa_write_memory(cpu, MMU_CTRL_ADDR, MMU_CTRL_ENABLE);
+    isa_write_memory(cpu, 0xA010, 0x77);
+    bool banked = cpu->memory[0x40010] == 0x77 && cpu->memory[0xA010] == 0x11 &&
+                  isa_physical_address(cpu, 0xAFFF) == 0x40FFF;
+    map_bank(cpu, 0xA, 0x41);
+    banked = banked && isa_read_memory(cpu, 0xA010) == 0;
+    map_bank(cpu, 0xA, 0x40);
+    banked = banked && isa_read_memory(cpu, 0xA010) == 0x77 && !mmu_is_identity(mmu, 0xA000, 1) &&
+             mmu_is_identity(mmu, 0x0000, 0xA000);
+    
+    // Device registers stay visible whatever a window holds
+    map_bank(cpu, 0x8, 0x23);
+    bool devices = isa_read_memory(cpu, MMU_CTRL_ADDR) == MMU_CTRL_ENABLE;
+    
+    // The incremental hash is keyed by physical address
+    uint64_t hash = cpu_state_hash(cpu);
+    cpu_rehash_memory(cpu);
+    bool hashed = cpu_state_hash(cpu) == hash;
+    
+    // Snapshots carry all of physical memory and the bank registers
+    cpu_snapshot_t* snapshot = cpu_snapshot_create();
+    bool saved = cpu_snapshot_save(cpu, snapshot);
+    isa_write_memory(cpu, 0xA010, 0x78);
+    map_bank(cpu, 0xA, 0x99);
+    bool changed = !cpu_snapshot_matches(cpu, snapshot);
+    cpu_snapshot_restore(cpu, snapshot);
+    bool restored = saved && cpu_snapshot_matches(cpu, snapshot) && cpu->memory[0x40010] == 0x77 &&
+                    isa_read_memory(cpu, 0xA010) == 0x77;
+    cpu_snapshot_destroy(snapshot);
+    
+    // Framebuffer rows are dirtied by writes to its physical memory, from
+    // whichever window maps it
+    map_bank(cpu, 0x1, FB_START >> 12);
+    map_bank(cpu, 0x9, 0x30);
+    cpu->devices->fb.dirty = 0;
+    isa_write_memory(cpu, 0x9000, 0xFF);
+    bool clean = cpu->devices->fb.dirty == 0;
+    isa_write_memory(cpu, 0x1000 + 2 * FB_ROW_BYTES(FB_FORMAT_MONO), 0xFF);
+    bool dirty = clean && cpu->devices->fb.dirty == (1ULL << 2);
+    
+    // Instructions are fetched through the mapping
+    uint8_t program[] = {0x00, 0x5A, 0x73, 0x00};       // LDI #$5A; HLT
+    memcpy(&cpu->memory[0x20000], program, sizeof(program));
+    cpu_rehash_memory(cpu);
+    map_bank(cpu, 0x2, 0x20);
+    cpu_reset_to_address(cpu, 0x2000);
+    cpu_step(cpu);
+    bool fetched = isa_get_register(cpu, REG_A) == 0x5A;
+    
+    // 8 KiB windows
+    isa_write_memory(cpu, MMU_CTRL_ADDR, MMU_CTRL_ENABLE | MMU_CTRL_8K);
+    map_bank(cpu, 0x1, 0x3);
+    bool large = isa_physical_address(cpu, 0x3FFF) == 0x7FFF && isa_read_memory(cpu, MMU_WINDOW_ADDR) == 1;
+    
+    // Reset maps memory straight through again
+    cpu_reset(cpu);
+    bool reset = mmu->control == 0 && mmu_is_identity(mmu, 0x0000, 0x10000);
+    cpu_destroy(cpu);
+    
+    // Physical memory must be a power of two the MMU can bank
+    machine_config_default(&config);
+    bool rejected = !machine_config_parse(&config, "[machine]\nmemory = 96K\n", "odd-size") &&
+                    !machine_config_parse(&config, "[machine]\nmemory = 32M\n", "too-large");
+    
+    return sized && identity && banked && devices && hashed && changed && restored && dirty &&
+           fetched && large && reset && rejected;
+}
+
+#ifndef _WIN32
+static void start_block(device_set_t* devices, uint8_t command, uint16_t sector, uint16_t buffer, uint8_t count) {
+    device_set_write(devices, BLOCK_SECTOR_ADDR, sector & 0xFF);
+    device_set_write(devices, BLOCK_SECTOR_ADDR_H, sector >> 8);
+    device_set_write(devices, BLOCK_BUFFER_ADDR, buffer & 0xFF);
+    device_set_write(devices, BLOCK_BUFFER_ADDR_H, buffer >> 8);
+    device_set_write(devices, BLOCK_COUNT_ADDR, count);
+    device_set_write(devices, BLOCK_CMD_ADDR, command);
+}
+
+// Host I/O threads get this long before a test gives up on them
+#define HOST_WAIT_SECONDS 10
+
+static struct timespec host_deadline(void) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += HOST_WAIT_SECONDS;
+    return deadline;
+}
+
+// Sleep between polls of a host thread; false once the deadline has passed
+static bool host_wait(const struct timespec* deadline) {
+    struct timespec now;
+    struct timespec pause = {0, 100000};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline->tv_sec ||
+        (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec)) {
+        return false;
+    }
+    nanosleep(&pause, NULL);
+    return true;
+}
+
+// Poll until an async command completes
+static bool wait_block(cpu_state_t* cpu) {
+    struct timespec deadline = host_deadline();
+    while (cpu->devices->block.busy && host_wait(&deadline)) {
+        cpu_poll_devices(cpu);
+    }
+    return !cpu->devices->block.busy;
+}
+
+bool test_block_device(void) {
+    const char* path = "test_block.tmp";
+    uint8_t sector[BLOCK_SECTOR_SIZE];
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        memset(sector, 0x10 + i, sizeof(sector));
+        fwrite(sector, 1, sizeof(sector), file);
+    }
+    fclose(file);
+    
+    block_image_t* image = block_image_open(path);
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!image || !cpu) {
+        block_image_close(image);
+        cpu_destroy(cpu);
+        remove(path);
+        return false;
+    }
+    device_set_t* devices = cpu->devices;
+    cpu_enable_state_hash(cpu, true);
+    blockdev_attach(cpu, image);
+    bool sized = device_set_read(devices, BLOCK_SIZE_ADDR) == 4;
+    
+    // Read two sectors from the mapping; completion raises the IRQ
+    device_set_write(devices, BLOCK_CTRL_ADDR, BLOCK_CTRL_IRQ);
+    start_block(devices, BLOCK_CMD_READ, 1, 0x2000, 2);
+    bool busy = device_set_read(devices, BLOCK_STATUS_ADDR) == BLOCK_STATUS_BUSY;
+    cpu_poll_devices(cpu);
+    bool read = cpu->memory[0x2000] == 0x11 && cpu->memory[0x21FF] == 0x11 &&
+                cpu->memory[0x2200] == 0x12 && cpu->memory[0x23FF] == 0x12 &&
+                device_set_read(devices, BLOCK_STATUS_ADDR) == BLOCK_STATUS_DONE &&
+                devices->irq && pic_highest(&devices->pic) == PIC_SOURCE_BLOCK;
+    uint64_t hash = cpu->memory_hash;
+    cpu_rehash_memory(cpu);
+    bool hashed = hash == cpu->memory_hash;
+    
+    // Write one sector back; acknowledging through the PIC clears the IRQ
+    device_set_write(devices, PIC_PENDING_ADDR, 1 << PIC_SOURCE_BLOCK);
+    bool acked = !devices->irq;
+    memset(sector, 0x5A, sizeof(sector));
+    cpu_load_program(cpu, sector, sizeof(sector), 0x3000);
+    start_block(devices, BLOCK_CMD_WRITE, 3, 0x3000, 1);
+    cpu_poll_devices(cpu);
+    start_block(devices, BLOCK_CMD_FLUSH, 0, 0, 0);
+    cpu_poll_devices(cpu);
+    bool written = devices->block.done && !devices->block.error &&
+                   devices->block.sectors_read == 2 && devices->block.sectors_written == 1;
+    
+    // Sectors past the end of the image fail without moving data
+    start_block(devices, BLOCK_CMD_READ, 3, 0x4000, 2);
+    cpu_poll_devices(cpu);
+    bool rejected = device_set_read(devices, BLOCK_STATUS_ADDR) == (BLOCK_STATUS_DONE | BLOCK_STATUS_ERROR) &&
+                    cpu->memory[0x4000] == 0;
+    block_image_close(image);
+    
+    // The async backend sees the mmap backend's write and completes later
+    image = block_image_open("async:test_block.tmp");
+    blockdev_attach(cpu, image);
+    start_block(devices, BLOCK_CMD_READ, 2, 0x4000, 2);
+    bool async_read = image && wait_block(cpu) && !devices->block.error &&
+                      cpu->memory[0x4000] == 0x12 && cpu->memory[0x4200] == 0x5A;
+    memset(sector, 0xC3, sizeof(sector));
+    cpu_load_program(cpu, sector, sizeof(sector), 0x3000);
+    start_block(devices, BLOCK_CMD_WRITE, 0, 0x3000, 1);
+    bool async_written = image && wait_block(cpu) && !devices->block.error;
+    hash = cpu->memory_hash;
+    cpu_rehash_memory(cpu);
+    hashed = hashed && hash == cpu->memory_hash;
+    blockdev_attach(cpu, NULL);
+    block_image_close(image);
+    
+    // Both writes reached the file
+    file = fopen(path, "rb");
+    uint8_t contents[4 * BLOCK_SECTOR_SIZE] = {0};
+    bool persisted = file && fread(contents, 1, sizeof(contents), file) == sizeof(contents) &&
+                     contents[0] == 0xC3 && contents[BLOCK_SECTOR_SIZE - 1] == 0xC3 &&
+                     contents[BLOCK_SECTOR_SIZE] == 0x11 && contents[3 * BLOCK_SECTOR_SIZE] == 0x5A &&
+                     contents[4 * BLOCK_SECTOR_SIZE - 1] == 0x5A;
+    if (file) {
+        fclose(file);
+    }
+    
+    cpu_destroy(cpu);
+    remove(path);
+    return sized && busy && read && hashed && acked && written && rejected && async_read &&
+           async_written && persisted;
+}
+
+// Each core adds 10 to a counter with CAS and 10 to another under a TAS
+// lock; core 0 then waits for the second total and sends core 1 an IPI
+static const uint8_t smp_program[] = {
+    0x00, 0x0A, 0x60, 0x00, 0x65, 0x03,     // LDI #10; PHA; POP D
+    0x01, 0x00, 0x10, 0x60, 0x00,           // loop: LDA $1000; PHA
+    0x10, 0x01, 0x60, 0x00, 0x65, 0x01,     // ADD #1; PHA; POP B
+    0x61, 0x00, 0x81, 0x00, 0x10,           // PLA; CAS $1000
+    0x51, 0xEE,                             // BNE loop
+    0x80, 0x01, 0x10, 0x51, 0xFB,           // lock: TAS $1001; BNE lock
+    0x01, 0x02, 0x10, 0x10, 0x01,           // LDA $1002; ADD #1
+    0x02, 0x02, 0x10,                       // STA $1002
+    0x00, 0x00, 0x02, 0x01, 0x10,           // LDI #0; STA $1001
+    0x16, 0x03, 0x51, 0xD8,                 // DEC D; BNE loop
+    0x01, 0x70, 0x80, 0x14, 0x00,           // LDA IPI_CORE; CMP #0
+    0x51, 0x0C,                             // BNE park
+    0x01, 0x02, 0x10, 0x14, 0x28,           // wait: LDA $1002; CMP #40
+    0x51, 0xF9,                             // BNE wait
+    0x00, 0x02, 0x02, 0x72, 0x80,           // LDI #2; STA IPI_SEND
+    0x73, 0x00                              // park: HLT
+};
+
+// IPI handler at 0x0300
+static const uint8_t smp_handler[] = {
+    0x00, 0x02, 0x02, 0x73, 0x80,           // LDI #2; STA IPI_PENDING
+    0x00, 0x5A, 0x02, 0x03, 0x10,           // LDI #$5A; STA $1003
+    0x73, 0x00                              // HLT
+};
+
+// Run the program on four cores and check the totals
+static bool run_smp_program(smp_schedule_t schedule, uint32_t quantum, uint32_t* instructions) {
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!cpu) {
+        return false;
+    }
+    
+    cpu_load_program(cpu, smp_program, sizeof(smp_program), 0x0200);
+    cpu_load_program(cpu, smp_handler, sizeof(smp_handler), 0x0300);
+    cpu->memory[0xFFFE] = 0x00;
+    cpu->memory[0xFFFF] = 0x03;
+    
+    smp_machine_t* smp = smp_create(cpu, 4, quantum, schedule);
+    bool ok = smp != NULL;
+    if (ok) {
+        smp_reset_to_address(smp, 0x0200);
+        ok = !smp_run(smp, 1000000) && cpu->memory[0x1000] == 40 && cpu->memory[0x1001] == 0 &&
+             cpu->memory[0x1002] == 40 && cpu->memory[0x1003] == 0x5A &&
+             cpu->devices->ipi.pending == 0;
+        for (int i = 0; i < 4; i++) {
+            instructions[i] = smp->cores[i]->instruction_count;
+            ok = ok && !smp->stopped[i];
+        }
+        smp_destroy(smp);
+    }
+    
+    cpu_destroy(cpu);
+    return ok;
+}
+
+bool test_smp_atomics(void) {
+    // TAS and CAS on one core
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!cpu) {
+        return false;
+    }
+    
+    uint8_t program[] = {0x80, 0x00, 0x10, 0x80, 0x00, 0x10};   // TAS $1000; TAS $1000
+    cpu_load_program(cpu, program, sizeof(program), 0x0200);
+    cpu_enable_state_hash(cpu, true);
+    cpu_reset_to_address(cpu, 0x0200);
+    cpu_step(cpu);
+    bool taken = isa_get_register(cpu, REG_A) == 0 && isa_get_flag(cpu, FLAG_ZERO) &&
+                 cpu->memory[0x1000] == 0xFF;
+    cpu_step(cpu);
+    bool busy = isa_get_register(cpu, REG_A) == 0xFF && !isa_get_flag(cpu, FLAG_ZERO);
+    uint64_t hash = cpu_state_hash(cpu);
+    cpu_rehash_memory(cpu);
+    bool hashed = cpu_state_hash(cpu) == hash;
+    
+    bool swapped = isa_compare_swap_memory(cpu, 0x1000, 0xFF, 0x34) == 0xFF && cpu->memory[0x1000] == 0x34;
+    bool kept = isa_compare_swap_memory(cpu, 0x1000, 0xFF, 0x56) == 0x34 && cpu->memory[0x1000] == 0x34;
+    
+    // CAS sets the flags as CMP of A with the old byte
+    uint8_t compare[] = {0x81, 0x00, 0x10, 0x14, 0x01};  // CAS $1000; CMP #1
+    uint8_t mask = FLAG_ZERO | FLAG_NEGATIVE | FLAG_CARRY | FLAG_OVERFLOW;
+    cpu_load_program(cpu, compare, sizeof(compare), 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    isa_write_memory(cpu, 0x1000, 0x01);
+    isa_set_register(cpu, REG_A, 0x80);
+    cpu_step(cpu);
+    uint8_t cas_flags = cpu->flags & mask;
+    isa_set_register(cpu, REG_A, 0x80);
+    cpu_step(cpu);
+    bool flags = cas_flags == (cpu->flags & mask) && cpu->memory[0x1000] == 0x01;
+    
+    // A single-core machine can interrupt itself
+    bool single = isa_read_memory(cpu, IPI_COUNT_ADDR) == 1 && isa_read_memory(cpu, IPI_CORE_ADDR) == 0;
+    isa_write_memory(cpu, IPI_SEND_ADDR, 0x03);
+    bool self = isa_read_memory(cpu, IPI_PENDING_ADDR) == 0x01;
+    isa_write_memory(cpu, IPI_PENDING_ADDR, 0x01);
+    self = self && isa_read_memory(cpu, IPI_PENDING_ADDR) == 0;
+    cpu_destroy(cpu);
+    
+    // Round-robin runs interleave the same way every time
+    uint32_t first[4], second[4], threaded[4];
+    bool round_robin = run_smp_program(SMP_SCHEDULE_ROUND_ROBIN, 1, first) &&
+                       run_smp_program(SMP_SCHEDULE_ROUND_ROBIN, 1, second) &&
+                       memcmp(first, second, sizeof(first)) == 0;
+    
+    // A thread per core: the interleaving is the host's, the totals are not
+    bool threads = true;
+    for (int i = 0; i < 20 && threads; i++) {
+        threads = run_smp_program(SMP_SCHEDULE_THREADS, 50, threaded);
+    }
+    
+    return taken && busy && hashed && swapped && kept && flags && single && self && round_robin && threads;
+}
+
+// Token ring: every board adds one to the byte it receives and sends it
+// on, halting once it has sent 41 or more; the byte after HLT starts it
+static const uint8_t net_ring_program[] = {
+    0x01, 0x24, 0x02, 0x14, 0x00,           // LDA $0224; CMP #0
+    0x50, 0x05, 0x00, 0x01,                 // BEQ wait; LDI #1
+    0x02, 0x00, 0x80,                       // STA UART_TX
+    0x01, 0x02, 0x80, 0x20, 0x02,           // wait: LDA UART_STATUS; AND #2
+    0x50, 0xF9,                             // BEQ wait
+    0x01, 0x01, 0x80, 0x10, 0x01,           // LDA UART_RX; ADD #1
+    0x02, 0x00, 0x80, 0x02, 0x01, 0x10,     // STA UART_TX; STA $1001
+    0x14, 0x29, 0x52, 0xEA,                 // CMP #41; BCS wait
+    0x73, 0x00, 0x00                        // HLT; start flag
+};
+
+// Run a four-board ring; false if a board ends with the wrong count
+static bool run_net_ring(int threads, uint64_t* digest) {
+    net_t* net = net_parse("[net]\nlatency = 50\n\n[board node]\ncount = 4\n\n[ring node]\n", "ring");
+    if (!net) {
+        return false;
+    }
+    
+    bool ok = net->board_count == 4 && net->link_count == 4 && net->lookahead == 50 && net_reset(net);
+    for (int i = 0; ok && i < net->board_count; i++) {
+        cpu_state_t* cpu = net->boards[i].cpu;
+        cpu_load_program(cpu, net_ring_program, sizeof(net_ring_program), 0x0200);
+        cpu->memory[0x0224] = i == 0;
+    }
+    
+    ok = ok && !net_run(net, 1000000, threads);
+    for (int i = 0; ok && i < net->board_count; i++) {
+        ok = !net->boards[i].stopped && net->boards[i].cpu->memory[0x1001] == 41 + i;
+    }
+    
+    // node0 halted before the last byte came round; it waits in the UART
+    uart_device_t* uart = &net->boards[0].cpu->devices->uart;
+    ok = ok && uart->rx_ready && uart->rx_data == 44;
+    *digest = net_digest(net);
+    net_destroy(net);
+    return ok;
+}
+
+bool test_net_ring(void) {
+    uint64_t single, pooled;
+    bool ring = run_net_ring(1, &single) && run_net_ring(3, &pooled) && single == pooled;
+    
+    // Links need both ends, and a UART receives from one link only
+    net_t* bad = net_parse("[board a]\n[link]\nfrom = a\nto = b\n", "unknown-board");
+    bool unknown = bad == NULL;
+    bad = net_parse("[board a]\n[board b]\n[board c]\n[link]\nfrom = a\nto = c\n[link]\nfrom = b\nto = c\n", "two-senders");
+    bool shared = bad == NULL;
+    
+    return ring && unknown && shared;
+}
+#endif
+
+#ifdef __linux__
+bool test_uart_rx_source(void) {
+    const char* path = "test_uart_rx.tmp";
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    fputs("ABC", file);
+    fclose(file);
+    
+    uart_source_t* source = uart_source_open("file:test_uart_rx.tmp");
+    cpu_state_t* cpu = cpu_create_isolated();
+    if (!source || !cpu) {
+        uart_source_destroy(source);
+        cpu_destroy(cpu);
+        remove(path);
+        return false;
+    }
+    
+    // Wait for the I/O thread to read the file
+    struct timespec deadline = host_deadline();
+    while (!uart_source_finished(source) && uart_source_available(source) < 3 && host_wait(&deadline)) {
+    }
+    
+    // One byte per 100 cycles, starting immediately
+    device_set_t* devices = cpu->devices;
+    device_set_attach_source(devices, source, 100);
+    device_set_service(devices, 0);
+    bool first = devices->uart.rx_ready && devices->uart.rx_data == 'A' &&
+                 devices->uart.rx_fifo_count == 0 && devices->next_event == 100;
+    device_set_service(devices, 50);
+    bool paced = devices->uart.rx_fifo_count == 0;
+    device_set_service(devices, 250);
+    bool queued = devices->uart.rx_fifo_count == 2;
+    
+    // RX interrupt is level triggered while data is waiting
+    device_set_write(devices, UART_CTRL_ADDR, UART_CTRL_RX_IRQ);
+    cpu_load_program(cpu, (uint8_t[]){0x72, 0x00}, 2, 0x0200);
+    cpu_reset_to_address(cpu, 0x0200);
+    cpu_step(cpu);
+    bool irq = devices->irq && cpu->irq_pending;
+    
+    uint8_t a = device_set_read(devices, UART_RX_ADDR);
+    uint8_t b = device_set_read(devices, UART_RX_ADDR);
+    uint8_t c = device_set_read(devices, UART_RX_ADDR);
+    bool drained = a == 'A' && b == 'B' && c == 'C' && !devices->uart.rx_ready && !devices->irq;
+    
+    // End of input stops further delivery attempts
+    device_set_service(devices, devices->uart.rx_next);
+    bool finished = devices->uart.rx_next == UART_SINK_NO_DEADLINE;
+    
+    cpu_destroy(cpu);
+    uart_source_destroy(source);
+    remove(path);
+    return first && paced && queued && irq && drained && finished;
+}
+#endif
+
 bool test_assembler_basic(void) {
     // This is a placeholder for assembler tests
     // In a real implementation, we would test the assembler
     return true;
 }
 
+bool test_assembler_symbols(void) {
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    
+    // Far more labels than the old fixed table held, each found again
+    char name[32];
+    bool added = true;
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "label_%d", i);
+        added = added && assembler_add_label(assembler, name, (uint16_t)(i * 7));
+    }
+    bool found = added && assembler->label_count == 100000;
+    for (int i = 0; i < 100000 && found; i++) {
+        snprintf(name, sizeof(name), "label_%d", i);
+        label_t* label = assembler_find_label(assembler, name);
+        found = label && label->address == (uint16_t)(i * 7) && strcmp(label->name, name) == 0;
+    }
+    bool missing = !assembler_find_label(assembler, "label_100000") && !assembler_find_label(assembler, "label_");
+    
+    // Defining a label again is an error and leaves the first definition
+    bool duplicate = !assembler_add_label(assembler, "label_5", 0x1234);
+    label_t* kept = assembler_find_label(assembler, "label_5");
+    bool redefined = duplicate && assembler->label_count == 100000 && kept && kept->address == 35;
+    
+    // Symbols have their own table
+    assembler_add_symbol(assembler, "UART_DATA", 0x8000);
+    symbol_t* symbol = assembler_find_symbol(assembler, "UART_DATA");
+    bool symbols = symbol && symbol->value == 0x8000 && !assembler_find_symbol(assembler, "label_1");
+    
+    // Every opcode's mnemonic finds that opcode
+    bool mnemonics = true;
+    for (int opcode = 0; opcode < 256; opcode++) {
+        if (isa_is_valid_opcode((uint8_t)opcode)) {
+            const char* mnemonic = isa_get_mnemonic((opcode_t)opcode);
+            const mnemonic_t* entry = assembler_lookup_mnemonic(mnemonic, strlen(mnemonic));
+            mnemonics = mnemonics && entry && entry->opcode == (opcode_t)opcode;
+        }
+    }
+    mnemonics = mnemonics && !assembler_lookup_mnemonic("LDX", 3) && !assembler_lookup_mnemonic("LD", 2) &&
+                !assembler_lookup_mnemonic("PUSHA", 5) && !assembler_lookup_mnemonic("", 0) &&
+                assembler_lookup_mnemonic("BNE loop", 3)->opcode == OP_BNE &&
+                assembler_lookup_mnemonic("JMP", 3)->operand == OPERAND_ABSOLUTE &&
+                assembler_lookup_mnemonic("HLT", 3)->operand == OPERAND_NONE;
+    
+    // Registers, likewise
+    const char* registers[] = {"A", "B", "C", "D", "X", "Y", "SP", "PC"};
+    bool regs = true;
+    for (int i = 0; i < 8; i++) {
+        register_t reg;
+        regs = regs && assembler_lookup_register(registers[i], strlen(registers[i]), &reg) && reg == (register_t)i;
+    }
+    register_t reg;
+    regs = regs && !assembler_lookup_register("E", 1, &reg) && !assembler_lookup_register("SPX", 3, &reg) &&
+           assembler_get_register("PC") == REG_PC && assembler_is_register_name("X") &&
+           assembler_get_opcode("CAS") == OP_CAS && !assembler_is_instruction_name("FOO");
+    
+    assembler_destroy(assembler);
+    return added && found && missing && redefined && symbols && mnemonics && regs;
+}
+
+// Assemble source text through a file; NULL if assembly fails
+static assembler_t* assemble_source(const char* path, const char* source) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return NULL;
+    }
+    fputs(source, file);
+    fclose(file);
+    
+    assembler_t* assembler = assembler_create();
+    if (assembler && !assembler_assemble_file(assembler, path)) {
+        assembler_destroy(assembler);
+        assembler = NULL;
+    }
+    remove(path);
+    return assembler;
+}
+
+bool test_assembler_fixups(void) {
+    // Forward references in every operand width, patched after one pass
+    const char* source =
+        ".org $0200\n"
+        "start:\n"
+        "    LDA [value]\n"
+        "    BNE skip\n"
+        "    JMP end + 1\n"
+        "skip:\n"
+        "    LDI count\n"
+        "    BEQ start\n"
+        "end:\n"
+        "    HLT\n"
+        "value: .word end\n"
+        "count: .byte value - start\n";
+    const uint8_t expected[] = {
+        0x01, 0x0D, 0x02,       // LDA [$020D]
+        0x51, 0x02,             // BNE +2
+        0x50, 0x05,             // JMP $020C, relaxed to BEQ +5
+        0x00, 0x0F,             // LDI $0F
+        0x50, 0xF5,             // BEQ -11
+        0x73, 0x00,             // HLT
+        0x0B, 0x02,             // .word $020B
+        0x0D                    // .byte $0D
+    };
+    assembler_t* assembler = assemble_source("test_asm.tmp", source);
+    bool assembled = assembler && assembler->output_size == sizeof(expected) &&
+                     memcmp(assembler->output, expected, sizeof(expected)) == 0 &&
+                     assembler->fixup_count == 7;
+    assembler_destroy(assembler);
+    
+    // Branch range is checked once the target is known: 64 NOPs put the
+    // target 128 bytes on, which takes the inverse branch over a JMP, 63
+    // at the furthest reach
+    bool range = true;
+    for (int nops = 63; nops <= 64; nops++) {
+        char far[1024] = "    BNE far\n";
+        for (int i = 0; i < nops; i++) {
+            strcat(far, "    NOP\n");
+        }
+        strcat(far, "far: HLT\n");
+        assembler = assemble_source("test_asm.tmp", far);
+        range = range && assembler &&
+                (nops == 63 ? assembler->output[1] == 126 :
+                              assembler->output[0] == OP_BEQ && assembler->output[1] == 3 &&
+                              assembler->output[2] == OP_JMP && assembler->output[3] == 0x85);
+        assembler_destroy(assembler);
+    }
+    
+    // Undefined names and duplicate labels fail
+    assembler = assemble_source("test_asm.tmp", "    JMP nowhere\n");
+    bool undefined = assembler == NULL;
+    assembler = assemble_source("test_asm.tmp", "a: NOP\na: NOP\n");
+    bool duplicate = assembler == NULL;
+    
+    return assembled && range && undefined && duplicate;
+}
+
+bool test_assembler_string(void) {
+    // Source built in memory, with one line far longer than 256 characters
+    // and no newline at the end
+    static char source[4096];
+    strcpy(source, "start: LDI 'A'   ; comment, with ] punctuation\n"
+                   "    .byte 0x10, $20, %101, 7");
+    for (int i = 0; i < 300; i++) {
+        strcat(source, ", 1");
+    }
+    strcat(source, "\n    .string \"Hi\"\n    JMP start");
+    
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    bool assembled = assembler_assemble_string(assembler, source);
+    const uint8_t* out = assembler->output;
+    bool bytes = assembled && assembler->output_size == 311 &&
+                 out[0] == OP_LDI && out[1] == 'A' && out[2] == 0x10 && out[3] == 0x20 && out[4] == 5 &&
+                 out[5] == 7 && out[6] == 1 && out[305] == 1 && memcmp(&out[306], "Hi", 2) == 0 &&
+                 out[308] == OP_JMP && out[309] == 0 && out[310] == 0;
+    
+    // Tokens are slices of the caller's buffer: the last one is its end
+    bool in_place = assembler->current_token.type == TOKEN_EOF &&
+                    assembler->current_token.text == source + strlen(source);
+    assembler_destroy(assembler);
+    
+    // Malformed input fails
+    const char* bad[] = {"    LDI 1 2\n", "    LDI 70000\n", "    .string \"open\n", "    MOV Q\n", "    STA [1\n"};
+    bool rejected = true;
+    for (int i = 0; i < 5; i++) {
+        assembler = assembler_create();
+        rejected = rejected && !assembler_assemble_string(assembler, bad[i]);
+        assembler_destroy(assembler);
+    }
+    
+    return bytes && in_place && rejected;
+}
+
+// Assemble source text into an object file
+static bool assemble_object(const char* path, const char* source) {
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    assembler->relocatable = true;
+    bool saved = assembler_assemble_string(assembler, source) && assembler_save_object(assembler, path);
+    assembler_destroy(assembler);
+    return saved;
+}
+
+// Link object files with a script; NULL if linking fails
+static linker_t* link_objects(const char* script, const char** paths, int count) {
+    linker_t* linker = linker_create();
+    bool linked = linker && linker_parse_script(linker, script, "<test>");
+    for (int i = 0; linked && i < count; i++) {
+        linked = linker_add_object(linker, paths[i]);
+    }
+    if (linked && linker_link(linker)) {
+        return linker;
+    }
+    linker_destroy(linker);
+    return NULL;
+}
+
+bool test_assembler_objects(void) {
+    // Two modules referring to each other's labels, with a data section
+    // placed after the code on a 16-byte boundary
+    const char* main_source = "    .global start\n"
+                              "start: LDI #1\n"
+                              "loop: JSR helper\n"
+                              "    BNE loop\n"
+                              "    JMP done\n"
+                              "    .section data\n"
+                              "value: .word table+1\n";
+    const char* lib_source = "    .global helper, table, done\n"
+                             "helper: LDA [table]\n"
+                             "    RTS\n"
+                             "done: HLT\n"
+                             "    .section data\n"
+                             "table: .byte 1, 2, 3\n";
+    const char* paths[] = {"test_obj1.tmp", "test_obj2.tmp", "test_obj1.tmp"};
+    bool assembled = assemble_object(paths[0], main_source) && assemble_object(paths[1], lib_source);
+    
+    // The same program assembled in one piece
+    assembler_t* whole = assembler_create();
+    if (!whole) {
+        return false;
+    }
+    whole->relax = false;       // The linker keeps branches as written
+    bool reference = assembler_assemble_string(whole, "    .org $200\n"
+                                                      "start: LDI #1\n"
+                                                      "loop: JSR helper\n"
+                                                      "    BNE loop\n"
+                                                      "    JMP done\n"
+                                                      "helper: LDA [table]\n"
+                                                      "    RTS\n"
+                                                      "done: HLT\n"
+                                                      "    .byte 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0\n"
+                                                      "value: .word table+1\n"
+                                                      "table: .byte 1, 2, 3\n");
+    
+    const char* script = "[image]\norigin = 0x200\n[section text]\n[section data]\nalign = 16\n";
+    linker_t* linker = assembled ? link_objects(script, paths, 2) : NULL;
+    bool linked = linker && reference && linker->image_start == 0x200 &&
+                  linker->image_end - linker->image_start == whole->output_size &&
+                  memcmp(linker->image + linker->image_start, whole->output, whole->output_size) == 0 &&
+                  linker->global_count == 4 && linker->output_count == 2 &&
+                  linker->outputs[1].address == 0x220;
+    assembler_destroy(whole);
+    
+    // The map lists the sections and the globals
+    bool mapped = linker && linker_save_map(linker, "test_link.tmp");
+    FILE* file = fopen("test_link.tmp", "r");
+    char map[1024] = {0};
+    if (file) {
+        mapped = mapped && fread(map, 1, sizeof(map) - 1, file) > 0;
+        fclose(file);
+    }
+    mapped = mapped && strstr(map, "0x0220") && strstr(map, "helper") && strstr(map, "test_obj2.tmp");
+    remove("test_link.tmp");
+    linker_destroy(linker);
+    
+    // A missing module leaves names undefined; a module linked twice
+    // defines its globals twice
+    linker = link_objects(script, paths, 1);
+    bool undefined = linker == NULL;
+    linker_destroy(linker);
+    linker = link_objects(script, paths, 3);
+    bool duplicate = linker == NULL;
+    linker_destroy(linker);
+    
+    // .org must start a section, and a .global must name a label
+    assembler_t* assembler = assembler_create();
+    assembler->relocatable = true;
+    bool misplaced = !assembler_assemble_string(assembler, "    NOP\n    .org $100\n");
+    assembler_destroy(assembler);
+    bool unknown = !assemble_object(paths[0], "    .global nothing\n    NOP\n");
+    
+    remove(paths[0]);
+    remove(paths[1]);
+    return assembled && linked && mapped && undefined && duplicate && misplaced && unknown;
+}
+
+bool test_assembler_arena(void) {
+    // Bump allocation: growing the last allocation stays in place, a large
+    // one gets its own block, and a reset hands out the same memory again
+    arena_t arena;
+    arena_init(&arena);
+    uint8_t* small = arena_alloc(&arena, 10);
+    uint8_t* grown = arena_grow(&arena, small, 10, 100);
+    uint8_t* large = arena_alloc(&arena, 3 * ARENA_BLOCK_SIZE);
+    bool bumped = small && grown == small && large && (uintptr_t)large % ARENA_ALIGN == 0;
+    arena_reset(&arena);
+    bumped = bumped && arena_alloc(&arena, 10) == small;
+    arena_destroy(&arena);
+    
+    // Many small sources through one assembler: once its arena has grown,
+    // every further assembly reuses the same blocks
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    char source[128];
+    int blocks = -1;
+    bool reused = true;
+    for (int i = 0; i < 1000 && reused; i++) {
+        snprintf(source, sizeof(source), "start: LDI #%d\n    BNE next\nnext: JMP start\n", i % 256);
+        reused = assembler_reset(assembler) && assembler_assemble_string(assembler, source) &&
+                 assembler->output_size == 7 && assembler->output[1] == i % 256 && assembler->label_count == 2;
+        int count = 0;
+        for (arena_block_t* block = assembler->arena.first; block; block = block->next) {
+            count++;
+        }
+        if (blocks < 0) {
+            blocks = count;
+        }
+        reused = reused && count == blocks;
+    }
+    
+    // Output past 64 KiB is an error rather than wrapping around
+    size_t size = 65537 * 8 + 1;
+    char* big = malloc(size);
+    bool bounded = false;
+    if (big) {
+        for (int i = 0; i < 65537; i++) {
+            memcpy(big + i * 8, ".byte 0\n", 8);
+        }
+        big[size - 1] = '\0';
+        bounded = assembler_reset(assembler) && !assembler_assemble_string(assembler, big) &&
+                  assembler->output_size == ASSEMBLER_OUTPUT_SIZE;
+        free(big);
+    }
+    
+    assembler_destroy(assembler);
+    return bumped && reused && bounded;
+}
+
+// Write text to a file
+static bool write_file(const char* path, const char* text) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fputs(text, file);
+    fclose(file);
+    return true;
+}
+
+bool test_assembler_includes(void) {
+    // A header of macros, included by several sources, is lexed once
+    const char* header =
+        ".macro store value, addr\n"
+        "    LDI #value\n"
+        "    STA [addr]\n"
+        ".endm\n"
+        ".macro wait count\n"
+        "    LDI #count\n"
+        "@loop:\n"
+        "    DEC A\n"
+        "    BNE @loop\n"
+        ".endm\n";
+    if (!write_file("test_defs.tmp", header) || !write_file("test_data.tmp", "ABC")) {
+        return false;
+    }
+    assembler_clear_include_cache();
+    
+    // Each expansion gets its own @loop, and .incbin copies the file
+    const char* source =
+        ".org $0200\n"
+        ".include \"test_defs.tmp\"\n"
+        "    store 5, port\n"
+        "    wait 3\n"
+        "    wait (1 + 2)\n"
+        "    HLT\n"
+        "port: .incbin \"test_data.tmp\"\n";
+    const uint8_t expected[] = {
+        0x00, 0x05, 0x02, 0x13, 0x02,       // LDI #5; STA [port]
+        0x00, 0x03, 0x16, 0x00, 0x51, 0xFC, // LDI #3; @1_loop: DEC A; BNE @1_loop
+        0x00, 0x03, 0x16, 0x00, 0x51, 0xFC, // LDI #3; @2_loop: DEC A; BNE @2_loop
+        0x73, 0x00,                         // HLT
+        'A', 'B', 'C'                       // port
+    };
+    bool expanded = true;
+    for (int i = 0; i < 3 && expanded; i++) {
+        assembler_t* assembler = assemble_source("test_asm.tmp", source);
+        expanded = assembler && assembler->output_size == sizeof(expected) &&
+                   memcmp(assembler->output, expected, sizeof(expected)) == 0;
+        assembler_destroy(assembler);
+    }
+    include_cache_stats_t stats = assembler_include_cache_stats();
+    bool cached = stats.lookups == 3 && stats.hits == 2 && stats.files == 1;
+    
+    // Touching the header keeps its tokens, editing it lexes it again
+    bool touched = write_file("test_defs.tmp", header);
+    assembler_destroy(assemble_source("test_asm.tmp", ".include \"test_defs.tmp\"\n"));
+    touched = touched && write_file("test_defs.tmp", ".macro nop2\n    NOP\n    NOP\n.endm\n");
+    assembler_t* assembler = assemble_source("test_asm.tmp", ".include \"test_defs.tmp\"\n    nop2\n");
+    touched = touched && assembler && assembler->output_size == 4;
+    assembler_destroy(assembler);
+    stats = assembler_include_cache_stats();
+    touched = touched && stats.lookups == 5 && stats.hits == 3 && stats.files == 2;
+    
+    // Malformed macros and includes are errors
+    const char* bad[] = {
+        ".macro open\n    NOP\n",
+        ".include \"test_defs.tmp\"\n    nop2 1\n",
+        ".include \"test_missing.tmp\"\n",
+        ".include \"test_asm.tmp\"\n",
+        ".endm\n",
+        ".macro LDI\n.endm\n"
+    };
+    bool rejected = true;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]) && rejected; i++) {
+        assembler = assemble_source("test_asm.tmp", bad[i]);
+        rejected = assembler == NULL;
+        assembler_destroy(assembler);
+    }
+    
+    remove("test_defs.tmp");
+    remove("test_data.tmp");
+    assembler_clear_include_cache();
+    return expanded && cached && touched && rejected;
+}
+
+bool test_assembler_relaxation(void) {
+    // A loop too long for its branch: BNE becomes BEQ over a JMP back,
+    // which pushes the forward BCS out of range on the next round
+    char source[2048] = ".org $0200\n    LDI #3\nloop: DEC A\n    BCS done\n";
+    for (int i = 0; i < 62; i++) {
+        strcat(source, "    NOP\n");
+    }
+    strcat(source, "    BNE loop\ndone: HLT\n");
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    bool relaxed = assembler_assemble_string(assembler, source) && assembler->output_size == 140;
+    const uint8_t* out = assembler->output;
+    relaxed = relaxed && out[4] == OP_BCC && out[5] == 3 && out[6] == OP_JMP && out[7] == 0x8A && out[8] == 0x02 &&
+                   out[133] == OP_BEQ && out[134] == 3 && out[135] == OP_JMP && out[136] == 0x02 &&
+                   out[138] == OP_HLT;
+    
+    // The relaxed loop runs as written
+    bool ran = false;
+    cpu_state_t* cpu = relaxed ? cpu_create() : NULL;
+    if (cpu) {
+        cpu_load_program(cpu, assembler->output, assembler->output_size, 0x0200);
+        cpu_reset_to_address(cpu, 0x0200);
+        ran = !cpu_run(cpu, 10000) && isa_get_register(cpu, REG_A) == 0 &&
+              isa_get_register16(cpu, REG_PC) >= 0x028A;
+        cpu_destroy(cpu);
+    }
+    
+    // A JMP only the fall-through of a branch reaches becomes the inverse
+    // branch; one with a label may be entered with any flags and stays
+    const char* jumps = "start: BEQ next\n    JMP start\nnext: BCS start\nhere: JMP start\n";
+    const uint8_t expected[] = {OP_BEQ, 0x02, OP_BNE, 0xFC, OP_BCS, 0xFA, OP_JMP, 0x00, 0x00};
+    bool shortened = assembler_reset(assembler) && assembler_assemble_string(assembler, jumps) &&
+                     assembler->output_size == sizeof(expected) &&
+                     memcmp(assembler->output, expected, sizeof(expected)) == 0;
+    
+    // Without relaxation the code is kept as written
+    assembler->relax = false;
+    bool exact = assembler_reset(assembler) && assembler_assemble_string(assembler, jumps) &&
+                 assembler->output_size == 10 && assembler->output[2] == OP_JMP &&
+                 assembler_reset(assembler) && !assembler_assemble_string(assembler, source);
+    
+    assembler_destroy(assembler);
+    return relaxed && ran && shortened && exact;
+}
+
+bool test_assembler_listing(void) {
+    const char* source = ".org $0200\nstart: LDI #10\nloop: DEC A\n    BNE loop\n    HLT\n"
+                         "table: .byte 1, 2, 3, 4, 5, 6\n";
+    const char* path = "test_listing.tmp";
+    assembler_t* assembler = assembler_create();
+    if (!assembler) {
+        return false;
+    }
+    assembler->listing = true;
+    bool listed = assembler_assemble_string(assembler, source) && assembler->line_count == 6 &&
+                  assembler_save_listing(assembler, path);
+    
+    // Every line with its address, bytes and cycles; data past five bytes
+    // on a row of its own
+    char text[2048] = "";
+    FILE* file = listed ? fopen(path, "r") : NULL;
+    if (file) {
+        text[fread(text, 1, sizeof(text) - 1, file)] = '\0';
+        fclose(file);
+    }
+    remove(path);
+    listed = listed && strstr(text, "    3  0202  16 00               1 loop: DEC A") &&
+             strstr(text, "    4  0204  51 FC               2     BNE loop") &&
+             strstr(text, "\n       020D  06 \n");
+    
+    // The counted loop and the blocks, in the cycles the simulator charges
+    int count;
+    cycle_block_t* blocks = listed ? assembler_cycle_blocks(assembler, &count) : NULL;
+    const cycle_block_t* start = NULL;
+    const cycle_block_t* loop = NULL;
+    for (int i = 0; blocks && i < count; i++) {
+        if (blocks[i].name && strcmp(blocks[i].name, "start") == 0 && !blocks[i].loop) {
+            start = &blocks[i];
+        }
+        if (blocks[i].loop) {
+            loop = &blocks[i];
+        }
+    }
+    bool estimated = count == 3 && start && loop && start->cycles == 2 && loop->start == 0x0202 &&
+                     loop->end == 0x0206 && loop->cycles == 3 && loop->iterations == 10;
+    
+    bool charged = false;
+    cpu_state_t* cpu = estimated ? cpu_create() : NULL;
+    if (cpu) {
+        cpu_load_program(cpu, assembler->output, assembler->output_size, 0x0200);
+        cpu_reset_to_address(cpu, 0x0200);
+        cpu_run(cpu, 1000);
+        charged = cpu->cycle_count == start->cycles + loop->cycles * loop->iterations + isa_get_cycles(OP_HLT);
+        cpu_destroy(cpu);
+    }
+    
+    // The report leads with the costliest: the loop, all its iterations
+    char report[512] = "";
+    FILE* out = tmpfile();
+    if (out) {
+        assembler_print_cycle_report(assembler, out, 1);
+        rewind(out);
+        report[fread(report, 1, sizeof(report) - 1, out)] = '\0';
+        fclose(out);
+    }
+    bool reported = strstr(report, "30  0202-0205  loop  loop (10 x 3)") && !strstr(report, "start");
+    
+    // Every line of a macro expansion keeps its indentation and columns
+    const char* macro = ".org $0200\n.macro twice r\n    INC r\n    INC r\n.endm\n    twice A\n";
+    bool expanded = assembler_reset(assembler) && assembler_assemble_string(assembler, macro) &&
+                    assembler_save_listing(assembler, path);
+    file = expanded ? fopen(path, "r") : NULL;
+    text[0] = '\0';
+    if (file) {
+        text[fread(text, 1, sizeof(text) - 1, file)] = '\0';
+        fclose(file);
+    }
+    remove(path);
+    expanded = expanded && strstr(text, "    3  0200  15 00               1     INC A\n") &&
+               strstr(text, "    4  0202  15 00               1     INC A\n");
+    
+    assembler_destroy(assembler);
+    return listed && estimated && charged && reported && expanded;
+}
+
 bool test_integration_hello(void) {
     // This is a placeholder for integration tests
     // In a real implementation, we would test the hello world program
@@ -463,4 +2524,3 @@ bool compare_cpu_state(cpu_state_t* cpu1, cpu_state_t* cpu2) {
 void print_test_failure(const char* test_name, const char* message) {
     printf("Test %s failed: %s\n", test_name, message);
 }
-